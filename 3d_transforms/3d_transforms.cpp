@@ -10,7 +10,16 @@
 #include "shlwapi.h"
 #include "math_helpers.h"
 #include "camera.h"
+#include "picker.h"
+#include "frustum_culler.h"
+#include "occlusion_buffer.h"
+#include "lod_selector.h"
+#include "transform_hierarchy.h"
+#include "dirty_bitset.h"
+#include "draw_list.h"
+#include "frame_arena.h"
 #include <functional>
+#include <mutex>
 
 using namespace DirectX;
 
@@ -23,8 +32,10 @@ extern "C" __declspec(dllexport) void wndproc(UINT msg, WPARAM wParam, LPARAM lP
 extern "C" __declspec(dllexport) bool initialize();
 
 s_internal void init_pipeline();
-s_internal void create_render_item(std::string name, std::string mesh_name, int id);
-s_internal void draw_render_items(ID3D12GraphicsCommandList *cmd_list, const std::vector<render_item> *render_items);
+s_internal void create_render_item(std::string name, std::string mesh_name);
+s_internal void add_instances(handle<render_item> ri_handle, UINT count);
+s_internal void remove_instance(handle<render_item> ri_handle, handle<instance> inst_handle);
+s_internal void draw_render_items(ID3D12GraphicsCommandList *cmd_list, const handle_registry<render_item> *render_items);
 s_internal void update_camera();
 
 // Command objects
@@ -37,6 +48,10 @@ s_internal ID3D12CommandAllocator *cmd_alloc = nullptr;
 s_internal frame_resource *frame_resources[NUM_BACK_BUFFERS];
 s_internal frame_resource *frame = nullptr;
 
+// Passes of the frame, the graph is rebuilt every frame
+s_internal render_graph frame_graph;
+s_internal d3d12_render_graph_backend *graph_backend = nullptr;
+
 // PSOs
 enum views
 {
@@ -75,18 +90,107 @@ s_internal float up_angle = 0.f;
 s_internal float forward_angle = 0.f;
 
 // Render items data
-#define MAX_RENDER_ITEMS 10
-#define MAX_INSTANCE_COUNT_PER_OBJECT 2
-s_internal std::vector<render_item> render_items;
+// The frame buffers grow when there are more, this only avoids recreating them for the first few instances
+s_internal constexpr size_t initial_instance_capacity = 256;
+s_internal constexpr UINT default_instance_count = 2;
+s_internal int ui_added_instance_count = 100;
+s_internal handle_registry<render_item> render_items;
+s_internal name_table names;
 
 // Instance data
+// The instances of every render item are packed in one array, rebuilt only when render items or instances are added or removed.
+// Edited instances are flagged to have their world matrix rebuilt, then flagged in every frame resource to be uploaded.
 s_internal int num_selected_instances = 0;
 s_internal std::vector<instance *> total_ri_instances;
+s_internal std::vector<instance_affine> packed_instances;
+s_internal std::vector<UINT> packed_instance_objects;
+s_internal std::vector<UINT> selected_instance_ids;
+s_internal dirty_bitset edited_instances;
+s_internal bool instances_changed = false;
+s_internal constexpr size_t max_upload_gap = 8;
+s_internal void rebuild_instance_list();
+s_internal void set_instance_transform(size_t index);
+s_internal void update_instance(size_t index);
+s_internal void pack_instances(size_t first, size_t count);
+s_internal void mark_instance_edited(instance const &inst) { edited_instances.set(inst.packed_index); }
+
+// Every render item is the parent of its instances, the node of each packed instance is in instance_nodes
+s_internal transform_hierarchy *instance_transforms = nullptr;
+s_internal std::vector<UINT> instance_nodes;
 s_internal instance *selected_inst;
-s_internal ID3D12DescriptorHeap *instanceIDs_srv_heap = nullptr;
+
+// Picking over every instance
+s_internal picker instance_picker;
+
+// Instance of each picker object, indexed by the picker id
+struct pick_target
+{
+    handle<render_item> item;
+    handle<instance> instance;
+};
+s_internal std::vector<pick_target> pick_targets;
 
 // Geometry
-s_internal std::unordered_map<std::string, mesh> geometries;
+s_internal handle_registry<mesh> geometries;
+s_internal std::unordered_map<std::string, mesh_handle> geometry_names;
+s_internal std::unordered_map<std::string, triangle_bvh> geometry_triangles;
+
+// Models parsed by the loader thread. It only touches this list, the render thread creates
+// their GPU resources and render items at the start of the next frame.
+struct loaded_model
+{
+    std::string name;
+    std::vector<position_color> vertices;
+    std::vector<WORD> indices;
+    std::vector<submesh> submeshes;
+    BoundingBox bounds;
+    triangle_bvh triangles;
+    occluder_mesh occluder;
+};
+s_internal std::mutex loaded_models_mutex;
+s_internal std::vector<loaded_model> loaded_models;
+s_internal void add_loaded_models();
+
+// Frustum culling, the instance boxes rarely move so the culler keeps per-instance state between frames
+s_internal frustum_culler instance_culler;
+s_internal aabb_soa instance_boxes;
+s_internal culling_cache instance_culling_cache;
+s_internal std::vector<UINT64> instance_frustum_mask;
+
+// Occlusion culling, simplified copies of the imported models are rasterized as occluders.
+// Only the instances in the frustum that cover enough of the buffer are, the biggest first.
+s_internal occlusion_buffer occlusion(320, 180);
+s_internal std::unordered_map<std::string, occluder_mesh> geometry_occluders;
+constexpr UINT occluder_grid_size = 16;
+constexpr float min_occluder_size = 24.f; // Pixels of the occlusion buffer
+constexpr size_t max_occluders = 64;
+
+// Meshes have a single LOD for now, the selector only drops the instances smaller than a few pixels
+s_internal float lod_thresholds[] = {4.f};
+s_internal lod_selector instance_lods(lod_thresholds, _countof(lod_thresholds));
+s_internal std::vector<UINT> lod_instances[_countof(lod_thresholds)];
+s_internal sphere_soa instance_spheres;
+s_internal std::vector<BoundingBox> instance_world_bounds;
+s_internal std::vector<UINT> visible_instance_ids;
+s_internal void cull_instances();
+
+// Draw list, the render item pointers are indexed by draw and by mesh id.
+// The mesh id is the slot of the geometry handle, it's stable for the lifetime of the mesh and slots are reused,
+// so a flat array indexed by it replaces a lookup. Both arrays only live for the frame, they're in the frame arena.
+enum draw_pass
+{
+    geometry_pass,
+    outline_pass,
+};
+enum draw_pso
+{
+    stencil_draw_pso,
+    outline_draw_pso,
+};
+s_internal draw_list draws;
+s_internal void build_draw_list(const handle_registry<render_item> &items,
+                                frame_vector<render_item const *> &draw_items,
+                                frame_vector<render_item const *> &draw_meshes);
 
 // Camera
 s_internal pass_data pass;
@@ -104,6 +208,7 @@ extern "C" __declspec(dllexport) bool initialize()
 
     dr = new device_resources();
     device = dr->device;
+    instance_transforms = new transform_hierarchy();
 
     imgui_init(dr->device);
 
@@ -117,9 +222,7 @@ extern "C" __declspec(dllexport) bool initialize()
         return false;
 
     for (UINT i = 0; i < NUM_BACK_BUFFERS; i++)
-        frame_resources[i] = new frame_resource(device, i,
-                                                MAX_RENDER_ITEMS,
-                                                MAX_RENDER_ITEMS * MAX_INSTANCE_COUNT_PER_OBJECT);
+        frame_resources[i] = new frame_resource(device, i, initial_instance_capacity);
     frame = frame_resources[0];
 
     hr = device->CreateCommandList(DEFAULT_NODE,
@@ -128,19 +231,12 @@ extern "C" __declspec(dllexport) bool initialize()
                                    nullptr,
                                    IID_PPV_ARGS(&cmdlist));
     ASSERT(SUCCEEDED(hr));
+    graph_backend = new d3d12_render_graph_backend(cmdlist);
 
     hr = device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&ui_requests_cmdalloc));
     ASSERT(SUCCEEDED(hr));
     ui_requests_cmdalloc->SetName(L"ui_requests_cmdalloc");
 
-    D3D12_DESCRIPTOR_HEAP_DESC srv_heap_desc;
-    srv_heap_desc.NodeMask = DEFAULT_NODE;
-    srv_heap_desc.NumDescriptors = MAX_RENDER_ITEMS;
-    srv_heap_desc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-    srv_heap_desc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-    hr = device->CreateDescriptorHeap(&srv_heap_desc, IID_PPV_ARGS(&instanceIDs_srv_heap));
-    ASSERT(SUCCEEDED(hr));
-
     hr = device->CreateCommandList(DEFAULT_NODE,
                                    D3D12_COMMAND_LIST_TYPE_DIRECT,
                                    ui_requests_cmdalloc,
@@ -153,26 +249,20 @@ extern "C" __declspec(dllexport) bool initialize()
     query = new gpu_query(device, cmdlist, dr->cmd_queue, &dr->backbuffer_index, NUM_QUERIES);
 
     std::vector<CD3DX12_ROOT_PARAMETER1> params;
-    // (root) ConstantBuffer<view_proj> cb_viewproj : register(b0);
+    // (root) ConstantBuffer<pass_constants> cb_pass : register(b0);
     CD3DX12_ROOT_PARAMETER1 param_viewproj;
     param_viewproj.InitAsConstantBufferView(0, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC, D3D12_SHADER_VISIBILITY_VERTEX);
     params.push_back(param_viewproj);
 
-    // (root) ConstantBuffer<object> cb_object : register(b1);
-    CD3DX12_ROOT_PARAMETER1 param_obj;
-    param_obj.InitAsConstantBufferView(1, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC, D3D12_SHADER_VISIBILITY_VERTEX);
-    params.push_back(param_obj);
-
     // (root) StructuredBuffer<instance> sb_instance : register(t0);
     CD3DX12_ROOT_PARAMETER1 param_inst;
     param_inst.InitAsShaderResourceView(0, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC, D3D12_SHADER_VISIBILITY_VERTEX);
     params.push_back(param_inst);
 
-    // (root) StructuredBuffer<uint> cb_instance_ids : register(t1);
+    // (root) StructuredBuffer<uint> sb_instance_ids : register(t2);
+    // Bound at the render item's first instance, so the buffer can grow without descriptors to update
     CD3DX12_ROOT_PARAMETER1 param_inst_id;
-    CD3DX12_DESCRIPTOR_RANGE1 range[1];
-    range[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, MAX_RENDER_ITEMS, 2, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE);
-    param_inst_id.InitAsDescriptorTable(1, range);
+    param_inst_id.InitAsShaderResourceView(2, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC, D3D12_SHADER_VISIBILITY_VERTEX);
     params.push_back(param_inst_id);
 
     // (root) StructuredBuffer<uint> sb_selected_instance_ids : register(t2);
@@ -231,7 +321,8 @@ extern "C" __declspec(dllexport) bool initialize()
                      sizeof(position_color), _countof(triangle_vertices), (void *)triangle_vertices,
                      sizeof(WORD), _countof(triangle_indices), (void *)triangle_indices,
                      &triangle);
-    geometries[mesh_name] = triangle;
+    geometry_names[mesh_name] = geometries.add(triangle);
+    geometry_triangles[mesh_name] = triangle_bvh(triangle_vertices, _countof(triangle_vertices), triangle_indices, _countof(triangle_indices));
 
     // create cube data
     position_color cube_vertices[8] = {
@@ -277,7 +368,8 @@ extern "C" __declspec(dllexport) bool initialize()
                      sizeof(position_color), _countof(cube_vertices), (void *)cube_vertices,
                      sizeof(WORD), _countof(cube_indices), (void *)cube_indices,
                      &cube);
-    geometries[mesh_name] = cube;
+    geometry_names[mesh_name] = geometries.add(cube);
+    geometry_triangles[mesh_name] = triangle_bvh(cube_vertices, _countof(cube_vertices), cube_indices, _countof(cube_indices));
 
     // stanford bunny
     const char *model_file = "C:\\Users\\maxim\\source\\repos\\transforms\\3d_transforms\\models\\bunny.obj";
@@ -309,7 +401,7 @@ extern "C" __declspec(dllexport) bool initialize()
 
     //for (int i = 0; i < NUM_RENDER_ITEMS; i++)
     //{
-    //    create_render_item("my cool bunny", mesh_name, i);
+    //    create_render_item("my cool bunny", mesh_name);
     //}
 
     cmdlist->Close();
@@ -318,128 +410,174 @@ extern "C" __declspec(dllexport) bool initialize()
     return true;
 }
 
-s_internal void create_render_item(std::string name, std::string mesh_name, int id)
+s_internal void create_render_item(std::string name, std::string mesh_name)
 {
     render_item ri;
-    ri.meshes = geometries[mesh_name];
+    ri.geometry = geometry_names[mesh_name];
+    mesh const *geometry = geometries.get(ri.geometry);
+    auto occluder = geometry_occluders.find(mesh_name);
+    if (occluder != geometry_occluders.end())
+        ri.occluder = &occluder->second;
     ri.topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-    ri.cb_index = id;
-    ri.vertex_count = ri.meshes.vertex_count;
-    ri.index_count = ri.meshes.index_count;
-    ri.name = name;
+    ri.vertex_count = geometry->vertex_count;
+    ri.index_count = geometry->index_count;
+    ri.name = names.intern(name);
     XMMATRIX world = XMMatrixIdentity();
     XMMATRIX t = XMMatrixTranslation(0.f, 0.f, 0.f);
     world = world * t;
     XMStoreFloat4x4(&ri.world, world);
 
-    // create instance data
-    for (int i = 0; i < MAX_INSTANCE_COUNT_PER_OBJECT; i++)
-    {
-        instance inst;
-        inst.name = "instance_" + std::to_string(i);
-        XMMATRIX world = XMMatrixIdentity();
+    ri.triangles = &geometry_triangles[mesh_name];
 
-        XMVECTOR right = XMVectorSet(1.f, 0.f, 0.f, 0.f);
-        inst.right_angle = 0.f;
-        XMVECTOR right_rot_quat = XMQuaternionRotationAxis(right, XMConvertToRadians(inst.right_angle));
+    add_instances(render_items.add(std::move(ri)), default_instance_count);
+}
 
-        XMVECTOR up = XMVectorSet(0.f, 1.f, 0.f, 0.f);
-        inst.up_angle = 0.f;
-        XMVECTOR up_rot_quat = XMQuaternionRotationAxis(up, XMConvertToRadians(inst.up_angle));
+s_internal void add_instances(handle<render_item> ri_handle, UINT count)
+{
+    render_item &ri = *render_items.get(ri_handle);
+    mesh const *geometry = geometries.get(ri.geometry);
 
-        XMVECTOR forward = XMVectorSet(0.f, 0.f, 1.f, 0.f);
-        inst.forward_angle = 0.f;
-        XMVECTOR forward_rot_quat = XMQuaternionRotationAxis(forward, XMConvertToRadians(inst.forward_angle));
+    // New instances are laid out on a grid, a little more than a mesh apart
+    XMFLOAT3 extents = geometry->bounds.Extents;
+    float spacing = 2.5f * std::max(extents.x, std::max(extents.y, extents.z));
+    const UINT instances_per_row = 32;
 
-        XMVECTOR rot_quat = XMQuaternionMultiply(forward_rot_quat, XMQuaternionMultiply(right_rot_quat, up_rot_quat));
-        XMMATRIX rot_mat = XMMatrixRotationQuaternion(rot_quat);
+    for (UINT i = 0; i < count; i++)
+    {
+        UINT number = ri.num_added_instances++;
 
+        instance inst;
+        inst.name = names.intern("instance_" + std::to_string(number));
         inst.scale[0] = 1.f;
         inst.scale[1] = 1.f;
         inst.scale[2] = 1.f;
-        XMMATRIX scale_mat = XMMatrixScaling(inst.scale[0], inst.scale[1], inst.scale[2]);
-
-        inst.translation[0] = 0.f;
+        inst.translation[0] = (number % instances_per_row) * spacing;
         inst.translation[1] = 0.f;
-        inst.translation[2] = 0.f;
-        XMMATRIX translation_mat = XMMatrixTranslation(inst.translation[0], inst.translation[1], inst.translation[2]);
-        XMMATRIX srt = scale_mat * rot_mat * translation_mat;
-        world = world * srt;
+        inst.translation[2] = (number / instances_per_row) * spacing;
 
+        XMMATRIX world = XMMatrixTranslation(inst.translation[0], inst.translation[1], inst.translation[2]);
         XMStoreFloat4x4(&inst.shader_data.world, world);
-        inst.bounds = ri.meshes.bounds;
-        ri.instances.push_back(inst);
+        inst.bounds = geometry->bounds;
+
+        handle<instance> inst_handle = ri.instances.add(inst);
+        instance &added = *ri.instances.get(inst_handle);
+        added.pick_id = instance_picker.add(ri.triangles, added.bounds, added.shader_data.world, 0);
+        if (added.pick_id >= pick_targets.size())
+            pick_targets.resize(added.pick_id + 1);
+        pick_targets[added.pick_id] = {ri_handle, inst_handle};
     }
+    instances_changed = true;
+}
 
-    // Create Instance IDs StructuredBuffer
-    D3D12_BUFFER_SRV buffer_srv_desc;
-    buffer_srv_desc.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
-    buffer_srv_desc.NumElements = MAX_INSTANCE_COUNT_PER_OBJECT;
-    buffer_srv_desc.StructureByteStride = sizeof(UINT);
-    buffer_srv_desc.FirstElement = ri.cb_index * MAX_INSTANCE_COUNT_PER_OBJECT;
-
-    D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc;
-    srv_desc.Buffer = buffer_srv_desc;
-    srv_desc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
-    srv_desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-    srv_desc.Format = DXGI_FORMAT_UNKNOWN;
-
-    size_t offset = ri.cb_index * dr->srv_desc_handle_incr_size;
-    D3D12_CPU_DESCRIPTOR_HANDLE offset_handle;
-    offset_handle.ptr = instanceIDs_srv_heap->GetCPUDescriptorHandleForHeapStart().ptr + offset;
-    device->CreateShaderResourceView(frame->sb_instanceIDs_upload->m_uploadbuffer, &srv_desc, offset_handle);
-
-    render_items.push_back(ri);
+s_internal void remove_instance(handle<render_item> ri_handle, handle<instance> inst_handle)
+{
+    render_item *ri = render_items.get(ri_handle);
+    instance *inst = ri ? ri->instances.get(inst_handle) : nullptr;
+    if (!inst)
+        return;
+
+    instance_picker.remove(inst->pick_id);
+    ri->instances.remove(inst_handle);
+    instances_changed = true;
 }
 
-s_internal void draw_render_items(ID3D12GraphicsCommandList *cmd_list, const std::vector<render_item> *render_items)
+s_internal void build_draw_list(const handle_registry<render_item> &items,
+                                frame_vector<render_item const *> &draw_items,
+                                frame_vector<render_item const *> &draw_meshes)
 {
-    size_t cb_size = frame->cb_objconstants_size;
-    size_t cb_resource_address = frame->cb_objconstant_upload->m_uploadbuffer->GetGPUVirtualAddress();
+    draws.clear();
 
-    for (render_item ri : *render_items)
+    for (UINT i = 0; i < (UINT)items.size(); i++)
     {
-        cmd_list->IASetPrimitiveTopology(ri.topology);
-        cmd_list->IASetVertexBuffers(0, 1, &ri.meshes.resource->vbv);
-        cmd_list->IASetIndexBuffer(&ri.meshes.resource->ibv);
+        render_item const &ri = items[i];
+        if (ri.visible_instance_count == 0)
+            continue;
+
+        // The meshes without visible items stay null, no command refers to them
+        UINT mesh = ri.geometry.index;
+        ASSERT2(mesh < draw_key::max_meshes, "The mesh id doesn't fit in the draw key.");
+        if (mesh >= draw_meshes.size())
+            draw_meshes.resize(mesh + 1);
+        draw_meshes[mesh] = &ri;
+        UINT material = i;
+
+        // Writes the stencil that keeps the outlines off the meshes
+        draws.add(draw_key::make(geometry_pass, stencil_draw_pso, mesh, material));
+        draw_items.push_back(&ri);
 
-        cmd_list->SetGraphicsRootShaderResourceView(2, frame->sb_instancedata_upload->m_uploadbuffer->GetGPUVirtualAddress());
+        if (ri.is_selected)
+        {
+            // Scaled up outline
+            draws.add(draw_key::make(outline_pass, outline_draw_pso, mesh, material));
+            draw_items.push_back(&ri);
+        }
+    }
 
-        size_t offset = ri.cb_index * dr->srv_desc_handle_incr_size;
-        D3D12_GPU_DESCRIPTOR_HANDLE offset_handle;
-        offset_handle.ptr = instanceIDs_srv_heap->GetGPUDescriptorHandleForHeapStart().ptr + offset;
-        cmd_list->SetGraphicsRootDescriptorTable(3, offset_handle);
+    draws.sort();
+    draws.build_commands();
+}
 
-        size_t cb_offset = ri.cb_index * cb_size;
-        cmd_list->SetGraphicsRootConstantBufferView(1, cb_resource_address + cb_offset);
+s_internal void draw_render_items(ID3D12GraphicsCommandList *cmd_list, const handle_registry<render_item> *render_items)
+{
+    frame_vector<render_item const *> draw_items;
+    frame_vector<render_item const *> draw_meshes;
+    build_draw_list(*render_items, draw_items, draw_meshes);
 
-        // Number of selected instances
-        cmdlist->SetGraphicsRoot32BitConstant(5, (UINT)num_selected_instances, 0);
+    D3D12_GPU_VIRTUAL_ADDRESS instance_ids_address = frame->sb_instanceIDs_upload->m_uploadbuffer->GetGPUVirtualAddress();
+    ID3D12PipelineState *psos[] = {stencil_pso, outline_pso};
 
-        // List of selected instance IDs
-        cmd_list->SetGraphicsRootShaderResourceView(4, frame->sb_selected_instanceIDs_upload->m_uploadbuffer->GetGPUVirtualAddress());
+    // Bindings shared by every draw
+    cmd_list->SetGraphicsRootShaderResourceView(1, frame->sb_instancedata_upload->m_uploadbuffer->GetGPUVirtualAddress());
 
-        // Write to stencil buffer
-        cmd_list->OMSetStencilRef(1);
-        cmd_list->SetPipelineState(stencil_pso);
-        cmd_list->DrawIndexedInstanced(ri.index_count, (UINT)ri.instances.size(), ri.start_index_location, ri.base_vertex_location, 0);
+    // Number of selected instances
+    cmd_list->SetGraphicsRoot32BitConstant(4, (UINT)num_selected_instances, 0);
 
-        if (ri.is_selected)
+    // List of selected instance IDs
+    cmd_list->SetGraphicsRootShaderResourceView(3, frame->sb_selected_instanceIDs_upload->m_uploadbuffer->GetGPUVirtualAddress());
+    cmd_list->OMSetStencilRef(1);
+
+    for (draw_command const &command : draws.commands())
+    {
+        switch (command.type)
+        {
+        case draw_command_type::set_pass:
+            // Every pass renders to the back buffer
+            break;
+
+        case draw_command_type::set_pso:
+            cmd_list->SetPipelineState(psos[command.value]);
+            break;
+
+        case draw_command_type::set_mesh:
+        {
+            render_item const *ri = draw_meshes[command.value];
+            mesh_resource const *resource = geometries.get(ri->geometry)->resource;
+            cmd_list->IASetPrimitiveTopology(ri->topology);
+            cmd_list->IASetVertexBuffers(0, 1, &resource->vbv);
+            cmd_list->IASetIndexBuffer(&resource->ibv);
+            break;
+        }
+
+        case draw_command_type::set_material:
         {
-            // Draw scaled up outline
-            cmd_list->SetPipelineState(outline_pso);
-            cmd_list->DrawIndexedInstanced(ri.index_count, (UINT)ri.instances.size(), ri.start_index_location, ri.base_vertex_location, 0);
+            render_item const &ri = (*render_items)[command.value];
+            cmd_list->SetGraphicsRootShaderResourceView(2, instance_ids_address + ri.first_instance * sizeof(UINT));
+            break;
+        }
+
+        case draw_command_type::draw:
+        {
+            // A render item adds one draw per pass with all its instances, so no two draws share a material
+            render_item const *ri = draw_items[draws.draw(command.value)];
+            cmd_list->DrawIndexedInstanced(ri->index_count, ri->visible_instance_count, ri->start_index_location, ri->base_vertex_location, 0);
+            break;
+        }
         }
-        // Draw mesh
-        cmd_list->DrawIndexedInstanced(ri.index_count, (UINT)ri.instances.size(), ri.start_index_location, ri.base_vertex_location, 0);
     }
 }
 
 DWORD __stdcall select_and_load_model(void *param)
 {
-    ui_requests_cmdalloc->Reset();
-    ui_requests_cmdlist->Reset(ui_requests_cmdalloc, nullptr);
-
     OPENFILENAME ofn;
     TCHAR szFile[MAX_PATH] = {};
 
@@ -460,10 +598,11 @@ DWORD __stdcall select_and_load_model(void *param)
         char model_file[MAX_PATH];
         wcstombs(model_file, ofn.lpstrFile, MAX_PATH);
 
-        std::vector<position_color> mesh_vertices;
-        std::vector<WORD> mesh_indices;
+        loaded_model model;
+        std::vector<position_color> &mesh_vertices = model.vertices;
+        std::vector<WORD> &mesh_indices = model.indices;
         std::vector<mesh_data> meshdata = import_meshdata(model_file);
-        std::vector<submesh> submeshes;
+        std::vector<submesh> &submeshes = model.submeshes;
 
         XMVECTOR max_point = XMVectorZero();
         XMVECTOR min_point = XMVectorZero();
@@ -498,113 +637,72 @@ DWORD __stdcall select_and_load_model(void *param)
         wchar_t *mesh_name = PathFindFileNameW(ofn.lpstrFile);
         char mesh_name_str[MAX_PATH];
         wcstombs(mesh_name_str, mesh_name, MAX_PATH);
+        model.name = mesh_name_str;
 
-        mesh new_mesh;
-        new_mesh.submeshes = submeshes;
-        new_mesh.bounds.CreateFromPoints(new_mesh.bounds, min_point, max_point);
-
-        create_mesh_data(device, ui_requests_cmdlist, mesh_name_str,
-                         sizeof(position_color), mesh_vertices.size(), (void *)mesh_vertices.data(),
-                         sizeof(WORD), mesh_indices.size(), (void *)mesh_indices.data(),
-                         &new_mesh);
-
-        UINT id = (UINT)render_items.size();
-        char id_str[12];
-        sprintf(id_str, "_%u", id);
-        strcat(mesh_name_str, id_str);
-
-        geometries[mesh_name_str] = new_mesh;
-        create_render_item(mesh_name_str, mesh_name_str, id);
+        model.bounds.CreateFromPoints(model.bounds, min_point, max_point);
+        model.triangles = triangle_bvh(mesh_vertices.data(), mesh_vertices.size(), mesh_indices.data(), mesh_indices.size());
+        if (!mesh_vertices.empty())
+        {
+            model.occluder = simplify_occluder(&mesh_vertices[0].position, sizeof(position_color), mesh_vertices.size(),
+                                               mesh_indices.data(), mesh_indices.size(), occluder_grid_size);
+        }
 
-        ui_requests_cmdlist->Close();
-        dr->cmd_queue->ExecuteCommandLists(1, (ID3D12CommandList *const *)&ui_requests_cmdlist);
+        std::lock_guard<std::mutex> lock(loaded_models_mutex);
+        loaded_models.push_back(std::move(model));
     }
     return 0;
 }
 
-s_internal void update_camera()
+// Called by the render thread, the only one that reads and writes the geometry and the render items
+s_internal void add_loaded_models()
 {
-    //ImGui::SliderFloat4("Right direction", cam.right.m128_f32, -1.f, 1.f);
-    //ImGui::SameLine();
-    //if (ImGui::Button("Reset right direction"))
-    //    cam.right = XMVectorSet(1.f, 0.f, 0.f, 0.f);
-
-    //ImGui::SliderFloat4("Up direction", cam.up.m128_f32, -1.f, 1.f);
-    //ImGui::SameLine();
-    //if (ImGui::Button("Reset up direction"))
-    //    cam.up = XMVectorSet(0.f, 1.f, 0.f, 0.f);
-
-    //ImGui::SliderFloat4("Forward direction", cam.forward.m128_f32, -1.f, 1.f);
-    //ImGui::SameLine();
-    //if (ImGui::Button("Reset forward direction"))
-    //    cam.forward = XMVectorSet(0.f, 0.f, 1.f, 0.f);
-
-    //ImGui::SliderFloat4("Camera position", cam.position.m128_f32, -150.f, 150.f);
-    //ImGui::SameLine();
-    //if (ImGui::Button("Reset camera position"))
-    //{
-    //    cam.position = cam.m_start_pos;
-    //}
+    std::vector<loaded_model> models;
+    {
+        std::lock_guard<std::mutex> lock(loaded_models_mutex);
+        if (loaded_models.empty())
+            return;
+        models.swap(loaded_models);
+    }
 
-    //ImGui::SliderFloat("Camera roll", &cam.roll, -180.f, +180.f);
-    //ImGui::SliderFloat("Camera pitch", &cam.pitch, -180.f, +180.f);
-    //ImGui::SliderFloat("Camera yaw", &cam.yaw, -180.f, +180.f);
+    ui_requests_cmdalloc->Reset();
+    ui_requests_cmdlist->Reset(ui_requests_cmdalloc, nullptr);
 
-    //cam.forward = XMVector3Normalize(cam.forward);
+    for (loaded_model &model : models)
+    {
+        mesh new_mesh;
+        new_mesh.submeshes = std::move(model.submeshes);
+        new_mesh.bounds = model.bounds;
 
-    //for (render_item &ri : render_items)
-    //{
-    //    for (instance &inst : ri.instances)
-    //        if (inst.is_selected == true)
-    //        {
-    //            cam.orbit_target_pos.m128_f32[0] = inst.shader_data.world._41;
-    //            cam.orbit_target_pos.m128_f32[1] = inst.shader_data.world._42;
-    //            cam.orbit_target_pos.m128_f32[2] = inst.shader_data.world._43;
-    //            cam.orbit_target_pos.m128_f32[3] = inst.shader_data.world._44;
-    //            ImGui::SliderFloat4("Orbit target position", cam.orbit_target_pos.m128_f32, -50.f, 50.f);
-    //        }
-    //}
+        create_mesh_data(device, ui_requests_cmdlist, model.name.c_str(),
+                         sizeof(position_color), model.vertices.size(), (void *)model.vertices.data(),
+                         sizeof(WORD), model.indices.size(), (void *)model.indices.data(),
+                         &new_mesh);
 
-    //XMVECTOR s = XMVectorReplicate(0.02f);
-    //if (GetAsyncKeyState('E'))
-    //{
-    //    cam.position = XMVectorMultiplyAdd(-s, cam.up, cam.position);
-    //}
+        char mesh_name_str[MAX_PATH + 12];
+        sprintf(mesh_name_str, "%s_%u", model.name.c_str(), (UINT)render_items.size());
 
-    //if (GetAsyncKeyState('Q'))
-    //{
-    //    cam.position = XMVectorMultiplyAdd(s, cam.up, cam.position);
-    //}
+        geometry_names[mesh_name_str] = geometries.add(new_mesh);
+        geometry_triangles[mesh_name_str] = std::move(model.triangles);
 
-    //if (GetAsyncKeyState('W'))
-    //{
-    //    cam.position = XMVectorMultiplyAdd(s, cam.forward, cam.position);
-    //}
-    //if (GetAsyncKeyState('S'))
-    //{
-    //    cam.position = XMVectorMultiplyAdd(-s, cam.forward, cam.position);
-    //}
-    //if (GetAsyncKeyState('A'))
-    //{
-    //    cam.position = XMVectorMultiplyAdd(-s, cam.right, cam.position);
-    //}
-    //if (GetAsyncKeyState('D'))
-    //{
-    //    cam.position = XMVectorMultiplyAdd(s, cam.right, cam.position);
-    //}
+        geometry_occluders[mesh_name_str] = std::move(model.occluder);
+        create_render_item(mesh_name_str, mesh_name_str);
+    }
 
-    ////XMMATRIX view = T;
-    ////XMStoreFloat4x4(&pass.view, view);
+    // Loading is rare, waiting lets the allocator be reset by the next load and the upload buffers stay alive until the copies are done
+    ui_requests_cmdlist->Close();
+    dr->cmd_queue->ExecuteCommandLists(1, (ID3D12CommandList *const *)&ui_requests_cmdlist);
+    dr->flush_cmd_queue();
+}
 
-    //// projection matrix
-    ////float aspect_ratio = (float)g_hwnd_width / (float)g_hwnd_height;
-    ////XMMATRIX proj = XMMatrixTranspose(XMMatrixPerspectiveFovLH(0.25f * XM_PI, aspect_ratio, 1.0f, 1000.0f));
-    ////XMStoreFloat4x4(&pass.proj, proj);
+s_internal void update_camera()
+{
+    main_cam.update_position();
+    main_cam.update_view();
 
-    //cam.update_view();
-    //XMStoreFloat4x4(&pass.view, cam.view);
-    //XMStoreFloat4x4(&pass.proj, XMMatrixTranspose(cam.proj));
-    //frame->cb_pass_upload->copy_data(0, (void *)&pass);
+    // m_inv_view holds the transposed view matrix, the shaders multiply row vectors by the transposed view_proj
+    XMMATRIX view_proj = XMMatrixTranspose(XMLoadFloat4x4(&main_cam.m_inv_view)) * XMLoadFloat4x4(&main_cam.m_proj);
+    XMStoreFloat4x4(&pass.view_proj, XMMatrixTranspose(view_proj));
+    frame->cb_pass_upload->copy_data(0, &pass);
 }
 
 struct tree_item
@@ -647,7 +745,7 @@ void imgui_nested_tree()
             ImGui::PushID((int)i);
             bool is_expanded = ImGui::TreeNodeExV((void *)nullptr, ImGuiTreeNodeFlags_FramePadding, "", nullptr);
             ImGui::SameLine();
-            if (ImGui::Selectable(ri->name.c_str(), ri->is_selected))
+            if (ImGui::Selectable(names.str(ri->name), ri->is_selected))
             {
                 if (!ImGui::GetIO().KeyCtrl)
                 {
@@ -669,7 +767,15 @@ void imgui_nested_tree()
 
             if (is_expanded)
             {
-                // Instances
+                ImGui::InputInt("##instance_count", &ui_added_instance_count);
+                ImGui::SameLine();
+                if (ImGui::Button("Add instances") && ui_added_instance_count > 0)
+                {
+                    add_instances(render_items.handle_at(i), (UINT)ui_added_instance_count);
+                }
+
+                // Instances, a deleted instance is removed after the loop since the last one moves into its place
+                handle<instance> deleted_instance;
                 for (size_t j = 0; j < ri->instances.size(); j++)
                 {
                     instance &inst = ri->instances[j];
@@ -677,7 +783,7 @@ void imgui_nested_tree()
                     ImGui::PushID((int)j);
                     bool is_expanded = ImGui::TreeNodeExV((void *)nullptr, ImGuiTreeNodeFlags_FramePadding, "", nullptr);
                     ImGui::SameLine();
-                    if (ImGui::Selectable(inst.name.c_str(), inst.is_selected))
+                    if (ImGui::Selectable(names.str(inst.name), inst.is_selected))
                     {
                         if (!ImGui::GetIO().KeyCtrl)
                         {
@@ -695,19 +801,31 @@ void imgui_nested_tree()
                     }
                     if (is_expanded)
                     {
-                        ImGui::SliderFloat3("Translation", inst.translation, -20.f, 20.f);
+                        if (ImGui::SliderFloat3("Translation", inst.translation, -20.f, 20.f))
+                        {
+                            mark_instance_edited(inst);
+                        }
                         ImGui::SameLine();
                         if (ImGui::Button("Reset translation"))
                         {
                             inst.translation[0] = 0.f;
                             inst.translation[1] = 0.f;
                             inst.translation[2] = 0.f;
+                            mark_instance_edited(inst);
+                        }
+                        if (ImGui::Button("Delete"))
+                        {
+                            deleted_instance = ri->instances.handle_at(j);
                         }
 
                         ImGui::TreePop();
                     }
                     ImGui::PopID();
                 }
+                if (!deleted_instance.is_null())
+                {
+                    remove_instance(render_items.handle_at(i), deleted_instance);
+                }
 
                 ImGui::TreePop();
             }
@@ -725,10 +843,11 @@ void imgui_nested_tree()
             tree_item tree_ri;
 
             // Submeshes
-            size_t num_submeshes = ri->meshes.submeshes.size();
+            mesh *geometry = geometries.get(ri->geometry);
+            size_t num_submeshes = geometry->submeshes.size();
             for (size_t k = 0; k < num_submeshes; k++)
             {
-                submesh *sm = &ri->meshes.submeshes[k];
+                submesh *sm = &geometry->submeshes[k];
 
                 tree_item tree_sm;
                 tree_sm.name = sm->name;
@@ -748,9 +867,9 @@ void imgui_nested_tree()
                         for (size_t i = 0; i < render_items.size(); i++)
                         {
                             render_items[i].is_selected = false;
-                            for (size_t j = 0; j < render_items[i].meshes.submeshes.size(); j++)
+                            for (submesh &sm : geometries.get(render_items[i].geometry)->submeshes)
                             {
-                                render_items[i].meshes.submeshes[j].is_selected = false;
+                                sm.is_selected = false;
                             }
                         }
                         selected_items.clear();
@@ -773,7 +892,7 @@ void imgui_nested_tree()
             {
                 tree_item tree_inst;
                 tree_inst.parent = &tree_ri;
-                tree_inst.name = inst.name;
+                tree_inst.name = names.str(inst.name);
                 tree_inst.is_selected = &inst.is_selected;
                 tree_inst.on_expand_callback = [inst](tree_item *ti) {
                     float inst_pos[4];
@@ -801,7 +920,7 @@ void imgui_nested_tree()
             }
 
             // Render items
-            tree_ri.name = ri->name;
+            tree_ri.name = names.str(ri->name);
             tree_ri.is_selected = &ri->is_selected;
 
             tree_ri.on_expand_callback = [num_instances, num_submeshes, indentation, ri, i](tree_item *ti) {
@@ -850,9 +969,9 @@ void imgui_nested_tree()
                     for (size_t i = 0; i < render_items.size(); i++)
                     {
                         render_items[i].is_selected = false;
-                        for (size_t j = 0; j < render_items[i].meshes.submeshes.size(); j++)
+                        for (submesh &sm : geometries.get(render_items[i].geometry)->submeshes)
                         {
-                            render_items[i].meshes.submeshes[j].is_selected = false;
+                            sm.is_selected = false;
                         }
                     }
                     selected_items.clear();
@@ -945,13 +1064,18 @@ void imgui_update()
             forward_angle = 0.f;
         }
 
-        ImGui::DragFloat3("Scale", scale, 0.01f, -20.f, 20.f);
+        // The scale applies to every instance
+        if (ImGui::DragFloat3("Scale", scale, 0.01f, -20.f, 20.f))
+        {
+            edited_instances.set_all();
+        }
         ImGui::SameLine();
         if (ImGui::Button("Reset scale"))
         {
             scale[0] = 1.f;
             scale[1] = 1.f;
             scale[2] = 1.f;
+            edited_instances.set_all();
         }
     }
 
@@ -964,6 +1088,7 @@ void imgui_update()
     imgui_gpu_memory(dr->adapter);
     ImGui::Text("imgui gpu time %.4f ms/frame",
                 imgui_gpu_time);
+    ImGui::Text("Frame arena: %zu KB used, %zu KB high water mark", thread_frame_arena().used() / 1024, thread_frame_arena().high_water_mark() / 1024);
     ImGui::End();
 
     ImGui::ShowDemoWindow(&show_demo);
@@ -977,6 +1102,9 @@ void imgui_update()
 
 extern "C" __declspec(dllexport) bool update_and_render()
 {
+    // Nothing allocated in the frame arena survives the previous frame
+    thread_frame_arena().reset();
+
     imgui_update();
 
     // frame resource synchronization
@@ -991,120 +1119,296 @@ extern "C" __declspec(dllexport) bool update_and_render()
     // view matrix
     update_camera();
 
-    total_ri_instances.clear();
-    // update object constant data
-    for (render_item &ri : render_items)
+    // The models loaded since the last frame get their render items before the instance list is rebuilt
+    add_loaded_models();
+
+    // The instance list only changes when render items or instances are added or removed
+    if (instances_changed)
     {
-        XMMATRIX world = XMLoadFloat4x4(&ri.world);
-        XMFLOAT4X4 transposed;
-        XMStoreFloat4x4(&transposed, XMMatrixTranspose(world));
-        frame->cb_objconstant_upload->copy_data(ri.cb_index, (void *)&transposed);
+        rebuild_instance_list();
+    }
+
+    // The GPU is done with this frame's buffers, they can be recreated if they're too small
+    frame->reserve(device, total_ri_instances.size());
 
-        for (instance &inst : ri.instances)
+    // Only the edited instances get their local transform set, the hierarchy then recomputes their world matrix
+    frame_vector<std::pair<size_t, size_t>> updated_ranges;
+    edited_instances.consume_ranges(0, [&updated_ranges](size_t first, size_t count) {
+        for (size_t i = first; i < first + count; i++)
         {
-            total_ri_instances.push_back(&inst);
+            set_instance_transform(i);
+        }
+        updated_ranges.push_back({first, count});
+    });
+    instance_transforms->update();
+    for (std::pair<size_t, size_t> const &range : updated_ranges)
+    {
+        for (size_t i = range.first; i < range.first + range.second; i++)
+        {
+            update_instance(i);
         }
+        pack_instances(range.first, range.second);
     }
 
-    // update instance data
-    num_selected_instances = 0;
-    frame->sb_selected_instanceIDs_upload->clear_data();
+    // Each frame buffer gets the ranges that changed since it was last used
+    frame->dirty_instances.consume_ranges(max_upload_gap, [](size_t first, size_t count) {
+        frame->sb_instancedata_upload->copy_range(first, &packed_instances[first], count);
+    });
 
+    selected_instance_ids.clear();
     for (size_t i = 0; i < total_ri_instances.size(); i++)
     {
-        frame->sb_instanceIDs_upload->copy_data((int)i, (void *)&i);
-
         if (total_ri_instances[i]->is_selected)
+            selected_instance_ids.push_back((UINT)i);
+    }
+    num_selected_instances = (int)selected_instance_ids.size();
+    if (frame->uploaded_selected_ids != selected_instance_ids)
+    {
+        frame->sb_selected_instanceIDs_upload->copy_range(0, selected_instance_ids.data(), selected_instance_ids.size());
+        frame->uploaded_selected_ids = selected_instance_ids;
+    }
+
+    cull_instances();
+
+    // render
+    cmd_alloc->Reset();
+    cmdlist->Reset(cmd_alloc, billboard_pso);
+
+    set_viewport_rects(cmdlist);
+    cmdlist->OMSetRenderTargets(1, &dr->rtv_descriptor_handles[backbuffer_index], FALSE, &dr->dsv_heap->GetCPUDescriptorHandleForHeapStart());
+    cmdlist->SetGraphicsRootSignature(dr->rootsig);
+    cmdlist->SetGraphicsRootConstantBufferView(0, frame->cb_pass_upload->m_uploadbuffer->GetGPUVirtualAddress());
+
+    frame_graph.reset();
+    render_graph::resource_id back_buffer = frame_graph.import_resource("back_buffer", dr->back_buffers[backbuffer_index], state_present, state_present);
+
+    render_graph::pass_builder clear = frame_graph.add_pass("clear dsv and rtv", [backbuffer_index] {
+        cmdlist->ClearDepthStencilView(dr->dsv_heap->GetCPUDescriptorHandleForHeapStart(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.f, 0, 0, NULL);
+        cmdlist->ClearRenderTargetView(dr->rtv_descriptor_handles[backbuffer_index], bg_color, 0, NULL);
+    });
+    clear.write(back_buffer, state_render_target);
+
+    render_graph::pass_builder render_items_drawing = frame_graph.add_pass("Draw render items", [] {
+        switch (shading)
         {
-            frame->sb_selected_instanceIDs_upload->copy_data(num_selected_instances++, (void *)&i);
+        case flat_color:
+            cmdlist->SetPipelineState(billboard_pso);
+            break;
+
+        case wireframe:
+            cmdlist->SetPipelineState(wireframe_pso);
+            break;
+
+        default:
+            break;
         }
+        draw_render_items(cmdlist, &render_items);
+    });
+    render_items_drawing.read_write(back_buffer, state_render_target);
 
-        instance *inst = total_ri_instances[i];
-        XMMATRIX inst_world = XMLoadFloat4x4(&inst->shader_data.world);
-        instance_data inst_shader_data;
-        XMStoreFloat4x4(&inst_shader_data.world, XMMatrixTranspose(inst_world));
+    render_graph::pass_builder ui_rendering = frame_graph.add_pass("ui_rendering", [] {
+        query->start("ui_rendering");
+        imgui_render(cmdlist);
+        query->stop("ui_rendering");
+    });
+    ui_rendering.read_write(back_buffer, state_render_target);
 
-        XMVECTOR right = XMVectorSet(1.f, 0.f, 0.f, 0.f);
-        XMVECTOR right_rot_quat = XMQuaternionRotationAxis(right, XMConvertToRadians(inst->right_angle));
+    bool is_graph_valid = frame_graph.compile();
+    ASSERT2(is_graph_valid, frame_graph.error());
+    frame_graph.execute(*graph_backend);
 
-        XMVECTOR up = XMVectorSet(0.f, 1.f, 0.f, 0.f);
-        XMVECTOR up_rot_quat = XMQuaternionRotationAxis(up, XMConvertToRadians(inst->up_angle));
+    query->resolve();
+    cmdlist->Close();
+    dr->cmd_queue->ExecuteCommandLists((UINT)1, (ID3D12CommandList *const *)&cmdlist);
 
-        XMVECTOR forward = XMVectorSet(0.f, 0.f, 1.f, 0.f);
-        XMVECTOR forward_rot_quat = XMQuaternionRotationAxis(forward, XMConvertToRadians(inst->forward_angle));
+    dr->present(is_vsync);
+    frame->fence_value = dr->signal();
 
-        XMVECTOR rot_quat = XMQuaternionMultiply(forward_rot_quat, XMQuaternionMultiply(right_rot_quat, up_rot_quat));
-        XMMATRIX rot_mat = XMMatrixRotationQuaternion(rot_quat);
+    imgui_gpu_time = query->result("ui_rendering");
 
-        XMMATRIX scale_mat = XMMatrixScaling(scale[0], scale[1], scale[2]);
-        XMMATRIX translation_mat = XMMatrixTranslation(inst->translation[0], inst->translation[1], inst->translation[2]);
-        XMMATRIX srt = scale_mat * rot_mat * translation_mat;
+    return true;
+}
 
-        if (num_selected_instances > 0)
+s_internal void rebuild_instance_list()
+{
+    total_ri_instances.clear();
+    packed_instance_objects.clear();
+    instance_transforms->clear();
+    instance_nodes.clear();
+    for (size_t i = 0; i < render_items.size(); i++)
+    {
+        XMVECTOR object_scale, object_rotation, object_translation;
+        XMMatrixDecompose(&object_scale, &object_rotation, &object_translation, XMLoadFloat4x4(&render_items[i].world));
+        XMFLOAT3 translation, scale;
+        XMFLOAT4 rotation;
+        XMStoreFloat3(&translation, object_translation);
+        XMStoreFloat4(&rotation, object_rotation);
+        XMStoreFloat3(&scale, object_scale);
+        UINT object_node = instance_transforms->add(transform_hierarchy::null_parent, translation, rotation, scale);
+
+        render_items[i].first_instance = (UINT)total_ri_instances.size();
+        for (instance &inst : render_items[i].instances)
         {
+            inst.packed_index = (UINT)total_ri_instances.size();
+            total_ri_instances.push_back(&inst);
+            packed_instance_objects.push_back((UINT)i);
+            instance_nodes.push_back(instance_transforms->add(object_node));
         }
+    }
 
-        XMMATRIX new_world = XMMatrixIdentity();
-        new_world = new_world * srt;
+    size_t num_instances = total_ri_instances.size();
+    packed_instances.resize(num_instances);
+    instance_world_bounds.resize(num_instances);
+    instance_spheres.resize(num_instances);
+    instance_boxes.resize(num_instances);
+    instance_culling_cache.resize(num_instances);
+    instance_frustum_mask.resize((num_instances + 63) / 64);
+    edited_instances.resize(num_instances);
+    edited_instances.set_all();
 
-        XMStoreFloat4x4(&inst->shader_data.world, new_world);
-        XMStoreFloat4x4(&inst_shader_data.world, XMMatrixTranspose(inst_world));
+    // The packed indices moved, the LODs kept for the hysteresis belong to other instances now
+    instance_lods.reset();
 
-        frame->sb_instancedata_upload->copy_data((int)i, (void *)&inst_shader_data);
+    for (frame_resource *fr : frame_resources)
+    {
+        fr->dirty_instances.resize(num_instances);
     }
+    instances_changed = false;
+}
 
-    // render
-    cmd_alloc->Reset();
-    cmdlist->Reset(cmd_alloc, billboard_pso);
+s_internal void set_instance_transform(size_t index)
+{
+    instance *inst = total_ri_instances[index];
 
-    cmdlist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
-                                    dr->back_buffers[backbuffer_index],
-                                    D3D12_RESOURCE_STATE_PRESENT,
-                                    D3D12_RESOURCE_STATE_RENDER_TARGET));
+    XMVECTOR right = XMVectorSet(1.f, 0.f, 0.f, 0.f);
+    XMVECTOR right_rot_quat = XMQuaternionRotationAxis(right, XMConvertToRadians(inst->right_angle));
 
-    set_viewport_rects(cmdlist);
-    cmdlist->ClearDepthStencilView(dr->dsv_heap->GetCPUDescriptorHandleForHeapStart(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.f, 0, 0, NULL);
-    cmdlist->ClearRenderTargetView(dr->rtv_descriptor_handles[backbuffer_index], bg_color, 0, NULL);
-    cmdlist->OMSetRenderTargets(1, &dr->rtv_descriptor_handles[backbuffer_index], FALSE, &dr->dsv_heap->GetCPUDescriptorHandleForHeapStart());
+    XMVECTOR up = XMVectorSet(0.f, 1.f, 0.f, 0.f);
+    XMVECTOR up_rot_quat = XMQuaternionRotationAxis(up, XMConvertToRadians(inst->up_angle));
 
-    switch (shading)
-    {
-    case flat_color:
-        cmdlist->SetPipelineState(billboard_pso);
-        break;
+    XMVECTOR forward = XMVectorSet(0.f, 0.f, 1.f, 0.f);
+    XMVECTOR forward_rot_quat = XMQuaternionRotationAxis(forward, XMConvertToRadians(inst->forward_angle));
 
-    case wireframe:
-        cmdlist->SetPipelineState(wireframe_pso);
-        break;
+    XMFLOAT4 rot_quat;
+    XMStoreFloat4(&rot_quat, XMQuaternionMultiply(forward_rot_quat, XMQuaternionMultiply(right_rot_quat, up_rot_quat)));
 
-    default:
-        break;
+    UINT node = instance_nodes[index];
+    instance_transforms->set_translation(node, XMFLOAT3(inst->translation[0], inst->translation[1], inst->translation[2]));
+    instance_transforms->set_rotation(node, rot_quat);
+    instance_transforms->set_scale(node, XMFLOAT3(scale[0], scale[1], scale[2]));
+}
+
+// Reads the world matrix the hierarchy computed for the instance, and updates everything that depends on it.
+// The shaders' packed copy is written by pack_instances, for a whole range at once
+s_internal void update_instance(size_t index)
+{
+    instance *inst = total_ri_instances[index];
+
+    XMFLOAT4X4 &inst_world = inst->shader_data.world;
+    inst_world = instance_transforms->world(instance_nodes[index]);
+
+    XMMATRIX world = XMLoadFloat4x4(&inst_world);
+    instance_picker.set_world(inst->pick_id, inst_world);
+
+    inst->bounds.Transform(instance_world_bounds[index], world);
+    instance_boxes.set(index, instance_world_bounds[index]);
+    instance_culling_cache.invalidate(index);
+    BoundingSphere sphere;
+    BoundingSphere::CreateFromBoundingBox(sphere, instance_world_bounds[index]);
+    instance_spheres.set(index, sphere);
+
+    for (frame_resource *fr : frame_resources)
+    {
+        fr->dirty_instances.set(index);
     }
+}
 
-    cmdlist->SetDescriptorHeaps(1, &instanceIDs_srv_heap);
-    cmdlist->SetGraphicsRootSignature(dr->rootsig);
-    cmdlist->SetGraphicsRootConstantBufferView(0, frame->cb_pass_upload->m_uploadbuffer->GetGPUVirtualAddress());
-    draw_render_items(cmdlist, &render_items);
+// Packs the world matrices of a range of updated instances for the shaders, in one batch
+s_internal void pack_instances(size_t first, size_t count)
+{
+    frame_vector<rtm::matrix3x4f> worlds;
+    worlds.reserve(count);
+    for (size_t i = first; i < first + count; i++)
+    {
+        XMFLOAT4X4 const &world = total_ri_instances[i]->shader_data.world;
+        worlds.push_back({rtm::vector_load(&world._11),
+                          rtm::vector_load(&world._21),
+                          rtm::vector_load(&world._31),
+                          rtm::vector_load(&world._41)});
+    }
+    pack_affine(worlds.data(), count, &packed_instances[first]);
+}
 
-    query->start("ui_rendering");
-    imgui_render(cmdlist);
-    query->stop("ui_rendering");
+// Writes the IDs of the instances that are in the camera frustum, big enough on screen and aren't hidden
+// behind the occluders, and how many there are for each render item
+s_internal void cull_instances()
+{
+    XMFLOAT4 planes[6];
+    main_cam.world_frustum_planes(planes);
+    instance_culler.set_planes(planes);
+    instance_culler.cull(instance_boxes, instance_culling_cache, instance_frustum_mask.data());
 
-    cmdlist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
-                                    dr->back_buffers[backbuffer_index],
-                                    D3D12_RESOURCE_STATE_RENDER_TARGET,
-                                    D3D12_RESOURCE_STATE_PRESENT));
+    instance_lods.set_camera(main_cam, (float)g_hwnd_height);
+    instance_lods.select(instance_spheres, lod_instances);
 
-    query->resolve();
-    cmdlist->Close();
-    dr->cmd_queue->ExecuteCommandLists((UINT)1, (ID3D12CommandList *const *)&cmdlist);
+    // The camera's view_proj, update_camera transposed it for the shaders
+    XMFLOAT4X4 view_proj;
+    XMStoreFloat4x4(&view_proj, XMMatrixTranspose(XMLoadFloat4x4(&pass.view_proj)));
+    occlusion.begin(view_proj);
 
-    dr->present(is_vsync);
-    frame->fence_value = dr->signal();
+    frame_vector<std::pair<float, UINT>> occluders;
+    for (UINT instance_id = 0; instance_id < (UINT)total_ri_instances.size(); instance_id++)
+    {
+        if ((instance_frustum_mask[instance_id / 64] & (UINT64(1) << (instance_id % 64))) == 0)
+            continue;
+
+        render_item const &ri = render_items[packed_instance_objects[instance_id]];
+        if (ri.occluder == nullptr || ri.occluder->indices.empty())
+            continue;
+
+        BoundingSphere sphere(XMFLOAT3(instance_spheres.m_center_x[instance_id], instance_spheres.m_center_y[instance_id], instance_spheres.m_center_z[instance_id]),
+                              instance_spheres.m_radius[instance_id]);
+        float size = occlusion.projected_size(sphere);
+        if (size >= min_occluder_size)
+            occluders.push_back({size, instance_id});
+    }
 
-    imgui_gpu_time = query->result("ui_rendering");
+    size_t num_occluders = std::min(occluders.size(), max_occluders);
+    std::partial_sort(occluders.begin(), occluders.begin() + num_occluders, occluders.end(),
+                      [](std::pair<float, UINT> const &a, std::pair<float, UINT> const &b) { return a.first > b.first; });
+    for (size_t i = 0; i < num_occluders; i++)
+    {
+        UINT instance_id = occluders[i].second;
+        occluder_mesh const *occluder = render_items[packed_instance_objects[instance_id]].occluder;
+        occlusion.rasterize(occluder->positions.data(), sizeof(XMFLOAT3), occluder->positions.size(),
+                            occluder->indices.data(), occluder->indices.size(), total_ri_instances[instance_id]->shader_data.world);
+    }
+    occlusion.build_hierarchy();
 
-    return true;
+    // The meshes have a single LOD, so the instances big enough on screen are all in the first list, in increasing order.
+    // Each render item's instances are contiguous, so are its visible ids, and its range goes to the upload buffer in one copy.
+    visible_instance_ids.resize(total_ri_instances.size());
+    for (render_item &ri : render_items)
+    {
+        ri.visible_instance_count = 0;
+    }
+
+    for (UINT instance_id : lod_instances[0])
+    {
+        if ((instance_frustum_mask[instance_id / 64] & (UINT64(1) << (instance_id % 64))) == 0)
+            continue;
+
+        if (!occlusion.is_visible(instance_world_bounds[instance_id]))
+            continue;
+
+        render_item &ri = render_items[packed_instance_objects[instance_id]];
+        visible_instance_ids[ri.first_instance + ri.visible_instance_count++] = instance_id;
+    }
+
+    for (render_item &ri : render_items)
+    {
+        frame->sb_instanceIDs_upload->copy_range(ri.first_instance, &visible_instance_ids[ri.first_instance], ri.visible_instance_count);
+    }
 }
 
 void pick(const DirectX::XMMATRIX &to_projection, const DirectX::XMMATRIX &to_view, const float ndc_x, const float ndc_y)
@@ -1118,40 +1422,36 @@ void pick(const DirectX::XMMATRIX &to_projection, const DirectX::XMMATRIX &to_vi
     XMMATRIX inv_view = XMMatrixInverse(&XMMatrixDeterminant(to_view), to_view);
     is_item_picked = false;
 
-    for (render_item &ri : render_items)
-    {
-        for (instance &inst : ri.instances)
-        {
-            XMVECTOR ray_origin = XMVectorSet(0.f, 0.f, 0.f, 1.f);
-            XMVECTOR ray_dir = XMVectorSet(point_x, point_y, 1.f, 0.f);
-
-            XMMATRIX inst_world = XMLoadFloat4x4(&inst.shader_data.world);
-            XMMATRIX inv_world = XMMatrixInverse(&XMMatrixDeterminant(inst_world), inst_world);
-            XMMATRIX view_to_local = inv_view * inv_world;
+    XMFLOAT3 world_origin;
+    XMFLOAT3 world_dir;
+    XMStoreFloat3(&world_origin, XMVector3TransformCoord(XMVectorSet(0.f, 0.f, 0.f, 1.f), inv_view));
+    XMStoreFloat3(&world_dir, XMVector3Normalize(XMVector3TransformNormal(XMVectorSet(point_x, point_y, 1.f, 0.f), inv_view)));
 
-            // Transform ray to local space of the current mesh we are testing against
-            ray_origin = XMVector3TransformCoord(ray_origin, view_to_local);
-            ray_dir = XMVector3Normalize(XMVector3TransformNormal(ray_dir, view_to_local));
+    picker::hit_result hit;
+    if (!instance_picker.pick(world_origin, world_dir, hit))
+        return;
 
-            float dist = 0.f;
-            if (inst.bounds.Intersects(ray_origin, ray_dir, dist))
+    // Only the nearest instance gets picked, holding ctrl adds it to the selection
+    if (!ImGui::GetIO().KeyCtrl)
+    {
+        for (render_item &ri : render_items)
+        {
+            ri.is_selected = false;
+            for (instance &inst : ri.instances)
             {
-                if (!ImGui::GetIO().KeyCtrl)
-                {
-                    for (render_item &ri : render_items)
-                    {
-                        ri.is_selected = false;
-                        for (instance &inst : ri.instances)
-                        {
-                            inst.is_selected = false;
-                        }
-                    }
-                }
-                inst.is_selected = true;
-                ri.is_selected = true;
+                inst.is_selected = false;
             }
         }
     }
+
+    pick_target const &target = pick_targets[hit.id];
+    render_item *ri = render_items.get(target.item);
+    instance *inst = ri ? ri->instances.get(target.instance) : nullptr;
+    if (!inst)
+        return;
+    inst->is_selected = true;
+    ri->is_selected = true;
+    is_item_picked = true;
 }
 
 extern "C" __declspec(dllexport) void wndproc(UINT msg, WPARAM wParam, LPARAM lParam)
@@ -1176,7 +1476,7 @@ extern "C" __declspec(dllexport) void wndproc(UINT msg, WPARAM wParam, LPARAM lP
     case WM_LBUTTONDOWN:
         if (!is_hovering_window())
         {
-            pick(XMMatrixTranspose(XMLoadFloat4x4(&pass.proj)), XMMatrixTranspose(XMLoadFloat4x4(&pass.view)), ndc_mouse_pos.x, ndc_mouse_pos.y);
+            pick(XMLoadFloat4x4(&main_cam.m_proj), XMMatrixTranspose(XMLoadFloat4x4(&main_cam.m_inv_view)), ndc_mouse_pos.x, ndc_mouse_pos.y);
         }
         break;
 
@@ -1204,15 +1504,14 @@ extern "C" __declspec(dllexport) void cleanup()
     safe_release(cmdlist);
     safe_release(ui_requests_cmdlist);
     safe_release(ui_requests_cmdalloc);
-    safe_release(instanceIDs_srv_heap);
 
-    for (std::pair<std::string, mesh> geometry : geometries)
+    for (mesh &geometry : geometries)
     {
-        safe_release(geometry.second.resource->vertex_default);
-        safe_release(geometry.second.resource->vertex_upload);
-        safe_release(geometry.second.resource->index_default);
-        safe_release(geometry.second.resource->index_upload);
-        delete geometry.second.resource;
+        safe_release(geometry.resource->vertex_default);
+        safe_release(geometry.resource->vertex_upload);
+        safe_release(geometry.resource->index_default);
+        safe_release(geometry.resource->index_upload);
+        delete geometry.resource;
     }
 
     imgui_shutdown();
@@ -1222,6 +1521,8 @@ extern "C" __declspec(dllexport) void cleanup()
 
     delete dr;
     delete query;
+    delete graph_backend;
+    delete instance_transforms;
 
 #ifdef DX12_ENABLE_DEBUG_LAYER
     IDXGIDebug1 *debug = NULL;
@@ -1,4 +1,5 @@
 #include "frame_resource.h"
+#include <algorithm>
 
 frame_cmd::frame_cmd(ID3D12Device *device, size_t frame_index) : m_frame_index(frame_index)
 {
@@ -17,22 +18,41 @@ frame_cmd::~frame_cmd()
     safe_release(cmd_alloc);
 }
 
-frame_resource::frame_resource(ID3D12Device *device, size_t frame_index, size_t element_count, size_t instance_count)
+frame_resource::frame_resource(ID3D12Device *device, size_t frame_index, size_t instance_count)
     : frame_cmd(device, frame_index)
 {
-    cb_objconstant_upload = new upload_buffer(device, element_count, sizeof(object_data), true, "obj_constants");
     cb_pass_upload = new upload_buffer(device, 1, sizeof(pass_data), true, "pass_data");
-
-    sb_instancedata_upload = new upload_buffer(device, instance_count, sizeof(instance_data), false, "instance_data");
-    sb_instanceIDs_upload = new upload_buffer(device, instance_count, sizeof(UINT), false, "instance_IDs");
-    sb_selected_instanceIDs_upload = new upload_buffer(device, instance_count, sizeof(UINT), false, "selected_instance_IDs");
+    reserve(device, instance_count);
 }
 
 frame_resource::~frame_resource()
 {
-    delete cb_objconstant_upload;
     delete sb_instancedata_upload;
     delete cb_pass_upload;
     delete sb_instanceIDs_upload;
     delete sb_selected_instanceIDs_upload;
 }
+
+bool frame_resource::reserve(ID3D12Device *device, size_t instance_count)
+{
+    bool is_resized = false;
+
+    // Buffers at least double when they grow, so adding items one by one only recreates them a few times
+    if (instance_count > instance_capacity)
+    {
+        instance_capacity = std::max(instance_count, instance_capacity * 2);
+        delete sb_instancedata_upload;
+        delete sb_instanceIDs_upload;
+        delete sb_selected_instanceIDs_upload;
+        sb_instancedata_upload = new upload_buffer(device, instance_capacity, sizeof(instance_affine), false, "instance_data");
+        sb_instanceIDs_upload = new upload_buffer(device, instance_capacity, sizeof(UINT), false, "instance_IDs");
+        sb_selected_instanceIDs_upload = new upload_buffer(device, instance_capacity, sizeof(UINT), false, "selected_instance_IDs");
+
+        // The new buffers start empty
+        dirty_instances.set_all();
+        uploaded_selected_ids.clear();
+        is_resized = true;
+    }
+
+    return is_resized;
+}
@@ -1,21 +1,21 @@
 #pragma once
 #include <common.h>
 #include <gpu_interface.h>
+#include <dirty_bitset.h>
+#include <chunked_pool.h>
+#include <occlusion_buffer.h>
+#include "instance_packing.h"
 
-struct object_data
-{
-    DirectX::XMFLOAT4X4 world;
-};
 
 struct instance_data
 {
     DirectX::XMFLOAT4X4 world;
 };
 
+// The view and projection multiplied once on the CPU, transposed for the shaders
 struct pass_data
 {
-    DirectX::XMFLOAT4X4 view;
-    DirectX::XMFLOAT4X4 proj;
+    DirectX::XMFLOAT4X4 view_proj;
 };
 
 class frame_cmd
@@ -34,19 +34,29 @@ class frame_resource : public frame_cmd
 {
 public:
     frame_resource() = default;
-    frame_resource(ID3D12Device *device, size_t frame_index, size_t element_count, size_t instance_count);
+    frame_resource(ID3D12Device *device, size_t frame_index, size_t instance_count);
     ~frame_resource();
-    upload_buffer *cb_objconstant_upload = nullptr;
     upload_buffer *sb_instancedata_upload = nullptr;
     upload_buffer *sb_instanceIDs_upload = nullptr;
     upload_buffer *sb_selected_instanceIDs_upload = nullptr;
     upload_buffer *cb_pass_upload = nullptr;
-    size_t cb_objconstants_size = 0;
+    size_t instance_capacity = 0;
+
+    // Recreates the buffers that are too small, only call once the GPU is done with this frame.
+    // Returns true when a buffer was recreated.
+    bool reserve(ID3D12Device *device, size_t instance_count);
+
+    // What changed since this frame's buffers were last written
+    dirty_bitset dirty_instances;
+    std::vector<UINT> uploaded_selected_ids;
 };
 
+class triangle_bvh;
+using mesh_handle = handle<mesh>;
+
 struct instance
 {
-    std::string name;
+    UINT name = 0; // interned, only used by the UI
     bool is_selected = false;
     instance_data shader_data;
     float translation[3] = {};
@@ -55,20 +65,26 @@ struct instance
     float up_angle = 0.f;
     float forward_angle = 0.f;
     DirectX::BoundingBox bounds;
+    UINT pick_id = 0;
+    UINT packed_index = 0;
 };
 
 struct render_item
 {
     render_item() = default;
 
-    std::string name;
+    UINT name = 0; // interned, only used by the UI
     bool is_selected = false;
     DirectX::XMFLOAT4X4 world;
-    int cb_index = -1;
     D3D12_PRIMITIVE_TOPOLOGY topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
 
-    mesh meshes;
-    std::vector<instance> instances;
+    mesh_handle geometry;
+    occluder_mesh const *occluder = nullptr;
+    triangle_bvh const *triangles = nullptr;
+    chunked_pool<instance> instances;
+    UINT num_added_instances = 0;
+    UINT first_instance = 0; // packed index of the first instance, the instances of a render item are contiguous
+    UINT visible_instance_count = 0;
 
     UINT index_count = 0;
     UINT vertex_count = 0;
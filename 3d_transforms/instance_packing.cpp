@@ -0,0 +1,31 @@
+#include "instance_packing.h"
+
+using namespace rtm;
+
+void pack_affine(matrix3x4f const *worlds, size_t count, instance_affine *out)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        matrix3x4f const &world = worlds[i];
+
+#if defined(RTM_SSE2_INTRINSICS)
+        // The axes are the rows of the row vector matrix, transposing them gives the rows of the 3x4 matrix
+        __m128 x_axis = world.x_axis;
+        __m128 y_axis = world.y_axis;
+        __m128 z_axis = world.z_axis;
+        __m128 w_axis = world.w_axis;
+        _MM_TRANSPOSE4_PS(x_axis, y_axis, z_axis, w_axis);
+        _mm_storeu_ps(out[i].rows[0], x_axis);
+        _mm_storeu_ps(out[i].rows[1], y_axis);
+        _mm_storeu_ps(out[i].rows[2], z_axis);
+#else
+        vector4f const axes[4] = {world.x_axis, world.y_axis, world.z_axis, world.w_axis};
+        for (int axis = 0; axis < 4; axis++)
+        {
+            out[i].rows[0][axis] = vector_get_x(axes[axis]);
+            out[i].rows[1][axis] = vector_get_y(axes[axis]);
+            out[i].rows[2][axis] = vector_get_z(axes[axis]);
+        }
+#endif
+    }
+}
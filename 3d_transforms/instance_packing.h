@@ -0,0 +1,13 @@
+#pragma once
+#include <rtm/matrix3x4f.h>
+
+// Instance transforms in the layout the shaders read them.
+// The object and instance transforms are concatenated on the CPU, so only one transform is read per vertex.
+
+// 48 bytes: the transposed 3x4 affine matrix, a point is transformed with 3 dot products
+struct instance_affine
+{
+    float rows[3][4];
+};
+
+void pack_affine(rtm::matrix3x4f const *worlds, size_t count, instance_affine *out);
@@ -1,9 +1,9 @@
-struct view_proj
+// view and projection multiplied on the CPU
+struct pass_constants
 {
-    matrix view;
-    matrix proj;
+    matrix view_proj;
 };
-ConstantBuffer<view_proj> cb_viewproj : register(b0);
+ConstantBuffer<pass_constants> cb_pass : register(b0);
 
 // input layout
 struct vertex_in
@@ -20,10 +20,8 @@ struct vertex_out
 
 vertex_out VS(vertex_in vs_in)
 {
-    matrix view_proj = mul(cb_viewproj.view, cb_viewproj.proj);
     vertex_out ps_in;
-    ps_in.hpos = float4(vs_in.pos, 1.0f);
-    ps_in.hpos = mul(ps_in.hpos, view_proj);
+    ps_in.hpos = mul(float4(vs_in.pos, 1.0f), cb_pass.view_proj);
 
     ps_in.color = vs_in.color;
     return ps_in;
@@ -14,30 +14,18 @@ vertex_out VS_outline(vertex_in vs_in, uint id : SV_InstanceID)
 {
     vertex_out ps_in;
 
-    matrix identity =
-    {
-        { 1, 0, 0, 0 },
-        { 0, 1, 0, 0 },
-        { 0, 0, 1, 0 },
-        { 0, 0, 0, 1 }
-    };
-    matrix outline_scale =
-    {
-        { 1.2f, 0, 0, 0 },
-        { 0, 1.2f, 0, 0 },
-        { 0, 0, 1.2f, 0 },
-        { 0, 0, 0, 1 }
-    };
-
+    // selected instances are scaled up around their origin
+    float scale = 1.0f;
     for (uint i = 0; i < cb_selected_insts_size.size; i++)
     {
         if (sb_selected_instance_ids[i] == sb_instance_ids[id])
         {
-            identity = mul(identity, outline_scale);
+            scale = 1.2f;
+            break;
         }
     }
 
-    ps_in.hpos = instance_mvp(vs_in.pos, id, identity);
+    ps_in.hpos = instance_mvp(vs_in.pos * scale, id);
     ps_in.color = vs_in.color;
     return ps_in;
 }
@@ -1,19 +1,14 @@
-struct view_proj
+// view and projection multiplied on the CPU
+struct pass_constants
 {
-    matrix view;
-    matrix proj;
+    matrix view_proj;
 };
-ConstantBuffer<view_proj> cb_viewproj : register(b0);
-
-struct object
-{
-    matrix world;
-};
-ConstantBuffer<object> cb_object : register(b1);
+ConstantBuffer<pass_constants> cb_pass : register(b0);
 
+// transposed 3x4 affine world matrix, one row per output component
 struct instance
 {
-    matrix world;
+    float4 rows[3];
 };
 StructuredBuffer<instance> sb_instance : register(t0);
 StructuredBuffer<uint> sb_selected_instance_ids : register(t1);
@@ -38,36 +33,21 @@ struct vertex_out
     float4 color : COLOR;
 };
 
-float4 instance_mvp(float3 pos, uint inst_id, matrix SRT)
+float4 instance_mvp(float3 pos, uint inst_id)
 {
     uint current_instanceID = sb_instance_ids[inst_id];
-    // convert to homogeneous clip space and apply the render_item's world matrix
-    float4 hpos = mul(float4(pos, 1.0f), cb_object.world);
-
-    // instance transform
-    matrix inst_world = sb_instance[current_instanceID].world;
-
-    // merge the instance world matrix and object world matrix
-    hpos = mul(hpos, inst_world);
-    hpos = mul(hpos, SRT);
+    instance inst = sb_instance[current_instanceID];
 
-    // apply the view_proj to both of them
-    matrix view_proj = mul(cb_viewproj.view, cb_viewproj.proj);
-    return mul(hpos, view_proj);
+    // the instance transform already contains the render_item's world matrix
+    float4 local_pos = float4(pos, 1.0f);
+    float4 world_pos = float4(dot(inst.rows[0], local_pos), dot(inst.rows[1], local_pos), dot(inst.rows[2], local_pos), 1.0f);
+    return mul(world_pos, cb_pass.view_proj);
 }
 
 vertex_out VS(vertex_in vs_in, uint id : SV_InstanceID)
 {
     vertex_out ps_in;
-    
-    matrix identity =
-    {
-        { 1, 0, 0, 0 },
-        { 0, 1, 0, 0 },
-        { 0, 0, 1, 0 },
-        { 0, 0, 0, 1 }
-    };
-    ps_in.hpos = instance_mvp(vs_in.pos, id, identity);
+    ps_in.hpos = instance_mvp(vs_in.pos, id);
     ps_in.color = vs_in.color;
     return ps_in;
 }
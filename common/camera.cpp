@@ -164,9 +164,9 @@ void camera::update_yaw_pitch(XMFLOAT2 current_mouse_pos, XMFLOAT2 last_mouse_po
     XMStoreFloat3(&m_transform.m_forward, forward);
 }
 
-std::vector<position_color> camera::calc_frustum_vertices()
+frame_vector<position_color> camera::calc_frustum_vertices()
 {
-    std::vector<position_color> vertices(0);
+    frame_vector<position_color> vertices;
     vertices.reserve(12);
 
     // Far plane
@@ -190,7 +190,7 @@ std::vector<position_color> camera::calc_frustum_vertices()
     return vertices;
 }
 
-std::vector<position_color> camera::calc_plane_vertices(float dist_from_origin, XMFLOAT4 color)
+frame_vector<position_color> camera::calc_plane_vertices(float dist_from_origin, XMFLOAT4 color)
 {
     XMVECTOR translation = XMLoadFloat3(&m_transform.m_translation); // C
     XMVECTOR right = XMLoadFloat3(&m_transform.m_right);             // x
@@ -232,6 +232,19 @@ void camera::viewspace_frustum_planes()
     XMStoreFloat4(&m_bottom_plane, XMVector4Normalize(XMVectorSet(0.f, m_proj_dist, 1.f, 0.f)));
 }
 
+void camera::world_frustum_planes(XMFLOAT4 planes[6])
+{
+    // A plane transforms by the inverse transpose of the point transform.
+    // Going from view to world space, that's the transposed view matrix, which is what m_inv_view holds.
+    XMMATRIX view_to_world = XMLoadFloat4x4(&m_inv_view);
+    XMFLOAT4 const *view_planes[6] = {&m_near_plane, &m_far_plane, &m_left_plane, &m_right_plane, &m_top_plane, &m_bottom_plane};
+
+    for (size_t i = 0; i < 6; i++)
+    {
+        XMStoreFloat4(&planes[i], XMVector4Transform(XMLoadFloat4(view_planes[i]), view_to_world));
+    }
+}
+
 //std::vector<position_color> camera::calc_frustum_plane_vertices()
 //{
 //    std::vector<position_color> plane_corners(0);
@@ -2,6 +2,7 @@
 #include "common.h"
 #include "transform.h"
 #include "gpu_interface.h"
+#include "frame_arena.h"
 
 struct COMMON_API camera
 {
@@ -16,9 +17,11 @@ struct COMMON_API camera
     void calc_projection();
     void update_yaw_pitch(DirectX::XMFLOAT2 current_mouse_pos,
                           DirectX::XMFLOAT2 last_mouse_pos);
-    std::vector<position_color> calc_frustum_vertices();
-    std::vector<position_color> calc_plane_vertices(float dist_from_origin, DirectX::XMFLOAT4 color);
+    // The vertices are allocated in the calling thread's frame arena
+    frame_vector<position_color> calc_frustum_vertices();
+    frame_vector<position_color> calc_plane_vertices(float dist_from_origin, DirectX::XMFLOAT4 color);
     void viewspace_frustum_planes();
+    void world_frustum_planes(DirectX::XMFLOAT4 planes[6]);
     std::vector<position_color> calc_frustum_plane_vertices();
     bool plane_intersect(position_color* point, DirectX::XMFLOAT4 plane1, DirectX::XMFLOAT4 plane2, DirectX::XMFLOAT4 plane3);
 
@@ -0,0 +1,78 @@
+#pragma once
+#include "handle_registry.h"
+#include <memory>
+
+// Dense storage of items referenced by generational handles, like handle_registry,
+// but the items live in fixed size chunks: growing allocates one more chunk instead of moving every item,
+// so pointers to items stay valid until an item is removed.
+// Removing an item moves the last one into its place to keep the items compact, the slots remap its handle.
+template <typename T, size_t items_per_chunk = 256>
+class chunked_pool
+{
+public:
+    class iterator
+    {
+    public:
+        iterator(chunked_pool *pool, size_t index) : m_pool(pool), m_index(index) {}
+        T &operator*() const { return (*m_pool)[m_index]; }
+        T *operator->() const { return &(*m_pool)[m_index]; }
+        iterator &operator++()
+        {
+            m_index++;
+            return *this;
+        }
+        bool operator!=(iterator const &other) const { return m_index != other.m_index; }
+
+    private:
+        chunked_pool *m_pool;
+        size_t m_index;
+    };
+
+    handle<T> add(T item)
+    {
+        if (m_count == capacity())
+            m_chunks.emplace_back(new T[items_per_chunk]);
+
+        (*this)[m_count++] = std::move(item);
+        return m_slots.add<T>();
+    }
+
+    bool remove(handle<T> h)
+    {
+        if (!is_valid(h))
+            return false;
+
+        UINT dense_index = m_slots.remove(h.index);
+        size_t last = --m_count;
+        if (dense_index != last)
+            (*this)[dense_index] = std::move((*this)[last]);
+        (*this)[last] = T();
+
+        // Keeps one empty chunk so adding and removing around a chunk border doesn't allocate every time
+        if (capacity() - m_count > 2 * items_per_chunk)
+            m_chunks.pop_back();
+        return true;
+    }
+
+    bool is_valid(handle<T> h) const { return m_slots.is_valid(h.index, h.generation); }
+
+    // Returns nullptr for a stale or null handle
+    T *get(handle<T> h) { return is_valid(h) ? &(*this)[m_slots.dense_index(h.index)] : nullptr; }
+    T const *get(handle<T> h) const { return is_valid(h) ? &(*this)[m_slots.dense_index(h.index)] : nullptr; }
+
+    // Dense access, the order changes when items are removed
+    size_t size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+    size_t capacity() const { return m_chunks.size() * items_per_chunk; }
+    T &operator[](size_t dense_index) { return m_chunks[dense_index / items_per_chunk][dense_index % items_per_chunk]; }
+    T const &operator[](size_t dense_index) const { return m_chunks[dense_index / items_per_chunk][dense_index % items_per_chunk]; }
+    handle<T> handle_at(size_t dense_index) const { return m_slots.handle_at<T>(dense_index); }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, m_count); }
+
+private:
+    std::vector<std::unique_ptr<T[]>> m_chunks;
+    size_t m_count = 0;
+    handle_slots m_slots;
+};
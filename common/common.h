@@ -3,11 +3,8 @@
 
 #define s_internal static
 
-#ifdef COMMON_EXPORTS
-#define COMMON_API __declspec(dllexport)
-#else
-#define COMMON_API __declspec(dllimport)
-#endif
+#include "common_api.h"
+#include "cpu_features.h"
 
 extern COMMON_API HRESULT hr;
 extern COMMON_API HWND g_hwnd;
@@ -0,0 +1,10 @@
+#pragma once
+// Export macro alone, for the parts of common that have no Windows or D3D12 dependencies
+// and are also built headless, like the tests.
+#if !defined(_WIN32)
+#define COMMON_API
+#elif defined(COMMON_EXPORTS)
+#define COMMON_API __declspec(dllexport)
+#else
+#define COMMON_API __declspec(dllimport)
+#endif
@@ -0,0 +1,5 @@
+#pragma once
+#include "common_api.h"
+
+// True when both the CPU and the OS support AVX2, so the AVX2 paths can be taken at runtime
+COMMON_API bool cpu_supports_avx2();
@@ -0,0 +1,113 @@
+#include "descriptor_allocator.h"
+#include <algorithm>
+
+descriptor_allocator::descriptor_allocator(descriptor_heap_type type, uint32_t persistent_count, uint32_t per_frame_count, uint32_t frame_count)
+    : m_type(type), m_persistent_count(persistent_count), m_per_frame_count(per_frame_count), m_frame_count(frame_count)
+{
+    if (persistent_count > 0)
+        m_free_ranges.push_back({0, persistent_count, type});
+}
+
+descriptor_range descriptor_allocator::allocate(uint32_t count)
+{
+    descriptor_range range;
+    range.type = m_type;
+    if (count == 0)
+        return range;
+
+    // First fit keeps the allocations packed at the front, the heaps are small enough for a linear search
+    for (size_t i = 0; i < m_free_ranges.size(); i++)
+    {
+        descriptor_range &free_range = m_free_ranges[i];
+        if (free_range.count < count)
+            continue;
+
+        range.first = free_range.first;
+        range.count = count;
+        free_range.first += count;
+        free_range.count -= count;
+        if (free_range.count == 0)
+            m_free_ranges.erase(m_free_ranges.begin() + i);
+
+        m_persistent_used += count;
+        return range;
+    }
+    return range;
+}
+
+bool descriptor_allocator::free(descriptor_range range)
+{
+    if (!range.is_valid() || range.count == 0)
+        return true;
+    if (range.type != m_type || range.first >= m_persistent_count || range.count > m_persistent_count - range.first)
+        return false;
+
+    auto next = std::lower_bound(m_free_ranges.begin(), m_free_ranges.end(), range,
+                                 [](descriptor_range const &a, descriptor_range const &b) { return a.first < b.first; });
+
+    // A range that overlaps a free one was already freed, at least in part
+    if (next != m_free_ranges.begin() && (next - 1)->first + (next - 1)->count > range.first)
+        return false;
+    if (next != m_free_ranges.end() && range.first + range.count > next->first)
+        return false;
+
+    m_persistent_used -= range.count;
+
+    bool merges_previous = next != m_free_ranges.begin() && (next - 1)->first + (next - 1)->count == range.first;
+    bool merges_next = next != m_free_ranges.end() && range.first + range.count == next->first;
+
+    if (merges_previous && merges_next)
+    {
+        (next - 1)->count += range.count + next->count;
+        m_free_ranges.erase(next);
+    }
+    else if (merges_previous)
+    {
+        (next - 1)->count += range.count;
+    }
+    else if (merges_next)
+    {
+        next->first = range.first;
+        next->count += range.count;
+    }
+    else
+    {
+        m_free_ranges.insert(next, range);
+    }
+    return true;
+}
+
+bool descriptor_allocator::begin_frame(uint32_t frame_index)
+{
+    if (frame_index >= m_frame_count)
+    {
+        // A full region, so the transient descriptors of a frame that doesn't exist can't overlap the next heap region
+        m_frame_offset = m_per_frame_count;
+        return false;
+    }
+
+    m_frame_index = frame_index;
+    m_frame_offset = 0;
+    return true;
+}
+
+descriptor_range descriptor_allocator::allocate_transient(uint32_t count)
+{
+    descriptor_range range;
+    range.type = m_type;
+    if (count == 0 || m_frame_offset + count > m_per_frame_count)
+        return range;
+
+    range.first = m_persistent_count + m_frame_index * m_per_frame_count + m_frame_offset;
+    range.count = count;
+    m_frame_offset += count;
+    return range;
+}
+
+uint32_t descriptor_allocator::largest_free_range() const
+{
+    uint32_t largest = 0;
+    for (descriptor_range const &range : m_free_ranges)
+        largest = std::max(largest, range.count);
+    return largest;
+}
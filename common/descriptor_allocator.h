@@ -0,0 +1,71 @@
+#pragma once
+// The D3D12 heap using it is descriptor_heap in gpu_interface.h.
+#include "common_api.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Same order as D3D12_DESCRIPTOR_HEAP_TYPE
+enum class descriptor_heap_type : uint32_t
+{
+    cbv_srv_uav,
+    sampler,
+    rtv,
+    dsv,
+};
+
+// Contiguous descriptors of a heap, usable as a descriptor table.
+// Tagged with the type of the heap it came from, so a range can't be freed to or resolved by a heap of another type.
+struct descriptor_range
+{
+    static constexpr uint32_t invalid_index = UINT32_MAX;
+
+    uint32_t first = invalid_index;
+    uint32_t count = 0;
+    descriptor_heap_type type = descriptor_heap_type::cbv_srv_uav;
+
+    bool is_valid() const { return first != invalid_index; }
+};
+
+// Hands out the descriptor slots of one heap.
+// The front of the heap is the persistent region: ranges live until freed, free ranges are kept sorted and merged with their neighbours.
+// The back is split in one linear region per frame in flight, for descriptors written every frame:
+// they are bumped out of the frame's region and all released when the frame comes back around.
+class descriptor_allocator
+{
+public:
+    COMMON_API descriptor_allocator(descriptor_heap_type type, uint32_t persistent_count, uint32_t per_frame_count, uint32_t frame_count);
+
+    // Returns an invalid range when no free range is large enough
+    COMMON_API descriptor_range allocate(uint32_t count);
+
+    // Returns false for a range of another heap type, outside the persistent region or overlapping a free range
+    // (a double free), the allocator is left unchanged
+    COMMON_API bool free(descriptor_range range);
+
+    // Releases the frame's transient descriptors, call once the GPU is done with the frame.
+    // Returns false when frame_index isn't below the frame count, the transient allocations then fail until a valid frame begins.
+    COMMON_API bool begin_frame(uint32_t frame_index);
+
+    // Valid until the same frame begins again, returns an invalid range when the frame's region is full
+    COMMON_API descriptor_range allocate_transient(uint32_t count);
+
+    descriptor_heap_type type() const { return m_type; }
+    uint32_t capacity() const { return m_persistent_count + m_per_frame_count * m_frame_count; }
+    uint32_t persistent_used() const { return m_persistent_used; }
+    uint32_t transient_used() const { return m_frame_offset; }
+
+    // Size of the largest free persistent range, a larger allocation would fail
+    COMMON_API uint32_t largest_free_range() const;
+
+private:
+    descriptor_heap_type m_type = descriptor_heap_type::cbv_srv_uav;
+    uint32_t m_persistent_count = 0;
+    uint32_t m_per_frame_count = 0;
+    uint32_t m_frame_count = 0;
+    uint32_t m_persistent_used = 0;
+
+    std::vector<descriptor_range> m_free_ranges; // Sorted by first
+    uint32_t m_frame_index = 0;
+    uint32_t m_frame_offset = 0;
+};
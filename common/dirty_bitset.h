@@ -0,0 +1,86 @@
+#pragma once
+#include "common.h"
+#include <intrin.h>
+#include <algorithm>
+#include <vector>
+
+// One bit per element, set when the element changed since it was last consumed.
+// Changes are consumed as ranges of consecutive elements, so that they can be uploaded with a few large copies.
+struct dirty_bitset
+{
+    void resize(size_t count)
+    {
+        m_count = count;
+        m_words.resize((count + 63) / 64, 0);
+        size_t tail = count & 63;
+        if (tail != 0)
+            m_words.back() &= (1ull << tail) - 1;
+    }
+
+    void set(size_t index)
+    {
+        m_words[index >> 6] |= 1ull << (index & 63);
+    }
+
+    void set_all()
+    {
+        std::fill(m_words.begin(), m_words.end(), ~0ull);
+        resize(m_count);
+    }
+
+    bool any() const
+    {
+        for (UINT64 word : m_words)
+        {
+            if (word != 0)
+                return true;
+        }
+        return false;
+    }
+
+    // Calls on_range(first, count) for every range of set bits and clears them.
+    // Ranges closer than max_gap clean elements are merged, one bigger copy is cheaper than two small ones.
+    template <typename range_fn>
+    void consume_ranges(size_t max_gap, range_fn const &on_range)
+    {
+        size_t run_begin = 0;
+        size_t run_end = 0;
+        bool in_run = false;
+        for (size_t w = 0; w < m_words.size(); w++)
+        {
+            UINT64 bits = m_words[w];
+            m_words[w] = 0;
+
+            unsigned long bit;
+            while (_BitScanForward64(&bit, bits))
+            {
+                // Length of the run of set bits starting at this one
+                UINT64 shifted = ~(bits >> bit);
+                unsigned long length = 64 - bit;
+                unsigned long run_length;
+                if (_BitScanForward64(&run_length, shifted))
+                    length = std::min(length, run_length);
+
+                size_t first = w * 64 + bit;
+                if (in_run && first - run_end > max_gap)
+                {
+                    on_range(run_begin, run_end - run_begin);
+                    in_run = false;
+                }
+                if (!in_run)
+                {
+                    run_begin = first;
+                    in_run = true;
+                }
+                run_end = first + length;
+
+                bits = length + bit >= 64 ? 0 : bits & ~(((1ull << length) - 1) << bit);
+            }
+        }
+        if (in_run)
+            on_range(run_begin, run_end - run_begin);
+    }
+
+    size_t m_count = 0;
+    std::vector<UINT64> m_words;
+};
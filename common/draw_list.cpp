@@ -0,0 +1,116 @@
+#include "draw_list.h"
+#include <utility>
+
+void draw_list::clear()
+{
+    m_entries.clear();
+    m_commands.clear();
+    m_state_changes = 0;
+}
+
+uint32_t draw_list::add(uint64_t key)
+{
+    uint32_t index = (uint32_t)m_entries.size();
+    m_entries.push_back({key, index});
+    return index;
+}
+
+void draw_list::sort()
+{
+    size_t count = m_entries.size();
+    if (count < 2)
+        return;
+
+    // One sweep builds the histograms of all 8 digits
+    uint32_t histograms[8][256] = {};
+    for (entry const &e : m_entries)
+    {
+        for (int digit = 0; digit < 8; digit++)
+            histograms[digit][(e.key >> (digit * 8)) & 0xFF]++;
+    }
+
+    m_scratch.resize(count);
+    entry *src = m_entries.data();
+    entry *dst = m_scratch.data();
+
+    for (int digit = 0; digit < 8; digit++)
+    {
+        uint32_t *histogram = histograms[digit];
+
+        // Every key has the same value for this digit, the pass wouldn't move anything
+        if (histogram[(src[0].key >> (digit * 8)) & 0xFF] == count)
+            continue;
+
+        uint32_t offsets[256];
+        uint32_t sum = 0;
+        for (int i = 0; i < 256; i++)
+        {
+            offsets[i] = sum;
+            sum += histogram[i];
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t bucket = (src[i].key >> (digit * 8)) & 0xFF;
+            dst[offsets[bucket]++] = src[i];
+        }
+        std::swap(src, dst);
+    }
+
+    // An odd number of passes left the result in the scratch buffer
+    if (src != m_entries.data())
+        m_entries.swap(m_scratch);
+}
+
+void draw_list::build_commands()
+{
+    m_commands.clear();
+    m_commands.reserve(m_entries.size() * 2);
+
+    // The first draw sets every state
+    uint32_t pass = ~0u;
+    uint32_t pso = ~0u;
+    uint32_t mesh = ~0u;
+    uint32_t material = ~0u;
+    size_t runs = 0;
+
+    for (size_t i = 0; i < m_entries.size(); i++)
+    {
+        uint64_t key = m_entries[i].key;
+        uint32_t key_pass = draw_key::pass(key);
+        uint32_t key_pso = draw_key::pso(key);
+        uint32_t key_mesh = draw_key::mesh(key);
+        uint32_t key_material = draw_key::material(key);
+
+        // The last command is the previous draw, this one joins its run
+        if (key_pass == pass && key_pso == pso && key_mesh == mesh && key_material == material)
+        {
+            m_commands.back().count++;
+            continue;
+        }
+
+        if (key_pass != pass)
+        {
+            pass = key_pass;
+            m_commands.push_back({draw_command_type::set_pass, pass});
+        }
+        if (key_pso != pso)
+        {
+            pso = key_pso;
+            m_commands.push_back({draw_command_type::set_pso, pso});
+        }
+        if (key_mesh != mesh)
+        {
+            mesh = key_mesh;
+            m_commands.push_back({draw_command_type::set_mesh, mesh});
+        }
+        if (key_material != material)
+        {
+            material = key_material;
+            m_commands.push_back({draw_command_type::set_material, material});
+        }
+        m_commands.push_back({draw_command_type::draw, uint32_t(i)});
+        runs++;
+    }
+    m_state_changes = m_commands.size() - runs;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "common_api.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 64 bit draw sort key, most significant first:
+// pass (4 bits) | pso (12 bits) | mesh (16 bits) | material (16 bits) | sequence (16 bits)
+// Sorting on it groups the draws by pass, then by the most expensive state to change.
+// The sequence keeps draws with the same state in a chosen order, like front to back.
+struct draw_key
+{
+    static constexpr uint32_t max_passes = 1u << 4;
+    static constexpr uint32_t max_psos = 1u << 12;
+    static constexpr uint32_t max_meshes = 1u << 16;
+    static constexpr uint32_t max_materials = 1u << 16;
+    static constexpr uint32_t max_sequence = 1u << 16;
+
+    static uint64_t make(uint32_t pass, uint32_t pso, uint32_t mesh, uint32_t material, uint32_t sequence = 0)
+    {
+        return uint64_t(pass & (max_passes - 1)) << 60 |
+               uint64_t(pso & (max_psos - 1)) << 48 |
+               uint64_t(mesh & (max_meshes - 1)) << 32 |
+               uint64_t(material & (max_materials - 1)) << 16 |
+               uint64_t(sequence & (max_sequence - 1));
+    }
+
+    static uint32_t pass(uint64_t key) { return uint32_t(key >> 60); }
+    static uint32_t pso(uint64_t key) { return uint32_t(key >> 48) & (max_psos - 1); }
+    static uint32_t mesh(uint64_t key) { return uint32_t(key >> 32) & (max_meshes - 1); }
+    static uint32_t material(uint64_t key) { return uint32_t(key >> 16) & (max_materials - 1); }
+};
+
+enum class draw_command_type : uint32_t
+{
+    set_pass,
+    set_pso,
+    set_mesh,
+    set_material,
+    draw,
+};
+
+// value is the pass, pso, mesh or material id.
+// A draw command covers a run of count draws with the same state, value is the sorted index of the first one:
+// draw_list::draw(value + i) are their indices, for the backend to issue them as one instanced draw.
+struct draw_command
+{
+    draw_command_type type;
+    uint32_t value;
+    uint32_t count = 1;
+};
+
+// Collects draws with their sort keys, radix sorts them and turns them into a command stream
+// that only changes a state when the next draw needs a different one.
+// The ids are meaningless here: the backend maps them to its pipeline states, buffers and bindings,
+// and executing the commands costs one call per state change plus one per run of draws with the same state.
+class draw_list
+{
+public:
+    // Keeps the allocations for the next frame
+    COMMON_API void clear();
+
+    // Returns the index of the draw, the backend stores what it needs to issue the draw call at that index
+    COMMON_API uint32_t add(uint64_t key);
+
+    // Stable least significant digit radix sort on the 8 bit digits of the keys.
+    // Digits that are the same for every key are skipped.
+    COMMON_API void sort();
+
+    // Call after sort. Consecutive draws whose keys only differ by the sequence are merged into one draw command.
+    COMMON_API void build_commands();
+
+    std::vector<draw_command> const &commands() const { return m_commands; }
+    size_t size() const { return m_entries.size(); }
+    uint64_t key(size_t sorted_index) const { return m_entries[sorted_index].key; }
+    uint32_t draw(size_t sorted_index) const { return m_entries[sorted_index].draw; }
+    size_t state_changes() const { return m_state_changes; }
+
+private:
+    struct entry
+    {
+        uint64_t key;
+        uint32_t draw;
+    };
+
+    std::vector<entry> m_entries;
+    std::vector<entry> m_scratch;
+    std::vector<draw_command> m_commands;
+    size_t m_state_changes = 0;
+};
@@ -0,0 +1,482 @@
+#include "pch.h"
+#include "dynamic_bvh.h"
+#include "frustum_culler.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+s_internal float surface_area(XMFLOAT3 const &min, XMFLOAT3 const &max)
+{
+    float dx = max.x - min.x;
+    float dy = max.y - min.y;
+    float dz = max.z - min.z;
+    return 2.f * (dx * dy + dy * dz + dz * dx);
+}
+
+// 1 / x, with zero replaced by a tiny value of the same sign. An axis-aligned ray would get 0 * inf = NaN
+// in the slab test for the boxes whose side lies on the ray, the large finite inverse keeps the slab infinite.
+s_internal float safe_inverse(float x)
+{
+    constexpr float min_magnitude = 1e-20f;
+    return 1.f / (fabsf(x) > min_magnitude ? x : copysignf(min_magnitude, x));
+}
+
+s_internal void merge(XMFLOAT3 const &min_a, XMFLOAT3 const &max_a,
+                      XMFLOAT3 const &min_b, XMFLOAT3 const &max_b,
+                      XMFLOAT3 &out_min, XMFLOAT3 &out_max)
+{
+    out_min = XMFLOAT3(std::min(min_a.x, min_b.x), std::min(min_a.y, min_b.y), std::min(min_a.z, min_b.z));
+    out_max = XMFLOAT3(std::max(max_a.x, max_b.x), std::max(max_a.y, max_b.y), std::max(max_a.z, max_b.z));
+}
+
+s_internal float merged_area(XMFLOAT3 const &min_a, XMFLOAT3 const &max_a,
+                             XMFLOAT3 const &min_b, XMFLOAT3 const &max_b)
+{
+    XMFLOAT3 min, max;
+    merge(min_a, max_a, min_b, max_b, min, max);
+    return surface_area(min, max);
+}
+
+dynamic_bvh::dynamic_bvh(float margin)
+{
+    m_margin = margin;
+}
+
+int dynamic_bvh::allocate_node()
+{
+    if (m_free_list == null_node)
+    {
+        m_nodes.emplace_back();
+        return int(m_nodes.size() - 1);
+    }
+
+    int index = m_free_list;
+    m_free_list = m_nodes[index].parent;
+    m_nodes[index] = node();
+    return index;
+}
+
+void dynamic_bvh::free_node(int index)
+{
+    m_nodes[index].parent = m_free_list;
+    m_nodes[index].height = -1;
+    m_free_list = index;
+}
+
+int dynamic_bvh::insert(BoundingBox const &box, UINT user_data)
+{
+    int leaf = allocate_node();
+    node &n = m_nodes[leaf];
+    n.min = XMFLOAT3(box.Center.x - box.Extents.x - m_margin, box.Center.y - box.Extents.y - m_margin, box.Center.z - box.Extents.z - m_margin);
+    n.max = XMFLOAT3(box.Center.x + box.Extents.x + m_margin, box.Center.y + box.Extents.y + m_margin, box.Center.z + box.Extents.z + m_margin);
+    n.user_data = user_data;
+    n.height = 0;
+
+    insert_leaf(leaf);
+    return leaf;
+}
+
+void dynamic_bvh::remove(int proxy)
+{
+    ASSERT2(m_nodes[proxy].is_leaf() && m_nodes[proxy].height == 0, "Only leaves can be removed from the BVH.");
+    remove_leaf(proxy);
+    free_node(proxy);
+}
+
+bool dynamic_bvh::move(int proxy, BoundingBox const &box)
+{
+    node &n = m_nodes[proxy];
+    XMFLOAT3 min(box.Center.x - box.Extents.x, box.Center.y - box.Extents.y, box.Center.z - box.Extents.z);
+    XMFLOAT3 max(box.Center.x + box.Extents.x, box.Center.y + box.Extents.y, box.Center.z + box.Extents.z);
+
+    // Still inside the fattened box, nothing to do
+    if (min.x >= n.min.x && min.y >= n.min.y && min.z >= n.min.z &&
+        max.x <= n.max.x && max.y <= n.max.y && max.z <= n.max.z)
+        return false;
+
+    remove_leaf(proxy);
+    n.min = XMFLOAT3(min.x - m_margin, min.y - m_margin, min.z - m_margin);
+    n.max = XMFLOAT3(max.x + m_margin, max.y + m_margin, max.z + m_margin);
+    insert_leaf(proxy);
+    return true;
+}
+
+int dynamic_bvh::find_best_sibling(int leaf) const
+{
+    // Branch and bound: the cost of a sibling is the area of its new parent, plus the area
+    // that every ancestor grows by. A subtree can't do better than the leaf's own area plus
+    // the growth inherited from its ancestors, which prunes most of the tree.
+    XMFLOAT3 const &leaf_min = m_nodes[leaf].min;
+    XMFLOAT3 const &leaf_max = m_nodes[leaf].max;
+    float leaf_area = surface_area(leaf_min, leaf_max);
+
+    struct candidate
+    {
+        int index;
+        float inherited_cost;
+    };
+
+    // Every expansion replaces a node by its two children one level down, so the stack holds at most one node per level plus one
+    constexpr int max_stack_size = 128;
+    ASSERT2(height() + 1 <= max_stack_size, "The BVH is too deep for the insertion stack.");
+    candidate stack[max_stack_size];
+    int stack_size = 0;
+    stack[stack_size++] = {m_root, 0.f};
+
+    int best_sibling = m_root;
+    float best_cost = FLT_MAX;
+
+    while (stack_size > 0)
+    {
+        candidate c = stack[--stack_size];
+
+        node const &n = m_nodes[c.index];
+        float direct_cost = merged_area(leaf_min, leaf_max, n.min, n.max);
+        float cost = direct_cost + c.inherited_cost;
+        if (cost < best_cost)
+        {
+            best_cost = cost;
+            best_sibling = c.index;
+        }
+
+        if (!n.is_leaf())
+        {
+            float child_inherited_cost = c.inherited_cost + direct_cost - surface_area(n.min, n.max);
+            if (leaf_area + child_inherited_cost < best_cost)
+            {
+                stack[stack_size++] = {n.child1, child_inherited_cost};
+                stack[stack_size++] = {n.child2, child_inherited_cost};
+            }
+        }
+    }
+    return best_sibling;
+}
+
+void dynamic_bvh::insert_leaf(int leaf)
+{
+    if (m_root == null_node)
+    {
+        m_root = leaf;
+        m_nodes[leaf].parent = null_node;
+        return;
+    }
+
+    int sibling = find_best_sibling(leaf);
+
+    // Create a new parent for the sibling and the leaf
+    int old_parent = m_nodes[sibling].parent;
+    int new_parent = allocate_node();
+    node &p = m_nodes[new_parent];
+    p.parent = old_parent;
+    p.child1 = sibling;
+    p.child2 = leaf;
+    merge(m_nodes[leaf].min, m_nodes[leaf].max, m_nodes[sibling].min, m_nodes[sibling].max, p.min, p.max);
+    p.height = m_nodes[sibling].height + 1;
+
+    if (old_parent != null_node)
+    {
+        if (m_nodes[old_parent].child1 == sibling)
+            m_nodes[old_parent].child1 = new_parent;
+        else
+            m_nodes[old_parent].child2 = new_parent;
+    }
+    else
+    {
+        m_root = new_parent;
+    }
+    m_nodes[sibling].parent = new_parent;
+    m_nodes[leaf].parent = new_parent;
+
+    // Refit the ancestors and improve them on the way up
+    for (int index = m_nodes[leaf].parent; index != null_node; index = m_nodes[index].parent)
+    {
+        refit(index);
+        rotate(index);
+    }
+}
+
+void dynamic_bvh::remove_leaf(int leaf)
+{
+    if (leaf == m_root)
+    {
+        m_root = null_node;
+        return;
+    }
+
+    int parent = m_nodes[leaf].parent;
+    int grand_parent = m_nodes[parent].parent;
+    int sibling = m_nodes[parent].child1 == leaf ? m_nodes[parent].child2 : m_nodes[parent].child1;
+
+    // The sibling takes the parent's place
+    free_node(parent);
+    m_nodes[sibling].parent = grand_parent;
+    if (grand_parent == null_node)
+    {
+        m_root = sibling;
+        return;
+    }
+
+    if (m_nodes[grand_parent].child1 == parent)
+        m_nodes[grand_parent].child1 = sibling;
+    else
+        m_nodes[grand_parent].child2 = sibling;
+
+    for (int index = grand_parent; index != null_node; index = m_nodes[index].parent)
+    {
+        refit(index);
+    }
+}
+
+void dynamic_bvh::refit(int index)
+{
+    node &n = m_nodes[index];
+    node const &c1 = m_nodes[n.child1];
+    node const &c2 = m_nodes[n.child2];
+    merge(c1.min, c1.max, c2.min, c2.max, n.min, n.max);
+    n.height = 1 + std::max(c1.height, c2.height);
+}
+
+void dynamic_bvh::rotate(int index)
+{
+    // A has children B and C, B has children D and E, C has children F and G.
+    // Swapping B with F or G changes the area of C, swapping C with D or E changes the area of B.
+    // The area of A stays the same, so pick the swap that shrinks the child the most.
+    node &a = m_nodes[index];
+    int b = a.child1;
+    int c = a.child2;
+    node &nb = m_nodes[b];
+    node &nc = m_nodes[c];
+
+    enum rotation
+    {
+        none,
+        b_f,
+        b_g,
+        c_d,
+        c_e
+    };
+    rotation best_rotation = none;
+    float best_cost_delta = 0.f;
+
+    if (!nc.is_leaf())
+    {
+        node const &f = m_nodes[nc.child1];
+        node const &g = m_nodes[nc.child2];
+        float area_c = surface_area(nc.min, nc.max);
+
+        float cost_bf = merged_area(nb.min, nb.max, g.min, g.max) - area_c;
+        if (cost_bf < best_cost_delta)
+        {
+            best_rotation = b_f;
+            best_cost_delta = cost_bf;
+        }
+
+        float cost_bg = merged_area(nb.min, nb.max, f.min, f.max) - area_c;
+        if (cost_bg < best_cost_delta)
+        {
+            best_rotation = b_g;
+            best_cost_delta = cost_bg;
+        }
+    }
+
+    if (!nb.is_leaf())
+    {
+        node const &d = m_nodes[nb.child1];
+        node const &e = m_nodes[nb.child2];
+        float area_b = surface_area(nb.min, nb.max);
+
+        float cost_cd = merged_area(nc.min, nc.max, e.min, e.max) - area_b;
+        if (cost_cd < best_cost_delta)
+        {
+            best_rotation = c_d;
+            best_cost_delta = cost_cd;
+        }
+
+        float cost_ce = merged_area(nc.min, nc.max, d.min, d.max) - area_b;
+        if (cost_ce < best_cost_delta)
+        {
+            best_rotation = c_e;
+            best_cost_delta = cost_ce;
+        }
+    }
+
+    // Swap the child of A with the grand child, then refit the node that lost its child
+    auto swap = [this, index](int child, int parent_of_grand_child, bool first_grand_child) {
+        node &p = m_nodes[parent_of_grand_child];
+        int grand_child = first_grand_child ? p.child1 : p.child2;
+
+        node &na = m_nodes[index];
+        if (na.child1 == child)
+            na.child1 = grand_child;
+        else
+            na.child2 = grand_child;
+        m_nodes[grand_child].parent = index;
+
+        if (first_grand_child)
+            p.child1 = child;
+        else
+            p.child2 = child;
+        m_nodes[child].parent = parent_of_grand_child;
+
+        refit(parent_of_grand_child);
+        refit(index);
+    };
+
+    switch (best_rotation)
+    {
+    case none:
+        break;
+    case b_f:
+        swap(b, c, true);
+        break;
+    case b_g:
+        swap(b, c, false);
+        break;
+    case c_d:
+        swap(c, b, true);
+        break;
+    case c_e:
+        swap(c, b, false);
+        break;
+    }
+}
+
+int dynamic_bvh::gather_wide(int index, int slots[4]) const
+{
+    int count = 0;
+    node const &n = m_nodes[index];
+    for (int child : {n.child1, n.child2})
+    {
+        node const &c = m_nodes[child];
+        if (c.is_leaf())
+        {
+            slots[count++] = child;
+        }
+        else
+        {
+            slots[count++] = c.child1;
+            slots[count++] = c.child2;
+        }
+    }
+    return count;
+}
+
+template <typename test_fn, typename leaf_fn>
+void dynamic_bvh::traverse(test_fn const &test, leaf_fn const &on_leaf) const
+{
+    if (m_root == null_node)
+        return;
+
+    // Every expansion pops a node and pushes at most 4 nodes two levels further down,
+    // so the stack holds at most 3 nodes per two levels of the tree, plus the last 4 pushed
+    constexpr int max_stack_size = 128;
+    ASSERT2(3 * (height() / 2 + 1) + 1 <= max_stack_size, "The BVH is too deep for the traversal stack.");
+    int stack[max_stack_size];
+    int stack_size = 0;
+
+    // The root is tested on its own, every other node is tested 4-wide with its siblings and cousins
+    int slots[4] = {m_root, m_root, m_root, m_root};
+    int count = 1;
+
+    while (true)
+    {
+        // Load the boxes SoA, unused lanes repeat the first slot and get masked out
+        for (int i = count; i < 4; i++)
+            slots[i] = slots[0];
+
+        node const &n0 = m_nodes[slots[0]];
+        node const &n1 = m_nodes[slots[1]];
+        node const &n2 = m_nodes[slots[2]];
+        node const &n3 = m_nodes[slots[3]];
+        __m128 min_x = _mm_setr_ps(n0.min.x, n1.min.x, n2.min.x, n3.min.x);
+        __m128 min_y = _mm_setr_ps(n0.min.y, n1.min.y, n2.min.y, n3.min.y);
+        __m128 min_z = _mm_setr_ps(n0.min.z, n1.min.z, n2.min.z, n3.min.z);
+        __m128 max_x = _mm_setr_ps(n0.max.x, n1.max.x, n2.max.x, n3.max.x);
+        __m128 max_y = _mm_setr_ps(n0.max.y, n1.max.y, n2.max.y, n3.max.y);
+        __m128 max_z = _mm_setr_ps(n0.max.z, n1.max.z, n2.max.z, n3.max.z);
+
+        int mask = test(min_x, min_y, min_z, max_x, max_y, max_z) & ((1 << count) - 1);
+        for (int i = 0; i < count; i++)
+        {
+            if ((mask & (1 << i)) == 0)
+                continue;
+
+            if (m_nodes[slots[i]].is_leaf())
+                on_leaf(slots[i]);
+            else
+                stack[stack_size++] = slots[i];
+        }
+
+        if (stack_size == 0)
+            break;
+
+        count = gather_wide(stack[--stack_size], slots);
+    }
+}
+
+void dynamic_bvh::query_frustum(XMFLOAT4 const planes[6], std::vector<UINT> &results) const
+{
+    frustum_planes frustum;
+    frustum.set(planes);
+    __m128 half = _mm_set1_ps(0.5f);
+
+    auto test = [&](__m128 min_x, __m128 min_y, __m128 min_z, __m128 max_x, __m128 max_y, __m128 max_z) {
+        __m128 cx = _mm_mul_ps(_mm_add_ps(min_x, max_x), half);
+        __m128 cy = _mm_mul_ps(_mm_add_ps(min_y, max_y), half);
+        __m128 cz = _mm_mul_ps(_mm_add_ps(min_z, max_z), half);
+        __m128 ex = _mm_mul_ps(_mm_sub_ps(max_x, min_x), half);
+        __m128 ey = _mm_mul_ps(_mm_sub_ps(max_y, min_y), half);
+        __m128 ez = _mm_mul_ps(_mm_sub_ps(max_z, min_z), half);
+        return _mm_movemask_ps(boxes_in_frustum_sse(frustum, cx, cy, cz, ex, ey, ez));
+    };
+
+    traverse(test, [&](int leaf) { results.push_back(m_nodes[leaf].user_data); });
+}
+
+void dynamic_bvh::query_box(BoundingBox const &box, std::vector<UINT> &results) const
+{
+    __m128 box_min_x = _mm_set1_ps(box.Center.x - box.Extents.x);
+    __m128 box_min_y = _mm_set1_ps(box.Center.y - box.Extents.y);
+    __m128 box_min_z = _mm_set1_ps(box.Center.z - box.Extents.z);
+    __m128 box_max_x = _mm_set1_ps(box.Center.x + box.Extents.x);
+    __m128 box_max_y = _mm_set1_ps(box.Center.y + box.Extents.y);
+    __m128 box_max_z = _mm_set1_ps(box.Center.z + box.Extents.z);
+
+    auto test = [&](__m128 min_x, __m128 min_y, __m128 min_z, __m128 max_x, __m128 max_y, __m128 max_z) {
+        __m128 overlap = _mm_and_ps(_mm_cmple_ps(min_x, box_max_x), _mm_cmpge_ps(max_x, box_min_x));
+        overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmple_ps(min_y, box_max_y), _mm_cmpge_ps(max_y, box_min_y)));
+        overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmple_ps(min_z, box_max_z), _mm_cmpge_ps(max_z, box_min_z)));
+        return _mm_movemask_ps(overlap);
+    };
+
+    traverse(test, [&](int leaf) { results.push_back(m_nodes[leaf].user_data); });
+}
+
+void dynamic_bvh::query_ray(XMFLOAT3 const &origin, XMFLOAT3 const &direction, float max_distance, ray_callback &callback) const
+{
+    __m128 origin_x = _mm_set1_ps(origin.x);
+    __m128 origin_y = _mm_set1_ps(origin.y);
+    __m128 origin_z = _mm_set1_ps(origin.z);
+    __m128 inv_dir_x = _mm_set1_ps(safe_inverse(direction.x));
+    __m128 inv_dir_y = _mm_set1_ps(safe_inverse(direction.y));
+    __m128 inv_dir_z = _mm_set1_ps(safe_inverse(direction.z));
+    float current_max_distance = max_distance;
+
+    // Slab test
+    auto test = [&](__m128 min_x, __m128 min_y, __m128 min_z, __m128 max_x, __m128 max_y, __m128 max_z) {
+        __m128 t1x = _mm_mul_ps(_mm_sub_ps(min_x, origin_x), inv_dir_x);
+        __m128 t2x = _mm_mul_ps(_mm_sub_ps(max_x, origin_x), inv_dir_x);
+        __m128 t1y = _mm_mul_ps(_mm_sub_ps(min_y, origin_y), inv_dir_y);
+        __m128 t2y = _mm_mul_ps(_mm_sub_ps(max_y, origin_y), inv_dir_y);
+        __m128 t1z = _mm_mul_ps(_mm_sub_ps(min_z, origin_z), inv_dir_z);
+        __m128 t2z = _mm_mul_ps(_mm_sub_ps(max_z, origin_z), inv_dir_z);
+
+        __m128 t_enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t1x, t2x), _mm_min_ps(t1y, t2y)), _mm_max_ps(_mm_min_ps(t1z, t2z), _mm_setzero_ps()));
+        __m128 t_exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t1x, t2x), _mm_max_ps(t1y, t2y)), _mm_min_ps(_mm_max_ps(t1z, t2z), _mm_set1_ps(current_max_distance)));
+        return _mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit));
+    };
+
+    traverse(test, [&](int leaf) { current_max_distance = callback.hit(m_nodes[leaf].user_data, current_max_distance); });
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "common.h"
+#include <DirectXCollision.h>
+#include <vector>
+
+// Dynamic AABB tree for objects that are added, removed and moved at runtime.
+// Leaves are inserted next to the sibling that minimizes the surface area heuristic (branch and bound search),
+// and the ancestors are rotated on the way back up when it lowers their surface area.
+// Leaves store fattened boxes, so an object that moves a little doesn't touch the tree.
+// Queries walk the binary tree two levels at a time, testing up to 4 grandchildren per SIMD test.
+class dynamic_bvh
+{
+public:
+    static constexpr int null_node = -1;
+
+    // Callback for ray queries, called for each leaf whose box is hit closer than max_distance.
+    // Returns the new maximum distance: the distance of an exact hit to only find the nearest one,
+    // or max_distance to keep visiting every leaf on the ray.
+    struct ray_callback
+    {
+        virtual float hit(UINT user_data, float max_distance) = 0;
+        virtual ~ray_callback() {}
+    };
+
+    COMMON_API dynamic_bvh(float margin = 0.1f);
+
+    // Returns the proxy of the new leaf
+    COMMON_API int insert(DirectX::BoundingBox const &box, UINT user_data);
+    COMMON_API void remove(int proxy);
+
+    // Updates the box of a leaf, reinserting it only when the box left the leaf's fattened box.
+    // Returns true when the tree changed.
+    COMMON_API bool move(int proxy, DirectX::BoundingBox const &box);
+
+    COMMON_API void query_frustum(DirectX::XMFLOAT4 const planes[6], std::vector<UINT> &results) const;
+    COMMON_API void query_box(DirectX::BoundingBox const &box, std::vector<UINT> &results) const;
+    COMMON_API void query_ray(DirectX::XMFLOAT3 const &origin, DirectX::XMFLOAT3 const &direction, float max_distance, ray_callback &callback) const;
+
+    UINT user_data(int proxy) const { return m_nodes[proxy].user_data; }
+    int height() const { return m_root == null_node ? 0 : m_nodes[m_root].height; }
+
+private:
+    struct node
+    {
+        DirectX::XMFLOAT3 min;
+        DirectX::XMFLOAT3 max;
+        int parent = null_node; // Next free node when the node is on the free list
+        int child1 = null_node;
+        int child2 = null_node;
+        int height = 0;         // 0 for leaves, -1 for free nodes
+        UINT user_data = 0;
+
+        bool is_leaf() const { return child1 == null_node; }
+    };
+
+    int allocate_node();
+    void free_node(int index);
+    void insert_leaf(int leaf);
+    void remove_leaf(int leaf);
+    int find_best_sibling(int leaf) const;
+    void refit(int index);
+    void rotate(int index);
+
+    // Gathers the children of an internal node, or their children when they aren't leaves
+    int gather_wide(int index, int slots[4]) const;
+
+    template <typename test_fn, typename leaf_fn>
+    void traverse(test_fn const &test, leaf_fn const &on_leaf) const;
+
+    std::vector<node> m_nodes;
+    int m_root = null_node;
+    int m_free_list = null_node;
+    float m_margin = 0.f;
+};
@@ -0,0 +1,77 @@
+#include "frame_arena.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+frame_arena::frame_arena(size_t initial_size)
+{
+    // Room for a few overflow blocks, so chaining them doesn't grow the vector
+    m_blocks.reserve(8);
+    add_block(initial_size);
+}
+
+frame_arena::~frame_arena()
+{
+    for (block &b : m_blocks)
+        std::free(b.data);
+}
+
+void frame_arena::add_block(size_t size)
+{
+    block b;
+    b.data = static_cast<uint8_t *>(std::malloc(size));
+    // The containers over the arena expect a failed allocation to throw, like with the default allocator
+    if (!b.data)
+        throw std::bad_alloc();
+    b.size = size;
+    m_blocks.push_back(b);
+    m_offset = 0;
+    m_capacity += size;
+    m_block_allocations++;
+}
+
+void *frame_arena::allocate(size_t size, size_t alignment)
+{
+    block *current = &m_blocks.back();
+    uintptr_t address = reinterpret_cast<uintptr_t>(current->data) + m_offset;
+    size_t padding = (alignment - address % alignment) % alignment;
+
+    if (m_offset + padding + size > current->size)
+    {
+        // The new block is at least as large as everything before it, so a frame only chains a few
+        add_block(std::max(m_capacity, size + alignment));
+        current = &m_blocks.back();
+        address = reinterpret_cast<uintptr_t>(current->data);
+        padding = (alignment - address % alignment) % alignment;
+    }
+
+    m_offset += padding;
+    void *ptr = current->data + m_offset;
+    m_offset += size;
+    m_used += padding + size;
+    m_high_water_mark = std::max(m_high_water_mark, m_used);
+    return ptr;
+}
+
+void frame_arena::reset()
+{
+    m_used = 0;
+    m_offset = 0;
+
+    if (m_blocks.size() == 1)
+        return;
+
+    // The frame overflowed, the next ones get a single block as large as all of this one's
+    size_t merged_size = m_capacity;
+    for (block &b : m_blocks)
+        std::free(b.data);
+    m_blocks.clear();
+    m_capacity = 0;
+    add_block(merged_size);
+}
+
+frame_arena &thread_frame_arena()
+{
+    thread_local frame_arena arena;
+    return arena;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "common_api.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Bump allocator for data that only lives until the end of the frame.
+// Allocating moves an offset, freeing does nothing, and reset at the start of the frame frees everything at once.
+// A frame that doesn't fit in the block chains more blocks, they are merged into a single block at the next reset,
+// so once the arena has seen its largest frame it stops allocating from the heap.
+class frame_arena
+{
+public:
+    COMMON_API frame_arena(size_t initial_size = 64 * 1024);
+    COMMON_API ~frame_arena();
+    frame_arena(frame_arena const &) = delete;
+    frame_arena &operator=(frame_arena const &) = delete;
+
+    COMMON_API void *allocate(size_t size, size_t alignment);
+
+    // Everything allocated since the last reset becomes invalid
+    COMMON_API void reset();
+
+    // Bytes allocated this frame, alignment padding included
+    size_t used() const { return m_used; }
+
+    // Most bytes used by a single frame since the arena was created
+    size_t high_water_mark() const { return m_high_water_mark; }
+
+    size_t capacity() const { return m_capacity; }
+
+    // Heap allocations made by the arena itself, stops growing once the frames fit in the merged block
+    size_t block_allocations() const { return m_block_allocations; }
+
+private:
+    struct block
+    {
+        uint8_t *data;
+        size_t size;
+    };
+
+    void add_block(size_t size);
+
+    std::vector<block> m_blocks;
+    size_t m_offset = 0; // In the last block
+    size_t m_used = 0;
+    size_t m_high_water_mark = 0;
+    size_t m_capacity = 0;
+    size_t m_block_allocations = 0;
+};
+
+// Arena of the calling thread, each thread resets its own at the start of its frame
+COMMON_API frame_arena &thread_frame_arena();
+
+// Standard allocator over a frame arena, for containers that don't outlive the frame.
+// Deallocating is a no-op: a container that grows leaves its old storage in the arena until the next reset.
+template <typename T>
+class arena_allocator
+{
+public:
+    using value_type = T;
+
+    arena_allocator() : m_arena(&thread_frame_arena()) {}
+    arena_allocator(frame_arena &arena) : m_arena(&arena) {}
+    template <typename U>
+    arena_allocator(arena_allocator<U> const &other) : m_arena(other.arena()) {}
+
+    T *allocate(size_t count) { return static_cast<T *>(m_arena->allocate(count * sizeof(T), alignof(T))); }
+    void deallocate(T *, size_t) {}
+
+    frame_arena *arena() const { return m_arena; }
+
+private:
+    frame_arena *m_arena;
+};
+
+template <typename T, typename U>
+bool operator==(arena_allocator<T> const &a, arena_allocator<U> const &b) { return a.arena() == b.arena(); }
+template <typename T, typename U>
+bool operator!=(arena_allocator<T> const &a, arena_allocator<U> const &b) { return a.arena() != b.arena(); }
+
+template <typename T>
+using frame_vector = std::vector<T, arena_allocator<T>>;
+using frame_string = std::basic_string<char, std::char_traits<char>, arena_allocator<char>>;
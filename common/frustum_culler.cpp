@@ -0,0 +1,365 @@
+#include "pch.h"
+#include "frustum_culler.h"
+#include <immintrin.h>
+#include <algorithm>
+
+frustum_culler::frustum_culler()
+{
+    m_use_avx2 = cpu_supports_avx2();
+}
+
+void frustum_culler::set_planes(DirectX::XMFLOAT4 const planes[6])
+{
+    // Keep track of how far the planes moved, for the boxes cached as fully inside
+    if (m_has_planes)
+    {
+        float max_normal_delta = 0.f;
+        float max_offset_delta = 0.f;
+        for (size_t i = 0; i < 6; i++)
+        {
+            float dx = planes[i].x - m_planes.m_x[i];
+            float dy = planes[i].y - m_planes.m_y[i];
+            float dz = planes[i].z - m_planes.m_z[i];
+            max_normal_delta = std::max(max_normal_delta, sqrtf(dx * dx + dy * dy + dz * dz));
+            max_offset_delta = std::max(max_offset_delta, fabsf(planes[i].w - m_planes.m_w[i]));
+        }
+        m_normal_drift += max_normal_delta;
+        m_offset_drift += max_offset_delta;
+    }
+    m_has_planes = true;
+    m_planes.set(planes);
+}
+
+void frustum_culler::cull(aabb_soa const &boxes, UINT64 *visibility_mask) const
+{
+    for (size_t first = 0; first < boxes.size(); first += 64)
+    {
+        *visibility_mask++ = cull_word(boxes, first);
+    }
+}
+
+size_t frustum_culler::cull(aabb_soa const &boxes, UINT *visible_indices) const
+{
+    size_t num_visible = 0;
+    for (size_t first = 0; first < boxes.size(); first += 64)
+    {
+        UINT64 word = cull_word(boxes, first);
+
+        unsigned long bit = 0;
+        while (_BitScanForward64(&bit, word))
+        {
+            visible_indices[num_visible++] = UINT(first + bit);
+            word &= word - 1;
+        }
+    }
+    return num_visible;
+}
+
+void frustum_culler::cull(aabb_soa const &boxes, culling_cache &cache, UINT64 *visibility_mask) const
+{
+    ASSERT2(cache.m_inside_margin.size() >= boxes.padded_size(), "The culling cache must be sized for the boxes.");
+
+    for (size_t first = 0; first < boxes.size(); first += 64)
+    {
+        *visibility_mask++ = cull_word_cached(boxes, cache, first);
+    }
+}
+
+size_t frustum_culler::cull(aabb_soa const &boxes, culling_cache &cache, UINT *visible_indices) const
+{
+    ASSERT2(cache.m_inside_margin.size() >= boxes.padded_size(), "The culling cache must be sized for the boxes.");
+
+    size_t num_visible = 0;
+    for (size_t first = 0; first < boxes.size(); first += 64)
+    {
+        UINT64 word = cull_word_cached(boxes, cache, first);
+
+        unsigned long bit = 0;
+        while (_BitScanForward64(&bit, word))
+        {
+            visible_indices[num_visible++] = UINT(first + bit);
+            word &= word - 1;
+        }
+    }
+    return num_visible;
+}
+
+UINT64 frustum_culler::cull_word_cached(aabb_soa const &boxes, culling_cache &cache, size_t first) const
+{
+    size_t count = std::min<size_t>(64, boxes.size() - first);
+    size_t padded_count = align_up(count, aabb_soa::m_simd_width);
+    UINT64 word = m_use_avx2 ? cull_word_cached_avx2(boxes, cache, first, padded_count) : cull_word_cached_scalar(boxes, cache, first, count);
+
+    if (count < 64)
+        word &= (UINT64(1) << count) - 1;
+    return word;
+}
+
+UINT64 frustum_culler::cull_word(aabb_soa const &boxes, size_t first) const
+{
+    // The streams are padded, but the padding boxes must not show up as visible
+    size_t count = std::min<size_t>(64, boxes.size() - first);
+    size_t padded_count = align_up(count, aabb_soa::m_simd_width);
+    UINT64 word = m_use_avx2 ? cull_word_avx2(boxes, first, padded_count) : cull_word_sse(boxes, first, padded_count);
+
+    if (count < 64)
+        word &= (UINT64(1) << count) - 1;
+    return word;
+}
+
+UINT64 frustum_culler::cull_word_avx2(aabb_soa const &boxes, size_t first, size_t count) const
+{
+    UINT64 word = 0;
+    for (size_t i = 0; i < count; i += 8)
+    {
+        size_t box = first + i;
+        __m256 cx = _mm256_loadu_ps(&boxes.m_center_x[box]);
+        __m256 cy = _mm256_loadu_ps(&boxes.m_center_y[box]);
+        __m256 cz = _mm256_loadu_ps(&boxes.m_center_z[box]);
+        __m256 ex = _mm256_loadu_ps(&boxes.m_extents_x[box]);
+        __m256 ey = _mm256_loadu_ps(&boxes.m_extents_y[box]);
+        __m256 ez = _mm256_loadu_ps(&boxes.m_extents_z[box]);
+
+        __m256 inside = boxes_in_frustum_avx2(m_planes, cx, cy, cz, ex, ey, ez);
+        word |= UINT64(_mm256_movemask_ps(inside)) << i;
+    }
+
+    // Avoid the AVX to SSE transition penalty in the code that follows
+    _mm256_zeroupper();
+    return word;
+}
+
+UINT64 frustum_culler::cull_word_sse(aabb_soa const &boxes, size_t first, size_t count) const
+{
+    UINT64 word = 0;
+    for (size_t i = 0; i < count; i += 4)
+    {
+        size_t box = first + i;
+        __m128 cx = _mm_loadu_ps(&boxes.m_center_x[box]);
+        __m128 cy = _mm_loadu_ps(&boxes.m_center_y[box]);
+        __m128 cz = _mm_loadu_ps(&boxes.m_center_z[box]);
+        __m128 ex = _mm_loadu_ps(&boxes.m_extents_x[box]);
+        __m128 ey = _mm_loadu_ps(&boxes.m_extents_y[box]);
+        __m128 ez = _mm_loadu_ps(&boxes.m_extents_z[box]);
+
+        __m128 inside = boxes_in_frustum_sse(m_planes, cx, cy, cz, ex, ey, ez);
+        word |= UINT64(_mm_movemask_ps(inside)) << i;
+    }
+    return word;
+}
+
+UINT64 frustum_culler::cull_word_cached_avx2(aabb_soa const &boxes, culling_cache &cache, size_t first, size_t count) const
+{
+    __m256 zero = _mm256_setzero_ps();
+    __m256 normal_drift = _mm256_set1_ps(m_normal_drift);
+    __m256 offset_drift = _mm256_set1_ps(m_offset_drift);
+
+    UINT64 word = 0;
+    for (size_t i = 0; i < count; i += 8)
+    {
+        size_t box = first + i;
+        __m256 cx = _mm256_loadu_ps(&boxes.m_center_x[box]);
+        __m256 cy = _mm256_loadu_ps(&boxes.m_center_y[box]);
+        __m256 cz = _mm256_loadu_ps(&boxes.m_center_z[box]);
+        __m256 ex = _mm256_loadu_ps(&boxes.m_extents_x[box]);
+        __m256 ey = _mm256_loadu_ps(&boxes.m_extents_y[box]);
+        __m256 ez = _mm256_loadu_ps(&boxes.m_extents_z[box]);
+
+        // Boxes that were fully inside and that the plane drift can't have pushed out yet
+        __m256 center_length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, cx), _mm256_mul_ps(cy, cy)), _mm256_mul_ps(cz, cz)));
+        __m256 extents_length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey)), _mm256_mul_ps(ez, ez)));
+        __m256 drift = _mm256_mul_ps(_mm256_sub_ps(normal_drift, _mm256_loadu_ps(&cache.m_normal_drift_at_test[box])), _mm256_add_ps(center_length, extents_length));
+        drift = _mm256_add_ps(drift, _mm256_sub_ps(offset_drift, _mm256_loadu_ps(&cache.m_offset_drift_at_test[box])));
+        __m256 still_inside = _mm256_cmp_ps(_mm256_loadu_ps(&cache.m_inside_margin[box]), drift, _CMP_GT_OQ);
+
+        int still_inside_mask = _mm256_movemask_ps(still_inside);
+        if (still_inside_mask == 0xFF)
+        {
+            word |= UINT64(0xFF) << i;
+            continue;
+        }
+
+        // Test the plane that rejected each box last time
+        __m256i cached_plane = _mm256_loadu_si256((__m256i const *)&cache.m_last_failing_plane[box]);
+        __m256 distance = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(m_planes.m_x, cached_plane, 4), cx), _mm256_i32gather_ps(m_planes.m_w, cached_plane, 4));
+        distance = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(m_planes.m_y, cached_plane, 4), cy), distance);
+        distance = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(m_planes.m_z, cached_plane, 4), cz), distance);
+        __m256 radius = _mm256_mul_ps(_mm256_i32gather_ps(m_planes.m_abs_x, cached_plane, 4), ex);
+        radius = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(m_planes.m_abs_y, cached_plane, 4), ey), radius);
+        radius = _mm256_add_ps(_mm256_mul_ps(_mm256_i32gather_ps(m_planes.m_abs_z, cached_plane, 4), ez), radius);
+        int rejected_mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_LE_OQ));
+
+        if ((still_inside_mask | rejected_mask) == 0xFF)
+        {
+            word |= UINT64(still_inside_mask) << i;
+            continue;
+        }
+
+        // Full test, remembering the first failing plane and the inside margin of every box
+        __m256i first_failing_plane = _mm256_set1_epi32(-1);
+        __m256 margin = _mm256_set1_ps(FLT_MAX);
+        for (int p = 0; p < 6; p++)
+        {
+            plane_distance_radius_avx2(m_planes, p, cx, cy, cz, ex, ey, ez, distance, radius);
+            __m256i fails = _mm256_castps_si256(_mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_LE_OQ));
+            __m256i is_first = _mm256_and_si256(fails, _mm256_cmpeq_epi32(first_failing_plane, _mm256_set1_epi32(-1)));
+            first_failing_plane = _mm256_blendv_epi8(first_failing_plane, _mm256_set1_epi32(p), is_first);
+            margin = _mm256_min_ps(margin, _mm256_sub_ps(distance, radius));
+        }
+
+        __m256i visible = _mm256_cmpeq_epi32(first_failing_plane, _mm256_set1_epi32(-1));
+        __m256 fully_inside = _mm256_cmp_ps(margin, zero, _CMP_GT_OQ);
+
+        // Update the cache: outside boxes remember their plane, fully inside boxes their margin
+        __m256i last_failing_plane = _mm256_blendv_epi8(first_failing_plane, cached_plane, visible);
+        _mm256_storeu_si256((__m256i *)&cache.m_last_failing_plane[box], last_failing_plane);
+        _mm256_storeu_ps(&cache.m_inside_margin[box], _mm256_blendv_ps(_mm256_set1_ps(-FLT_MAX), margin, fully_inside));
+        _mm256_storeu_ps(&cache.m_normal_drift_at_test[box], normal_drift);
+        _mm256_storeu_ps(&cache.m_offset_drift_at_test[box], offset_drift);
+
+        word |= UINT64(_mm256_movemask_ps(_mm256_castsi256_ps(visible))) << i;
+    }
+
+    _mm256_zeroupper();
+    return word;
+}
+
+UINT64 frustum_culler::cull_word_cached_scalar(aabb_soa const &boxes, culling_cache &cache, size_t first, size_t count) const
+{
+    UINT64 word = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t box = first + i;
+        float cx = boxes.m_center_x[box];
+        float cy = boxes.m_center_y[box];
+        float cz = boxes.m_center_z[box];
+        float ex = boxes.m_extents_x[box];
+        float ey = boxes.m_extents_y[box];
+        float ez = boxes.m_extents_z[box];
+
+        // Fully inside and the plane drift can't have pushed it out yet
+        float bound = sqrtf(cx * cx + cy * cy + cz * cz) + sqrtf(ex * ex + ey * ey + ez * ez);
+        float drift = (m_normal_drift - cache.m_normal_drift_at_test[box]) * bound + (m_offset_drift - cache.m_offset_drift_at_test[box]);
+        if (cache.m_inside_margin[box] > drift)
+        {
+            word |= UINT64(1) << i;
+            continue;
+        }
+
+        // Start with the plane that rejected the box last time
+        int cached_plane = cache.m_last_failing_plane[box];
+        int first_failing_plane = -1;
+        float margin = FLT_MAX;
+        for (int n = 0; n < 6; n++)
+        {
+            int p = n == 0 ? cached_plane : (n == cached_plane ? 0 : n);
+            float distance = m_planes.m_x[p] * cx + m_planes.m_y[p] * cy + m_planes.m_z[p] * cz + m_planes.m_w[p];
+            float radius = m_planes.m_abs_x[p] * ex + m_planes.m_abs_y[p] * ey + m_planes.m_abs_z[p] * ez;
+            if (distance + radius <= 0.f)
+            {
+                first_failing_plane = p;
+                break;
+            }
+            margin = std::min(margin, distance - radius);
+        }
+
+        if (first_failing_plane >= 0)
+        {
+            cache.m_last_failing_plane[box] = first_failing_plane;
+            cache.m_inside_margin[box] = -FLT_MAX;
+            continue;
+        }
+
+        cache.m_inside_margin[box] = margin > 0.f ? margin : -FLT_MAX;
+        cache.m_normal_drift_at_test[box] = m_normal_drift;
+        cache.m_offset_drift_at_test[box] = m_offset_drift;
+        word |= UINT64(1) << i;
+    }
+    return word;
+}
+
+multi_frustum_culler::multi_frustum_culler()
+{
+    m_use_avx2 = cpu_supports_avx2();
+}
+
+void multi_frustum_culler::set_frusta(DirectX::XMFLOAT4 const (*planes)[6], size_t num_frusta)
+{
+    ASSERT2(num_frusta <= m_max_frusta, "Too many frusta for the multi frustum culler.");
+    m_num_frusta = num_frusta;
+
+    for (size_t k = 0; k < num_frusta; k++)
+    {
+        m_frusta[k].set(planes[k]);
+    }
+}
+
+void multi_frustum_culler::cull(aabb_soa const &boxes, UINT64 *const *visibility_masks) const
+{
+    UINT64 words[m_max_frusta];
+    for (size_t first = 0; first < boxes.size(); first += 64)
+    {
+        size_t count = std::min<size_t>(64, boxes.size() - first);
+        size_t padded_count = align_up(count, aabb_soa::m_simd_width);
+
+        if (m_use_avx2)
+            cull_words_avx2(boxes, first, padded_count, words);
+        else
+            cull_words_sse(boxes, first, padded_count, words);
+
+        UINT64 valid_bits = count < 64 ? (UINT64(1) << count) - 1 : ~UINT64(0);
+        for (size_t k = 0; k < m_num_frusta; k++)
+        {
+            visibility_masks[k][first / 64] = words[k] & valid_bits;
+        }
+    }
+}
+
+void multi_frustum_culler::cull_words_avx2(aabb_soa const &boxes, size_t first, size_t count, UINT64 *words) const
+{
+    for (size_t k = 0; k < m_num_frusta; k++)
+        words[k] = 0;
+
+    for (size_t i = 0; i < count; i += 8)
+    {
+        // Load the boxes once for all the frusta
+        size_t box = first + i;
+        __m256 cx = _mm256_loadu_ps(&boxes.m_center_x[box]);
+        __m256 cy = _mm256_loadu_ps(&boxes.m_center_y[box]);
+        __m256 cz = _mm256_loadu_ps(&boxes.m_center_z[box]);
+        __m256 ex = _mm256_loadu_ps(&boxes.m_extents_x[box]);
+        __m256 ey = _mm256_loadu_ps(&boxes.m_extents_y[box]);
+        __m256 ez = _mm256_loadu_ps(&boxes.m_extents_z[box]);
+
+        for (size_t k = 0; k < m_num_frusta; k++)
+        {
+            __m256 inside = boxes_in_frustum_avx2(m_frusta[k], cx, cy, cz, ex, ey, ez);
+            words[k] |= UINT64(_mm256_movemask_ps(inside)) << i;
+        }
+    }
+
+    _mm256_zeroupper();
+}
+
+void multi_frustum_culler::cull_words_sse(aabb_soa const &boxes, size_t first, size_t count, UINT64 *words) const
+{
+    for (size_t k = 0; k < m_num_frusta; k++)
+        words[k] = 0;
+
+    for (size_t i = 0; i < count; i += 4)
+    {
+        size_t box = first + i;
+        __m128 cx = _mm_loadu_ps(&boxes.m_center_x[box]);
+        __m128 cy = _mm_loadu_ps(&boxes.m_center_y[box]);
+        __m128 cz = _mm_loadu_ps(&boxes.m_center_z[box]);
+        __m128 ex = _mm_loadu_ps(&boxes.m_extents_x[box]);
+        __m128 ey = _mm_loadu_ps(&boxes.m_extents_y[box]);
+        __m128 ez = _mm_loadu_ps(&boxes.m_extents_z[box]);
+
+        for (size_t k = 0; k < m_num_frusta; k++)
+        {
+            __m128 inside = boxes_in_frustum_sse(m_frusta[k], cx, cy, cz, ex, ey, ez);
+            words[k] |= UINT64(_mm_movemask_ps(inside)) << i;
+        }
+    }
+}
@@ -0,0 +1,229 @@
+#pragma once
+#include "common.h"
+#include <DirectXCollision.h>
+#include <immintrin.h>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+// Axis-aligned bounding boxes stored SoA, so that the culler can load 8 of them at once.
+// The streams are padded to a multiple of 8 boxes.
+struct aabb_soa
+{
+    static constexpr size_t m_simd_width = 8;
+
+    void resize(size_t count)
+    {
+        m_count = count;
+        size_t padded_count = align_up(count, m_simd_width);
+        m_center_x.resize(padded_count, 0.f);
+        m_center_y.resize(padded_count, 0.f);
+        m_center_z.resize(padded_count, 0.f);
+        m_extents_x.resize(padded_count, 0.f);
+        m_extents_y.resize(padded_count, 0.f);
+        m_extents_z.resize(padded_count, 0.f);
+    }
+
+    void set(size_t index, DirectX::BoundingBox const &box)
+    {
+        m_center_x[index] = box.Center.x;
+        m_center_y[index] = box.Center.y;
+        m_center_z[index] = box.Center.z;
+        m_extents_x[index] = box.Extents.x;
+        m_extents_y[index] = box.Extents.y;
+        m_extents_z[index] = box.Extents.z;
+    }
+
+    size_t size() const { return m_count; }
+    size_t padded_size() const { return m_center_x.size(); }
+
+    size_t m_count = 0;
+    std::vector<float> m_center_x;
+    std::vector<float> m_center_y;
+    std::vector<float> m_center_z;
+    std::vector<float> m_extents_x;
+    std::vector<float> m_extents_y;
+    std::vector<float> m_extents_z;
+};
+
+// The 6 planes of a frustum SoA, with the absolute values of the normals for the box radius
+struct frustum_planes
+{
+    void set(DirectX::XMFLOAT4 const planes[6])
+    {
+        for (size_t i = 0; i < 6; i++)
+        {
+            m_x[i] = planes[i].x;
+            m_y[i] = planes[i].y;
+            m_z[i] = planes[i].z;
+            m_w[i] = planes[i].w;
+            m_abs_x[i] = fabsf(planes[i].x);
+            m_abs_y[i] = fabsf(planes[i].y);
+            m_abs_z[i] = fabsf(planes[i].z);
+        }
+    }
+
+    float m_x[6] = {};
+    float m_y[6] = {};
+    float m_z[6] = {};
+    float m_w[6] = {};
+    float m_abs_x[6] = {};
+    float m_abs_y[6] = {};
+    float m_abs_z[6] = {};
+};
+
+// Signed distance of the box centers to plane p, and the box radii projected on its normal.
+// A box is outside the plane when its center is farther behind it than its radius:
+// dot(n, c) + d <= -(|n.x| * e.x + |n.y| * e.y + |n.z| * e.z)
+inline void plane_distance_radius_avx2(frustum_planes const &planes, size_t p,
+                                       __m256 cx, __m256 cy, __m256 cz, __m256 ex, __m256 ey, __m256 ez,
+                                       __m256 &distance, __m256 &radius)
+{
+    distance = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes.m_x[p]), cx), _mm256_set1_ps(planes.m_w[p]));
+    distance = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes.m_y[p]), cy), distance);
+    distance = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes.m_z[p]), cz), distance);
+
+    radius = _mm256_mul_ps(_mm256_set1_ps(planes.m_abs_x[p]), ex);
+    radius = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes.m_abs_y[p]), ey), radius);
+    radius = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes.m_abs_z[p]), ez), radius);
+}
+
+inline void plane_distance_radius_sse(frustum_planes const &planes, size_t p,
+                                      __m128 cx, __m128 cy, __m128 cz, __m128 ex, __m128 ey, __m128 ez,
+                                      __m128 &distance, __m128 &radius)
+{
+    distance = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes.m_x[p]), cx), _mm_set1_ps(planes.m_w[p]));
+    distance = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes.m_y[p]), cy), distance);
+    distance = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes.m_z[p]), cz), distance);
+
+    radius = _mm_mul_ps(_mm_set1_ps(planes.m_abs_x[p]), ex);
+    radius = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes.m_abs_y[p]), ey), radius);
+    radius = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes.m_abs_z[p]), ez), radius);
+}
+
+// Lane mask of the 8 or 4 boxes that are at least partially inside all 6 planes
+inline __m256 boxes_in_frustum_avx2(frustum_planes const &planes,
+                                    __m256 cx, __m256 cy, __m256 cz, __m256 ex, __m256 ey, __m256 ez)
+{
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (size_t p = 0; p < 6; p++)
+    {
+        __m256 distance, radius;
+        plane_distance_radius_avx2(planes, p, cx, cy, cz, ex, ey, ez, distance, radius);
+        inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_GT_OQ));
+    }
+    return inside;
+}
+
+inline __m128 boxes_in_frustum_sse(frustum_planes const &planes,
+                                   __m128 cx, __m128 cy, __m128 cz, __m128 ex, __m128 ey, __m128 ez)
+{
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (size_t p = 0; p < 6; p++)
+    {
+        __m128 distance, radius;
+        plane_distance_radius_sse(planes, p, cx, cy, cz, ex, ey, ez, distance, radius);
+        inside = _mm_and_ps(inside, _mm_cmpgt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+    }
+    return inside;
+}
+
+// Per-object state the culler carries from one frame to the next, for scenes whose boxes don't move.
+// Call invalidate() when a box changes.
+struct culling_cache
+{
+    void resize(size_t count)
+    {
+        size_t padded_count = align_up(count, aabb_soa::m_simd_width);
+        m_last_failing_plane.resize(padded_count, 0);
+        m_inside_margin.resize(padded_count, -FLT_MAX);
+        m_normal_drift_at_test.resize(padded_count, 0.f);
+        m_offset_drift_at_test.resize(padded_count, 0.f);
+    }
+
+    void invalidate(size_t index)
+    {
+        m_inside_margin[index] = -FLT_MAX;
+    }
+
+    // The plane that rejected the box the last time it was outside, tested first
+    std::vector<int> m_last_failing_plane;
+
+    // How deep inside every plane the box was when last found fully inside, -FLT_MAX otherwise,
+    // and how much the planes had drifted at that time
+    std::vector<float> m_inside_margin;
+    std::vector<float> m_normal_drift_at_test;
+    std::vector<float> m_offset_drift_at_test;
+};
+
+// Culls batches of boxes against a frustum, 8 boxes per iteration with AVX2 or 4 with SSE when it's not available.
+// The planes are set once per frame, in the same space as the boxes, with unit normals pointing inside.
+//
+// The cached variants of cull() exploit frame to frame coherency:
+// - A box that was outside is first tested against the plane that rejected it last time.
+// - A box that was fully inside skips the tests until the planes have drifted by more than its margin.
+//   The drift is bounded conservatively: a plane change moves the signed distance minus radius of a box
+//   by at most |delta normal| * (|center| + |extents|) + |delta offset|.
+class frustum_culler
+{
+public:
+    COMMON_API frustum_culler();
+
+    COMMON_API void set_planes(DirectX::XMFLOAT4 const planes[6]);
+
+    // Sets bit i of the mask when box i is at least partially inside the frustum.
+    // The mask must hold (boxes.size() + 63) / 64 words.
+    COMMON_API void cull(aabb_soa const &boxes, UINT64 *visibility_mask) const;
+
+    // Writes the indices of the visible boxes in increasing order, returns how many were written.
+    // visible_indices must hold boxes.size() indices.
+    COMMON_API size_t cull(aabb_soa const &boxes, UINT *visible_indices) const;
+
+    // Same as above, reading and updating the per-object cache, which must be sized for the boxes
+    COMMON_API void cull(aabb_soa const &boxes, culling_cache &cache, UINT64 *visibility_mask) const;
+    COMMON_API size_t cull(aabb_soa const &boxes, culling_cache &cache, UINT *visible_indices) const;
+
+private:
+    UINT64 cull_word(aabb_soa const &boxes, size_t first) const;
+    UINT64 cull_word_avx2(aabb_soa const &boxes, size_t first, size_t count) const;
+    UINT64 cull_word_sse(aabb_soa const &boxes, size_t first, size_t count) const;
+    UINT64 cull_word_cached(aabb_soa const &boxes, culling_cache &cache, size_t first) const;
+    UINT64 cull_word_cached_avx2(aabb_soa const &boxes, culling_cache &cache, size_t first, size_t count) const;
+    UINT64 cull_word_cached_scalar(aabb_soa const &boxes, culling_cache &cache, size_t first, size_t count) const;
+
+    frustum_planes m_planes;
+
+    // Accumulated upper bounds of how much the plane normals and offsets changed since the culler was created
+    float m_normal_drift = 0.f;
+    float m_offset_drift = 0.f;
+    bool m_has_planes = false;
+
+    bool m_use_avx2 = false;
+};
+
+// Culls the same boxes against several frusta in one sweep, e.g. the main, debug and shadow cameras.
+// Each box is loaded once and tested against every frustum, instead of one full pass per frustum.
+class multi_frustum_culler
+{
+public:
+    static constexpr size_t m_max_frusta = 8;
+
+    COMMON_API multi_frustum_culler();
+
+    // planes[k] are the 6 planes of frustum k, same conventions as frustum_culler
+    COMMON_API void set_frusta(DirectX::XMFLOAT4 const (*planes)[6], size_t num_frusta);
+
+    // visibility_masks[k] receives the mask of frustum k and must hold (boxes.size() + 63) / 64 words
+    COMMON_API void cull(aabb_soa const &boxes, UINT64 *const *visibility_masks) const;
+
+    size_t num_frusta() const { return m_num_frusta; }
+
+private:
+    void cull_words_avx2(aabb_soa const &boxes, size_t first, size_t count, UINT64 *words) const;
+    void cull_words_sse(aabb_soa const &boxes, size_t first, size_t count, UINT64 *words) const;
+
+    size_t m_num_frusta = 0;
+    frustum_planes m_frusta[m_max_frusta];
+
+    bool m_use_avx2 = false;
+};
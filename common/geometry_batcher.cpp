@@ -0,0 +1,103 @@
+#include "geometry_batcher.h"
+#include <cstring>
+
+namespace
+{
+// FNV-1a
+uint64_t hash_bytes(void const *data, size_t size, uint64_t hash)
+{
+    uint8_t const *bytes = (uint8_t const *)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+} // namespace
+
+geometry_batcher::geometry_batcher(size_t vertex_size)
+    : m_vertex_size(vertex_size)
+{
+}
+
+void geometry_batcher::clear()
+{
+    m_vertices.clear();
+    m_indices.clear();
+    m_batches.clear();
+    m_batch_lookup.clear();
+    m_added.clear();
+    m_instances.clear();
+    m_instance_indices.clear();
+}
+
+uint32_t geometry_batcher::find_batch(void const *vertices, size_t vertex_count, uint16_t const *indices, size_t index_count, uint64_t hash) const
+{
+    auto range = m_batch_lookup.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        batch const &b = m_batches[it->second];
+        if (b.vertex_count != vertex_count || b.index_count != index_count)
+            continue;
+
+        if (memcmp(&m_vertices[b.base_vertex * m_vertex_size], vertices, vertex_count * m_vertex_size) == 0 &&
+            memcmp(&m_indices[b.start_index], indices, index_count * sizeof(uint16_t)) == 0)
+            return it->second;
+    }
+    return UINT32_MAX;
+}
+
+uint32_t geometry_batcher::add(void const *vertices, size_t vertex_count,
+                               uint16_t const *indices, size_t index_count,
+                               DirectX::XMFLOAT4X4 const &transform)
+{
+    uint64_t hash = hash_bytes(vertices, vertex_count * m_vertex_size, 0xcbf29ce484222325ull);
+    hash = hash_bytes(indices, index_count * sizeof(uint16_t), hash);
+
+    uint32_t batch_index = find_batch(vertices, vertex_count, indices, index_count, hash);
+    if (batch_index == UINT32_MAX)
+    {
+        batch new_batch;
+        new_batch.base_vertex = (uint32_t)(m_vertices.size() / m_vertex_size);
+        new_batch.vertex_count = (uint32_t)vertex_count;
+        new_batch.start_index = (uint32_t)m_indices.size();
+        new_batch.index_count = (uint32_t)index_count;
+
+        uint8_t const *vertex_bytes = (uint8_t const *)vertices;
+        m_vertices.insert(m_vertices.end(), vertex_bytes, vertex_bytes + vertex_count * m_vertex_size);
+        m_indices.insert(m_indices.end(), indices, indices + index_count);
+
+        batch_index = (uint32_t)m_batches.size();
+        m_batches.push_back(new_batch);
+        m_batch_lookup.emplace(hash, batch_index);
+    }
+
+    m_batches[batch_index].instance_count++;
+    m_added.push_back({batch_index, transform});
+    return (uint32_t)m_added.size() - 1;
+}
+
+void geometry_batcher::build()
+{
+    uint32_t first_instance = 0;
+    for (batch &b : m_batches)
+    {
+        b.first_instance = first_instance;
+        first_instance += b.instance_count;
+    }
+
+    // Counting sort of the instances by batch, keeping the order they were added in
+    std::vector<uint32_t> cursors(m_batches.size());
+    for (size_t i = 0; i < m_batches.size(); i++)
+        cursors[i] = m_batches[i].first_instance;
+
+    m_instances.resize(m_added.size());
+    m_instance_indices.resize(m_added.size());
+    for (size_t i = 0; i < m_added.size(); i++)
+    {
+        uint32_t index = cursors[m_added[i].batch]++;
+        m_instances[index] = m_added[i].transform;
+        m_instance_indices[i] = index;
+    }
+}
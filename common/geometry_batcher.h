@@ -0,0 +1,70 @@
+#pragma once
+#include "common_api.h"
+#include <DirectXMath.h>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Merges many small meshes into shared vertex and index streams.
+// Meshes with the same vertices and indices are stored once and become instances of the same batch,
+// so they can be drawn with one instanced draw reading their transforms from an array.
+// The key is the bytes of both streams, not the topology: the same shape with its vertices reordered,
+// the triangles rotated or a vertex attribute off by a bit is another batch. Importers that emit the same
+// mesh through the same code path produce identical bytes, which is the case this is meant for.
+// Every mesh added to a batcher has the same vertex layout.
+class geometry_batcher
+{
+public:
+    struct batch
+    {
+        uint32_t base_vertex = 0;
+        uint32_t vertex_count = 0;
+        uint32_t start_index = 0;
+        uint32_t index_count = 0;
+        uint32_t first_instance = 0; // Valid after build
+        uint32_t instance_count = 0;
+    };
+
+    COMMON_API geometry_batcher(size_t vertex_size);
+
+    // Keeps the allocations
+    COMMON_API void clear();
+
+    // Returns the id of the instance, in the order of the calls
+    COMMON_API uint32_t add(void const *vertices, size_t vertex_count,
+                            uint16_t const *indices, size_t index_count,
+                            DirectX::XMFLOAT4X4 const &transform);
+
+    // Groups the instance transforms by batch, call after the last add
+    COMMON_API void build();
+
+    std::vector<uint8_t> const &vertices() const { return m_vertices; }
+    std::vector<uint16_t> const &indices() const { return m_indices; }
+    std::vector<DirectX::XMFLOAT4X4> const &instances() const { return m_instances; }
+    std::vector<batch> const &batches() const { return m_batches; }
+    size_t vertex_size() const { return m_vertex_size; }
+
+    // Index of the instance in instances() after build
+    uint32_t instance_index(uint32_t id) const { return m_instance_indices[id]; }
+    uint32_t instance_batch(uint32_t id) const { return m_added[id].batch; }
+
+private:
+    struct added_instance
+    {
+        uint32_t batch;
+        DirectX::XMFLOAT4X4 transform;
+    };
+
+    uint32_t find_batch(void const *vertices, size_t vertex_count, uint16_t const *indices, size_t index_count, uint64_t hash) const;
+
+    size_t m_vertex_size = 0;
+    std::vector<uint8_t> m_vertices;
+    std::vector<uint16_t> m_indices;
+    std::vector<batch> m_batches;
+    std::unordered_multimap<uint64_t, uint32_t> m_batch_lookup;
+
+    std::vector<added_instance> m_added;
+    std::vector<DirectX::XMFLOAT4X4> m_instances;
+    std::vector<uint32_t> m_instance_indices;
+};
@@ -26,8 +26,6 @@ device_resources::device_resources() : last_signaled_fence_value(0)
     check_hr(D3D12CreateDevice((IUnknown *)adapter, D3D_FEATURE_LEVEL_12_1, IID_PPV_ARGS(&device)));
     NAME_D3D12_OBJECT(device);
 
-    srv_desc_handle_incr_size = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
-
     // create command objects
     {
         D3D12_COMMAND_QUEUE_DESC cmd_queue_desc;
@@ -629,6 +627,179 @@ void create_default_buffer(ID3D12Device *device,
         byte_size);
 }
 
+d3d12_upload_ring::d3d12_upload_ring(ID3D12Device *device, ID3D12Fence *fence, size_t size, const char *name)
+    : m_fence(fence), m_size(size), m_ring(this)
+{
+    check_hr(device->CreateCommittedResource(
+        &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+        D3D12_HEAP_FLAG_NONE,
+        &CD3DX12_RESOURCE_DESC::Buffer(size),
+        D3D12_RESOURCE_STATE_GENERIC_READ,
+        nullptr,
+        IID_PPV_ARGS(&m_resource)));
+    set_name(m_resource, name);
+
+    // Upload heaps can stay mapped, the CPU only writes the parts the GPU is done with
+    D3D12_RANGE read_range = {};
+    check_hr(m_resource->Map(0, &read_range, (void **)&m_mapped_data));
+
+    m_fence_event = CreateEventEx(nullptr, NULL, NULL, EVENT_ALL_ACCESS);
+}
+
+d3d12_upload_ring::~d3d12_upload_ring()
+{
+    if (m_resource != nullptr)
+        m_resource->Unmap(0, nullptr);
+    m_mapped_data = nullptr;
+    safe_release(m_resource);
+    CloseHandle(m_fence_event);
+}
+
+void d3d12_upload_ring::wait_fence(uint64_t value)
+{
+    if (m_fence->GetCompletedValue() >= value)
+        return;
+
+    check_hr(m_fence->SetEventOnCompletion(value, m_fence_event));
+    WaitForSingleObject(m_fence_event, INFINITE);
+}
+
+descriptor_heap::descriptor_heap(ID3D12Device *device, UINT persistent_count, UINT per_frame_count, const char *name)
+    : m_allocator(descriptor_heap_type::cbv_srv_uav, persistent_count, per_frame_count, NUM_BACK_BUFFERS)
+{
+    D3D12_DESCRIPTOR_HEAP_TYPE type = D3D12_DESCRIPTOR_HEAP_TYPE(m_allocator.type());
+    D3D12_DESCRIPTOR_HEAP_DESC heap_desc;
+    heap_desc.NodeMask = DEFAULT_NODE;
+    heap_desc.Type = type;
+    heap_desc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+    heap_desc.NumDescriptors = m_allocator.capacity();
+    check_hr(device->CreateDescriptorHeap(&heap_desc, IID_PPV_ARGS(&m_heap)));
+    set_name(m_heap, name);
+
+    m_cpu_start = m_heap->GetCPUDescriptorHandleForHeapStart();
+    m_gpu_start = m_heap->GetGPUDescriptorHandleForHeapStart();
+    m_increment_size = device->GetDescriptorHandleIncrementSize(type);
+}
+
+descriptor_heap::~descriptor_heap()
+{
+    safe_release(m_heap);
+}
+
+descriptor_range descriptor_heap::allocate(UINT count)
+{
+    descriptor_range range = m_allocator.allocate(count);
+    ASSERT2(range.is_valid(), "The descriptor heap is full.");
+    return range;
+}
+
+void descriptor_heap::free(descriptor_range range)
+{
+    bool is_freed = m_allocator.free(range);
+    ASSERT2(is_freed, "The descriptor range wasn't allocated from this heap or was already freed.");
+}
+
+void descriptor_heap::begin_frame(UINT frame_index)
+{
+    bool is_valid_frame = m_allocator.begin_frame(frame_index);
+    ASSERT2(is_valid_frame, "The frame index is past the heap's frames in flight.");
+}
+
+descriptor_range descriptor_heap::allocate_transient(UINT count)
+{
+    descriptor_range range = m_allocator.allocate_transient(count);
+    ASSERT2(range.is_valid(), "The descriptor heap's frame region is full.");
+    return range;
+}
+
+D3D12_RESOURCE_STATES to_d3d12_states(resource_states states)
+{
+    static const std::pair<resource_states, D3D12_RESOURCE_STATES> state_map[] = {
+        {state_vertex_and_constant_buffer, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER},
+        {state_index_buffer, D3D12_RESOURCE_STATE_INDEX_BUFFER},
+        {state_render_target, D3D12_RESOURCE_STATE_RENDER_TARGET},
+        {state_unordered_access, D3D12_RESOURCE_STATE_UNORDERED_ACCESS},
+        {state_depth_write, D3D12_RESOURCE_STATE_DEPTH_WRITE},
+        {state_depth_read, D3D12_RESOURCE_STATE_DEPTH_READ},
+        {state_non_pixel_shader_resource, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE},
+        {state_pixel_shader_resource, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE},
+        {state_indirect_argument, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT},
+        {state_copy_dest, D3D12_RESOURCE_STATE_COPY_DEST},
+        {state_copy_source, D3D12_RESOURCE_STATE_COPY_SOURCE},
+    };
+
+    D3D12_RESOURCE_STATES d3d12_states = D3D12_RESOURCE_STATE_COMMON;
+    for (auto const &state : state_map)
+    {
+        if (states & state.first)
+            d3d12_states |= state.second;
+    }
+    return d3d12_states;
+}
+
+void d3d12_render_graph_backend::barriers(render_graph::barrier const *barriers, size_t count)
+{
+    m_d3d12_barriers.clear();
+    for (size_t i = 0; i < count; i++)
+    {
+        render_graph::barrier const &b = barriers[i];
+        ASSERT2(b.native != nullptr, "Render graph resources need a native resource before the graph is executed.");
+
+        switch (b.type)
+        {
+        case render_graph::barrier::transition:
+            m_d3d12_barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition((ID3D12Resource *)b.native,
+                                                                            to_d3d12_states(b.state_before),
+                                                                            to_d3d12_states(b.state_after)));
+            break;
+
+        case render_graph::barrier::uav:
+            m_d3d12_barriers.push_back(CD3DX12_RESOURCE_BARRIER::UAV((ID3D12Resource *)b.native));
+            break;
+
+        case render_graph::barrier::aliasing:
+            m_d3d12_barriers.push_back(CD3DX12_RESOURCE_BARRIER::Aliasing((ID3D12Resource *)b.native_before, (ID3D12Resource *)b.native));
+            break;
+        }
+    }
+    m_cmd_list->ResourceBarrier((UINT)m_d3d12_barriers.size(), m_d3d12_barriers.data());
+}
+
+void create_default_buffer(ID3D12Device *device,
+                           ID3D12GraphicsCommandList *cmd_list,
+                           d3d12_upload_ring *uploads,
+                           const void *data,
+                           size_t byte_size,
+                           ID3D12Resource **default_resource,
+                           const char *name,
+                           D3D12_RESOURCE_FLAGS flags)
+{
+    check_hr(device->CreateCommittedResource(
+        &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+        D3D12_HEAP_FLAG_NONE,
+        &CD3DX12_RESOURCE_DESC::Buffer(byte_size, flags),
+        D3D12_RESOURCE_STATE_COPY_DEST,
+        nullptr,
+        IID_PPV_ARGS(default_resource)));
+
+    char resource_name[50];
+    strcpy(resource_name, name);
+    strcat(resource_name, "_default_resource");
+    set_name(*default_resource, resource_name);
+
+    if (!data)
+        return;
+
+    upload_allocation upload = uploads->allocate(byte_size, D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+    ASSERT2(upload.is_valid(), "The upload ring is too small for this buffer.");
+    memcpy(upload.cpu, data, byte_size);
+
+    cmd_list->CopyBufferRegion(
+        *default_resource, 0,
+        uploads->resource(), upload.offset,
+        byte_size);
+}
+
 void create_mesh_data(ID3D12Device *device, ID3D12GraphicsCommandList *cmd_list, const char *name,
                       size_t vertex_stride, size_t vertex_count, void *vertex_data,
                       size_t index_stride, size_t index_count, void *index_data,
@@ -681,7 +852,7 @@ void create_mesh_data(ID3D12Device *device, ID3D12GraphicsCommandList *cmd_list,
 }
 
 upload_buffer::upload_buffer(ID3D12Device *device, size_t max_element_count, size_t element_byte_size, bool is_constant_buffer, const char *name)
-    : m_element_byte_size(element_byte_size), m_max_element_count((UINT)max_element_count)
+    : m_element_byte_size(element_byte_size), m_max_element_count((UINT)max_element_count), m_is_constant_buffer(is_constant_buffer)
 {
     m_buffer_size = m_element_byte_size * max_element_count;
 
@@ -725,6 +896,13 @@ void upload_buffer::copy_data(int elementIndex, const void *data)
     memcpy(&m_mapped_data[elementIndex * m_element_byte_size], data, m_element_byte_size);
 }
 
+void upload_buffer::copy_range(size_t first_element, const void *data, size_t element_count)
+{
+    ASSERT2(!m_is_constant_buffer, "Constant buffer elements are padded, copy them with write_span.");
+    ASSERT2(first_element + element_count <= m_max_element_count, "Writing past the end of the upload buffer.");
+    stream_copy(&m_mapped_data[first_element * m_element_byte_size], data, element_count * m_element_byte_size);
+}
+
 //void device_resources::draw_debug_lines(ID3D12GraphicsCommandList *cmd_list, std::vector<debug_line *> *debug_lines)
 //{
 //    if (!is_line_buffer_ready)
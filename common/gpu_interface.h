@@ -3,6 +3,10 @@
 #include <DirectXCollision.h>
 #include "pix3.h"
 #include <DXProgrammableCapture.h>
+#include "upload_ring.h"
+#include "descriptor_allocator.h"
+#include "render_graph.h"
+#include "stream_copy.h"
 
 constexpr int NUM_BACK_BUFFERS = 3;
 constexpr int DEFAULT_NODE = 0;
@@ -96,6 +100,99 @@ COMMON_API void create_default_buffer(ID3D12Device *device, ID3D12GraphicsComman
                                       const void *data, size_t byte_size,
                                       ID3D12Resource **upload_resource, ID3D12Resource **default_resource, const char *name, D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_NONE);
 
+// Upload ring in a persistently mapped UPLOAD resource, reclaimed with the queue's fence
+class COMMON_API d3d12_upload_ring : public upload_backend
+{
+public:
+    d3d12_upload_ring(ID3D12Device *device, ID3D12Fence *fence, size_t size, const char *name);
+    ~d3d12_upload_ring();
+    d3d12_upload_ring(d3d12_upload_ring const &) = delete;
+    d3d12_upload_ring &operator=(d3d12_upload_ring const &) = delete;
+
+    upload_allocation allocate(size_t size, size_t alignment) { return m_ring.allocate(size, alignment); }
+    void end_frame(UINT64 fence_value) { m_ring.end_frame(fence_value); }
+    upload_ring const &ring() const { return m_ring; }
+    ID3D12Resource *resource() const { return m_resource; }
+
+    uint8_t *cpu_base() override { return m_mapped_data; }
+    uint64_t gpu_base() override { return m_resource->GetGPUVirtualAddress(); }
+    size_t size() const override { return m_size; }
+    uint64_t completed_fence() override { return m_fence->GetCompletedValue(); }
+    void wait_fence(uint64_t value) override;
+
+private:
+    ID3D12Resource *m_resource = nullptr;
+    BYTE *m_mapped_data = nullptr;
+    ID3D12Fence *m_fence = nullptr;
+    HANDLE m_fence_event = nullptr;
+    size_t m_size = 0;
+    upload_ring m_ring;
+};
+
+// Shader visible CBV/SRV/UAV heap whose slots come from a descriptor_allocator,
+// so descriptors are created where the allocator says instead of at fixed offsets.
+class COMMON_API descriptor_heap
+{
+public:
+    descriptor_heap(ID3D12Device *device, UINT persistent_count, UINT per_frame_count, const char *name);
+    ~descriptor_heap();
+    descriptor_heap(descriptor_heap const &) = delete;
+    descriptor_heap &operator=(descriptor_heap const &) = delete;
+
+    // A failed allocation means the heap was created too small
+    descriptor_range allocate(UINT count);
+    void free(descriptor_range range);
+
+    // frame_index is the back buffer index, the GPU must be done with that frame's previous descriptors
+    void begin_frame(UINT frame_index);
+    descriptor_range allocate_transient(UINT count);
+
+    // Handle of the descriptor at index in the range, the GPU handle of the first descriptor binds the whole range as a table
+    D3D12_CPU_DESCRIPTOR_HANDLE cpu(descriptor_range range, UINT index = 0) const
+    {
+        ASSERT2(range.type == m_allocator.type(), "The descriptor range belongs to a heap of another type.");
+        return {m_cpu_start.ptr + SIZE_T(range.first + index) * m_increment_size};
+    }
+    D3D12_GPU_DESCRIPTOR_HANDLE gpu(descriptor_range range, UINT index = 0) const
+    {
+        ASSERT2(range.type == m_allocator.type(), "The descriptor range belongs to a heap of another type.");
+        return {m_gpu_start.ptr + UINT64(range.first + index) * m_increment_size};
+    }
+
+    ID3D12DescriptorHeap *heap() const { return m_heap; }
+    descriptor_allocator const &allocator() const { return m_allocator; }
+
+private:
+    ID3D12DescriptorHeap *m_heap = nullptr;
+    D3D12_CPU_DESCRIPTOR_HANDLE m_cpu_start = {};
+    D3D12_GPU_DESCRIPTOR_HANDLE m_gpu_start = {};
+    UINT m_increment_size = 0;
+    descriptor_allocator m_allocator;
+};
+
+COMMON_API D3D12_RESOURCE_STATES to_d3d12_states(resource_states states);
+
+// Issues the barriers of a render_graph on a command list, with a PIX event around every pass
+class COMMON_API d3d12_render_graph_backend : public render_graph_backend
+{
+public:
+    explicit d3d12_render_graph_backend(ID3D12GraphicsCommandList *cmd_list) : m_cmd_list(cmd_list) {}
+
+    void barriers(render_graph::barrier const *barriers, size_t count) override;
+    void begin_pass(const char *name) override { PIXBeginEvent(m_cmd_list, 1, name); }
+    void end_pass() override { PIXEndEvent(m_cmd_list); }
+
+private:
+    ID3D12GraphicsCommandList *m_cmd_list = nullptr;
+    std::vector<D3D12_RESOURCE_BARRIER> m_d3d12_barriers;
+};
+
+// Same as above, the data goes through the upload ring instead of an upload resource of its own.
+// Without data, only the default resource is created.
+COMMON_API void create_default_buffer(ID3D12Device *device, ID3D12GraphicsCommandList *cmd_list, d3d12_upload_ring *uploads,
+                                      const void *data, size_t byte_size,
+                                      ID3D12Resource **default_resource, const char *name, D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_NONE);
+
 COMMON_API void create_mesh_data(ID3D12Device *device, ID3D12GraphicsCommandList *cmd_list, const char *name,
                                  size_t vertex_stride, size_t vertex_count, void *vertex_data,
                                  size_t index_stride, size_t index_count, void *index_data,
@@ -109,12 +206,27 @@ public:
     void copy_data(int elementIndex, const void *data);
     void clear_data();
 
+    // Contiguous elements in one streaming copy, instead of a copy_data per element.
+    // Not for constant buffers, their elements are padded: write them with write_span.
+    void copy_range(size_t first_element, const void *data, size_t element_count);
+
+    // Converts the source elements while writing them, convert(Src const &, Dst &) fills each element
+    template <typename Dst, typename Src, typename Fn>
+    void write_span(size_t first_element, const Src *data, size_t element_count, Fn convert)
+    {
+        ASSERT2(sizeof(Dst) <= m_element_byte_size, "The destination type is larger than the buffer's elements.");
+        ASSERT2(first_element + element_count <= m_max_element_count, "Writing past the end of the upload buffer.");
+        stream_convert(&m_mapped_data[first_element * m_element_byte_size], m_element_byte_size, data, element_count,
+                       [&convert](const Src &src, void *dst) { convert(src, *static_cast<Dst *>(dst)); });
+    }
+
     const char *name;
     ID3D12Resource *m_uploadbuffer = nullptr;
     size_t m_buffer_size = 0;
     UINT m_max_element_count = 0;
     BYTE *m_mapped_data = nullptr;
     size_t m_element_byte_size = 0;
+    bool m_is_constant_buffer = false;
 };
 
 //#ifdef DX12_ENABLE_DEBUG_LAYER
@@ -242,7 +354,6 @@ struct COMMON_API device_resources
 
     D3D12_CPU_DESCRIPTOR_HANDLE rtv_descriptor_handles[NUM_BACK_BUFFERS];
     ID3D12Resource *back_buffers[NUM_BACK_BUFFERS];
-    UINT srv_desc_handle_incr_size = 0;
     UINT rtv_handle_incr_size = 0;
 
     // command objects
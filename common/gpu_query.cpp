@@ -41,7 +41,7 @@ gpu_query::~gpu_query()
     safe_release(m_query_rb_buffer);
 }
 
-void gpu_query::start(std::string query_name)
+void gpu_query::start(std::string const &query_name)
 {
     if (m_queries.find(query_name) == m_queries.end())
         m_queries[query_name].index = m_num_queries++;
@@ -53,7 +53,7 @@ void gpu_query::start(std::string query_name)
     m_cmd_list->EndQuery(m_query_heap, D3D12_QUERY_TYPE_TIMESTAMP, buffer_start);
 }
 
-void gpu_query::stop(std::string query_name)
+void gpu_query::stop(std::string const &query_name)
 {
     if (m_queries.empty())
         return;
@@ -64,7 +64,7 @@ void gpu_query::stop(std::string query_name)
     m_cmd_list->EndQuery(m_query_heap, D3D12_QUERY_TYPE_TIMESTAMP, buffer_end);
 }
 
-double gpu_query::result(std::string query_name)
+double gpu_query::result(std::string const &query_name)
 {
     if (m_queries.empty())
         return 0.0;
@@ -12,10 +12,10 @@ public:
     COMMON_API gpu_query(ID3D12Device *device, ID3D12GraphicsCommandList *cmd_list, ID3D12CommandQueue *cmd_queue, UINT *backbuffer_index, UINT num_queries);
     COMMON_API ~gpu_query();
 
-    COMMON_API void start(std::string query_name);
-    COMMON_API void stop(std::string query_name);
+    COMMON_API void start(std::string const &query_name);
+    COMMON_API void stop(std::string const &query_name);
     COMMON_API void resolve();
-    COMMON_API double result(std::string query_name);
+    COMMON_API double result(std::string const &query_name);
 
 private:
     ID3D12GraphicsCommandList *m_cmd_list;
@@ -0,0 +1,169 @@
+#pragma once
+#include "common.h"
+#include <climits>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Typed reference to an item of a handle_registry.
+// The generation changes every time a slot is reused, so a handle to a removed item never finds the item that replaced it.
+template <typename T>
+struct handle
+{
+    UINT index = UINT_MAX;
+    UINT generation = 0;
+
+    bool is_null() const { return index == UINT_MAX; }
+    bool operator==(handle const &other) const { return index == other.index && generation == other.generation; }
+    bool operator!=(handle const &other) const { return !(*this == other); }
+};
+
+// Maps generational handles to the dense index of their item, for the containers below.
+// Removing an item moves the last item into its place, and its slot is updated to the new index.
+class handle_slots
+{
+public:
+    // Returns the handle of an item appended to the dense storage
+    template <typename T>
+    handle<T> add()
+    {
+        UINT slot_index;
+        if (m_free_list != UINT_MAX)
+        {
+            slot_index = m_free_list;
+            m_free_list = m_slots[slot_index].dense_index;
+        }
+        else
+        {
+            slot_index = (UINT)m_slots.size();
+            m_slots.push_back({0, 1});
+        }
+
+        m_slots[slot_index].dense_index = (UINT)m_item_slots.size();
+        m_item_slots.push_back(slot_index);
+        return {slot_index, m_slots[slot_index].generation};
+    }
+
+    // Returns the dense index of the removed item, the caller moves its last item there
+    UINT remove(UINT slot_index)
+    {
+        UINT dense_index = m_slots[slot_index].dense_index;
+        UINT last = (UINT)m_item_slots.size() - 1;
+        if (dense_index != last)
+        {
+            m_item_slots[dense_index] = m_item_slots[last];
+            m_slots[m_item_slots[dense_index]].dense_index = dense_index;
+        }
+        m_item_slots.pop_back();
+
+        slot &s = m_slots[slot_index];
+        s.generation++;
+        s.dense_index = m_free_list;
+        m_free_list = slot_index;
+        return dense_index;
+    }
+
+    bool is_valid(UINT slot_index, UINT generation) const
+    {
+        return slot_index < m_slots.size() && m_slots[slot_index].generation == generation;
+    }
+
+    UINT dense_index(UINT slot_index) const { return m_slots[slot_index].dense_index; }
+
+    template <typename T>
+    handle<T> handle_at(size_t dense_index) const
+    {
+        UINT slot_index = m_item_slots[dense_index];
+        return {slot_index, m_slots[slot_index].generation};
+    }
+
+private:
+    struct slot
+    {
+        UINT dense_index; // Next free slot when the slot is on the free list
+        UINT generation;
+    };
+
+    std::vector<UINT> m_item_slots;
+    std::vector<slot> m_slots;
+    UINT m_free_list = UINT_MAX;
+};
+
+// Dense storage of items referenced by generational handles.
+// Items are contiguous and iterated without indirection, removing one moves the last item into its place.
+// Handles go through a slot that points to the item's dense index, so they stay valid when other items move.
+template <typename T>
+class handle_registry
+{
+public:
+    handle<T> add(T item)
+    {
+        m_items.push_back(std::move(item));
+        return m_slots.add<T>();
+    }
+
+    bool remove(handle<T> h)
+    {
+        if (!is_valid(h))
+            return false;
+
+        UINT dense_index = m_slots.remove(h.index);
+        if (dense_index != m_items.size() - 1)
+            m_items[dense_index] = std::move(m_items.back());
+        m_items.pop_back();
+        return true;
+    }
+
+    bool is_valid(handle<T> h) const { return m_slots.is_valid(h.index, h.generation); }
+
+    // Returns nullptr for a stale or null handle
+    T *get(handle<T> h) { return is_valid(h) ? &m_items[m_slots.dense_index(h.index)] : nullptr; }
+    T const *get(handle<T> h) const { return is_valid(h) ? &m_items[m_slots.dense_index(h.index)] : nullptr; }
+
+    void clear()
+    {
+        while (!m_items.empty())
+            remove(handle_at(m_items.size() - 1));
+    }
+
+    // Dense access, the order changes when items are removed
+    size_t size() const { return m_items.size(); }
+    bool empty() const { return m_items.empty(); }
+    T &operator[](size_t dense_index) { return m_items[dense_index]; }
+    T const &operator[](size_t dense_index) const { return m_items[dense_index]; }
+    handle<T> handle_at(size_t dense_index) const { return m_slots.handle_at<T>(dense_index); }
+
+    typename std::vector<T>::iterator begin() { return m_items.begin(); }
+    typename std::vector<T>::iterator end() { return m_items.end(); }
+    typename std::vector<T>::const_iterator begin() const { return m_items.begin(); }
+    typename std::vector<T>::const_iterator end() const { return m_items.end(); }
+
+private:
+    std::vector<T> m_items;
+    handle_slots m_slots;
+};
+
+// Interned strings, the same name is stored once and referred to by a small id.
+// Meant for names only shown in the UI, so nothing hashes or copies strings per frame.
+class name_table
+{
+public:
+    UINT intern(std::string const &name)
+    {
+        auto it = m_ids.find(name);
+        if (it != m_ids.end())
+            return it->second;
+
+        UINT id = (UINT)m_names.size();
+        m_names.push_back(name);
+        m_ids.emplace(name, id);
+        return id;
+    }
+
+    char const *str(UINT id) const { return m_names[id].c_str(); }
+
+private:
+    std::vector<std::string> m_names;
+    std::unordered_map<std::string, UINT> m_ids;
+};
@@ -0,0 +1,166 @@
+#include "pch.h"
+#include "lod_selector.h"
+#include <immintrin.h>
+#include <algorithm>
+
+using namespace DirectX;
+
+lod_selector::lod_selector(float const *thresholds, size_t num_lods, float hysteresis)
+{
+    ASSERT2(num_lods > 0 && num_lods <= m_max_lods, "A LOD selector needs between 1 and 8 LODs.");
+    for (size_t i = 0; i < num_lods; i++)
+    {
+        ASSERT2(i == 0 || thresholds[i] < thresholds[i - 1], "LOD thresholds have to be in decreasing order.");
+        m_thresholds[i] = thresholds[i];
+    }
+    m_num_lods = num_lods;
+    m_hysteresis = hysteresis;
+    m_use_avx2 = cpu_supports_avx2();
+}
+
+void lod_selector::set_camera(camera const &cam, float viewport_height)
+{
+    m_eye_pos = cam.m_transform.m_translation;
+    m_forward = cam.m_transform.m_forward;
+    m_size_scale = cam.m_proj(1, 1) * viewport_height;
+}
+
+void lod_selector::reset()
+{
+    std::fill(m_lods.begin(), m_lods.end(), m_no_lod);
+}
+
+void lod_selector::select(sphere_soa const &spheres, std::vector<UINT> *lod_lists)
+{
+    for (size_t i = 0; i < m_num_lods; i++)
+    {
+        lod_lists[i].clear();
+    }
+    m_lods.resize(spheres.padded_size(), m_no_lod);
+
+    if (m_use_avx2)
+        select_avx2(spheres, lod_lists);
+    else
+        select_sse(spheres, lod_lists);
+}
+
+// The LOD is the number of thresholds the size is under.
+// It's counted against the thresholds pushed down and up by the hysteresis,
+// and the previous LOD is clamped between the two counts, so it only changes when the size is clearly past a threshold.
+void lod_selector::select_avx2(sphere_soa const &spheres, std::vector<UINT> *lod_lists)
+{
+    __m256 eye_x = _mm256_set1_ps(m_eye_pos.x);
+    __m256 eye_y = _mm256_set1_ps(m_eye_pos.y);
+    __m256 eye_z = _mm256_set1_ps(m_eye_pos.z);
+    __m256 forward_x = _mm256_set1_ps(m_forward.x);
+    __m256 forward_y = _mm256_set1_ps(m_forward.y);
+    __m256 forward_z = _mm256_set1_ps(m_forward.z);
+    __m256 size_scale = _mm256_set1_ps(m_size_scale);
+
+    __m256 lower[m_max_lods];
+    __m256 upper[m_max_lods];
+    __m256 threshold[m_max_lods];
+    for (size_t k = 0; k < m_num_lods; k++)
+    {
+        lower[k] = _mm256_set1_ps(m_thresholds[k] * (1.f - m_hysteresis));
+        upper[k] = _mm256_set1_ps(m_thresholds[k] * (1.f + m_hysteresis));
+        threshold[k] = _mm256_set1_ps(m_thresholds[k]);
+    }
+    __m256i no_lod = _mm256_set1_epi32(m_no_lod);
+
+    alignas(32) int lods[8];
+    size_t count = spheres.size();
+    for (size_t i = 0; i < count; i += 8)
+    {
+        // Depth along the view direction, clamped to the radius for the spheres the camera is in
+        __m256 radius = _mm256_loadu_ps(&spheres.m_radius[i]);
+        __m256 depth = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&spheres.m_center_x[i]), eye_x), forward_x);
+        depth = _mm256_add_ps(depth, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&spheres.m_center_y[i]), eye_y), forward_y));
+        depth = _mm256_add_ps(depth, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&spheres.m_center_z[i]), eye_z), forward_z));
+        depth = _mm256_max_ps(depth, radius);
+        __m256 size = _mm256_div_ps(_mm256_mul_ps(radius, size_scale), depth);
+
+        // Compare masks are -1, subtracting them counts the thresholds
+        __m256i coarse = _mm256_setzero_si256();
+        __m256i fine = _mm256_setzero_si256();
+        __m256i exact = _mm256_setzero_si256();
+        for (size_t k = 0; k < m_num_lods; k++)
+        {
+            coarse = _mm256_sub_epi32(coarse, _mm256_castps_si256(_mm256_cmp_ps(size, lower[k], _CMP_LT_OQ)));
+            fine = _mm256_sub_epi32(fine, _mm256_castps_si256(_mm256_cmp_ps(size, upper[k], _CMP_LT_OQ)));
+            exact = _mm256_sub_epi32(exact, _mm256_castps_si256(_mm256_cmp_ps(size, threshold[k], _CMP_LT_OQ)));
+        }
+
+        __m256i previous = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<__m128i const *>(&m_lods[i])));
+        previous = _mm256_blendv_epi8(previous, exact, _mm256_cmpeq_epi32(previous, no_lod));
+        __m256i lod = _mm256_min_epi32(_mm256_max_epi32(previous, coarse), fine);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lods), lod);
+
+        size_t num_lanes = std::min<size_t>(8, count - i);
+        for (size_t lane = 0; lane < num_lanes; lane++)
+        {
+            m_lods[i + lane] = UINT8(lods[lane]);
+            if (size_t(lods[lane]) < m_num_lods)
+                lod_lists[lods[lane]].push_back(UINT(i + lane));
+        }
+    }
+    _mm256_zeroupper();
+}
+
+void lod_selector::select_sse(sphere_soa const &spheres, std::vector<UINT> *lod_lists)
+{
+    __m128 eye_x = _mm_set1_ps(m_eye_pos.x);
+    __m128 eye_y = _mm_set1_ps(m_eye_pos.y);
+    __m128 eye_z = _mm_set1_ps(m_eye_pos.z);
+    __m128 forward_x = _mm_set1_ps(m_forward.x);
+    __m128 forward_y = _mm_set1_ps(m_forward.y);
+    __m128 forward_z = _mm_set1_ps(m_forward.z);
+    __m128 size_scale = _mm_set1_ps(m_size_scale);
+
+    __m128 lower[m_max_lods];
+    __m128 upper[m_max_lods];
+    __m128 threshold[m_max_lods];
+    for (size_t k = 0; k < m_num_lods; k++)
+    {
+        lower[k] = _mm_set1_ps(m_thresholds[k] * (1.f - m_hysteresis));
+        upper[k] = _mm_set1_ps(m_thresholds[k] * (1.f + m_hysteresis));
+        threshold[k] = _mm_set1_ps(m_thresholds[k]);
+    }
+
+    alignas(16) int coarse_lods[4];
+    alignas(16) int fine_lods[4];
+    alignas(16) int exact_lods[4];
+    size_t count = spheres.size();
+    for (size_t i = 0; i < count; i += 4)
+    {
+        __m128 radius = _mm_loadu_ps(&spheres.m_radius[i]);
+        __m128 depth = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&spheres.m_center_x[i]), eye_x), forward_x);
+        depth = _mm_add_ps(depth, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&spheres.m_center_y[i]), eye_y), forward_y));
+        depth = _mm_add_ps(depth, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&spheres.m_center_z[i]), eye_z), forward_z));
+        depth = _mm_max_ps(depth, radius);
+        __m128 size = _mm_div_ps(_mm_mul_ps(radius, size_scale), depth);
+
+        __m128i coarse = _mm_setzero_si128();
+        __m128i fine = _mm_setzero_si128();
+        __m128i exact = _mm_setzero_si128();
+        for (size_t k = 0; k < m_num_lods; k++)
+        {
+            coarse = _mm_sub_epi32(coarse, _mm_castps_si128(_mm_cmplt_ps(size, lower[k])));
+            fine = _mm_sub_epi32(fine, _mm_castps_si128(_mm_cmplt_ps(size, upper[k])));
+            exact = _mm_sub_epi32(exact, _mm_castps_si128(_mm_cmplt_ps(size, threshold[k])));
+        }
+        _mm_store_si128(reinterpret_cast<__m128i *>(coarse_lods), coarse);
+        _mm_store_si128(reinterpret_cast<__m128i *>(fine_lods), fine);
+        _mm_store_si128(reinterpret_cast<__m128i *>(exact_lods), exact);
+
+        size_t num_lanes = std::min<size_t>(4, count - i);
+        for (size_t lane = 0; lane < num_lanes; lane++)
+        {
+            int previous = m_lods[i + lane] == m_no_lod ? exact_lods[lane] : m_lods[i + lane];
+            int lod = std::min(std::max(previous, coarse_lods[lane]), fine_lods[lane]);
+            m_lods[i + lane] = UINT8(lod);
+            if (size_t(lod) < m_num_lods)
+                lod_lists[lod].push_back(UINT(i + lane));
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include "common.h"
+#include "camera.h"
+#include <DirectXCollision.h>
+#include <vector>
+
+// Bounding spheres stored SoA, padded to a multiple of 8 like aabb_soa
+struct sphere_soa
+{
+    static constexpr size_t m_simd_width = 8;
+
+    void resize(size_t count)
+    {
+        m_count = count;
+        size_t padded_count = align_up(count, m_simd_width);
+        m_center_x.resize(padded_count, 0.f);
+        m_center_y.resize(padded_count, 0.f);
+        m_center_z.resize(padded_count, 0.f);
+        m_radius.resize(padded_count, 0.f);
+    }
+
+    void set(size_t index, DirectX::BoundingSphere const &sphere)
+    {
+        m_center_x[index] = sphere.Center.x;
+        m_center_y[index] = sphere.Center.y;
+        m_center_z[index] = sphere.Center.z;
+        m_radius[index] = sphere.Radius;
+    }
+
+    size_t size() const { return m_count; }
+    size_t padded_size() const { return m_center_x.size(); }
+
+    size_t m_count = 0;
+    std::vector<float> m_center_x;
+    std::vector<float> m_center_y;
+    std::vector<float> m_center_z;
+    std::vector<float> m_radius;
+};
+
+// Picks a level of detail per object from the projected diameter of its bounding sphere, in pixels.
+// LOD i is used while the diameter is above m_thresholds[i], objects below the last threshold are dropped.
+// To stop objects from flickering between two LODs, an object only changes LOD once its size is
+// past the threshold by more than the hysteresis fraction.
+// Runs 8 objects per iteration with AVX2, 4 with SSE when it's not available.
+class lod_selector
+{
+public:
+    static constexpr size_t m_max_lods = 8;
+
+    // thresholds are in pixels, in decreasing order
+    COMMON_API lod_selector(float const *thresholds, size_t num_lods, float hysteresis = 0.1f);
+
+    COMMON_API void set_camera(camera const &cam, float viewport_height);
+
+    // Fills one list of object indices per LOD, ready to be used as instance IDs.
+    // The LOD of every object is kept for the hysteresis of the next call, reset() forgets them.
+    COMMON_API void select(sphere_soa const &spheres, std::vector<UINT> *lod_lists);
+    COMMON_API void reset();
+
+    size_t num_lods() const { return m_num_lods; }
+
+    // num_lods() when the object was dropped
+    UINT8 lod(size_t index) const { return m_lods[index]; }
+
+private:
+    void select_avx2(sphere_soa const &spheres, std::vector<UINT> *lod_lists);
+    void select_sse(sphere_soa const &spheres, std::vector<UINT> *lod_lists);
+
+    float m_thresholds[m_max_lods] = {};
+    size_t m_num_lods = 0;
+    float m_hysteresis = 0.f;
+
+    DirectX::XMFLOAT3 m_eye_pos;
+    DirectX::XMFLOAT3 m_forward;
+
+    // Projected diameter of a sphere of radius 1 at a depth of 1, in pixels
+    float m_size_scale = 0.f;
+
+    // The LOD picked for every object last time, m_no_lod when it has none yet
+    static constexpr UINT8 m_no_lod = 0xFF;
+    std::vector<UINT8> m_lods;
+    bool m_use_avx2 = false;
+};
@@ -0,0 +1,479 @@
+#include "occlusion_buffer.h"
+#include "cpu_features.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#ifdef _MSC_VER
+#define AVX2_FUNCTION
+#else
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+using namespace DirectX;
+
+namespace
+{
+XMFLOAT4X4 multiply(XMFLOAT4X4 const &a, XMFLOAT4X4 const &b)
+{
+    XMFLOAT4X4 result;
+    for (int row = 0; row < 4; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            result.m[row][col] = a.m[row][0] * b.m[0][col] + a.m[row][1] * b.m[1][col] +
+                                 a.m[row][2] * b.m[2][col] + a.m[row][3] * b.m[3][col];
+        }
+    }
+    return result;
+}
+
+// Row vector convention, like the rest of the engine
+void transform_point(XMFLOAT4X4 const &m, float x, float y, float z, float out[4])
+{
+    for (int col = 0; col < 4; col++)
+    {
+        out[col] = x * m.m[0][col] + y * m.m[1][col] + z * m.m[2][col] + m.m[3][col];
+    }
+}
+
+constexpr float min_w = 1e-5f;
+
+// Clusters of the occluder simplification, so that their indices fit in 16 bits
+constexpr unsigned int max_grid_size = 40;
+
+// Edge function and depth plane of a triangle in pixel space: value = a * x + b * y + c
+struct triangle_setup
+{
+    float edge_a[3];
+    float edge_b[3];
+    float edge_c[3];
+    float z_a;
+    float z_b;
+    float z_c;
+    int min_x;
+    int max_x;
+    int min_y;
+    int max_y;
+};
+
+// Returns false when the triangle covers no pixel
+template <typename vertex>
+bool setup_triangle(vertex const &v0, vertex const &v1_in, vertex const &v2_in, int width, int height, triangle_setup &setup)
+{
+    float area = (v1_in.x - v0.x) * (v2_in.y - v0.y) - (v1_in.y - v0.y) * (v2_in.x - v0.x);
+    if (area == 0.f)
+        return false;
+
+    // Occluders are rasterized from both sides, flip the winding so the inside of every edge is positive
+    vertex const &v1 = area > 0.f ? v1_in : v2_in;
+    vertex const &v2 = area > 0.f ? v2_in : v1_in;
+    area = fabsf(area);
+
+    setup.min_x = std::max(0, int(floorf(std::min(std::min(v0.x, v1.x), v2.x))));
+    setup.max_x = std::min(width - 1, int(ceilf(std::max(std::max(v0.x, v1.x), v2.x))));
+    setup.min_y = std::max(0, int(floorf(std::min(std::min(v0.y, v1.y), v2.y))));
+    setup.max_y = std::min(height - 1, int(ceilf(std::max(std::max(v0.y, v1.y), v2.y))));
+    if (setup.min_x > setup.max_x || setup.min_y > setup.max_y)
+        return false;
+
+    // Edge i is opposite of vertex i, so it's also the barycentric weight of vertex i once divided by the area
+    vertex const *corners[3] = {&v0, &v1, &v2};
+    for (int i = 0; i < 3; i++)
+    {
+        vertex const &a = *corners[(i + 1) % 3];
+        vertex const &b = *corners[(i + 2) % 3];
+        setup.edge_a[i] = a.y - b.y;
+        setup.edge_b[i] = b.x - a.x;
+        setup.edge_c[i] = -(setup.edge_a[i] * a.x + setup.edge_b[i] * a.y);
+    }
+
+    float inv_area = 1.f / area;
+    setup.z_a = (setup.edge_a[0] * v0.z + setup.edge_a[1] * v1.z + setup.edge_a[2] * v2.z) * inv_area;
+    setup.z_b = (setup.edge_b[0] * v0.z + setup.edge_b[1] * v1.z + setup.edge_b[2] * v2.z) * inv_area;
+    setup.z_c = (setup.edge_c[0] * v0.z + setup.edge_c[1] * v1.z + setup.edge_c[2] * v2.z) * inv_area;
+    return true;
+}
+} // namespace
+
+occluder_mesh simplify_occluder(XMFLOAT3 const *positions, size_t stride, size_t vertex_count,
+                                unsigned short const *indices, size_t index_count, unsigned int grid_size)
+{
+    occluder_mesh result;
+    if (vertex_count == 0 || index_count < 3)
+        return result;
+    grid_size = std::min(std::max(grid_size, 1u), max_grid_size);
+
+    char const *position_bytes = reinterpret_cast<char const *>(positions);
+    auto position = [&](size_t i) -> XMFLOAT3 const & { return *reinterpret_cast<XMFLOAT3 const *>(position_bytes + i * stride); };
+
+    float min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (size_t i = 0; i < vertex_count; i++)
+    {
+        float const *p = &position(i).x;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            min[axis] = std::min(min[axis], p[axis]);
+            max[axis] = std::max(max[axis], p[axis]);
+        }
+    }
+
+    float cell_scale[3];
+    for (int axis = 0; axis < 3; axis++)
+        cell_scale[axis] = max[axis] > min[axis] ? grid_size / (max[axis] - min[axis]) : 0.f;
+
+    // Every vertex goes to the cluster of its cell, the clusters are numbered in order of first use
+    std::vector<int> cell_clusters(size_t(grid_size) * grid_size * grid_size, -1);
+    std::vector<unsigned short> vertex_clusters(vertex_count);
+    std::vector<unsigned int> cluster_counts;
+    for (size_t i = 0; i < vertex_count; i++)
+    {
+        float const *p = &position(i).x;
+        unsigned int cell[3];
+        for (int axis = 0; axis < 3; axis++)
+            cell[axis] = std::min(grid_size - 1, static_cast<unsigned int>((p[axis] - min[axis]) * cell_scale[axis]));
+
+        int &cluster = cell_clusters[(size_t(cell[2]) * grid_size + cell[1]) * grid_size + cell[0]];
+        if (cluster < 0)
+        {
+            cluster = int(result.positions.size());
+            result.positions.push_back(XMFLOAT3(0.f, 0.f, 0.f));
+            cluster_counts.push_back(0);
+        }
+        vertex_clusters[i] = (unsigned short)cluster;
+
+        XMFLOAT3 &sum = result.positions[cluster];
+        sum.x += p[0];
+        sum.y += p[1];
+        sum.z += p[2];
+        cluster_counts[cluster]++;
+    }
+
+    for (size_t i = 0; i < result.positions.size(); i++)
+    {
+        float inv_count = 1.f / cluster_counts[i];
+        result.positions[i].x *= inv_count;
+        result.positions[i].y *= inv_count;
+        result.positions[i].z *= inv_count;
+    }
+
+    // Occluders are rasterized from both sides, so a triangle is the same as any permutation of its corners
+    std::vector<uint64_t> triangles;
+    triangles.reserve(index_count / 3);
+    for (size_t i = 0; i + 2 < index_count; i += 3)
+    {
+        uint64_t a = vertex_clusters[indices[i]];
+        uint64_t b = vertex_clusters[indices[i + 1]];
+        uint64_t c = vertex_clusters[indices[i + 2]];
+        if (a == b || b == c || a == c)
+            continue;
+
+        if (a > b)
+            std::swap(a, b);
+        if (b > c)
+            std::swap(b, c);
+        if (a > b)
+            std::swap(a, b);
+        triangles.push_back(a << 32 | b << 16 | c);
+    }
+    std::sort(triangles.begin(), triangles.end());
+    triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+
+    result.indices.reserve(triangles.size() * 3);
+    for (uint64_t triangle : triangles)
+    {
+        result.indices.push_back((unsigned short)(triangle >> 32));
+        result.indices.push_back((unsigned short)(triangle >> 16));
+        result.indices.push_back((unsigned short)triangle);
+    }
+    return result;
+}
+
+occlusion_buffer::occlusion_buffer(unsigned int width, unsigned int height)
+    : m_width((width + 7) & ~7u), m_height(height)
+{
+    m_use_avx2 = cpu_supports_avx2();
+
+    unsigned int level_width = m_width;
+    unsigned int level_height = m_height;
+    for (;;)
+    {
+        m_levels.emplace_back(size_t(level_width) * level_height, 1.f);
+        m_level_widths.push_back(level_width);
+        m_level_heights.push_back(level_height);
+        if (level_width == 1 && level_height == 1)
+            break;
+        level_width = (level_width + 1) / 2;
+        level_height = (level_height + 1) / 2;
+    }
+}
+
+void occlusion_buffer::begin(XMFLOAT4X4 const &view_proj)
+{
+    m_view_proj = view_proj;
+    m_y_scale = sqrtf(view_proj._12 * view_proj._12 + view_proj._22 * view_proj._22 + view_proj._32 * view_proj._32);
+    std::fill(m_levels[0].begin(), m_levels[0].end(), 1.f);
+}
+
+float occlusion_buffer::projected_size(BoundingSphere const &world_sphere) const
+{
+    float clip[4];
+    transform_point(m_view_proj, world_sphere.Center.x, world_sphere.Center.y, world_sphere.Center.z, clip);
+    if (clip[3] <= world_sphere.Radius)
+        return FLT_MAX;
+    return world_sphere.Radius * m_y_scale * m_height / clip[3];
+}
+
+occlusion_buffer::screen_vertex occlusion_buffer::to_screen(clip_vertex const &v) const
+{
+    float inv_w = 1.f / v.w;
+    screen_vertex s;
+    s.x = (v.x * inv_w * 0.5f + 0.5f) * m_width;
+    s.y = (0.5f - v.y * inv_w * 0.5f) * m_height;
+    s.z = v.z * inv_w;
+    s.w = v.w;
+    return s;
+}
+
+void occlusion_buffer::rasterize(XMFLOAT3 const *positions, size_t stride, size_t vertex_count,
+                                 unsigned short const *indices, size_t index_count, XMFLOAT4X4 const &world)
+{
+    XMFLOAT4X4 to_clip = multiply(world, m_view_proj);
+
+    // Project every vertex once, w = 0 marks the ones in front of the near plane
+    m_clip_vertices.resize(vertex_count);
+    m_screen_vertices.resize(vertex_count);
+    char const *position_bytes = reinterpret_cast<char const *>(positions);
+    for (size_t i = 0; i < vertex_count; i++)
+    {
+        XMFLOAT3 const &p = *reinterpret_cast<XMFLOAT3 const *>(position_bytes + i * stride);
+        float clip[4];
+        transform_point(to_clip, p.x, p.y, p.z, clip);
+        clip_vertex &c = m_clip_vertices[i];
+        c = {clip[0], clip[1], clip[2], clip[3]};
+
+        if (c.w < min_w || c.z < 0.f)
+            m_screen_vertices[i].w = 0.f;
+        else
+            m_screen_vertices[i] = to_screen(c);
+    }
+
+    for (size_t i = 0; i + 2 < index_count; i += 3)
+    {
+        screen_vertex const &v0 = m_screen_vertices[indices[i]];
+        screen_vertex const &v1 = m_screen_vertices[indices[i + 1]];
+        screen_vertex const &v2 = m_screen_vertices[indices[i + 2]];
+        if (v0.w == 0.f || v1.w == 0.f || v2.w == 0.f)
+            rasterize_clipped(m_clip_vertices[indices[i]], m_clip_vertices[indices[i + 1]], m_clip_vertices[indices[i + 2]]);
+        else
+            draw_triangle(v0, v1, v2);
+    }
+}
+
+// Sutherland-Hodgman against the near plane (z = 0) and against w = min_w so nothing divides by 0,
+// each plane adds at most one vertex and the polygon is drawn as a fan
+void occlusion_buffer::rasterize_clipped(clip_vertex const &v0, clip_vertex const &v1, clip_vertex const &v2)
+{
+    clip_vertex polygon[5] = {v0, v1, v2};
+    clip_vertex clipped[5];
+    int count = 3;
+    for (int plane = 0; plane < 2; plane++)
+    {
+        auto distance = [plane](clip_vertex const &v) { return plane == 0 ? v.z : v.w - min_w; };
+
+        int clipped_count = 0;
+        for (int i = 0; i < count; i++)
+        {
+            clip_vertex const &a = polygon[i];
+            clip_vertex const &b = polygon[(i + 1) % count];
+            float distance_a = distance(a);
+            float distance_b = distance(b);
+            if (distance_a >= 0.f)
+                clipped[clipped_count++] = a;
+            if ((distance_a >= 0.f) != (distance_b >= 0.f))
+            {
+                float t = distance_a / (distance_a - distance_b);
+                clipped[clipped_count++] = {a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t};
+            }
+        }
+
+        count = clipped_count;
+        if (count < 3)
+            return;
+        std::copy(clipped, clipped + count, polygon);
+    }
+
+    screen_vertex screen[5];
+    for (int i = 0; i < count; i++)
+        screen[i] = to_screen(polygon[i]);
+    for (int i = 1; i + 1 < count; i++)
+        draw_triangle(screen[0], screen[i], screen[i + 1]);
+}
+
+void occlusion_buffer::draw_triangle(screen_vertex const &v0, screen_vertex const &v1, screen_vertex const &v2)
+{
+    if (m_use_avx2)
+        rasterize_triangle_avx2(v0, v1, v2);
+    else
+        rasterize_triangle(v0, v1, v2);
+}
+
+void occlusion_buffer::rasterize_triangle(screen_vertex const &v0, screen_vertex const &v1, screen_vertex const &v2)
+{
+    triangle_setup setup;
+    if (!setup_triangle(v0, v1, v2, int(m_width), int(m_height), setup))
+        return;
+
+    __m128 lane_offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    __m128 edge_a[3];
+    for (int i = 0; i < 3; i++)
+        edge_a[i] = _mm_set1_ps(setup.edge_a[i]);
+    __m128 z_a = _mm_set1_ps(setup.z_a);
+    __m128 zero = _mm_setzero_ps();
+
+    float *depth = m_levels[0].data();
+    int first_x = setup.min_x & ~3;
+    for (int y = setup.min_y; y <= setup.max_y; y++)
+    {
+        float py = y + 0.5f;
+        float *row = depth + size_t(y) * m_width;
+        for (int x = first_x; x <= setup.max_x; x += 4)
+        {
+            __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), lane_offsets);
+
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int i = 0; i < 3; i++)
+            {
+                __m128 e = _mm_add_ps(_mm_mul_ps(edge_a[i], px), _mm_set1_ps(setup.edge_b[i] * py + setup.edge_c[i]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(e, zero));
+            }
+            if (_mm_movemask_ps(inside) == 0)
+                continue;
+
+            __m128 z = _mm_add_ps(_mm_mul_ps(z_a, px), _mm_set1_ps(setup.z_b * py + setup.z_c));
+            __m128 old_z = _mm_loadu_ps(row + x);
+            __m128 new_z = _mm_min_ps(old_z, z);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, new_z), _mm_andnot_ps(inside, old_z)));
+        }
+    }
+}
+
+AVX2_FUNCTION void occlusion_buffer::rasterize_triangle_avx2(screen_vertex const &v0, screen_vertex const &v1, screen_vertex const &v2)
+{
+    triangle_setup setup;
+    if (!setup_triangle(v0, v1, v2, int(m_width), int(m_height), setup))
+        return;
+
+    __m256 lane_offsets = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+    __m256 edge_a[3];
+    for (int i = 0; i < 3; i++)
+        edge_a[i] = _mm256_set1_ps(setup.edge_a[i]);
+    __m256 z_a = _mm256_set1_ps(setup.z_a);
+    __m256 zero = _mm256_setzero_ps();
+
+    // The width is a multiple of 8, so rows are read and written 8 aligned pixels at a time
+    float *depth = m_levels[0].data();
+    int first_x = setup.min_x & ~7;
+    for (int y = setup.min_y; y <= setup.max_y; y++)
+    {
+        float py = y + 0.5f;
+        float *row = depth + size_t(y) * m_width;
+        for (int x = first_x; x <= setup.max_x; x += 8)
+        {
+            __m256 px = _mm256_add_ps(_mm256_set1_ps(float(x)), lane_offsets);
+
+            __m256 e0 = _mm256_add_ps(_mm256_mul_ps(edge_a[0], px), _mm256_set1_ps(setup.edge_b[0] * py + setup.edge_c[0]));
+            __m256 e1 = _mm256_add_ps(_mm256_mul_ps(edge_a[1], px), _mm256_set1_ps(setup.edge_b[1] * py + setup.edge_c[1]));
+            __m256 e2 = _mm256_add_ps(_mm256_mul_ps(edge_a[2], px), _mm256_set1_ps(setup.edge_b[2] * py + setup.edge_c[2]));
+            __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ), _mm256_cmp_ps(e1, zero, _CMP_GE_OQ)),
+                                          _mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+            if (_mm256_movemask_ps(inside) == 0)
+                continue;
+
+            __m256 z = _mm256_add_ps(_mm256_mul_ps(z_a, px), _mm256_set1_ps(setup.z_b * py + setup.z_c));
+            __m256 old_z = _mm256_loadu_ps(row + x);
+            _mm256_storeu_ps(row + x, _mm256_blendv_ps(old_z, _mm256_min_ps(old_z, z), inside));
+        }
+    }
+    _mm256_zeroupper();
+}
+
+void occlusion_buffer::build_hierarchy()
+{
+    for (size_t level = 1; level < m_levels.size(); level++)
+    {
+        std::vector<float> const &src = m_levels[level - 1];
+        std::vector<float> &dst = m_levels[level];
+        unsigned int src_width = m_level_widths[level - 1];
+        unsigned int src_height = m_level_heights[level - 1];
+        unsigned int dst_width = m_level_widths[level];
+        unsigned int dst_height = m_level_heights[level];
+
+        for (unsigned int y = 0; y < dst_height; y++)
+        {
+            unsigned int y0 = y * 2;
+            unsigned int y1 = std::min(y0 + 1, src_height - 1);
+            for (unsigned int x = 0; x < dst_width; x++)
+            {
+                unsigned int x0 = x * 2;
+                unsigned int x1 = std::min(x0 + 1, src_width - 1);
+                dst[y * dst_width + x] = std::max(std::max(src[y0 * src_width + x0], src[y0 * src_width + x1]),
+                                                  std::max(src[y1 * src_width + x0], src[y1 * src_width + x1]));
+            }
+        }
+    }
+}
+
+bool occlusion_buffer::is_visible(BoundingBox const &world_box) const
+{
+    float min_x = FLT_MAX, min_y = FLT_MAX, min_z = FLT_MAX;
+    float max_x = -FLT_MAX, max_y = -FLT_MAX;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        float x = world_box.Center.x + ((corner & 1) ? world_box.Extents.x : -world_box.Extents.x);
+        float y = world_box.Center.y + ((corner & 2) ? world_box.Extents.y : -world_box.Extents.y);
+        float z = world_box.Center.z + ((corner & 4) ? world_box.Extents.z : -world_box.Extents.z);
+        float clip[4];
+        transform_point(m_view_proj, x, y, z, clip);
+
+        // The box crosses the near plane, the camera could be inside it
+        if (clip[3] < min_w || clip[2] < 0.f)
+            return true;
+
+        float inv_w = 1.f / clip[3];
+        float sx = (clip[0] * inv_w * 0.5f + 0.5f) * m_width;
+        float sy = (0.5f - clip[1] * inv_w * 0.5f) * m_height;
+        min_x = std::min(min_x, sx);
+        max_x = std::max(max_x, sx);
+        min_y = std::min(min_y, sy);
+        max_y = std::max(max_y, sy);
+        min_z = std::min(min_z, clip[2] * inv_w);
+    }
+
+    if (max_x < 0.f || max_y < 0.f || min_x >= float(m_width) || min_y >= float(m_height) || min_z > 1.f)
+        return false;
+
+    int x0 = std::max(0, int(min_x));
+    int y0 = std::max(0, int(min_y));
+    int x1 = std::min(int(m_width) - 1, int(max_x));
+    int y1 = std::min(int(m_height) - 1, int(max_y));
+
+    // Go down the pyramid until the box covers at most 4x4 texels
+    size_t level = 0;
+    while (level + 1 < m_levels.size() && ((x1 >> level) - (x0 >> level) >= 4 || (y1 >> level) - (y0 >> level) >= 4))
+        level++;
+
+    std::vector<float> const &depth = m_levels[level];
+    unsigned int level_width = m_level_widths[level];
+    for (int y = y0 >> level; y <= (y1 >> level); y++)
+    {
+        for (int x = x0 >> level; x <= (x1 >> level); x++)
+        {
+            if (min_z <= depth[y * level_width + x])
+                return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "common_api.h"
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+#include <cstddef>
+#include <vector>
+
+// Simplified copy of a mesh to rasterize as an occluder. The vertices are clustered on a grid over the mesh bounds,
+// each cluster becomes one vertex at the average position, and the triangles that collapse or repeat are dropped.
+// The result strays from the mesh by up to one cell, so the grid has to stay fine compared to what it hides.
+struct occluder_mesh
+{
+    std::vector<DirectX::XMFLOAT3> positions;
+    std::vector<unsigned short> indices;
+};
+
+// grid_size is the number of cells along each axis, clamped so the clusters fit in 16 bit indices
+COMMON_API occluder_mesh simplify_occluder(DirectX::XMFLOAT3 const *positions, size_t stride, size_t vertex_count,
+                                           unsigned short const *indices, size_t index_count, unsigned int grid_size);
+
+// Software occlusion culling.
+// Occluder triangles are rasterized at low resolution into a depth buffer (8 pixels at a time with AVX2, 4 with SSE),
+// then a max depth pyramid is built over it so a box only reads a handful of texels to know if it's hidden.
+// Depth is the post projection z in [0, 1], with 1 on the far plane.
+class occlusion_buffer
+{
+public:
+    // The width is rounded up to a multiple of 8
+    COMMON_API occlusion_buffer(unsigned int width, unsigned int height);
+
+    // Clears the depth to the far plane
+    COMMON_API void begin(DirectX::XMFLOAT4X4 const &view_proj);
+
+    // Height of a sphere on the buffer in pixels, with the view_proj of the last begin().
+    // FLT_MAX when the camera is inside the sphere. Used to pick the occluders worth rasterizing.
+    COMMON_API float projected_size(DirectX::BoundingSphere const &world_sphere) const;
+
+    // positions points to the first vertex position, stride is the byte size of a vertex.
+    // Triangles crossing the near plane are clipped against it.
+    COMMON_API void rasterize(DirectX::XMFLOAT3 const *positions, size_t stride, size_t vertex_count,
+                              unsigned short const *indices, size_t index_count, DirectX::XMFLOAT4X4 const &world);
+
+    // Call once every occluder is rasterized, before testing
+    COMMON_API void build_hierarchy();
+
+    // Conservative: only returns false when the box is fully behind the occluders or off screen
+    COMMON_API bool is_visible(DirectX::BoundingBox const &world_box) const;
+
+    unsigned int width() const { return m_width; }
+    unsigned int height() const { return m_height; }
+    float depth(unsigned int x, unsigned int y) const { return m_levels[0][y * m_width + x]; }
+
+private:
+    struct clip_vertex
+    {
+        float x;
+        float y;
+        float z;
+        float w;
+    };
+
+    struct screen_vertex
+    {
+        float x;
+        float y;
+        float z;
+        float w;
+    };
+
+    screen_vertex to_screen(clip_vertex const &v) const;
+    void rasterize_clipped(clip_vertex const &v0, clip_vertex const &v1, clip_vertex const &v2);
+    void draw_triangle(screen_vertex const &v0, screen_vertex const &v1, screen_vertex const &v2);
+    void rasterize_triangle(screen_vertex const &v0, screen_vertex const &v1, screen_vertex const &v2);
+    void rasterize_triangle_avx2(screen_vertex const &v0, screen_vertex const &v1, screen_vertex const &v2);
+
+    unsigned int m_width = 0;
+    unsigned int m_height = 0;
+    DirectX::XMFLOAT4X4 m_view_proj;
+    float m_y_scale = 0.f; // Clip space y of a unit length at a depth of 1
+    bool m_use_avx2 = false;
+
+    // m_levels[0] is the rasterized depth, each next level is the max of 2x2 texels of the previous one
+    std::vector<std::vector<float>> m_levels;
+    std::vector<unsigned int> m_level_widths;
+    std::vector<unsigned int> m_level_heights;
+
+    std::vector<clip_vertex> m_clip_vertices;
+    std::vector<screen_vertex> m_screen_vertices;
+};
@@ -0,0 +1,126 @@
+#include "pch.h"
+#include "picker.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+using namespace DirectX;
+
+BoundingBox picker::world_bounds(object const &obj) const
+{
+    BoundingBox bounds;
+    obj.local_bounds.Transform(bounds, XMLoadFloat4x4(&obj.world));
+    return bounds;
+}
+
+UINT picker::add(triangle_bvh const *mesh, BoundingBox const &local_bounds, XMFLOAT4X4 const &world, UINT user_data)
+{
+    UINT id = UINT(m_objects.size());
+    if (!m_free_ids.empty())
+    {
+        id = m_free_ids.back();
+        m_free_ids.pop_back();
+    }
+
+    object obj;
+    obj.mesh = mesh;
+    obj.local_bounds = local_bounds;
+    obj.user_data = user_data;
+    obj.world = world;
+    XMStoreFloat4x4(&obj.inv_world, XMMatrixInverse(nullptr, XMLoadFloat4x4(&world)));
+    obj.proxy = m_bvh.insert(world_bounds(obj), id);
+
+    if (id == m_objects.size())
+        m_objects.push_back(obj);
+    else
+        m_objects[id] = obj;
+    return id;
+}
+
+void picker::remove(UINT id)
+{
+    ASSERT2(id < m_objects.size() && m_objects[id].proxy != dynamic_bvh::null_node, "Invalid picker object id.");
+    object &obj = m_objects[id];
+    m_bvh.remove(obj.proxy);
+    obj.proxy = dynamic_bvh::null_node;
+    obj.mesh = nullptr;
+    m_free_ids.push_back(id);
+}
+
+void picker::set_world(UINT id, XMFLOAT4X4 const &world)
+{
+    // A removed object has no proxy to move
+    ASSERT2(id < m_objects.size() && m_objects[id].proxy != dynamic_bvh::null_node, "Invalid picker object id.");
+    object &obj = m_objects[id];
+    if (memcmp(&obj.world, &world, sizeof(world)) == 0)
+        return;
+
+    obj.world = world;
+    XMStoreFloat4x4(&obj.inv_world, XMMatrixInverse(nullptr, XMLoadFloat4x4(&world)));
+    m_bvh.move(obj.proxy, world_bounds(obj));
+}
+
+bool picker::pick(XMFLOAT3 const &origin, XMFLOAT3 const &direction, hit_result &result) const
+{
+    // The ray goes to each object's local space without being normalized,
+    // so distances along it stay in world units and can be compared between objects.
+    struct nearest_hit : dynamic_bvh::ray_callback
+    {
+        std::vector<object> const *objects;
+        XMVECTOR origin;
+        XMVECTOR direction;
+        bool has_hit = false;
+        hit_result nearest;
+
+        float hit(UINT id, float max_distance) override
+        {
+            object const &obj = (*objects)[id];
+            XMMATRIX inv_world = XMLoadFloat4x4(&obj.inv_world);
+            XMVECTOR local_origin = XMVector3TransformCoord(origin, inv_world);
+            XMVECTOR local_dir = XMVector3TransformNormal(direction, inv_world);
+
+            float distance = max_distance;
+            bool is_hit = false;
+            if (obj.mesh && !obj.mesh->empty())
+            {
+                XMFLOAT3 o, d;
+                XMStoreFloat3(&o, local_origin);
+                XMStoreFloat3(&d, local_dir);
+                is_hit = obj.mesh->intersect(o, d, distance);
+            }
+            else
+            {
+                // BoundingBox wants a unit direction, scale its distance back to the ray's units
+                float length = XMVectorGetX(XMVector3Length(local_dir));
+                float box_distance = 0.f;
+                if (length > 0.f && obj.local_bounds.Intersects(local_origin, XMVectorScale(local_dir, 1.f / length), box_distance))
+                {
+                    box_distance /= length;
+                    is_hit = box_distance < max_distance;
+                    distance = box_distance;
+                }
+            }
+
+            if (!is_hit)
+                return max_distance;
+
+            has_hit = true;
+            nearest.id = id;
+            nearest.user_data = obj.user_data;
+            nearest.distance = distance;
+
+            // Only what is closer than this hit is left to visit
+            return distance;
+        }
+    };
+
+    nearest_hit callback;
+    callback.objects = &m_objects;
+    callback.origin = XMVectorSet(origin.x, origin.y, origin.z, 1.f);
+    callback.direction = XMVectorSet(direction.x, direction.y, direction.z, 0.f);
+    m_bvh.query_ray(origin, direction, FLT_MAX, callback);
+
+    if (callback.has_hit)
+        result = callback.nearest;
+    return callback.has_hit;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "common.h"
+#include "dynamic_bvh.h"
+#include "triangle_bvh.h"
+#include <DirectXCollision.h>
+#include <vector>
+
+// Ray picking over a set of objects that each reference a mesh's triangle BVH.
+// The inverse world transform of an object is only recomputed when its world transform changes,
+// the world bounds go through a dynamic BVH, and the nearest object on the ray is refined against its triangles.
+class picker
+{
+public:
+    struct hit_result
+    {
+        UINT id = 0;
+        UINT user_data = 0;
+        float distance = 0.f;
+    };
+
+    // Returns the id of the new object.
+    // Objects without triangles (null or empty mesh) are picked against their local bounds.
+    COMMON_API UINT add(triangle_bvh const *mesh, DirectX::BoundingBox const &local_bounds, DirectX::XMFLOAT4X4 const &world, UINT user_data);
+    COMMON_API void set_world(UINT id, DirectX::XMFLOAT4X4 const &world);
+
+    // The id gets reused by the next add
+    COMMON_API void remove(UINT id);
+
+    // Finds the nearest hit, the distance is in units of the direction's length
+    COMMON_API bool pick(DirectX::XMFLOAT3 const &origin, DirectX::XMFLOAT3 const &direction, hit_result &result) const;
+
+private:
+    struct object
+    {
+        DirectX::XMFLOAT4X4 world;
+        DirectX::XMFLOAT4X4 inv_world;
+        DirectX::BoundingBox local_bounds;
+        triangle_bvh const *mesh = nullptr;
+        int proxy = dynamic_bvh::null_node;
+        UINT user_data = 0;
+    };
+
+    DirectX::BoundingBox world_bounds(object const &obj) const;
+
+    std::vector<object> m_objects;
+    std::vector<UINT> m_free_ids;
+    dynamic_bvh m_bvh;
+};
@@ -0,0 +1,410 @@
+#include "render_graph.h"
+#include <algorithm>
+
+render_graph::resource_id render_graph::import_resource(const char *name, void *native, resource_states initial_state)
+{
+    resource r;
+    r.name = name;
+    r.native = native;
+    r.is_imported = true;
+    r.initial_state = initial_state;
+    m_resources.push_back(r);
+    return (resource_id)m_resources.size() - 1;
+}
+
+render_graph::resource_id render_graph::import_resource(const char *name, void *native, resource_states initial_state, resource_states final_state)
+{
+    resource_id id = import_resource(name, native, initial_state);
+    m_resources[id].has_final_state = true;
+    m_resources[id].final_state = final_state;
+    return id;
+}
+
+render_graph::resource_id render_graph::create_transient(const char *name, transient_desc const &desc)
+{
+    resource r;
+    r.name = name;
+    r.desc = desc;
+    m_resources.push_back(r);
+    return (resource_id)m_resources.size() - 1;
+}
+
+render_graph::pass_builder render_graph::add_pass(const char *name, std::function<void()> execute)
+{
+    m_passes.emplace_back();
+    m_passes.back().name = name;
+    m_passes.back().execute = std::move(execute);
+    return pass_builder(this, (uint32_t)m_passes.size() - 1);
+}
+
+void render_graph::add_access(uint32_t pass, resource_id resource, resource_states state, uint32_t mode)
+{
+    m_added_accesses.push_back({pass, resource, state, mode});
+}
+
+void render_graph::reset()
+{
+    m_resources.clear();
+    m_passes.clear();
+    m_added_accesses.clear();
+    m_accesses.clear();
+    m_schedule.clear();
+    m_barriers.clear();
+    m_batches.clear();
+    m_transients.clear();
+    m_transient_heap_size = 0;
+    m_error.clear();
+}
+
+bool render_graph::compile()
+{
+    m_accesses.clear();
+    m_schedule.clear();
+    m_barriers.clear();
+    m_batches.clear();
+    m_transients.clear();
+    m_transient_heap_size = 0;
+    m_error.clear();
+    for (resource &r : m_resources)
+    {
+        r.is_used = false;
+        r.first_level = UINT32_MAX;
+        r.last_level = 0;
+        r.heap_offset = 0;
+    }
+
+    if (!gather_accesses())
+        return false;
+
+    cull_passes();
+    schedule_passes();
+    place_transients();
+    plan_barriers();
+    return true;
+}
+
+// Groups the accesses by pass, in the order the passes were added,
+// and merges the accesses of a pass to the same resource
+bool render_graph::gather_accesses()
+{
+    std::stable_sort(m_added_accesses.begin(), m_added_accesses.end(),
+                     [](access const &a, access const &b) { return a.pass < b.pass; });
+
+    size_t next = 0;
+    for (uint32_t p = 0; p < (uint32_t)m_passes.size(); p++)
+    {
+        pass &current = m_passes[p];
+        current.first_access = (uint32_t)m_accesses.size();
+
+        for (; next < m_added_accesses.size() && m_added_accesses[next].pass == p; next++)
+        {
+            access const &added = m_added_accesses[next];
+            auto same_resource = std::find_if(m_accesses.begin() + current.first_access, m_accesses.end(),
+                                              [&](access const &a) { return a.resource == added.resource; });
+            if (same_resource == m_accesses.end())
+            {
+                m_accesses.push_back(added);
+                continue;
+            }
+
+            // A resource is in one state for the whole pass, only read-only states combine
+            if (same_resource->state != added.state && (!is_read_only(same_resource->state) || !is_read_only(added.state)))
+            {
+                m_error = std::string("The pass ") + current.name + " uses " + m_resources[added.resource].name + " in states that don't combine.";
+                return false;
+            }
+            same_resource->state |= added.state;
+            same_resource->mode |= added.mode;
+        }
+
+        current.access_count = (uint32_t)m_accesses.size() - current.first_access;
+    }
+    return true;
+}
+
+// Walks the passes backwards: a pass is live when something after it needs what it writes.
+// A pass only writing a resource replaces its content, the passes before it don't need to write it.
+void render_graph::cull_passes()
+{
+    m_needed.assign(m_resources.size(), false);
+
+    for (size_t p = m_passes.size(); p-- > 0;)
+    {
+        pass &current = m_passes[p];
+        current.is_live = current.has_side_effect;
+        for (uint32_t i = 0; i < current.access_count && !current.is_live; i++)
+        {
+            access const &a = m_accesses[current.first_access + i];
+            if ((a.mode & access_write) && (m_resources[a.resource].is_imported || m_needed[a.resource]))
+                current.is_live = true;
+        }
+
+        if (!current.is_live)
+            continue;
+
+        for (uint32_t i = 0; i < current.access_count; i++)
+        {
+            access const &a = m_accesses[current.first_access + i];
+            if (a.mode & access_read)
+                m_needed[a.resource] = true;
+            else
+                m_needed[a.resource] = false;
+        }
+    }
+}
+
+// A pass comes after the last pass writing what it uses, and a pass writing a resource comes after the passes reading it.
+// A pass with side effects comes after every pass added before it, its effects can depend on them without a resource.
+// The passes are grouped by level, a level only depends on the levels before it.
+void render_graph::schedule_passes()
+{
+    constexpr uint32_t none = UINT32_MAX;
+    m_last_write_level.assign(m_resources.size(), none);
+    m_last_read_level.assign(m_resources.size(), none);
+
+    uint32_t level_count = 0;
+    for (pass &current : m_passes)
+    {
+        if (!current.is_live)
+            continue;
+
+        // Last in its level when it's the level of the last scheduled pass, the passes of a level keep their order
+        uint32_t level = current.has_side_effect && level_count > 0 ? level_count - 1 : 0;
+        for (uint32_t i = 0; i < current.access_count; i++)
+        {
+            access const &a = m_accesses[current.first_access + i];
+            if (m_last_write_level[a.resource] != none)
+                level = std::max(level, m_last_write_level[a.resource] + 1);
+            if ((a.mode & access_write) && m_last_read_level[a.resource] != none)
+                level = std::max(level, m_last_read_level[a.resource] + 1);
+        }
+
+        for (uint32_t i = 0; i < current.access_count; i++)
+        {
+            access const &a = m_accesses[current.first_access + i];
+            if (a.mode & access_write)
+            {
+                m_last_write_level[a.resource] = level;
+                m_last_read_level[a.resource] = none;
+            }
+            else
+            {
+                uint32_t last_read = m_last_read_level[a.resource];
+                m_last_read_level[a.resource] = last_read == none ? level : std::max(last_read, level);
+            }
+
+            resource &r = m_resources[a.resource];
+            r.is_used = true;
+            r.first_level = std::min(r.first_level, level);
+            r.last_level = std::max(r.last_level, level);
+        }
+
+        current.level = level;
+        level_count = std::max(level_count, level + 1);
+    }
+
+    // Counting sort by level, stable so the passes of a level keep the order they were added in
+    m_batches.assign(level_count, {0, 0, 0, 0});
+    for (pass const &current : m_passes)
+    {
+        if (current.is_live)
+            m_batches[current.level].scheduled_count++;
+    }
+
+    uint32_t first = 0;
+    for (batch &b : m_batches)
+    {
+        b.first_scheduled = first;
+        first += b.scheduled_count;
+        b.scheduled_count = 0;
+    }
+
+    m_schedule.resize(first);
+    for (uint32_t p = 0; p < (uint32_t)m_passes.size(); p++)
+    {
+        if (!m_passes[p].is_live)
+            continue;
+
+        batch &b = m_batches[m_passes[p].level];
+        m_schedule[b.first_scheduled + b.scheduled_count++] = p;
+    }
+}
+
+// Greedy placement, largest first: each transient resource goes at the lowest offset
+// not used by a placed resource alive in any of the same levels
+void render_graph::place_transients()
+{
+    for (resource_id id = 0; id < (resource_id)m_resources.size(); id++)
+    {
+        if (!m_resources[id].is_imported && m_resources[id].is_used)
+            m_transients.push_back(id);
+    }
+
+    std::stable_sort(m_transients.begin(), m_transients.end(), [&](resource_id a, resource_id b) {
+        return m_resources[a].desc.size > m_resources[b].desc.size;
+    });
+
+    for (size_t i = 0; i < m_transients.size(); i++)
+    {
+        resource &r = m_resources[m_transients[i]];
+        uint64_t offset = 0;
+
+        // Moves past every overlapping resource until a full pass over the placed ones finds no overlap
+        bool moved = true;
+        while (moved)
+        {
+            moved = false;
+            for (size_t j = 0; j < i; j++)
+            {
+                resource const &placed = m_resources[m_transients[j]];
+                bool lifetimes_overlap = placed.first_level <= r.last_level && r.first_level <= placed.last_level;
+                bool memory_overlaps = placed.heap_offset < offset + r.desc.size && offset < placed.heap_offset + placed.desc.size;
+                if (lifetimes_overlap && memory_overlaps)
+                {
+                    uint64_t alignment = std::max<uint64_t>(r.desc.alignment, 1);
+                    offset = (placed.heap_offset + placed.desc.size + alignment - 1) / alignment * alignment;
+                    moved = true;
+                }
+            }
+        }
+
+        r.heap_offset = offset;
+        m_transient_heap_size = std::max(m_transient_heap_size, offset + r.desc.size);
+    }
+}
+
+// One batch of barriers before every level.
+// A resource read in different states by the passes of a level is transitioned once to the combination of the states,
+// and a resource already in read-only states covering the needed ones isn't transitioned at all.
+void render_graph::plan_barriers()
+{
+    for (resource &r : m_resources)
+    {
+        r.state = r.initial_state;
+        r.was_written = false;
+        r.level_stamp = UINT32_MAX;
+    }
+
+    for (uint32_t level = 0; level < (uint32_t)m_batches.size(); level++)
+    {
+        batch &b = m_batches[level];
+        b.first_barrier = (uint32_t)m_barriers.size();
+
+        m_level_resources.clear();
+        for (uint32_t s = 0; s < b.scheduled_count; s++)
+        {
+            pass const &current = m_passes[m_schedule[b.first_scheduled + s]];
+            for (uint32_t i = 0; i < current.access_count; i++)
+            {
+                access const &a = m_accesses[current.first_access + i];
+                resource &r = m_resources[a.resource];
+                if (r.level_stamp != level)
+                {
+                    r.level_stamp = level;
+                    r.level_state = state_common;
+                    r.level_writes = false;
+                    m_level_resources.push_back(a.resource);
+                }
+                r.level_state |= a.state;
+                r.level_writes |= (a.mode & access_write) != 0;
+            }
+        }
+
+        for (resource_id id : m_level_resources)
+        {
+            resource &r = m_resources[id];
+            resource_states needed = r.level_state;
+            bool is_covered = r.state == needed ||
+                              (needed != state_common && is_read_only(r.state) && (r.state & needed) == needed);
+
+            if (!r.is_imported && r.first_level == level)
+            {
+                // A transient resource starts in the state of its first use, after taking over its memory
+                barrier alias;
+                alias.type = barrier::aliasing;
+                alias.resource = id;
+                size_t previous_owners = 0;
+                for (resource_id previous : m_transients)
+                {
+                    resource const &p = m_resources[previous];
+                    bool memory_overlaps = p.heap_offset < r.heap_offset + r.desc.size && r.heap_offset < p.heap_offset + p.desc.size;
+                    if (previous != id && memory_overlaps && p.last_level < level)
+                    {
+                        alias.resource_before = previous;
+                        previous_owners++;
+                    }
+                }
+
+                // Memory used by several resources before aliases "any resource", memory used by none needs no barrier
+                if (previous_owners > 1)
+                    alias.resource_before = invalid_resource;
+                if (previous_owners > 0)
+                    m_barriers.push_back(alias);
+                r.initial_state = needed;
+                r.state = needed;
+            }
+            else if (!is_covered)
+            {
+                barrier transition;
+                transition.type = barrier::transition;
+                transition.resource = id;
+                transition.state_before = r.state;
+                transition.state_after = needed;
+                m_barriers.push_back(transition);
+                r.state = needed;
+            }
+            else if (r.state == state_unordered_access && r.was_written)
+            {
+                barrier uav;
+                uav.type = barrier::uav;
+                uav.resource = id;
+                m_barriers.push_back(uav);
+            }
+            r.was_written = r.level_writes;
+        }
+
+        b.barrier_count = (uint32_t)m_barriers.size() - b.first_barrier;
+    }
+
+    // Imported resources leave the graph in their final state
+    batch last = {(uint32_t)m_barriers.size(), 0, (uint32_t)m_schedule.size(), 0};
+    for (resource_id id = 0; id < (resource_id)m_resources.size(); id++)
+    {
+        resource const &r = m_resources[id];
+        if (!r.has_final_state || r.state == r.final_state)
+            continue;
+
+        barrier transition;
+        transition.type = barrier::transition;
+        transition.resource = id;
+        transition.state_before = r.state;
+        transition.state_after = r.final_state;
+        m_barriers.push_back(transition);
+    }
+    last.barrier_count = (uint32_t)m_barriers.size() - last.first_barrier;
+    if (last.barrier_count > 0)
+        m_batches.push_back(last);
+}
+
+void render_graph::execute(render_graph_backend &backend)
+{
+    for (barrier &b : m_barriers)
+    {
+        b.native = m_resources[b.resource].native;
+        b.native_before = b.resource_before != invalid_resource ? m_resources[b.resource_before].native : nullptr;
+    }
+
+    for (batch const &b : m_batches)
+    {
+        if (b.barrier_count > 0)
+            backend.barriers(&m_barriers[b.first_barrier], b.barrier_count);
+
+        for (uint32_t s = 0; s < b.scheduled_count; s++)
+        {
+            pass &current = m_passes[m_schedule[b.first_scheduled + s]];
+            backend.begin_pass(current.name);
+            current.execute();
+            backend.end_pass();
+        }
+    }
+}
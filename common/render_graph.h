@@ -0,0 +1,283 @@
+#pragma once
+// The D3D12 backend is d3d12_render_graph_backend in gpu_interface.h.
+#include "common_api.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Resource states, as flags so that read-only states can be combined like D3D12 states
+enum resource_state : uint32_t
+{
+    state_common = 0,
+    state_present = 0,
+    state_vertex_and_constant_buffer = 1 << 0,
+    state_index_buffer = 1 << 1,
+    state_render_target = 1 << 2,
+    state_unordered_access = 1 << 3,
+    state_depth_write = 1 << 4,
+    state_depth_read = 1 << 5,
+    state_non_pixel_shader_resource = 1 << 6,
+    state_pixel_shader_resource = 1 << 7,
+    state_indirect_argument = 1 << 8,
+    state_copy_dest = 1 << 9,
+    state_copy_source = 1 << 10,
+};
+using resource_states = uint32_t;
+
+constexpr resource_states write_states = state_render_target | state_unordered_access | state_depth_write | state_copy_dest;
+inline bool is_read_only(resource_states states) { return (states & write_states) == 0; }
+
+class render_graph_backend;
+
+// Frame graph: passes declare the resources they read and write, and the graph works out the rest.
+// compile() culls the passes whose results are never used, orders the others by dependency level,
+// batches the state transitions of each level into one barrier call, skips the transitions to states the resource is already in,
+// and places transient resources with disjoint lifetimes at the same offset of a shared heap.
+// The passes of a level don't depend on each other, they run in the order they were added.
+// A pass with side effects never runs before the passes added before it.
+// The graph is rebuilt every frame: reset() keeps the allocations.
+class render_graph
+{
+public:
+    using resource_id = uint32_t;
+    static constexpr resource_id invalid_resource = UINT32_MAX;
+
+    struct transient_desc
+    {
+        uint64_t size = 0;
+        uint64_t alignment = 64 * 1024;
+    };
+
+    struct barrier
+    {
+        enum barrier_type
+        {
+            transition,
+            uav,      // Orders two accesses to a resource staying in state_unordered_access
+            aliasing, // A transient resource takes over the memory of resource_before, or of several resources when invalid
+        };
+
+        barrier_type type = transition;
+        resource_id resource = invalid_resource;
+        resource_id resource_before = invalid_resource;
+        resource_states state_before = state_common;
+        resource_states state_after = state_common;
+
+        // Set from the resources' native handles when the graph is executed
+        void *native = nullptr;
+        void *native_before = nullptr;
+    };
+
+    class pass_builder
+    {
+    public:
+        pass_builder(render_graph *graph, uint32_t pass) : m_graph(graph), m_pass(pass) {}
+
+        // Reads need the content written by the previous passes, writes replace it
+        pass_builder &read(resource_id resource, resource_states state)
+        {
+            m_graph->add_access(m_pass, resource, state, access_read);
+            return *this;
+        }
+        pass_builder &write(resource_id resource, resource_states state)
+        {
+            m_graph->add_access(m_pass, resource, state, access_write);
+            return *this;
+        }
+        pass_builder &read_write(resource_id resource, resource_states state)
+        {
+            m_graph->add_access(m_pass, resource, state, access_read | access_write);
+            return *this;
+        }
+
+        // The pass has effects outside of the graph's resources, it is never culled and runs after the passes added before it
+        pass_builder &side_effect()
+        {
+            m_graph->m_passes[m_pass].has_side_effect = true;
+            return *this;
+        }
+
+    private:
+        render_graph *m_graph;
+        uint32_t m_pass;
+    };
+
+    // Resources created outside of the graph, in the given state when the graph starts.
+    // Writing one has an effect outside of the graph, so its writers are never culled.
+    COMMON_API resource_id import_resource(const char *name, void *native, resource_states initial_state);
+
+    // Transitioned to final_state after its last use
+    COMMON_API resource_id import_resource(const char *name, void *native, resource_states initial_state, resource_states final_state);
+
+    // Resources only used inside the graph, placed in the transient heap by compile().
+    // The first pass using one must write all of it, its content doesn't survive the frame.
+    COMMON_API resource_id create_transient(const char *name, transient_desc const &desc);
+
+    // The native resource of a transient resource is created from its heap offset after compile
+    void set_native(resource_id resource, void *native) { m_resources[resource].native = native; }
+    void *native(resource_id resource) const { return m_resources[resource].native; }
+
+    COMMON_API pass_builder add_pass(const char *name, std::function<void()> execute);
+
+    // Returns false when a pass uses a resource in states that don't combine, see error()
+    COMMON_API bool compile();
+    COMMON_API void execute(render_graph_backend &backend);
+
+    // Forgets the passes and resources, keeps the allocations
+    COMMON_API void reset();
+
+    std::string const &error() const { return m_error; }
+
+    // Compiled schedule, the passes are indices in the order they were added
+    std::vector<uint32_t> const &schedule() const { return m_schedule; }
+    std::vector<barrier> const &barriers() const { return m_barriers; }
+    bool is_culled(uint32_t pass) const { return !m_passes[pass].is_live; }
+    size_t pass_count() const { return m_passes.size(); }
+    size_t resource_count() const { return m_resources.size(); }
+    size_t culled_pass_count() const { return m_passes.size() - m_schedule.size(); }
+    size_t barrier_batch_count() const { return m_batches.size(); }
+    const char *pass_name(uint32_t pass) const { return m_passes[pass].name; }
+    const char *resource_name(resource_id resource) const { return m_resources[resource].name; }
+
+    // Offset in the transient heap, the heap holds every transient resource of the frame
+    uint64_t transient_offset(resource_id resource) const { return m_resources[resource].heap_offset; }
+
+    // For a transient resource, the state of its first use, to create it in
+    resource_states initial_state(resource_id resource) const { return m_resources[resource].initial_state; }
+    uint64_t transient_heap_size() const { return m_transient_heap_size; }
+
+private:
+    enum access_mode : uint32_t
+    {
+        access_read = 1 << 0,
+        access_write = 1 << 1,
+    };
+
+    struct resource
+    {
+        const char *name = nullptr;
+        void *native = nullptr;
+        bool is_imported = false;
+        bool has_final_state = false;
+        resource_states initial_state = state_common;
+        resource_states final_state = state_common;
+        transient_desc desc;
+
+        // Compiled
+        resource_states state = state_common;
+        bool was_written = false; // By the last level using it, for UAV barriers
+        bool is_used = false;
+        uint32_t level_stamp = UINT32_MAX; // Level whose states are gathered in level_state
+        resource_states level_state = state_common;
+        bool level_writes = false;
+        uint32_t first_level = UINT32_MAX;
+        uint32_t last_level = 0;
+        uint64_t heap_offset = 0;
+    };
+
+    struct access
+    {
+        uint32_t pass;
+        resource_id resource;
+        resource_states state;
+        uint32_t mode;
+    };
+
+    struct pass
+    {
+        const char *name = nullptr;
+        std::function<void()> execute;
+        bool has_side_effect = false;
+
+        // Compiled
+        uint32_t first_access = 0;
+        uint32_t access_count = 0;
+        bool is_live = false;
+        uint32_t level = 0;
+    };
+
+    // Passes of the same dependency level, with the barriers to issue before them
+    struct batch
+    {
+        uint32_t first_barrier;
+        uint32_t barrier_count;
+        uint32_t first_scheduled;
+        uint32_t scheduled_count;
+    };
+
+    COMMON_API void add_access(uint32_t pass, resource_id resource, resource_states state, uint32_t mode);
+    bool gather_accesses();
+    void cull_passes();
+    void schedule_passes();
+    void place_transients();
+    void plan_barriers();
+
+    std::vector<resource> m_resources;
+    std::vector<pass> m_passes;
+    std::vector<access> m_added_accesses;
+
+    // Compiled
+    std::vector<access> m_accesses; // Grouped by pass, one per resource used by the pass
+    std::vector<uint32_t> m_schedule;
+    std::vector<barrier> m_barriers;
+    std::vector<batch> m_batches;
+    std::vector<bool> m_needed;
+    std::vector<uint32_t> m_last_write_level;
+    std::vector<uint32_t> m_last_read_level;
+    std::vector<resource_id> m_transients;
+    std::vector<resource_id> m_level_resources;
+    uint64_t m_transient_heap_size = 0;
+    std::string m_error;
+};
+
+// Issues the compiled barriers and brackets the passes, one implementation per graphics API
+class render_graph_backend
+{
+public:
+    virtual ~render_graph_backend() = default;
+    virtual void barriers(render_graph::barrier const *barriers, size_t count) = 0;
+    virtual void begin_pass(const char *name) = 0;
+    virtual void end_pass() = 0;
+};
+
+// Backend recording what it is asked to do, to check and benchmark the compiled graphs without a GPU
+class render_graph_recorder : public render_graph_backend
+{
+public:
+    struct event
+    {
+        enum event_type
+        {
+            barrier,
+            begin_pass,
+            end_pass,
+        };
+
+        event_type type;
+        const char *pass_name;
+        render_graph::barrier barrier_data;
+    };
+
+    void barriers(render_graph::barrier const *barriers, size_t count) override
+    {
+        for (size_t i = 0; i < count; i++)
+            m_events.push_back({event::barrier, nullptr, barriers[i]});
+        m_barrier_calls++;
+    }
+    void begin_pass(const char *name) override { m_events.push_back({event::begin_pass, name, {}}); }
+    void end_pass() override { m_events.push_back({event::end_pass, nullptr, {}}); }
+
+    std::vector<event> const &events() const { return m_events; }
+    size_t barrier_calls() const { return m_barrier_calls; }
+    void clear()
+    {
+        m_events.clear();
+        m_barrier_calls = 0;
+    }
+
+private:
+    std::vector<event> m_events;
+    size_t m_barrier_calls = 0;
+};
@@ -52,7 +52,7 @@ struct cpu_timer
         return (double)current_time.QuadPart;
     }
 
-    void start(std::string name)
+    void start(std::string const &name)
     {
         measurement cpu_time = {};
         cpu_time.start_time = get_timestamp();
@@ -63,20 +63,20 @@ struct cpu_timer
         timers[name].clock_cycles = clock_cycles;
     }
 
-    void stop(std::string name)
+    void stop(std::string const &name)
     {
         timers[name].cpu_time.end_time = get_timestamp();
         timers[name].clock_cycles.end_cycle = __rdtsc();
     }
 
-    double result_ms(std::string name)
+    double result_ms(std::string const &name)
     {
         measurement cpu_time = timers[name].cpu_time;
         double delta = cpu_time.end_time - cpu_time.start_time;
         return (delta / cpu_frequency) * milliseconds;
     }
 
-    UINT64 result_cycles(std::string name)
+    UINT64 result_cycles(std::string const &name)
     {
         measurement cpu_cycles = timers[name].clock_cycles;
         return cpu_cycles.end_cycle - cpu_cycles.start_cycle;
@@ -0,0 +1,55 @@
+#include "stream_copy.h"
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define STREAM_COPY_SSE2 1
+#endif
+
+namespace
+{
+// Below this, the fence and the partial lines cost more than the cache pollution saved
+constexpr size_t min_stream_size = 256;
+constexpr size_t line_size = 64;
+} // namespace
+
+void stream_copy(void *dst, void const *src, size_t size)
+{
+#if STREAM_COPY_SSE2
+    if (size < min_stream_size)
+    {
+        std::memcpy(dst, src, size);
+        return;
+    }
+
+    uint8_t *d = static_cast<uint8_t *>(dst);
+    uint8_t const *s = static_cast<uint8_t const *>(src);
+
+    // Partial first line, up to the next line boundary of the destination
+    size_t head = (line_size - (reinterpret_cast<uintptr_t>(d) & (line_size - 1))) & (line_size - 1);
+    std::memcpy(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    // Whole lines, the source can be unaligned
+    size_t lines = size / line_size;
+    for (size_t i = 0; i < lines; i++)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + 32));
+        __m128i e = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i *>(d), a);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(d + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(d + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i *>(d + 48), e);
+        d += line_size;
+        s += line_size;
+    }
+
+    // Partial last line
+    std::memcpy(d, s, size - lines * line_size);
+    _mm_sfence();
+#else
+    std::memcpy(dst, src, size);
+#endif
+}
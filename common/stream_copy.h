@@ -0,0 +1,41 @@
+#pragma once
+#include "common_api.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Copies into memory the CPU only writes, like mapped upload heaps.
+// Upload heaps are write-combined: the bulk of the copy uses non-temporal stores of whole 64-byte lines,
+// which skip the cache and never read the destination back. Small copies are a plain memcpy.
+// Ends with a store fence, so the data is visible before the command list that reads it is submitted.
+COMMON_API void stream_copy(void *dst, void const *src, size_t size);
+
+// Staging space of stream_convert, on the stack
+constexpr size_t stream_staging_size = 4096;
+
+// Converts count source elements into destination elements dst_stride bytes apart, like constant buffers padded to 256 bytes.
+// The elements are converted in a staging buffer that is written out with stream_copy, padding included,
+// so the destination is written once in whole lines. convert(Src const &, void *dst_element) fills each element.
+template <typename Src, typename Fn>
+void stream_convert(void *dst, size_t dst_stride, Src const *src, size_t count, Fn convert)
+{
+    alignas(64) uint8_t staging[stream_staging_size];
+    size_t batch_count = dst_stride <= sizeof(staging) ? sizeof(staging) / dst_stride : 0;
+    uint8_t *out = static_cast<uint8_t *>(dst);
+
+    if (batch_count == 0)
+    {
+        for (size_t i = 0; i < count; i++)
+            convert(src[i], out + i * dst_stride);
+        return;
+    }
+
+    for (size_t first = 0; first < count; first += batch_count)
+    {
+        size_t n = count - first < batch_count ? count - first : batch_count;
+        std::memset(staging, 0, n * dst_stride);
+        for (size_t i = 0; i < n; i++)
+            convert(src[first + i], staging + i * dst_stride);
+        stream_copy(out + first * dst_stride, staging, n * dst_stride);
+    }
+}
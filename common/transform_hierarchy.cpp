@@ -0,0 +1,201 @@
+#include "pch.h"
+#include "transform_hierarchy.h"
+#include <algorithm>
+
+using namespace DirectX;
+
+// Levels smaller than this are updated on the calling thread
+s_internal constexpr size_t min_parallel_level_size = 4096;
+s_internal constexpr size_t nodes_per_chunk = 1024;
+
+transform_hierarchy::transform_hierarchy()
+    : m_next_chunk(0), m_num_updated(0)
+{
+    m_work = CreateThreadpoolWork(update_work, this, nullptr);
+    ASSERT2(m_work != nullptr, last_error());
+}
+
+transform_hierarchy::~transform_hierarchy()
+{
+    if (m_work)
+    {
+        WaitForThreadpoolWorkCallbacks(m_work, TRUE);
+        CloseThreadpoolWork(m_work);
+    }
+}
+
+UINT transform_hierarchy::add(UINT parent, XMFLOAT3 const &translation, XMFLOAT4 const &rotation, XMFLOAT3 const &scale)
+{
+    ASSERT2(parent == null_parent || parent < m_parents.size(), "A node has to be added after its parent.");
+
+    UINT node = UINT(m_parents.size());
+    UINT depth = parent == null_parent ? 0 : m_depths[parent] + 1;
+
+    m_translation_x.push_back(translation.x);
+    m_translation_y.push_back(translation.y);
+    m_translation_z.push_back(translation.z);
+    m_rotation_x.push_back(rotation.x);
+    m_rotation_y.push_back(rotation.y);
+    m_rotation_z.push_back(rotation.z);
+    m_rotation_w.push_back(rotation.w);
+    m_scale_x.push_back(scale.x);
+    m_scale_y.push_back(scale.y);
+    m_scale_z.push_back(scale.z);
+
+    m_parents.push_back(parent);
+    m_depths.push_back(depth);
+    m_world.emplace_back();
+    m_stamps.push_back(0);
+
+    if (m_levels.size() <= depth)
+        m_levels.resize(depth + 1);
+    m_levels[depth].push_back(node);
+
+    mark_dirty(node);
+    return node;
+}
+
+void transform_hierarchy::clear()
+{
+    m_translation_x.clear();
+    m_translation_y.clear();
+    m_translation_z.clear();
+    m_rotation_x.clear();
+    m_rotation_y.clear();
+    m_rotation_z.clear();
+    m_rotation_w.clear();
+    m_scale_x.clear();
+    m_scale_y.clear();
+    m_scale_z.clear();
+
+    m_parents.clear();
+    m_depths.clear();
+    m_world.clear();
+    m_stamps.clear();
+
+    for (std::vector<UINT> &level : m_levels)
+        level.clear();
+    m_min_dirty_depth = SIZE_MAX;
+    m_max_dirty_depth = 0;
+}
+
+void transform_hierarchy::set_translation(UINT node, XMFLOAT3 const &translation)
+{
+    m_translation_x[node] = translation.x;
+    m_translation_y[node] = translation.y;
+    m_translation_z[node] = translation.z;
+    mark_dirty(node);
+}
+
+void transform_hierarchy::set_rotation(UINT node, XMFLOAT4 const &rotation)
+{
+    m_rotation_x[node] = rotation.x;
+    m_rotation_y[node] = rotation.y;
+    m_rotation_z[node] = rotation.z;
+    m_rotation_w[node] = rotation.w;
+    mark_dirty(node);
+}
+
+void transform_hierarchy::set_scale(UINT node, XMFLOAT3 const &scale)
+{
+    m_scale_x[node] = scale.x;
+    m_scale_y[node] = scale.y;
+    m_scale_z[node] = scale.z;
+    mark_dirty(node);
+}
+
+void transform_hierarchy::mark_dirty(UINT node)
+{
+    m_stamps[node] = m_current_stamp;
+    m_min_dirty_depth = std::min<size_t>(m_min_dirty_depth, m_depths[node]);
+    m_max_dirty_depth = std::max<size_t>(m_max_dirty_depth, m_depths[node]);
+}
+
+void transform_hierarchy::update()
+{
+    if (m_min_dirty_depth == SIZE_MAX)
+        return;
+
+    // The levels above the first changed node are up to date
+    for (size_t depth = m_min_dirty_depth; depth < m_levels.size(); depth++)
+    {
+        std::vector<UINT> const &level = m_levels[depth];
+
+        size_t num_updated = 0;
+        if (level.size() >= min_parallel_level_size && m_work)
+        {
+            m_chunk_nodes = level.data();
+            m_chunk_node_count = level.size();
+            m_next_chunk = 0;
+            m_num_updated = 0;
+
+            // The calling thread takes chunks too, so one less work item than there are chunks
+            size_t num_chunks = (level.size() + nodes_per_chunk - 1) / nodes_per_chunk;
+            for (size_t i = 1; i < num_chunks; i++)
+                SubmitThreadpoolWork(m_work);
+            update_chunks();
+            WaitForThreadpoolWorkCallbacks(m_work, FALSE);
+            num_updated = m_num_updated;
+        }
+        else
+        {
+            num_updated = update_nodes(level.data(), level.size());
+        }
+
+        // Nothing moved at this depth and no deeper node was changed, the rest of the tree is up to date
+        if (num_updated == 0 && depth >= m_max_dirty_depth)
+            break;
+    }
+
+    m_current_stamp++;
+    m_min_dirty_depth = SIZE_MAX;
+    m_max_dirty_depth = 0;
+}
+
+void CALLBACK transform_hierarchy::update_work(PTP_CALLBACK_INSTANCE instance, void *context, PTP_WORK work)
+{
+    static_cast<transform_hierarchy *>(context)->update_chunks();
+}
+
+void transform_hierarchy::update_chunks()
+{
+    for (;;)
+    {
+        size_t begin = m_next_chunk++ * nodes_per_chunk;
+        if (begin >= m_chunk_node_count)
+            break;
+
+        size_t count = std::min(nodes_per_chunk, m_chunk_node_count - begin);
+        m_num_updated += update_nodes(m_chunk_nodes + begin, count);
+    }
+}
+
+// Recomputes the nodes that changed or whose parent was recomputed in this update.
+// Nodes of one level only read the stamps and matrices of the previous level, so levels can be split across threads.
+size_t transform_hierarchy::update_nodes(UINT const *nodes, size_t count)
+{
+    size_t num_updated = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        UINT node = nodes[i];
+        UINT parent = m_parents[node];
+        bool parent_changed = parent != null_parent && m_stamps[parent] == m_current_stamp;
+        if (!parent_changed && m_stamps[node] != m_current_stamp)
+            continue;
+
+        // (scale * rotation) * translation, like transform::update_world
+        XMMATRIX local = XMMatrixRotationQuaternion(XMVectorSet(m_rotation_x[node], m_rotation_y[node], m_rotation_z[node], m_rotation_w[node]));
+        local.r[0] = XMVectorScale(local.r[0], m_scale_x[node]);
+        local.r[1] = XMVectorScale(local.r[1], m_scale_y[node]);
+        local.r[2] = XMVectorScale(local.r[2], m_scale_z[node]);
+        local.r[3] = XMVectorSet(m_translation_x[node], m_translation_y[node], m_translation_z[node], 1.f);
+
+        if (parent != null_parent)
+            local = local * XMLoadFloat4x4(&m_world[parent]);
+
+        XMStoreFloat4x4(&m_world[node], local);
+        m_stamps[node] = m_current_stamp;
+        num_updated++;
+    }
+    return num_updated;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "common.h"
+#include <atomic>
+#include <vector>
+
+// Transform hierarchy stored SoA, with quaternion rotations.
+// A node is always added after its parent, so indices are in topological order,
+// and nodes are also grouped by depth so that a whole level can be updated in parallel.
+// Setters only mark the node, update() recomputes the world matrices of the changed subtrees,
+// level by level, splitting the big levels across the thread pool.
+class transform_hierarchy
+{
+public:
+    static constexpr UINT null_parent = UINT(-1);
+
+    COMMON_API transform_hierarchy();
+    COMMON_API ~transform_hierarchy();
+    transform_hierarchy(transform_hierarchy const &) = delete;
+    transform_hierarchy &operator=(transform_hierarchy const &) = delete;
+
+    // Returns the index of the new node
+    COMMON_API UINT add(UINT parent,
+                        DirectX::XMFLOAT3 const &translation = DirectX::XMFLOAT3(0.f, 0.f, 0.f),
+                        DirectX::XMFLOAT4 const &rotation = DirectX::XMFLOAT4(0.f, 0.f, 0.f, 1.f),
+                        DirectX::XMFLOAT3 const &scale = DirectX::XMFLOAT3(1.f, 1.f, 1.f));
+
+    // Removes every node, keeping the memory for the nodes added next
+    COMMON_API void clear();
+
+    COMMON_API void set_translation(UINT node, DirectX::XMFLOAT3 const &translation);
+    COMMON_API void set_rotation(UINT node, DirectX::XMFLOAT4 const &rotation);
+    COMMON_API void set_scale(UINT node, DirectX::XMFLOAT3 const &scale);
+
+    COMMON_API void update();
+
+    DirectX::XMFLOAT4X4 const &world(UINT node) const { return m_world[node]; }
+    UINT parent(UINT node) const { return m_parents[node]; }
+    size_t size() const { return m_parents.size(); }
+
+private:
+    static void CALLBACK update_work(PTP_CALLBACK_INSTANCE instance, void *context, PTP_WORK work);
+
+    void mark_dirty(UINT node);
+    void update_chunks();
+    size_t update_nodes(UINT const *nodes, size_t count);
+
+    // Local TRS
+    std::vector<float> m_translation_x;
+    std::vector<float> m_translation_y;
+    std::vector<float> m_translation_z;
+    std::vector<float> m_rotation_x;
+    std::vector<float> m_rotation_y;
+    std::vector<float> m_rotation_z;
+    std::vector<float> m_rotation_w;
+    std::vector<float> m_scale_x;
+    std::vector<float> m_scale_y;
+    std::vector<float> m_scale_z;
+
+    std::vector<UINT> m_parents;
+    std::vector<UINT> m_depths;
+    std::vector<DirectX::XMFLOAT4X4> m_world;
+
+    // The update a node was last changed or recomputed in, it has to be recomputed
+    // when it or its parent carries the stamp of the current update
+    std::vector<UINT64> m_stamps;
+    UINT64 m_current_stamp = 1;
+
+    std::vector<std::vector<UINT>> m_levels;
+    size_t m_min_dirty_depth = SIZE_MAX;
+    size_t m_max_dirty_depth = 0;
+
+    // The level being updated in parallel
+    PTP_WORK m_work = nullptr;
+    UINT const *m_chunk_nodes = nullptr;
+    size_t m_chunk_node_count = 0;
+    std::atomic<size_t> m_next_chunk;
+    std::atomic<size_t> m_num_updated;
+};
@@ -0,0 +1,331 @@
+#include "pch.h"
+#include "triangle_bvh.h"
+#include <algorithm>
+#include <numeric>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+constexpr UINT max_leaf_triangles = 4;
+constexpr int num_bins = 16;
+// Below this depth the nodes split in the middle, so the tree stays shallow enough for the traversal stack
+constexpr UINT max_sah_depth = 32;
+constexpr UINT max_stack_size = 64;
+
+struct build_triangle
+{
+    XMFLOAT3 corners[3];
+    XMFLOAT3 min;
+    XMFLOAT3 max;
+    XMFLOAT3 centroid;
+};
+
+struct bounds
+{
+    XMVECTOR min = XMVectorReplicate(FLT_MAX);
+    XMVECTOR max = XMVectorReplicate(-FLT_MAX);
+
+    void grow(XMFLOAT3 const &min_point, XMFLOAT3 const &max_point)
+    {
+        min = XMVectorMin(min, XMLoadFloat3(&min_point));
+        max = XMVectorMax(max, XMLoadFloat3(&max_point));
+    }
+
+    float area() const
+    {
+        XMFLOAT3 d;
+        XMStoreFloat3(&d, XMVectorMax(XMVectorSubtract(max, min), XMVectorZero()));
+        return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+};
+
+float component(XMFLOAT3 const &v, int axis)
+{
+    return (&v.x)[axis];
+}
+
+float safe_inverse(float x)
+{
+    constexpr float min_magnitude = 1e-20f;
+    return 1.f / (fabsf(x) > min_magnitude ? x : copysignf(min_magnitude, x));
+}
+
+// Slab test, writes where the ray enters the box
+bool intersect_box(triangle_bvh_node const &n, XMFLOAT3 const &origin, XMFLOAT3 const &inv_dir, float max_distance, float &t_enter)
+{
+    float tx1 = (n.min.x - origin.x) * inv_dir.x, tx2 = (n.max.x - origin.x) * inv_dir.x;
+    float ty1 = (n.min.y - origin.y) * inv_dir.y, ty2 = (n.max.y - origin.y) * inv_dir.y;
+    float tz1 = (n.min.z - origin.z) * inv_dir.z, tz2 = (n.max.z - origin.z) * inv_dir.z;
+    t_enter = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::max(std::min(tz1, tz2), 0.f));
+    float t_exit = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::min(std::max(tz1, tz2), max_distance));
+    return t_enter <= t_exit;
+}
+
+void build_node(std::vector<triangle_bvh_node> &nodes, std::vector<triangle_packet> &packets,
+                std::vector<build_triangle> const &triangles, std::vector<UINT> &order,
+                UINT node_index, UINT begin, UINT end, UINT depth, UINT &max_depth)
+{
+    max_depth = std::max(max_depth, depth);
+
+    bounds node_bounds;
+    bounds centroid_bounds;
+    for (UINT i = begin; i < end; i++)
+    {
+        build_triangle const &tri = triangles[order[i]];
+        node_bounds.grow(tri.min, tri.max);
+        centroid_bounds.grow(tri.centroid, tri.centroid);
+    }
+    XMStoreFloat3(&nodes[node_index].min, node_bounds.min);
+    XMStoreFloat3(&nodes[node_index].max, node_bounds.max);
+
+    UINT count = end - begin;
+    if (count <= max_leaf_triangles)
+    {
+        triangle_packet packet = {};
+        for (UINT lane = 0; lane < count; lane++)
+        {
+            build_triangle const &tri = triangles[order[begin + lane]];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float v0 = component(tri.corners[0], axis);
+                packet.v0[axis][lane] = v0;
+                packet.e1[axis][lane] = component(tri.corners[1], axis) - v0;
+                packet.e2[axis][lane] = component(tri.corners[2], axis) - v0;
+            }
+        }
+
+        nodes[node_index].is_leaf = 1;
+        nodes[node_index].first = UINT(packets.size());
+        packets.push_back(packet);
+        return;
+    }
+
+    // Split along the largest extent of the centroids
+    XMFLOAT3 centroid_min, centroid_max;
+    XMStoreFloat3(&centroid_min, centroid_bounds.min);
+    XMStoreFloat3(&centroid_max, centroid_bounds.max);
+    XMFLOAT3 extent(centroid_max.x - centroid_min.x, centroid_max.y - centroid_min.y, centroid_max.z - centroid_min.z);
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    float axis_min = component(centroid_min, axis);
+    float axis_extent = component(extent, axis);
+
+    UINT mid = begin;
+    if (axis_extent > 0.f && depth < max_sah_depth)
+    {
+        // Binned SAH: bin the centroids, then sweep the bins for the cheapest split
+        bounds bin_bounds[num_bins];
+        UINT bin_counts[num_bins] = {};
+        float bin_scale = num_bins / axis_extent;
+        auto bin_of = [&](build_triangle const &tri) {
+            return std::min(num_bins - 1, int((component(tri.centroid, axis) - axis_min) * bin_scale));
+        };
+
+        for (UINT i = begin; i < end; i++)
+        {
+            build_triangle const &tri = triangles[order[i]];
+            int bin = bin_of(tri);
+            bin_counts[bin]++;
+            bin_bounds[bin].grow(tri.min, tri.max);
+        }
+
+        float right_costs[num_bins] = {};
+        bounds right;
+        UINT right_count = 0;
+        for (int bin = num_bins - 1; bin > 0; bin--)
+        {
+            right.min = XMVectorMin(right.min, bin_bounds[bin].min);
+            right.max = XMVectorMax(right.max, bin_bounds[bin].max);
+            right_count += bin_counts[bin];
+            right_costs[bin] = right_count * right.area();
+        }
+
+        float best_cost = FLT_MAX;
+        int best_split = -1;
+        bounds left;
+        UINT left_count = 0;
+        for (int bin = 0; bin < num_bins - 1; bin++)
+        {
+            left.min = XMVectorMin(left.min, bin_bounds[bin].min);
+            left.max = XMVectorMax(left.max, bin_bounds[bin].max);
+            left_count += bin_counts[bin];
+
+            float cost = left_count * left.area() + right_costs[bin + 1];
+            if (left_count > 0 && left_count < count && cost < best_cost)
+            {
+                best_cost = cost;
+                best_split = bin;
+            }
+        }
+
+        if (best_split >= 0)
+        {
+            auto first_right = std::partition(order.begin() + begin, order.begin() + end,
+                                              [&](UINT i) { return bin_of(triangles[i]) <= best_split; });
+            mid = UINT(first_right - order.begin());
+        }
+    }
+
+    // Every centroid is in the same spot or in the same bin, split in the middle
+    if (mid == begin || mid == end)
+    {
+        mid = begin + count / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                         [&](UINT a, UINT b) { return component(triangles[a].centroid, axis) < component(triangles[b].centroid, axis); });
+    }
+
+    UINT left_child = UINT(nodes.size());
+    nodes.emplace_back();
+    nodes.emplace_back();
+    nodes[node_index].first = left_child;
+    nodes[node_index].is_leaf = 0;
+
+    build_node(nodes, packets, triangles, order, left_child, begin, mid, depth + 1, max_depth);
+    build_node(nodes, packets, triangles, order, left_child + 1, mid, end, depth + 1, max_depth);
+}
+} // namespace
+
+triangle_bvh::triangle_bvh(position_color const *vertices, size_t vertex_count, WORD const *indices, size_t index_count)
+{
+    size_t num_triangles = index_count / 3;
+    if (num_triangles == 0)
+        return;
+
+    std::vector<build_triangle> triangles(num_triangles);
+    for (size_t i = 0; i < num_triangles; i++)
+    {
+        build_triangle &tri = triangles[i];
+        XMVECTOR min = XMVectorReplicate(FLT_MAX);
+        XMVECTOR max = XMVectorReplicate(-FLT_MAX);
+        for (int corner = 0; corner < 3; corner++)
+        {
+            WORD index = indices[i * 3 + corner];
+            ASSERT2(index < vertex_count, "Triangle index out of the vertex range.");
+            tri.corners[corner] = vertices[index].position;
+
+            XMVECTOR p = XMLoadFloat3(&tri.corners[corner]);
+            min = XMVectorMin(min, p);
+            max = XMVectorMax(max, p);
+        }
+        XMStoreFloat3(&tri.min, min);
+        XMStoreFloat3(&tri.max, max);
+        XMStoreFloat3(&tri.centroid, XMVectorScale(XMVectorAdd(min, max), 0.5f));
+    }
+
+    std::vector<UINT> order(num_triangles);
+    std::iota(order.begin(), order.end(), 0);
+
+    m_nodes.reserve(num_triangles / 2 + 1);
+    m_packets.reserve(num_triangles / 2 + 1);
+    m_nodes.emplace_back();
+    build_node(m_nodes, m_packets, triangles, order, 0, 0, UINT(num_triangles), 0, m_depth);
+}
+
+bool triangle_bvh::intersect(XMFLOAT3 const &origin, XMFLOAT3 const &direction, float &distance) const
+{
+    if (m_nodes.empty())
+        return false;
+
+    XMFLOAT3 inv_dir(safe_inverse(direction.x), safe_inverse(direction.y), safe_inverse(direction.z));
+
+    __m128 ox = _mm_set1_ps(origin.x);
+    __m128 oy = _mm_set1_ps(origin.y);
+    __m128 oz = _mm_set1_ps(origin.z);
+    __m128 dx = _mm_set1_ps(direction.x);
+    __m128 dy = _mm_set1_ps(direction.y);
+    __m128 dz = _mm_set1_ps(direction.z);
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.f);
+    __m128 epsilon = _mm_set1_ps(1e-8f);
+    __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+    // Each level leaves at most its farther child on the stack
+    struct stack_entry
+    {
+        UINT node;
+        float t_enter;
+    };
+    ASSERT2(m_depth + 1 <= max_stack_size, "The BVH is too deep for the traversal stack.");
+    stack_entry stack[max_stack_size];
+    int stack_size = 0;
+
+    bool has_hit = false;
+    float root_enter;
+    if (intersect_box(m_nodes[0], origin, inv_dir, distance, root_enter))
+        stack[stack_size++] = {0, root_enter};
+
+    while (stack_size > 0)
+    {
+        stack_entry entry = stack[--stack_size];
+        if (entry.t_enter > distance)
+            continue;
+
+        triangle_bvh_node const &n = m_nodes[entry.node];
+        if (!n.is_leaf)
+        {
+            // Visit the nearer child first so the hit distance shrinks before the farther one is tested
+            float t_left, t_right;
+            bool hit_left = intersect_box(m_nodes[n.first], origin, inv_dir, distance, t_left);
+            bool hit_right = intersect_box(m_nodes[n.first + 1], origin, inv_dir, distance, t_right);
+            if (hit_left && hit_right)
+            {
+                bool left_first = t_left <= t_right;
+                stack[stack_size++] = left_first ? stack_entry{n.first + 1, t_right} : stack_entry{n.first, t_left};
+                stack[stack_size++] = left_first ? stack_entry{n.first, t_left} : stack_entry{n.first + 1, t_right};
+            }
+            else if (hit_left)
+                stack[stack_size++] = {n.first, t_left};
+            else if (hit_right)
+                stack[stack_size++] = {n.first + 1, t_right};
+            continue;
+        }
+
+        // Moller-Trumbore, 4 triangles at a time
+        triangle_packet const &p = m_packets[n.first];
+        __m128 e1x = _mm_load_ps(p.e1[0]), e1y = _mm_load_ps(p.e1[1]), e1z = _mm_load_ps(p.e1[2]);
+        __m128 e2x = _mm_load_ps(p.e2[0]), e2y = _mm_load_ps(p.e2[1]), e2z = _mm_load_ps(p.e2[2]);
+
+        // pvec = direction x e2
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        __m128 inv_det = _mm_div_ps(one, det);
+
+        // tvec = origin - v0
+        __m128 tx = _mm_sub_ps(ox, _mm_load_ps(p.v0[0]));
+        __m128 ty = _mm_sub_ps(oy, _mm_load_ps(p.v0[1]));
+        __m128 tz = _mm_sub_ps(oz, _mm_load_ps(p.v0[2]));
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inv_det);
+
+        // qvec = tvec x e1
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+        __m128 hit = _mm_cmpgt_ps(_mm_and_ps(det, abs_mask), epsilon);
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(u, zero));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(v, zero));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), one));
+        hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, zero));
+        hit = _mm_and_ps(hit, _mm_cmplt_ps(t, _mm_set1_ps(distance)));
+
+        int mask = _mm_movemask_ps(hit);
+        if (mask == 0)
+            continue;
+
+        alignas(16) float hit_distances[4];
+        _mm_store_ps(hit_distances, t);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            if (mask & (1 << lane))
+                distance = std::min(distance, hit_distances[lane]);
+        }
+        has_hit = true;
+    }
+    return has_hit;
+}
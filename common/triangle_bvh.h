@@ -0,0 +1,40 @@
+#pragma once
+#include "common.h"
+#include "gpu_interface.h"
+#include <vector>
+
+struct triangle_bvh_node
+{
+    DirectX::XMFLOAT3 min;
+    UINT first = 0; // First child for internal nodes, the second one follows it. Packet index for leaves.
+    DirectX::XMFLOAT3 max;
+    UINT is_leaf = 0;
+};
+
+// Up to 4 triangles stored SoA as a corner and two edges, so a ray is tested against all of them at once.
+// Unused lanes hold degenerate triangles that can't be hit.
+struct alignas(16) triangle_packet
+{
+    float v0[3][4];
+    float e1[3][4];
+    float e2[3][4];
+};
+
+// Static BVH over the triangles of a mesh, in the mesh's local space, for exact ray hits.
+// Built once with binned SAH, each leaf holds one packet of up to 4 triangles.
+// Nodes past a fixed depth split at the median, which bounds the traversal stack.
+class triangle_bvh
+{
+public:
+    COMMON_API triangle_bvh() = default;
+    COMMON_API triangle_bvh(position_color const *vertices, size_t vertex_count, WORD const *indices, size_t index_count);
+
+    // Finds the nearest triangle hit closer than distance and writes its distance, in units of the direction's length
+    COMMON_API bool intersect(DirectX::XMFLOAT3 const &origin, DirectX::XMFLOAT3 const &direction, float &distance) const;
+
+    bool empty() const { return m_nodes.empty(); }
+
+    std::vector<triangle_bvh_node> m_nodes;
+    std::vector<triangle_packet> m_packets;
+    UINT m_depth = 0;
+};
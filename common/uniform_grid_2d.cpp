@@ -0,0 +1,241 @@
+#include "uniform_grid_2d.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+float distance_to_rect(float x, float y, uniform_grid_2d::rect const &r)
+{
+    float dx = std::max(std::max(r.min_x - x, 0.f), x - r.max_x);
+    float dy = std::max(std::max(r.min_y - y, 0.f), y - r.max_y);
+    return std::sqrt(dx * dx + dy * dy);
+}
+} // namespace
+
+uniform_grid_2d::uniform_grid_2d(float cell_size)
+    : m_cell_size(cell_size), m_inv_cell_size(1.f / cell_size)
+{
+}
+
+uniform_grid_2d::cell_range uniform_grid_2d::cells_of(rect const &bounds) const
+{
+    cell_range cells;
+    cells.min_x = (int)std::floor(bounds.min_x * m_inv_cell_size);
+    cells.min_y = (int)std::floor(bounds.min_y * m_inv_cell_size);
+    cells.max_x = (int)std::floor(bounds.max_x * m_inv_cell_size);
+    cells.max_y = (int)std::floor(bounds.max_y * m_inv_cell_size);
+    return cells;
+}
+
+void uniform_grid_2d::add_to_cells(uint32_t id, cell_range const &cells)
+{
+    for (int y = cells.min_y; y <= cells.max_y; y++)
+    {
+        for (int x = cells.min_x; x <= cells.max_x; x++)
+            m_cells[cell_key(x, y)].push_back(id);
+    }
+}
+
+void uniform_grid_2d::remove_from_cells(uint32_t id, cell_range const &cells)
+{
+    for (int y = cells.min_y; y <= cells.max_y; y++)
+    {
+        for (int x = cells.min_x; x <= cells.max_x; x++)
+        {
+            auto cell = m_cells.find(cell_key(x, y));
+            std::vector<uint32_t> &ids = cell->second;
+            auto it = std::find(ids.begin(), ids.end(), id);
+            *it = ids.back();
+            ids.pop_back();
+            if (ids.empty())
+                m_cells.erase(cell);
+        }
+    }
+}
+
+void uniform_grid_2d::insert(uint32_t id, rect const &bounds)
+{
+    if (id >= m_entries.size())
+    {
+        m_entries.resize(id + 1);
+        m_visited.resize(id + 1, 0);
+    }
+
+    entry &e = m_entries[id];
+    if (e.in_grid)
+    {
+        update(id, bounds);
+        return;
+    }
+
+    e.bounds = bounds;
+    e.cells = cells_of(bounds);
+    e.in_grid = true;
+    add_to_cells(id, e.cells);
+}
+
+void uniform_grid_2d::remove(uint32_t id)
+{
+    if (!contains(id))
+        return;
+
+    entry &e = m_entries[id];
+    remove_from_cells(id, e.cells);
+    e.in_grid = false;
+}
+
+void uniform_grid_2d::update(uint32_t id, rect const &bounds)
+{
+    if (!contains(id))
+    {
+        insert(id, bounds);
+        return;
+    }
+
+    entry &e = m_entries[id];
+    e.bounds = bounds;
+
+    cell_range cells = cells_of(bounds);
+    if (cells.min_x == e.cells.min_x && cells.min_y == e.cells.min_y &&
+        cells.max_x == e.cells.max_x && cells.max_y == e.cells.max_y)
+        return;
+
+    remove_from_cells(id, e.cells);
+    add_to_cells(id, cells);
+    e.cells = cells;
+}
+
+void uniform_grid_2d::clear()
+{
+    m_entries.clear();
+    m_cells.clear();
+    m_visited.clear();
+    m_query_stamp = 0;
+}
+
+bool uniform_grid_2d::visit(uint32_t id) const
+{
+    if (m_visited[id] == m_query_stamp)
+        return false;
+    m_visited[id] = m_query_stamp;
+    return true;
+}
+
+void uniform_grid_2d::query_point(float x, float y, std::vector<uint32_t> &results) const
+{
+    auto cell = m_cells.find(cell_key((int)std::floor(x * m_inv_cell_size), (int)std::floor(y * m_inv_cell_size)));
+    if (cell == m_cells.end())
+        return;
+
+    // A point is in a single cell, so there are no duplicates to skip
+    for (uint32_t id : cell->second)
+    {
+        rect const &r = m_entries[id].bounds;
+        if (x >= r.min_x && x <= r.max_x && y >= r.min_y && y <= r.max_y)
+            results.push_back(id);
+    }
+}
+
+void uniform_grid_2d::query_rect(rect const &area, std::vector<uint32_t> &results) const
+{
+    if (++m_query_stamp == 0)
+    {
+        std::fill(m_visited.begin(), m_visited.end(), 0);
+        m_query_stamp = 1;
+    }
+
+    cell_range cells = cells_of(area);
+
+    // A large area has more cells than occupied cells, walk the occupied ones instead
+    size_t area_cells = size_t(cells.max_x - cells.min_x + 1) * size_t(cells.max_y - cells.min_y + 1);
+    auto test_cell = [&](std::vector<uint32_t> const &ids) {
+        for (uint32_t id : ids)
+        {
+            rect const &r = m_entries[id].bounds;
+            if (r.min_x <= area.max_x && r.max_x >= area.min_x && r.min_y <= area.max_y && r.max_y >= area.min_y && visit(id))
+                results.push_back(id);
+        }
+    };
+
+    if (area_cells > m_cells.size())
+    {
+        for (auto const &cell : m_cells)
+            test_cell(cell.second);
+        return;
+    }
+
+    for (int y = cells.min_y; y <= cells.max_y; y++)
+    {
+        for (int x = cells.min_x; x <= cells.max_x; x++)
+        {
+            auto cell = m_cells.find(cell_key(x, y));
+            if (cell != m_cells.end())
+                test_cell(cell->second);
+        }
+    }
+}
+
+bool uniform_grid_2d::nearest(float x, float y, float max_distance, uint32_t &id, float &distance) const
+{
+    if (m_cells.empty())
+        return false;
+
+    if (++m_query_stamp == 0)
+    {
+        std::fill(m_visited.begin(), m_visited.end(), 0);
+        m_query_stamp = 1;
+    }
+
+    bool found = false;
+    float best = max_distance;
+    auto test_cell = [&](std::vector<uint32_t> const &ids) {
+        for (uint32_t candidate : ids)
+        {
+            if (!visit(candidate))
+                continue;
+
+            float d = distance_to_rect(x, y, m_entries[candidate].bounds);
+            if (d <= best)
+            {
+                best = d;
+                id = candidate;
+                found = true;
+            }
+        }
+    };
+
+    int center_x = (int)std::floor(x * m_inv_cell_size);
+    int center_y = (int)std::floor(y * m_inv_cell_size);
+    size_t searched_cells = 0;
+
+    // Rings of cells around the point, a rectangle first seen in ring r + 1 is at least r cells away
+    for (int ring = 0;; ring++)
+    {
+        if ((ring - 1) * m_cell_size > best)
+            break;
+
+        // Past the occupied cells, testing them all is cheaper than growing the rings
+        if (searched_cells > m_cells.size())
+        {
+            for (auto const &cell : m_cells)
+                test_cell(cell.second);
+            break;
+        }
+
+        for (int cy = center_y - ring; cy <= center_y + ring; cy++)
+        {
+            bool is_edge_row = cy == center_y - ring || cy == center_y + ring;
+            int step = is_edge_row ? 1 : 2 * ring;
+            for (int cx = center_x - ring; cx <= center_x + ring; cx += std::max(step, 1))
+            {
+                auto cell = m_cells.find(cell_key(cx, cy));
+                if (cell != m_cells.end())
+                    test_cell(cell->second);
+                searched_cells++;
+            }
+        }
+    }
+
+    distance = best;
+    return found;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "common_api.h"
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Uniform grid over 2D rectangles for point, rectangle and nearest neighbour queries.
+// Cells are hashed, so the grid has no bounds and only the occupied cells use memory.
+// A rectangle is stored in every cell it overlaps: the cell size should be around the size of the typical rectangle.
+// Moving a rectangle only touches the grid when it crosses a cell border.
+class uniform_grid_2d
+{
+public:
+    struct rect
+    {
+        float min_x;
+        float min_y;
+        float max_x;
+        float max_y;
+    };
+
+    COMMON_API uniform_grid_2d(float cell_size);
+
+    // ids are chosen by the caller and should be dense, like indices into the caller's array
+    COMMON_API void insert(uint32_t id, rect const &bounds);
+    COMMON_API void remove(uint32_t id);
+    COMMON_API void update(uint32_t id, rect const &bounds);
+    COMMON_API void clear();
+
+    // The results are appended, each id once
+    COMMON_API void query_point(float x, float y, std::vector<uint32_t> &results) const;
+    COMMON_API void query_rect(rect const &area, std::vector<uint32_t> &results) const;
+
+    // Returns false when no rectangle is closer than max_distance, the distance is 0 inside a rectangle
+    COMMON_API bool nearest(float x, float y, float max_distance, uint32_t &id, float &distance) const;
+
+    bool contains(uint32_t id) const { return id < m_entries.size() && m_entries[id].in_grid; }
+    size_t occupied_cells() const { return m_cells.size(); }
+
+private:
+    struct cell_range
+    {
+        int min_x;
+        int min_y;
+        int max_x;
+        int max_y;
+    };
+
+    struct entry
+    {
+        rect bounds;
+        cell_range cells;
+        bool in_grid = false;
+    };
+
+    cell_range cells_of(rect const &bounds) const;
+    void add_to_cells(uint32_t id, cell_range const &cells);
+    void remove_from_cells(uint32_t id, cell_range const &cells);
+    static uint64_t cell_key(int x, int y) { return uint64_t(uint32_t(x)) << 32 | uint32_t(y); }
+
+    // Marks the id as visited by the current query, returns false when it already was
+    bool visit(uint32_t id) const;
+
+    float m_cell_size = 1.f;
+    float m_inv_cell_size = 1.f;
+    std::vector<entry> m_entries;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> m_cells;
+
+    // Rectangles spanning several cells are only reported once per query
+    mutable std::vector<uint32_t> m_visited;
+    mutable uint32_t m_query_stamp = 0;
+};
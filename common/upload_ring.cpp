@@ -0,0 +1,114 @@
+#include "upload_ring.h"
+
+upload_ring::upload_ring(upload_backend *backend)
+    : m_backend(backend), m_capacity(backend->size())
+{
+    m_frames.reserve(8);
+}
+
+bool upload_ring::try_allocate(size_t size, size_t alignment, size_t &offset)
+{
+    size_t aligned_head = (m_head + alignment - 1) & ~(alignment - 1);
+
+    // The used range is [tail, head), or wraps around as [tail, capacity) + [0, head)
+    bool is_wrapped = m_head < m_tail || (m_head == m_tail && m_used > 0);
+    if (!is_wrapped)
+    {
+        if (aligned_head + size <= m_capacity)
+        {
+            offset = aligned_head;
+            m_used += offset + size - m_head;
+            m_frame_bytes += offset + size - m_head;
+            m_head = offset + size;
+            return true;
+        }
+
+        // The end of the ring is skipped, it comes back with the frame that uses it
+        if (size <= m_tail)
+        {
+            size_t skipped = m_capacity - m_head;
+            offset = 0;
+            m_used += skipped + size;
+            m_frame_bytes += skipped + size;
+            m_head = size;
+            return true;
+        }
+        return false;
+    }
+
+    if (aligned_head + size <= m_tail)
+    {
+        offset = aligned_head;
+        m_used += offset + size - m_head;
+        m_frame_bytes += offset + size - m_head;
+        m_head = offset + size;
+        return true;
+    }
+    return false;
+}
+
+upload_allocation upload_ring::allocate(size_t size, size_t alignment)
+{
+    upload_allocation allocation;
+    if (size == 0 || size > m_capacity)
+        return allocation;
+
+    size_t offset = 0;
+    bool is_allocated = try_allocate(size, alignment, offset);
+    if (!is_allocated)
+    {
+        retire();
+        is_allocated = try_allocate(size, alignment, offset);
+    }
+
+    // Waits for one frame at a time, the oldest frames are usually done already
+    while (!is_allocated && !m_frames.empty())
+    {
+        m_backend->wait_fence(m_frames.front().fence_value);
+        m_wait_count++;
+        retire();
+        is_allocated = try_allocate(size, alignment, offset);
+    }
+
+    if (!is_allocated)
+        return allocation;
+
+    allocation.cpu = m_backend->cpu_base() + offset;
+    allocation.gpu_address = m_backend->gpu_base() + offset;
+    allocation.offset = offset;
+    allocation.size = size;
+    return allocation;
+}
+
+void upload_ring::end_frame(uint64_t fence_value)
+{
+    // Frames that didn't upload anything have nothing to reclaim
+    if (m_frame_bytes == 0)
+        return;
+
+    m_frames.push_back({fence_value, m_head, m_frame_bytes});
+    m_frame_bytes = 0;
+}
+
+void upload_ring::retire()
+{
+    if (m_frames.empty())
+        return;
+
+    uint64_t completed = m_backend->completed_fence();
+    size_t retired = 0;
+    while (retired < m_frames.size() && m_frames[retired].fence_value <= completed)
+    {
+        m_tail = m_frames[retired].end;
+        m_used -= m_frames[retired].bytes;
+        retired++;
+    }
+    m_frames.erase(m_frames.begin(), m_frames.begin() + retired);
+
+    // Back to the start of the ring when it's empty, so the next allocations don't wrap early
+    if (m_used == 0)
+    {
+        m_head = 0;
+        m_tail = 0;
+    }
+}
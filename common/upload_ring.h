@@ -0,0 +1,107 @@
+#pragma once
+#include "common_api.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+// Memory an upload_ring sub-allocates from, and the fence telling when the GPU is done reading it.
+class upload_backend
+{
+public:
+    virtual ~upload_backend() {}
+
+    // Mapped for the lifetime of the backend
+    virtual uint8_t *cpu_base() = 0;
+    virtual uint64_t gpu_base() = 0;
+    virtual size_t size() const = 0;
+
+    virtual uint64_t completed_fence() = 0;
+
+    // Blocks until the fence reaches the value
+    virtual void wait_fence(uint64_t value) = 0;
+};
+
+// Backend over plain memory, the "GPU" completes a fence when the test says so
+class null_upload_backend : public upload_backend
+{
+public:
+    null_upload_backend(size_t size) : m_memory(static_cast<uint8_t *>(std::malloc(size))), m_size(size) {}
+    ~null_upload_backend() { std::free(m_memory); }
+    null_upload_backend(null_upload_backend const &) = delete;
+    null_upload_backend &operator=(null_upload_backend const &) = delete;
+
+    uint8_t *cpu_base() override { return m_memory; }
+    uint64_t gpu_base() override { return 0x10000; }
+    size_t size() const override { return m_size; }
+    uint64_t completed_fence() override { return m_completed_fence; }
+    void wait_fence(uint64_t value) override
+    {
+        if (value > m_completed_fence)
+            m_completed_fence = value;
+        m_wait_count++;
+    }
+
+    void complete(uint64_t value) { m_completed_fence = value; }
+    size_t wait_count() const { return m_wait_count; }
+
+private:
+    uint8_t *m_memory;
+    size_t m_size;
+    uint64_t m_completed_fence = 0;
+    size_t m_wait_count = 0;
+};
+
+struct upload_allocation
+{
+    uint8_t *cpu = nullptr;
+    uint64_t gpu_address = 0;
+    size_t offset = 0; // From the start of the backend's memory, for copies out of the ring
+    size_t size = 0;
+
+    bool is_valid() const { return cpu != nullptr; }
+};
+
+// Sub-allocates upload memory in a ring shared by every frame in flight.
+// Allocations are never freed one by one: end_frame tags everything allocated since the previous call with the frame's fence,
+// and the space goes back to the ring once the GPU has passed that fence.
+// When the ring is full, allocating waits for the oldest frame still in flight.
+class upload_ring
+{
+public:
+    COMMON_API upload_ring(upload_backend *backend);
+
+    // Alignment is a power of two, constant buffers need 256 bytes.
+    // Returns an invalid allocation when the size doesn't fit next to the current frame's allocations, even after waiting.
+    COMMON_API upload_allocation allocate(size_t size, size_t alignment);
+
+    // The allocations since the last call are reclaimed once the fence completes
+    COMMON_API void end_frame(uint64_t fence_value);
+
+    // Reclaims the frames whose fence completed, allocate calls it when the ring is full
+    COMMON_API void retire();
+
+    size_t capacity() const { return m_capacity; }
+    size_t used() const { return m_used; }
+    size_t frames_in_flight() const { return m_frames.size(); }
+    size_t wait_count() const { return m_wait_count; }
+
+private:
+    struct frame
+    {
+        uint64_t fence_value;
+        size_t end; // Head of the ring when the frame ended
+        size_t bytes; // Alignment padding and the space skipped by wrapping included
+    };
+
+    bool try_allocate(size_t size, size_t alignment, size_t &offset);
+
+    upload_backend *m_backend;
+    size_t m_capacity = 0;
+    size_t m_head = 0;
+    size_t m_tail = 0;
+    size_t m_used = 0;
+    size_t m_frame_bytes = 0;
+    size_t m_wait_count = 0;
+    std::vector<frame> m_frames; // Oldest first
+};
@@ -0,0 +1,49 @@
+#include "pch.h"
+#include "virtual_pool.h"
+
+virtual_pool::virtual_pool(size_t max_byte_size)
+{
+    SYSTEM_INFO system_info = {};
+    GetSystemInfo(&system_info);
+
+    // Commit in chunks of the allocation granularity (64KB) to limit the number of VirtualAlloc calls
+    m_commit_granularity = system_info.dwAllocationGranularity;
+    m_reserved = align_up(max_byte_size, m_commit_granularity);
+
+    m_base = (BYTE *)VirtualAlloc(nullptr, m_reserved, MEM_RESERVE, PAGE_NOACCESS);
+    ASSERT2(m_base != nullptr, "Failed to reserve the virtual pool's address range.");
+}
+
+virtual_pool::~virtual_pool()
+{
+    if (m_base)
+        VirtualFree(m_base, 0, MEM_RELEASE);
+}
+
+bool virtual_pool::commit(size_t byte_size)
+{
+    if (byte_size <= m_committed)
+        return true;
+
+    if (byte_size > m_reserved)
+        return false;
+
+    size_t new_committed = align_up(byte_size, m_commit_granularity);
+
+    // Only commit the pages past the current end, the committed range stays in place
+    void *ptr = VirtualAlloc(m_base + m_committed, new_committed - m_committed, MEM_COMMIT, PAGE_READWRITE);
+    if (ptr == nullptr)
+        return false;
+
+    m_committed = new_committed;
+    return true;
+}
+
+void virtual_pool::decommit()
+{
+    if (m_committed > 0)
+    {
+        VirtualFree(m_base, m_committed, MEM_DECOMMIT);
+        m_committed = 0;
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "common.h"
+
+// A pool of memory that reserves a large range of address space up front and commits pages on demand.
+// Growing the pool never moves it, so pointers into the pool stay valid for its whole lifetime.
+class virtual_pool
+{
+public:
+    COMMON_API virtual_pool(size_t max_byte_size);
+    COMMON_API ~virtual_pool();
+    virtual_pool(virtual_pool const &) = delete;
+    virtual_pool &operator=(virtual_pool const &) = delete;
+
+    // Make sure at least byte_size bytes are backed by memory.
+    // Returns false if byte_size doesn't fit in the reserved range.
+    COMMON_API bool commit(size_t byte_size);
+
+    // Give the committed pages back to the OS, the address range stays reserved
+    COMMON_API void decommit();
+
+    BYTE *data() const { return m_base; }
+    size_t committed() const { return m_committed; }
+    size_t reserved() const { return m_reserved; }
+
+private:
+    BYTE *m_base = nullptr;
+    size_t m_reserved = 0;
+    size_t m_committed = 0;
+    size_t m_commit_granularity = 0;
+};
@@ -2,6 +2,7 @@
 #include <d3d12.h>
 #include "../common/d3dx12.h"
 #include "../common/common.h"
+#include "../common/stream_copy.h"
 
 template <typename T>
 struct upload_buffer2
@@ -39,6 +40,23 @@ struct upload_buffer2
         memcpy(&m_mapped_data[element_index * m_element_byte_size], data, sizeof(T));
     }
 
+    // Contiguous elements in one streaming copy, padded elements like constant buffers go through write_span
+    void copy_range(size_t first_element, const T *data, size_t element_count)
+    {
+        if (m_element_byte_size == sizeof(T))
+            stream_copy(&m_mapped_data[first_element * m_element_byte_size], data, element_count * sizeof(T));
+        else
+            write_span(first_element, data, element_count, [](const T &src, T &dst) { dst = src; });
+    }
+
+    // Converts the source elements while writing them, convert(Src const &, T &) fills each element
+    template <typename Src, typename Fn>
+    void write_span(size_t first_element, const Src *data, size_t element_count, Fn convert)
+    {
+        stream_convert(&m_mapped_data[first_element * m_element_byte_size], m_element_byte_size, data, element_count,
+                       [&convert](const Src &src, void *dst) { convert(src, *static_cast<T *>(dst)); });
+    }
+
     ID3D12Resource *m_upload = nullptr;
     size_t m_element_byte_size = 0;
     BYTE *m_mapped_data = nullptr;
@@ -54,13 +54,11 @@ public:
 class frame_resource : public frame_cmd
 {
 public:
-    frame_resource(ID3D12Device *device, size_t frame_index, BYTE *particle_data, UINT num_transforms);
+    frame_resource(ID3D12Device *device, size_t frame_index, UINT num_transforms);
     ~frame_resource();
 
-    BYTE *particle_vb_range = nullptr;
     std::unique_ptr<upload_buffer2<pass_data>> cb_pass_upload = nullptr;
     std::unique_ptr<upload_buffer> cb_material_upload = nullptr;
     std::unique_ptr<upload_buffer2<model_data>> cb_transforms_upload = nullptr;
-    std::unique_ptr<upload_buffer2<position_color>> cb_debug_vertices_upload = nullptr;
     std::unique_ptr<upload_buffer2<physics>> cb_physics = nullptr;
 };
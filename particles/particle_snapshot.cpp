@@ -0,0 +1,138 @@
+#include "pch.h"
+#include "particle_snapshot.h"
+#include <algorithm>
+
+namespace particle
+{
+
+size_t particle_snapshot::file_size(size_t num_particles)
+{
+    return sizeof(snapshot_header) + num_particles * (2 * sizeof(XMFLOAT3) + 2 * sizeof(float));
+}
+
+particle_snapshot::particle_snapshot(const wchar_t *path)
+{
+    m_file = CreateFile2(path, GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return;
+
+    LARGE_INTEGER byte_size = {};
+    if (!GetFileSizeEx(m_file, &byte_size) || size_t(byte_size.QuadPart) < sizeof(snapshot_header))
+    {
+        close();
+        return;
+    }
+
+    if (!map(PAGE_READONLY, FILE_MAP_READ, size_t(byte_size.QuadPart)))
+        return;
+
+    // Reject files from another format version or that were truncated
+    if (m_header->magic != snapshot_magic ||
+        m_header->version != snapshot_version ||
+        file_size(size_t(m_header->num_particles)) != size_t(byte_size.QuadPart))
+    {
+        close();
+    }
+}
+
+particle_snapshot::particle_snapshot(const wchar_t *path, size_t num_particles)
+{
+    m_file = CreateFile2(path, GENERIC_READ | GENERIC_WRITE, 0, CREATE_ALWAYS, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return;
+
+    // Creating the mapping extends the file to its final size
+    if (!map(PAGE_READWRITE, FILE_MAP_WRITE, file_size(num_particles)))
+        return;
+
+    *m_header = snapshot_header();
+    m_header->num_particles = num_particles;
+}
+
+particle_snapshot::~particle_snapshot()
+{
+    close();
+}
+
+bool particle_snapshot::map(DWORD protection, DWORD access, size_t byte_size)
+{
+    m_mapping = CreateFileMapping(m_file, nullptr, protection, DWORD(UINT64(byte_size) >> 32), DWORD(byte_size), nullptr);
+    if (m_mapping)
+        m_view = (BYTE *)MapViewOfFile(m_mapping, access, 0, 0, byte_size);
+
+    if (m_view == nullptr)
+    {
+        close();
+        return false;
+    }
+
+    // The SoA streams follow the header, their length is given by the size of the mapping
+    m_header = reinterpret_cast<snapshot_header *>(m_view);
+    size_t num_particles = (byte_size - sizeof(snapshot_header)) / (2 * sizeof(XMFLOAT3) + 2 * sizeof(float));
+
+    BYTE *stream = m_view + sizeof(snapshot_header);
+    m_positions = reinterpret_cast<XMFLOAT3 *>(stream);
+    stream += num_particles * sizeof(XMFLOAT3);
+    m_sizes = reinterpret_cast<float *>(stream);
+    stream += num_particles * sizeof(float);
+    m_velocities = reinterpret_cast<XMFLOAT3 *>(stream);
+    stream += num_particles * sizeof(XMFLOAT3);
+    m_ages = reinterpret_cast<float *>(stream);
+    return true;
+}
+
+void particle_snapshot::close()
+{
+    if (m_view)
+        UnmapViewOfFile(m_view);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+
+    m_view = nullptr;
+    m_mapping = nullptr;
+    m_file = INVALID_HANDLE_VALUE;
+    m_header = nullptr;
+    m_positions = nullptr;
+    m_sizes = nullptr;
+    m_velocities = nullptr;
+    m_ages = nullptr;
+}
+
+s_internal bool nearly_equal(float a, float b, float tolerance)
+{
+    return fabsf(a - b) <= tolerance;
+}
+
+s_internal bool nearly_equal(XMFLOAT3 const &a, XMFLOAT3 const &b, float tolerance)
+{
+    return nearly_equal(a.x, b.x, tolerance) && nearly_equal(a.y, b.y, tolerance) && nearly_equal(a.z, b.z, tolerance);
+}
+
+bool snapshots_match(particle_snapshot const &a, particle_snapshot const &b, float tolerance, size_t *first_mismatch)
+{
+    ASSERT2(a.is_valid() && b.is_valid(), "Can't compare invalid particle snapshots.");
+
+    // Extra particles in one of the snapshots count as a mismatch at the end of the shortest one
+    size_t num_particles = std::min(a.num_particles(), b.num_particles());
+    size_t mismatch = a.num_particles() == b.num_particles() ? SIZE_MAX : num_particles;
+
+    for (size_t i = 0; i < num_particles; i++)
+    {
+        if (!nearly_equal(a.m_positions[i], b.m_positions[i], tolerance) ||
+            !nearly_equal(a.m_sizes[i], b.m_sizes[i], tolerance) ||
+            !nearly_equal(a.m_velocities[i], b.m_velocities[i], tolerance) ||
+            !nearly_equal(a.m_ages[i], b.m_ages[i], tolerance))
+        {
+            mismatch = i;
+            break;
+        }
+    }
+
+    if (first_mismatch)
+        *first_mismatch = mismatch;
+    return mismatch == SIZE_MAX;
+}
+
+} // namespace particle
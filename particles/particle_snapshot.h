@@ -0,0 +1,66 @@
+#pragma once
+#include "common.h"
+#include <DirectXMath.h>
+
+namespace particle
+{
+using namespace DirectX;
+
+// Emission progress of a source, saved along the particles so that a restored system doesn't emit a catch-up burst
+struct source_state
+{
+    float time = 0.f;
+    UINT32 _pad0 = 0;
+    UINT64 num_created = 0;
+};
+
+// "PSNP" in file order
+s_internal constexpr UINT32 snapshot_magic = 0x504E5350;
+s_internal constexpr UINT32 snapshot_version = 1;
+
+struct snapshot_header
+{
+    UINT32 magic = snapshot_magic;
+    UINT32 version = snapshot_version;
+    UINT64 num_particles = 0;
+    source_state source = {};
+};
+
+// Binary snapshot of a CPU particle system, accessed through a file mapping.
+// The particles follow the header as SoA streams, oldest particle first:
+// positions (XMFLOAT3), sizes (float), velocities (XMFLOAT3), ages (float).
+class particle_snapshot
+{
+public:
+    // Maps an existing snapshot file for reading, check is_valid() before use
+    particle_snapshot(const wchar_t *path);
+    // Creates a snapshot file sized for num_particles and maps it for writing
+    particle_snapshot(const wchar_t *path, size_t num_particles);
+    ~particle_snapshot();
+    particle_snapshot(particle_snapshot const &) = delete;
+    particle_snapshot &operator=(particle_snapshot const &) = delete;
+
+    bool is_valid() const { return m_header != nullptr; }
+    size_t num_particles() const { return size_t(m_header->num_particles); }
+    static size_t file_size(size_t num_particles);
+
+    snapshot_header *m_header = nullptr;
+    XMFLOAT3 *m_positions = nullptr;
+    float *m_sizes = nullptr;
+    XMFLOAT3 *m_velocities = nullptr;
+    float *m_ages = nullptr;
+
+private:
+    bool map(DWORD protection, DWORD access, size_t byte_size);
+    void close();
+
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+    BYTE *m_view = nullptr;
+};
+
+// Compares two snapshots particle by particle, every component must be within tolerance.
+// On mismatch, first_mismatch receives the index of the first differing particle.
+bool snapshots_match(particle_snapshot const &a, particle_snapshot const &b, float tolerance, size_t *first_mismatch = nullptr);
+
+} // namespace particle
@@ -4,6 +4,7 @@
 
 particle_system_gpu::particle_system_gpu(ID3D12Device *device,
                                          ID3D12GraphicsCommandList *cmd_list,
+                                         d3d12_upload_ring *uploads,
                                          std::vector<particle::aligned_aos> *particle_data,
                                          D3D12_GPU_VIRTUAL_ADDRESS transform_cbv,
                                          D3D12_GPU_VIRTUAL_ADDRESS physics_cbv,
@@ -16,18 +17,18 @@ particle_system_gpu::particle_system_gpu(ID3D12Device *device,
     size_t particle_count = particle_data->size();
     size_t buffer_size = particle_count * particle::byte_size;
 
-    create_default_buffer(device, cmd_list, particle_data->data(), buffer_size,
-                          &m_output_upload, &m_output_default, "particle_output_data", D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+    create_default_buffer(device, cmd_list, uploads, particle_data->data(), buffer_size,
+                          &m_output_default, "particle_output_data", D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
 
-    create_default_buffer(device, cmd_list, particle_data->data(), buffer_size,
-                          &m_input_upload, &m_input_default, "particle_input_data", D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+    create_default_buffer(device, cmd_list, uploads, particle_data->data(), buffer_size,
+                          &m_input_default, "particle_input_data", D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
 
     // Reset buffers
-    create_default_buffer(device, cmd_list, particle_data->data(), buffer_size,
-                          &m_output_upload, &m_output_reset, "particle_output_reset_data");
+    create_default_buffer(device, cmd_list, uploads, particle_data->data(), buffer_size,
+                          &m_output_reset, "particle_output_reset_data");
 
-    create_default_buffer(device, cmd_list, particle_data->data(), buffer_size,
-                          &m_input_upload, &m_input_reset, "particle_input_reset_data");
+    create_default_buffer(device, cmd_list, uploads, particle_data->data(), buffer_size,
+                          &m_input_reset, "particle_input_reset_data");
 
     // Create indirect drawing command objects for particles
     D3D12_DRAW_ARGUMENTS draw_args = {};
@@ -45,9 +46,9 @@ particle_system_gpu::particle_system_gpu(ID3D12Device *device,
 
     size_t indirect_arg_buffer_size = sizeof(draw_indirect_command2);
 
-    create_default_buffer(device, cmd_list,
+    create_default_buffer(device, cmd_list, uploads,
                           (void *)&indirect_cmd, indirect_arg_buffer_size,
-                          &m_indirect_drawing_upload, &m_indirect_drawing_default, "particle_draw_args");
+                          &m_indirect_drawing_default, "particle_draw_args");
 
     // Create the indirect indexed drawing command objects for particle bounds
     indirect_arg_buffer_size = sizeof(bounds_draw_indirect_command);
@@ -68,9 +69,9 @@ particle_system_gpu::particle_system_gpu(ID3D12Device *device,
     indirect_bounds_draw_cmd.draw_args.StartIndexLocation = 0;
     indirect_bounds_draw_cmd.draw_args.StartInstanceLocation = 0;
 
-    create_default_buffer(device, cmd_list,
+    create_default_buffer(device, cmd_list, uploads,
                           (void *)&indirect_bounds_draw_cmd, indirect_arg_buffer_size,
-                          &m_indirect_drawing_bounds_upload, &m_indirect_drawing_bounds_default, "particle_bounds_draw_args");
+                          &m_indirect_drawing_bounds_default, "particle_bounds_draw_args");
 
     // Create the indirect calculation of particle bounds
     D3D12_DISPATCH_ARGUMENTS dispatch_args = {1, 1, 1};
@@ -80,9 +81,9 @@ particle_system_gpu::particle_system_gpu(ID3D12Device *device,
     indirect_bounds_calc_cmd.transform_cbv = transform_cbv;
     indirect_bounds_calc_cmd.dispatch_args = dispatch_args;
 
-    create_default_buffer(device, cmd_list,
+    create_default_buffer(device, cmd_list, uploads,
                           (void *)&indirect_bounds_calc_cmd, indirect_arg_buffer_size,
-                          &m_indirect_bounds_calc_upload, &m_indirect_bounds_calc_default, "particle_bounds_calc_args");
+                          &m_indirect_bounds_calc_default, "particle_bounds_calc_args");
 
     // Create the indirect simulation command objects for particles
     dispatch_args = {1, 1, 1};
@@ -95,15 +96,15 @@ particle_system_gpu::particle_system_gpu(ID3D12Device *device,
 
     indirect_arg_buffer_size = sizeof(simulation_indirect_command);
 
-    create_default_buffer(device, cmd_list,
+    create_default_buffer(device, cmd_list, uploads,
                           (void *)&simulation_cmd, indirect_arg_buffer_size,
-                          &m_indirect_sim_cmds_input_upload, &m_indirect_sim_cmds_input_default, "sim_cmds_input_args");
+                          &m_indirect_sim_cmds_input_default, "sim_cmds_input_args");
 
     simulation_cmd.particle_input_uav = m_output_default->GetGPUVirtualAddress();
     simulation_cmd.particle_output_uav = m_input_default->GetGPUVirtualAddress();
-    create_default_buffer(device, cmd_list,
+    create_default_buffer(device, cmd_list, uploads,
                           (void *)&simulation_cmd, indirect_arg_buffer_size,
-                          &m_indirect_sim_cmds_swap_upload, &m_indirect_sim_cmds_swap_default, "sim_cmds_swapped_args");
+                          &m_indirect_sim_cmds_swap_default, "sim_cmds_swapped_args");
 }
 
 particle_system_gpu::~particle_system_gpu()
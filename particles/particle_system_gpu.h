@@ -2,11 +2,13 @@
 #include "common.h"
 #include "transform.h"
 #include "particle.h"
+#include "gpu_interface.h"
 
 struct particle_system_gpu
 {
     particle_system_gpu(ID3D12Device *device,
                         ID3D12GraphicsCommandList *cmd_list,
+                        d3d12_upload_ring *uploads,
                         std::vector<particle::aligned_aos> *particle_data,
                         D3D12_GPU_VIRTUAL_ADDRESS transform_cbv,
                         D3D12_GPU_VIRTUAL_ADDRESS physics_cbv,
@@ -16,24 +18,17 @@ struct particle_system_gpu
     ~particle_system_gpu();
     void reset(ID3D12GraphicsCommandList *cmd_list);
     ID3D12Resource *m_output_default;
-    ID3D12Resource *m_output_upload;
     ID3D12Resource *m_output_reset;
     ID3D12Resource *m_input_default;
-    ID3D12Resource *m_input_upload;
     ID3D12Resource *m_input_reset;
     transform m_transform;
     UINT m_max_particle_count;
 
     ID3D12Resource *m_indirect_drawing_default;
-    ID3D12Resource *m_indirect_drawing_upload;
     ID3D12Resource *m_indirect_drawing_bounds_default;
-    ID3D12Resource *m_indirect_drawing_bounds_upload;
-    ID3D12Resource *m_indirect_sim_cmds_input_upload;
     ID3D12Resource *m_indirect_sim_cmds_input_default;
     ID3D12Resource *m_indirect_sim_cmds_swap_default;
-    ID3D12Resource *m_indirect_sim_cmds_swap_upload;
     ID3D12Resource *m_indirect_bounds_calc_default;
-    ID3D12Resource *m_indirect_bounds_calc_upload;
 };
 
 struct draw_indirect_command2
@@ -1,108 +1,414 @@
 #include "pch.h"
 #include "particle_system_oop.h"
 #include <algorithm>
+#include <cfloat>
+#include <random>
 
 namespace particle
 {
 
 // System
-particle_system_oop::particle_system_oop(source *src, std::vector<action *> actions, ID3D12Device *device)
+particle_system_oop::particle_system_oop(source *src, std::vector<action *> actions, ID3D12Device *device, particle_trails *trails)
+    : m_pool(m_max_particles * byte_size)
 {
+    m_device = device;
     m_source.reset(src);
+    m_trails.reset(trails);
+
+    if (m_trails)
+        m_rendering_mode = rendering_mode::ribbon;
 
     for (action *act : actions)
         m_actions.emplace_back(act);
 
-    m_vertexbuffer_stride = m_max_particles_per_frame * byte_size;
-    m_num_particles_total = m_max_particles_per_frame * NUM_BACK_BUFFERS;
+    // Constant lifetimes mean particles die in the order they were spawned, no need to partition the pool
+    if (m_source->has_constant_lifetime())
+        m_storage_mode = storage_mode::ring;
 
-    m_vertex_upload_resource = new upload_buffer(device, m_num_particles_total, byte_size, false, "particles_vertices");
+    bool committed = grow_pool(m_particles_per_commit);
+    ASSERT2(committed, "Failed to commit the initial particle pool.");
 }
 
 particle_system_oop::~particle_system_oop()
 {
+    for (retired_upload_buffer &retired : m_retired_upload_resources)
+        delete retired.buffer;
+
     delete m_vertex_upload_resource;
 }
 
-void particle_system_oop::reset(particle ptr)
+void particle_system_oop::reset()
 {
-    ptr->age = 0.f;
-    ptr->size = 1.f;
-    ptr->position = XMFLOAT3(0.f, 0.f, 0.f);
-    ptr->velocity = XMFLOAT3(0.f, 0.f, 0.f);
     m_num_particles_alive = 0;
+    m_num_particles_to_render = 0;
+    m_ring_tail = 0;
+}
+
+void particle_system_oop::simulate(float dt, frame_resource *frame, XMFLOAT3 const &eye_pos)
+{
+    switch (m_storage_mode)
+    {
+    case storage_mode::partitioned:
+        simulate_partitioned(dt);
+        break;
+    case storage_mode::ring:
+        simulate_ring(dt);
+        break;
+    }
+
+    upload(frame->m_frame_index, eye_pos);
+    update_bounds();
+    m_frame_count++;
 }
 
-void particle_system_oop::simulate(float dt, frame_resource *frame)
+void particle_system_oop::simulate_partitioned(float dt)
 {
-    particle current_particle = reinterpret_cast<particle>(frame->particle_vb_range);
-    particle current_particle_start = current_particle;
-    particle current_particle_end = current_particle + m_num_particles_alive;
-    particle max_particle_end = current_particle + m_max_particles_per_frame;
+    particle pool = pool_begin();
 
+    // Run actions
     for (size_t i = 0; i < m_num_particles_alive; i++)
     {
-        current_particle_start[i] = m_previous_particle[i];
+        for (auto &act : m_actions)
+        {
+            act.get()->apply(dt, pool + i);
+        }
+
+        if (m_trails)
+            m_trails->record(i, pool[i].position);
+    }
+
+    // Spawn new particles. When the source fills the committed pages, commit more and let it catch up.
+    // The time was already accumulated by the first call.
+    size_t num_particles = m_num_particles_alive;
+    float spawn_dt = dt;
+    while (true)
+    {
+        particle spawn_start = pool + num_particles;
+        particle spawn_end = m_source->apply(spawn_dt, spawn_start, pool + m_pool_capacity);
+        spawned(spawn_start, spawn_end);
+        num_particles += spawn_end - spawn_start;
+        spawn_dt = 0.f;
+
+        if (num_particles < m_pool_capacity || !grow_pool(num_particles + 1))
+            break;
+    }
 
-        // Run actions
+    // Compact the pool, reconcile the emitted with the timed-out particles.
+    // Unlike std::partition, this keeps the particles in spawn order and moves their trails along.
+    size_t num_alive = 0;
+    for (size_t i = 0; i < num_particles; i++)
+    {
+        if (pool[i].age > m_max_age)
+            continue;
+
+        if (num_alive != i)
+        {
+            pool[num_alive] = pool[i];
+            if (m_trails)
+                m_trails->move(num_alive, i);
+        }
+        num_alive++;
+    }
+
+    m_num_particles_alive = num_alive;
+}
+
+void particle_system_oop::simulate_ring(float dt)
+{
+    particle pool = pool_begin();
+
+    // Run actions
+    for (size_t i = 0; i < m_num_particles_alive; i++)
+    {
+        size_t slot = (m_ring_tail + i) % m_pool_capacity;
         for (auto &act : m_actions)
         {
-            act.get()->apply(dt, current_particle_start + i);
+            act.get()->apply(dt, pool + slot);
         }
+
+        if (m_trails)
+            m_trails->record(slot, pool[slot].position);
+    }
+
+    retire_timed_out();
+
+    // Spawn new particles at the head, one contiguous range of free slots at a time.
+    // The time was already accumulated by the first call.
+    float spawn_dt = dt;
+    while (true)
+    {
+        if (m_num_particles_alive == m_pool_capacity && !grow_ring())
+            break;
+
+        size_t head_slot = (m_ring_tail + m_num_particles_alive) % m_pool_capacity;
+        particle spawn_start = pool + head_slot;
+        particle range_end = pool + (head_slot < m_ring_tail ? m_ring_tail : m_pool_capacity);
+
+        particle spawn_end = m_source->apply(spawn_dt, spawn_start, range_end);
+        spawned(spawn_start, spawn_end);
+        m_num_particles_alive += spawn_end - spawn_start;
+        spawn_dt = 0.f;
+
+        if (spawn_end < range_end)
+            break;
+    }
+
+    // Like the partitioned mode, particles spawned older than the maximum age don't live for a frame
+    retire_timed_out();
+}
+
+void particle_system_oop::retire_timed_out()
+{
+    // Every particle has the same lifetime, so they time out in spawn order: advance the tail
+    particle pool = pool_begin();
+    while (m_num_particles_alive > 0 && pool[m_ring_tail].age > m_max_age)
+    {
+        m_ring_tail = (m_ring_tail + 1) % m_pool_capacity;
+        m_num_particles_alive--;
     }
+}
 
-    // Spawn new particles
-    current_particle_end = m_source->apply(dt, current_particle_end, max_particle_end);
+bool particle_system_oop::grow_pool(size_t min_num_particles)
+{
+    size_t new_capacity = std::min(align_up(min_num_particles, m_particles_per_commit), m_max_particles);
+    if (new_capacity < min_num_particles || !m_pool.commit(new_capacity * byte_size))
+        return false;
+
+    m_pool_capacity = new_capacity;
+    if (m_trails)
+        m_trails->resize(m_pool_capacity);
+    return true;
+}
 
-    m_num_particles_alive = current_particle_end - current_particle_start;
-    m_previous_particle = current_particle;
+bool particle_system_oop::grow_ring()
+{
+    size_t old_capacity = m_pool_capacity;
+    if (!grow_pool(old_capacity * 2))
+        return false;
+
+    // The pool doesn't move, only the particles that wrapped around the old end need to
+    // follow it so that the live range stays contiguous modulo the new capacity
+    size_t wrapped_end = m_ring_tail + m_num_particles_alive;
+    if (wrapped_end > old_capacity)
+    {
+        particle pool = pool_begin();
+        memcpy(pool + old_capacity, pool, (wrapped_end - old_capacity) * byte_size);
+        if (m_trails)
+            m_trails->move(old_capacity, 0, wrapped_end - old_capacity);
+    }
+    return true;
+}
 
-    // Partition the pool, reconcile the emitted with the timed-out particles
-    current_particle_end = std::partition(current_particle_start, current_particle_end,
-                                          [](auto &v) { return v.age <= 100.f; });
+void particle_system_oop::spawned(particle begin, particle end)
+{
+    if (m_trails)
+    {
+        for (particle p = begin; p < end; p++)
+            m_trails->start(p - pool_begin(), p->position);
+    }
+}
 
-    m_num_particles_to_render = UINT(current_particle_end - current_particle_start);
+void particle_system_oop::upload(size_t frame_index, XMFLOAT3 const &eye_pos)
+{
+    // Free the upload buffers that no frame in flight can be reading from anymore
+    auto first_in_use = std::remove_if(m_retired_upload_resources.begin(), m_retired_upload_resources.end(),
+                                       [this](retired_upload_buffer &retired) {
+                                           if (m_frame_count - retired.frame_count < NUM_BACK_BUFFERS)
+                                               return false;
+                                           delete retired.buffer;
+                                           return true;
+                                       });
+    m_retired_upload_resources.erase(first_in_use, m_retired_upload_resources.end());
+
+    // The upload buffer is created by the first upload, large enough for a snapshot loaded before it
+    if (!m_vertex_upload_resource || m_num_particles_alive > m_max_particles_per_frame)
+        grow_upload_buffer(m_num_particles_alive);
+
+    // Copy the live particles to the frame partition, unwrapping the ring if needed
+    particle pool = pool_begin();
+    particle destination = reinterpret_cast<particle>(get_frame_partition(frame_index));
+    size_t first_range_count = std::min(m_num_particles_alive, m_pool_capacity - m_ring_tail);
+    memcpy(destination, pool + m_ring_tail, first_range_count * byte_size);
+    memcpy(destination + first_range_count, pool, (m_num_particles_alive - first_range_count) * byte_size);
+
+    m_num_particles_to_render = UINT(m_num_particles_alive);
 
     if (m_num_particles_to_render > 0)
     {
-        // Create VBVs from particle pointers
-        size_t particle_gpu_data_start = m_vertex_upload_resource->m_uploadbuffer->GetGPUVirtualAddress();
-        UINT particle_vb_size = (UINT)m_vertexbuffer_stride;
-        UINT particle_vb_stride = (UINT)byte_size;
-        BYTE *particle_cpu_data_start = m_vertex_upload_resource->m_mapped_data;
+        create_vbvs(destination, m_VBVs);
+    }
 
-        // Position data
-        size_t position_offset = (BYTE *)&current_particle_start->position - particle_cpu_data_start;
-        m_VBVs[0].BufferLocation = particle_gpu_data_start + position_offset;
-        m_VBVs[0].SizeInBytes = particle_vb_size - offsetof(aligned_aos, position);
-        m_VBVs[0].StrideInBytes = particle_vb_stride;
+    if (m_trails)
+    {
+        // Ribbons follow the particles in the frame partition, in the same order
+        position_color *ribbons = reinterpret_cast<position_color *>(destination + m_max_particles_per_frame);
+        UINT vertices_per_ribbon = m_trails->vertices_per_ribbon();
+        for (size_t i = 0; i < m_num_particles_alive; i++)
+        {
+            size_t slot = (m_ring_tail + i) % m_pool_capacity;
+            m_trails->build_ribbon(slot, pool[slot].position, eye_pos, ribbons + i * vertices_per_ribbon);
+        }
 
-        // Size data
-        size_t size_offset = (BYTE *)&current_particle_start->size - particle_cpu_data_start;
-        m_VBVs[1].BufferLocation = particle_gpu_data_start + size_offset;
-        m_VBVs[1].SizeInBytes = particle_vb_size - offsetof(aligned_aos, size);
-        m_VBVs[1].StrideInBytes = particle_vb_stride;
+        D3D12_GPU_VIRTUAL_ADDRESS gpu_data_start = m_vertex_upload_resource->m_uploadbuffer->GetGPUVirtualAddress();
+        m_ribbon_VBV.BufferLocation = gpu_data_start + ((BYTE *)ribbons - m_vertex_upload_resource->m_mapped_data);
+        m_ribbon_VBV.SizeInBytes = UINT(m_max_particles_per_frame * vertices_per_ribbon * sizeof(position_color));
+        m_ribbon_VBV.StrideInBytes = sizeof(position_color);
 
-        // Velocity data
-        size_t velocity_offset = (BYTE *)&current_particle_start->velocity - particle_cpu_data_start;
-        m_VBVs[2].BufferLocation = particle_gpu_data_start + velocity_offset;
-        m_VBVs[2].SizeInBytes = particle_vb_size - offsetof(aligned_aos, velocity);
-        m_VBVs[2].StrideInBytes = particle_vb_stride;
+        m_ribbon_IBV.BufferLocation = gpu_data_start;
+        m_ribbon_IBV.SizeInBytes = UINT(m_ribbon_indices_byte_size);
+        m_ribbon_IBV.Format = DXGI_FORMAT_R32_UINT;
 
-        // Age data
-        size_t age_offset = (BYTE *)&current_particle_start->age - particle_cpu_data_start;
-        m_VBVs[3].BufferLocation = particle_gpu_data_start + age_offset;
-        m_VBVs[3].SizeInBytes = particle_vb_size - offsetof(aligned_aos, age);
-        m_VBVs[3].StrideInBytes = particle_vb_stride;
+        m_num_ribbon_indices_to_render = UINT(m_num_particles_alive * m_trails->indices_per_ribbon());
+    }
+}
+
+void particle_system_oop::update_bounds()
+{
+    if (m_num_particles_alive == 0)
+    {
+        m_bounds = BoundingBox(XMFLOAT3(0.f, 0.f, 0.f), XMFLOAT3(0.f, 0.f, 0.f));
+        return;
+    }
+
+    particle pool = pool_begin();
+    XMVECTOR min = XMVectorReplicate(FLT_MAX);
+    XMVECTOR max = XMVectorReplicate(-FLT_MAX);
+    float max_size = 0.f;
+    for (size_t i = 0; i < m_num_particles_alive; i++)
+    {
+        size_t slot = (m_ring_tail + i) % m_pool_capacity;
+        XMVECTOR position = XMLoadFloat3(&pool[slot].position);
+        min = XMVectorMin(min, position);
+        max = XMVectorMax(max, position);
+        max_size = std::max(max_size, pool[slot].size);
+
+        if (m_trails)
+            m_trails->extend_bounds(slot, min, max);
+    }
+
+    // The sprites and ribbons reach past the positions
+    XMVECTOR padding = XMVectorReplicate(0.5f * max_size + (m_trails ? m_trails->m_width : 0.f));
+    BoundingBox::CreateFromPoints(m_bounds, XMVectorSubtract(min, padding), XMVectorAdd(max, padding));
+}
+
+void particle_system_oop::grow_upload_buffer(size_t min_num_particles)
+{
+    // Frames in flight may still read from the current buffer, release it once they're done
+    if (m_vertex_upload_resource)
+        m_retired_upload_resources.push_back({m_frame_count, m_vertex_upload_resource});
+
+    while (m_max_particles_per_frame < min_num_particles)
+        m_max_particles_per_frame *= 2;
+
+    create_upload_buffer();
+}
+
+void particle_system_oop::create_upload_buffer()
+{
+    // Layout: [ribbon indices][frame partition 0]...[frame partition N-1]
+    // A frame partition holds the particles, followed by their ribbons
+    size_t ribbons_byte_size = 0;
+    m_ribbon_indices_byte_size = 0;
+    if (m_trails)
+    {
+        ribbons_byte_size = m_max_particles_per_frame * m_trails->vertices_per_ribbon() * sizeof(position_color);
+        m_ribbon_indices_byte_size = m_max_particles_per_frame * m_trails->indices_per_ribbon() * sizeof(UINT);
     }
+
+    m_vertexbuffer_stride = m_max_particles_per_frame * byte_size + ribbons_byte_size;
+    m_num_particles_total = m_max_particles_per_frame * NUM_BACK_BUFFERS;
+    m_vertex_upload_resource = new upload_buffer(m_device, 1, m_ribbon_indices_byte_size + m_vertexbuffer_stride * NUM_BACK_BUFFERS, false, "particles_vertices");
+
+    if (m_trails)
+        m_trails->build_indices(reinterpret_cast<UINT *>(m_vertex_upload_resource->m_mapped_data), m_max_particles_per_frame);
+}
+
+void particle_system_oop::create_vbvs(particle first, std::array<D3D12_VERTEX_BUFFER_VIEW, 4> &vbvs)
+{
+    // Create VBVs from particle pointers
+    size_t particle_gpu_data_start = m_vertex_upload_resource->m_uploadbuffer->GetGPUVirtualAddress();
+    UINT particle_vb_size = UINT(m_max_particles_per_frame * byte_size);
+    UINT particle_vb_stride = (UINT)byte_size;
+    BYTE *particle_cpu_data_start = m_vertex_upload_resource->m_mapped_data;
+
+    // Position data
+    size_t position_offset = (BYTE *)&first->position - particle_cpu_data_start;
+    vbvs[0].BufferLocation = particle_gpu_data_start + position_offset;
+    vbvs[0].SizeInBytes = particle_vb_size - offsetof(aligned_aos, position);
+    vbvs[0].StrideInBytes = particle_vb_stride;
+
+    // Size data
+    size_t size_offset = (BYTE *)&first->size - particle_cpu_data_start;
+    vbvs[1].BufferLocation = particle_gpu_data_start + size_offset;
+    vbvs[1].SizeInBytes = particle_vb_size - offsetof(aligned_aos, size);
+    vbvs[1].StrideInBytes = particle_vb_stride;
+
+    // Velocity data
+    size_t velocity_offset = (BYTE *)&first->velocity - particle_cpu_data_start;
+    vbvs[2].BufferLocation = particle_gpu_data_start + velocity_offset;
+    vbvs[2].SizeInBytes = particle_vb_size - offsetof(aligned_aos, velocity);
+    vbvs[2].StrideInBytes = particle_vb_stride;
+
+    // Age data
+    size_t age_offset = (BYTE *)&first->age - particle_cpu_data_start;
+    vbvs[3].BufferLocation = particle_gpu_data_start + age_offset;
+    vbvs[3].SizeInBytes = particle_vb_size - offsetof(aligned_aos, age);
+    vbvs[3].StrideInBytes = particle_vb_stride;
 }
 
-BYTE *particle_system_oop::get_frame_partition(int frame_index)
+BYTE *particle_system_oop::get_frame_partition(size_t frame_index)
 {
-    BYTE *ptr = m_vertex_upload_resource->m_mapped_data;
+    BYTE *ptr = m_vertex_upload_resource->m_mapped_data + m_ribbon_indices_byte_size;
     return ptr + (m_vertexbuffer_stride * frame_index);
 }
 
+bool particle_system_oop::save_snapshot(const wchar_t *path)
+{
+    particle_snapshot snapshot(path, m_num_particles_alive);
+    if (!snapshot.is_valid())
+        return false;
+
+    snapshot.m_header->source = m_source->get_state();
+
+    // Scatter the particles to the SoA streams straight into the mapped file, oldest first
+    particle pool = pool_begin();
+    for (size_t i = 0; i < m_num_particles_alive; i++)
+    {
+        particle p = pool + (m_ring_tail + i) % m_pool_capacity;
+        snapshot.m_positions[i] = p->position;
+        snapshot.m_sizes[i] = p->size;
+        snapshot.m_velocities[i] = p->velocity;
+        snapshot.m_ages[i] = p->age;
+    }
+    return true;
+}
+
+bool particle_system_oop::load_snapshot(particle_snapshot const &snapshot)
+{
+    if (!snapshot.is_valid())
+        return false;
+
+    size_t num_particles = snapshot.num_particles();
+    if (num_particles > m_pool_capacity && !grow_pool(num_particles))
+        return false;
+
+    // The snapshot is in spawn order, which is a valid layout for both storage modes
+    particle pool = pool_begin();
+    for (size_t i = 0; i < num_particles; i++)
+    {
+        pool[i].position = snapshot.m_positions[i];
+        pool[i].size = snapshot.m_sizes[i];
+        pool[i].velocity = snapshot.m_velocities[i];
+        pool[i].age = snapshot.m_ages[i];
+    }
+    spawned(pool, pool + num_particles);
+
+    m_num_particles_alive = num_particles;
+    m_ring_tail = 0;
+    m_source->set_state(snapshot.m_header->source);
+    return true;
+}
+
 // Sources
 flow::flow(double particles_per_second, std::vector<initializer *> initializers)
 {
@@ -116,6 +422,35 @@ flow::~flow()
 {
 }
 
+bool flow::has_constant_lifetime() const
+{
+    bool has_age = false;
+    for (auto &initializer : m_initializers)
+    {
+        if (initializer->is_age())
+        {
+            if (!initializer->is_constant())
+                return false;
+            has_age = true;
+        }
+    }
+    return has_age;
+}
+
+source_state flow::get_state() const
+{
+    source_state state;
+    state.time = m_time;
+    state.num_created = m_num_created;
+    return state;
+}
+
+void flow::set_state(source_state const &state)
+{
+    m_time = state.time;
+    m_num_created = size_t(state.num_created);
+}
+
 particle flow::apply(float dt, particle begin, particle end)
 {
     m_time += dt;
@@ -130,12 +465,9 @@ particle flow::apply(float dt, particle begin, particle end)
         num_particles_to_create = std::min(num_particles_to_create - m_num_created, remaining_particle_slots);
 
         // Initialize the new particles
-        for (size_t i = 0; i < num_particles_to_create; ++i)
+        for (auto &initializer : m_initializers)
         {
-            for (auto &initializer : m_initializers)
-            {
-                initializer->apply(dt, begin + i);
-            }
+            initializer->apply(dt, begin, begin + num_particles_to_create);
         }
         m_num_created += num_particles_to_create;
 
@@ -220,6 +552,183 @@ void cylinder::emit(XMFLOAT3 &v)
     XMStoreFloat3(&v, random_point);
 }
 
+mesh_surface::mesh_surface(mesh_data const &mesh, XMMATRIX const &world)
+{
+    size_t num_triangles = mesh.indices.size() / 3;
+    ASSERT2(num_triangles > 0, "A mesh surface needs at least 1 triangle");
+
+    m_corner0.resize(num_triangles);
+    m_corner1.resize(num_triangles);
+    m_corner2.resize(num_triangles);
+
+    std::vector<float> areas(num_triangles);
+    for (size_t i = 0; i < num_triangles; i++)
+    {
+        XMVECTOR p0 = XMVector3TransformCoord(XMLoadFloat3(&mesh.vertices[mesh.indices[i * 3 + 0]].position), world);
+        XMVECTOR p1 = XMVector3TransformCoord(XMLoadFloat3(&mesh.vertices[mesh.indices[i * 3 + 1]].position), world);
+        XMVECTOR p2 = XMVector3TransformCoord(XMLoadFloat3(&mesh.vertices[mesh.indices[i * 3 + 2]].position), world);
+        XMStoreFloat3(&m_corner0[i], p0);
+        XMStoreFloat3(&m_corner1[i], p1);
+        XMStoreFloat3(&m_corner2[i], p2);
+
+        areas[i] = 0.5f * XMVectorGetX(XMVector3Length(XMVector3Cross(p1 - p0, p2 - p0)));
+        m_total_area += areas[i];
+    }
+    ASSERT2(m_total_area > 0.f, "A mesh surface needs a non-zero area");
+
+    // Build the alias table (Vose's method)
+    m_probability.resize(num_triangles);
+    m_alias.resize(num_triangles);
+
+    std::vector<UINT> underfull;
+    std::vector<UINT> overfull;
+    underfull.reserve(num_triangles);
+    overfull.reserve(num_triangles);
+
+    // Scale the areas so that the average weight is 1
+    float scale = float(num_triangles) / m_total_area;
+    for (UINT i = 0; i < (UINT)num_triangles; i++)
+    {
+        areas[i] *= scale;
+        if (areas[i] < 1.f)
+            underfull.push_back(i);
+        else
+            overfull.push_back(i);
+    }
+
+    while (!underfull.empty() && !overfull.empty())
+    {
+        UINT less = underfull.back();
+        underfull.pop_back();
+        UINT more = overfull.back();
+        overfull.pop_back();
+
+        m_probability[less] = areas[less];
+        m_alias[less] = more;
+
+        // Give the leftover of the small bucket to the large one
+        areas[more] = (areas[more] + areas[less]) - 1.f;
+        if (areas[more] < 1.f)
+            underfull.push_back(more);
+        else
+            overfull.push_back(more);
+    }
+
+    // Whatever remains is full, up to floating point error
+    for (UINT i : overfull)
+    {
+        m_probability[i] = 1.f;
+        m_alias[i] = i;
+    }
+    for (UINT i : underfull)
+    {
+        m_probability[i] = 1.f;
+        m_alias[i] = i;
+    }
+
+    // Seed every lane with a different non-zero state
+    std::random_device rd{};
+    m_rng_state = _mm_set_epi32(int(rd() | 1), int(rd() | 1), int(rd() | 1), int(rd() | 1));
+}
+
+XMVECTOR mesh_surface::next_random()
+{
+    // xorshift32 on each lane
+    __m128i x = m_rng_state;
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+    m_rng_state = x;
+
+    // Use the top 23 bits as the mantissa of a float in [1, 2), then shift to [0, 1)
+    __m128i mantissa = _mm_or_si128(_mm_srli_epi32(x, 9), _mm_set1_epi32(0x3f800000));
+    return _mm_sub_ps(_mm_castsi128_ps(mantissa), _mm_set1_ps(1.f));
+}
+
+UINT mesh_surface::pick_triangle(float u)
+{
+    // The integer part selects the column, the fractional part decides between it and its alias
+    float scaled = u * float(m_probability.size());
+    UINT column = std::min(UINT(scaled), UINT(m_probability.size() - 1));
+    float fraction = scaled - float(column);
+    return fraction < m_probability[column] ? column : m_alias[column];
+}
+
+void mesh_surface::emit(XMFLOAT3 &v)
+{
+    XMFLOAT4 r;
+    XMStoreFloat4(&r, next_random());
+
+    UINT tri = pick_triangle(r.x);
+
+    // Uniform barycentric coordinates
+    float sqrt_r1 = sqrtf(r.y);
+    float w0 = 1.f - sqrt_r1;
+    float w1 = sqrt_r1 * (1.f - r.z);
+    float w2 = sqrt_r1 * r.z;
+
+    XMVECTOR p = XMVectorScale(XMLoadFloat3(&m_corner0[tri]), w0);
+    p = XMVectorMultiplyAdd(XMLoadFloat3(&m_corner1[tri]), XMVectorReplicate(w1), p);
+    p = XMVectorMultiplyAdd(XMLoadFloat3(&m_corner2[tri]), XMVectorReplicate(w2), p);
+    XMStoreFloat3(&v, p);
+}
+
+void mesh_surface::emit(particle begin, particle end)
+{
+    size_t count = size_t(end - begin);
+    size_t i = 0;
+
+    // 4 particles per iteration, SoA
+    for (; i + 4 <= count; i += 4)
+    {
+        XMVECTOR u_tri = next_random();
+        XMVECTOR r1 = next_random();
+        XMVECTOR r2 = next_random();
+
+        XMFLOAT4 u;
+        XMStoreFloat4(&u, u_tri);
+        UINT tris[4] = {pick_triangle(u.x), pick_triangle(u.y), pick_triangle(u.z), pick_triangle(u.w)};
+
+        XMVECTOR sqrt_r1 = XMVectorSqrt(r1);
+        XMVECTOR w0 = XMVectorSubtract(g_XMOne, sqrt_r1);
+        XMVECTOR w1 = XMVectorMultiply(sqrt_r1, XMVectorSubtract(g_XMOne, r2));
+        XMVECTOR w2 = XMVectorMultiply(sqrt_r1, r2);
+
+        // Gather the corners of the 4 triangles into SoA registers
+        XMFLOAT3 const &a0 = m_corner0[tris[0]], &a1 = m_corner0[tris[1]], &a2 = m_corner0[tris[2]], &a3 = m_corner0[tris[3]];
+        XMFLOAT3 const &b0 = m_corner1[tris[0]], &b1 = m_corner1[tris[1]], &b2 = m_corner1[tris[2]], &b3 = m_corner1[tris[3]];
+        XMFLOAT3 const &c0 = m_corner2[tris[0]], &c1 = m_corner2[tris[1]], &c2 = m_corner2[tris[2]], &c3 = m_corner2[tris[3]];
+
+        XMVECTOR x = XMVectorMultiply(XMVectorSet(a0.x, a1.x, a2.x, a3.x), w0);
+        x = XMVectorMultiplyAdd(XMVectorSet(b0.x, b1.x, b2.x, b3.x), w1, x);
+        x = XMVectorMultiplyAdd(XMVectorSet(c0.x, c1.x, c2.x, c3.x), w2, x);
+
+        XMVECTOR y = XMVectorMultiply(XMVectorSet(a0.y, a1.y, a2.y, a3.y), w0);
+        y = XMVectorMultiplyAdd(XMVectorSet(b0.y, b1.y, b2.y, b3.y), w1, y);
+        y = XMVectorMultiplyAdd(XMVectorSet(c0.y, c1.y, c2.y, c3.y), w2, y);
+
+        XMVECTOR z = XMVectorMultiply(XMVectorSet(a0.z, a1.z, a2.z, a3.z), w0);
+        z = XMVectorMultiplyAdd(XMVectorSet(b0.z, b1.z, b2.z, b3.z), w1, z);
+        z = XMVectorMultiplyAdd(XMVectorSet(c0.z, c1.z, c2.z, c3.z), w2, z);
+
+        // Back to AoS
+        XMFLOAT4 xs, ys, zs;
+        XMStoreFloat4(&xs, x);
+        XMStoreFloat4(&ys, y);
+        XMStoreFloat4(&zs, z);
+        begin[i + 0].position = XMFLOAT3(xs.x, ys.x, zs.x);
+        begin[i + 1].position = XMFLOAT3(xs.y, ys.y, zs.y);
+        begin[i + 2].position = XMFLOAT3(xs.z, ys.z, zs.z);
+        begin[i + 3].position = XMFLOAT3(xs.w, ys.w, zs.w);
+    }
+
+    // Remainder
+    for (; i < count; i++)
+    {
+        emit(begin[i].position);
+    }
+}
+
 // Actions
 void move::apply(float dt, particle particle)
 {
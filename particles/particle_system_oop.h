@@ -2,11 +2,16 @@
 #include "common.h"
 #include <d3d12.h>
 #include "directxpackedvector.h"
+#include <DirectXCollision.h>
 #include <memory>
 #include <array>
+#include <type_traits>
 #include <gpu_interface.h>
+#include <virtual_pool.h>
 #include "frame_resource.h"
 #include "particle.h"
+#include "particle_snapshot.h"
+#include "particle_trails.h"
 
 namespace particle
 {
@@ -18,12 +23,24 @@ using particle = particle::aligned_aos *__restrict;
 struct source
 {
     virtual particle apply(float dt, particle begin, particle end) = 0;
+    // True when every particle emitted by this source lives for the same amount of time
+    virtual bool has_constant_lifetime() const { return false; }
+    virtual source_state get_state() const { return {}; }
+    virtual void set_state(source_state const &state) {}
     virtual ~source() {}
 };
 
 struct initializer
 {
     virtual void apply(float, particle) = 0;
+    // Initialize a contiguous range of newly spawned particles
+    virtual void apply(float dt, particle begin, particle end)
+    {
+        for (particle p = begin; p < end; p++)
+            apply(dt, p);
+    }
+    virtual bool is_age() const { return false; }
+    virtual bool is_constant() const { return false; }
     virtual ~initializer() {}
 };
 
@@ -64,6 +81,32 @@ struct random
     void emit(float &v);
 };
 
+// Emits positions on the surface of a triangle mesh, uniformly distributed by area.
+// Triangles are picked in O(1) with a Walker alias table built once over the triangle areas.
+struct mesh_surface
+{
+    mesh_surface(mesh_data const &mesh, XMMATRIX const &world = XMMatrixIdentity());
+    void emit(XMFLOAT3 &v);
+    void emit(particle begin, particle end);
+
+    // Triangle corners in world space, one array per corner
+    std::vector<XMFLOAT3> m_corner0;
+    std::vector<XMFLOAT3> m_corner1;
+    std::vector<XMFLOAT3> m_corner2;
+
+    // Alias table: keep triangle i with probability m_probability[i], otherwise pick m_alias[i]
+    std::vector<float> m_probability;
+    std::vector<UINT> m_alias;
+    float m_total_area = 0.f;
+
+    // xorshift32 state of each SIMD lane, four independent streams
+    __m128i m_rng_state;
+
+private:
+    UINT pick_triangle(float u);
+    XMVECTOR next_random();
+};
+
 // Initializers
 template <typename domain>
 struct position : initializer
@@ -73,6 +116,15 @@ struct position : initializer
     void apply(float dt, particle p) override { m_domain.emit(p->position); };
 };
 
+template <>
+struct position<mesh_surface> : initializer
+{
+    mesh_surface m_domain;
+    position(mesh_surface new_domain) : m_domain(std::move(new_domain)){};
+    void apply(float dt, particle p) override { m_domain.emit(p->position); };
+    void apply(float dt, particle begin, particle end) override { m_domain.emit(begin, end); };
+};
+
 template <typename domain>
 struct size : initializer
 {
@@ -95,6 +147,8 @@ struct age : initializer
     domain m_domain;
     age(domain new_domain) : m_domain(new_domain){};
     void apply(float dt, particle p) override { m_domain.emit(p->age); };
+    bool is_age() const override { return true; };
+    bool is_constant() const override { return std::is_same<domain, constant>::value; };
 };
 
 // Sources
@@ -103,6 +157,9 @@ struct flow : source
     flow(double particles_per_second, std::vector<initializer *> initializers);
     virtual ~flow();
     particle apply(float dt, particle begin, particle end) override;
+    bool has_constant_lifetime() const override;
+    source_state get_state() const override;
+    void set_state(source_state const &state) override;
 
     float m_time = 0;
     size_t m_num_created = 0;
@@ -127,7 +184,8 @@ enum class rendering_mode
 {
     point,
     billboard,
-    overdraw
+    overdraw,
+    ribbon
 };
 
 enum class simulation_mode
@@ -136,28 +194,89 @@ enum class simulation_mode
     gpu
 };
 
+enum class storage_mode
+{
+    partitioned, // Dead particles are partitioned out of the pool every frame
+    ring         // Particles die in spawn order, the pool is a FIFO ring buffer
+};
+
 struct particle_system_oop
 {
-    particle_system_oop(source *src, std::vector<action *> actions, ID3D12Device *device);
+    // Passing trails switches the system to ribbon rendering.
+    // The device is only used once the system is simulated, a snapshot can be loaded before.
+    particle_system_oop(source *src, std::vector<action *> actions, ID3D12Device *device, particle_trails *trails = nullptr);
     ~particle_system_oop();
-    void reset(particle ptr);
-    void simulate(float dt, frame_resource *current_particle);
-    BYTE *get_frame_partition(int frame_index);
+    void reset();
+    void simulate(float dt, frame_resource *frame, XMFLOAT3 const &eye_pos);
+    BYTE *get_frame_partition(size_t frame_index);
+
+    // Write the live particles and the source's progress to a snapshot file
+    bool save_snapshot(const wchar_t *path);
+    // Replace the current particles with a snapshot's, to warm-start an effect without simulating its pre-roll
+    bool load_snapshot(particle_snapshot const &snapshot);
+
+    static constexpr float m_max_age = 100.f;
+
+    // Only address space is reserved for this many particles, pages get committed as the pool fills up
+    static constexpr size_t m_max_particles = 1 << 24;
+    static constexpr size_t m_particles_per_commit = 1 << 16;
+
     upload_buffer *m_vertex_upload_resource = nullptr;
     size_t m_vertexbuffer_stride = 0;
-    size_t m_num_particles_total = 1024;
+    size_t m_num_particles_total = 0;
     size_t m_num_particles_alive = 0;
     UINT m_num_particles_to_render = 0;
-    static constexpr int m_max_particles_per_frame = 1024;
+    // World bounds of the live particles and their trails, updated by simulate()
+    BoundingBox m_bounds = {};
+
+    // Size of a frame partition of the upload buffer, grows to the next power of two when the pool outgrows it
+    size_t m_max_particles_per_frame = 1024;
     simulation_mode m_simulation_mode = simulation_mode::cpu;
     rendering_mode m_rendering_mode = rendering_mode::point;
+    storage_mode m_storage_mode = storage_mode::partitioned;
     std::array<D3D12_VERTEX_BUFFER_VIEW, 4> m_VBVs = {};
 
+    // Ribbons are built after the particles in the frame partition, their indices are shared by every frame
+    UINT m_num_ribbon_indices_to_render = 0;
+    D3D12_VERTEX_BUFFER_VIEW m_ribbon_VBV = {};
+    D3D12_INDEX_BUFFER_VIEW m_ribbon_IBV = {};
+
 private:
+    void simulate_partitioned(float dt);
+    void simulate_ring(float dt);
+    void retire_timed_out();
+    bool grow_pool(size_t min_num_particles);
+    bool grow_ring();
+    void spawned(particle begin, particle end);
+    void upload(size_t frame_index, XMFLOAT3 const &eye_pos);
+    void update_bounds();
+    void grow_upload_buffer(size_t min_num_particles);
+    void create_upload_buffer();
+    void create_vbvs(particle first, std::array<D3D12_VERTEX_BUFFER_VIEW, 4> &vbvs);
+    particle pool_begin() const { return reinterpret_cast<particle>(m_pool.data()); }
+
+    // The simulation state lives in the pool and is simulated in place,
+    // the live particles are copied to the frame's upload partition afterwards
+    virtual_pool m_pool;
+    size_t m_pool_capacity = 0;
+    std::unique_ptr<particle_trails> m_trails = nullptr;
+
+    // In ring mode, slot of the oldest live particle. Always 0 in partitioned mode.
+    size_t m_ring_tail = 0;
+
+    // Upload buffers that were replaced while frames in flight could still be reading from them
+    struct retired_upload_buffer
+    {
+        UINT64 frame_count;
+        upload_buffer *buffer;
+    };
+    std::vector<retired_upload_buffer> m_retired_upload_resources = {};
+    UINT64 m_frame_count = 0;
+    size_t m_ribbon_indices_byte_size = 0;
+
+    ID3D12Device *m_device = nullptr;
     std::vector<std::unique_ptr<action>> m_actions = {};
-    particle m_particle = nullptr;
     std::unique_ptr<source> m_source = nullptr;
-    particle m_previous_particle = nullptr;
 };
 
 } // namespace particle
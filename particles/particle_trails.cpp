@@ -0,0 +1,205 @@
+#include "pch.h"
+#include "particle_trails.h"
+#include <algorithm>
+
+namespace particle
+{
+
+particle_trails::particle_trails(UINT history_length, float min_distance, float width)
+{
+    ASSERT2(history_length > 0 && history_length <= 255, "Trails must keep between 1 and 255 points of history.");
+    m_history_length = history_length;
+    m_min_distance_sq = min_distance * min_distance;
+    m_width = width;
+}
+
+void particle_trails::resize(size_t num_slots)
+{
+    m_x.resize(num_slots * m_history_length);
+    m_y.resize(num_slots * m_history_length);
+    m_z.resize(num_slots * m_history_length);
+    m_heads.resize(num_slots);
+    m_counts.resize(num_slots);
+}
+
+void particle_trails::start(size_t slot, XMFLOAT3 const &position)
+{
+    size_t first = slot * m_history_length;
+    m_x[first] = position.x;
+    m_y[first] = position.y;
+    m_z[first] = position.z;
+    m_heads[slot] = 0;
+    m_counts[slot] = 1;
+}
+
+void particle_trails::record(size_t slot, XMFLOAT3 const &position)
+{
+    size_t first = slot * m_history_length;
+    size_t newest = first + m_heads[slot];
+
+    // Decimate by distance, a slow particle doesn't use up its history on nearly identical points
+    float dx = position.x - m_x[newest];
+    float dy = position.y - m_y[newest];
+    float dz = position.z - m_z[newest];
+    if (dx * dx + dy * dy + dz * dz < m_min_distance_sq)
+        return;
+
+    m_heads[slot] = BYTE((m_heads[slot] + 1) % m_history_length);
+    m_counts[slot] = BYTE(std::min<UINT>(m_counts[slot] + 1u, m_history_length));
+
+    newest = first + m_heads[slot];
+    m_x[newest] = position.x;
+    m_y[newest] = position.y;
+    m_z[newest] = position.z;
+}
+
+void particle_trails::move(size_t dst_slot, size_t src_slot, size_t count)
+{
+    size_t dst = dst_slot * m_history_length;
+    size_t src = src_slot * m_history_length;
+    size_t num_points = count * m_history_length;
+    memmove(&m_x[dst], &m_x[src], num_points * sizeof(float));
+    memmove(&m_y[dst], &m_y[src], num_points * sizeof(float));
+    memmove(&m_z[dst], &m_z[src], num_points * sizeof(float));
+    memmove(&m_heads[dst_slot], &m_heads[src_slot], count);
+    memmove(&m_counts[dst_slot], &m_counts[src_slot], count);
+}
+
+void particle_trails::build_indices(UINT *indices, size_t num_ribbons) const
+{
+    // Two triangles per segment, between the left/right vertex pairs of consecutive points
+    for (size_t ribbon = 0; ribbon < num_ribbons; ribbon++)
+    {
+        UINT base = UINT(ribbon * vertices_per_ribbon());
+        for (UINT segment = 0; segment < m_history_length; segment++)
+        {
+            UINT v = base + segment * 2;
+            *indices++ = v;
+            *indices++ = v + 1;
+            *indices++ = v + 2;
+            *indices++ = v + 1;
+            *indices++ = v + 3;
+            *indices++ = v + 2;
+        }
+    }
+}
+
+void particle_trails::extend_bounds(size_t slot, XMVECTOR &min, XMVECTOR &max) const
+{
+    // The history fills up from the start of the slot before it wraps around
+    size_t first = slot * m_history_length;
+    for (size_t point = first; point < first + m_counts[slot]; point++)
+    {
+        XMVECTOR position = XMVectorSet(m_x[point], m_y[point], m_z[point], 0.f);
+        min = XMVectorMin(min, position);
+        max = XMVectorMax(max, position);
+    }
+}
+
+void particle_trails::build_ribbon(size_t slot, XMFLOAT3 const &position, XMFLOAT3 const &eye_pos, position_color *vertices) const
+{
+    // Gather the ribbon points in order into padded SoA arrays.
+    // Index 0 duplicates the first point and the tail repeats the last one, so that every point
+    // has a previous and next neighbor, and the points past the history collapse into degenerate segments.
+    constexpr size_t max_points = 256 + 4;
+    alignas(16) float px[max_points + 2];
+    alignas(16) float py[max_points + 2];
+    alignas(16) float pz[max_points + 2];
+
+    UINT num_ribbon_points = m_history_length + 1;
+    UINT num_simd_points = UINT(align_up(num_ribbon_points, 4));
+
+    size_t first = slot * m_history_length;
+    UINT head = m_heads[slot];
+    UINT count = m_counts[slot];
+
+    px[1] = position.x;
+    py[1] = position.y;
+    pz[1] = position.z;
+    UINT num_points = 1;
+    for (UINT i = 0; i < count; i++)
+    {
+        size_t point = first + (head + m_history_length - i) % m_history_length;
+        px[num_points + 1] = m_x[point];
+        py[num_points + 1] = m_y[point];
+        pz[num_points + 1] = m_z[point];
+        num_points++;
+    }
+    px[0] = px[1];
+    py[0] = py[1];
+    pz[0] = pz[1];
+    for (UINT i = num_points + 1; i < num_simd_points + 2; i++)
+    {
+        px[i] = px[num_points];
+        py[i] = py[num_points];
+        pz[i] = pz[num_points];
+    }
+
+    __m128 eye_x = _mm_set1_ps(eye_pos.x);
+    __m128 eye_y = _mm_set1_ps(eye_pos.y);
+    __m128 eye_z = _mm_set1_ps(eye_pos.z);
+    __m128 half_width = _mm_set1_ps(m_width * 0.5f);
+    __m128 epsilon = _mm_set1_ps(1e-12f);
+    __m128 lane_offsets = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+    __m128 inv_num_points = _mm_set1_ps(1.f / float(num_ribbon_points));
+    __m128 one = _mm_set1_ps(1.f);
+
+    // 4 ribbon points at a time
+    for (UINT k = 0; k < num_simd_points; k += 4)
+    {
+        __m128 x = _mm_loadu_ps(&px[k + 1]);
+        __m128 y = _mm_loadu_ps(&py[k + 1]);
+        __m128 z = _mm_loadu_ps(&pz[k + 1]);
+
+        // Tangent from the previous to the next point
+        __m128 tx = _mm_sub_ps(_mm_loadu_ps(&px[k + 2]), _mm_loadu_ps(&px[k]));
+        __m128 ty = _mm_sub_ps(_mm_loadu_ps(&py[k + 2]), _mm_loadu_ps(&py[k]));
+        __m128 tz = _mm_sub_ps(_mm_loadu_ps(&pz[k + 2]), _mm_loadu_ps(&pz[k]));
+
+        // Direction to the camera
+        __m128 vx = _mm_sub_ps(eye_x, x);
+        __m128 vy = _mm_sub_ps(eye_y, y);
+        __m128 vz = _mm_sub_ps(eye_z, z);
+
+        // The ribbon extends along tangent x view, so it always faces the camera
+        __m128 sx = _mm_sub_ps(_mm_mul_ps(ty, vz), _mm_mul_ps(tz, vy));
+        __m128 sy = _mm_sub_ps(_mm_mul_ps(tz, vx), _mm_mul_ps(tx, vz));
+        __m128 sz = _mm_sub_ps(_mm_mul_ps(tx, vy), _mm_mul_ps(ty, vx));
+
+        // Taper the ribbon and fade it out towards its oldest point
+        __m128 point_index = _mm_add_ps(_mm_set1_ps(float(k)), lane_offsets);
+        __m128 fade = _mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(point_index, inv_num_points)), _mm_setzero_ps());
+
+        // A degenerate tangent gives a zero side vector instead of a NaN
+        __m128 length_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, sx), _mm_mul_ps(sy, sy)), _mm_mul_ps(sz, sz));
+        __m128 scale = _mm_mul_ps(_mm_mul_ps(_mm_rsqrt_ps(_mm_max_ps(length_sq, epsilon)), half_width), fade);
+        scale = _mm_and_ps(scale, _mm_cmpgt_ps(length_sq, epsilon));
+        sx = _mm_mul_ps(sx, scale);
+        sy = _mm_mul_ps(sy, scale);
+        sz = _mm_mul_ps(sz, scale);
+
+        alignas(16) float left[3][4];
+        alignas(16) float right[3][4];
+        alignas(16) float alpha[4];
+        _mm_store_ps(left[0], _mm_sub_ps(x, sx));
+        _mm_store_ps(left[1], _mm_sub_ps(y, sy));
+        _mm_store_ps(left[2], _mm_sub_ps(z, sz));
+        _mm_store_ps(right[0], _mm_add_ps(x, sx));
+        _mm_store_ps(right[1], _mm_add_ps(y, sy));
+        _mm_store_ps(right[2], _mm_add_ps(z, sz));
+        _mm_store_ps(alpha, fade);
+
+        UINT num_lanes = std::min(4u, num_ribbon_points - k);
+        for (UINT lane = 0; lane < num_lanes; lane++)
+        {
+            position_color &l = vertices[(k + lane) * 2];
+            position_color &r = vertices[(k + lane) * 2 + 1];
+            l.position = XMFLOAT3(left[0][lane], left[1][lane], left[2][lane]);
+            r.position = XMFLOAT3(right[0][lane], right[1][lane], right[2][lane]);
+            l.color = XMFLOAT4(m_color.x, m_color.y, m_color.z, m_color.w * alpha[lane]);
+            r.color = l.color;
+        }
+    }
+}
+
+} // namespace particle
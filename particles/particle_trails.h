@@ -0,0 +1,47 @@
+#pragma once
+#include "common.h"
+#include <gpu_interface.h>
+#include <vector>
+
+namespace particle
+{
+using namespace DirectX;
+
+// Position history of every particle slot of a pool, used to build camera-facing ribbons.
+// The history is stored SoA: slot i owns [i * m_history_length, (i + 1) * m_history_length) of every
+// stream, as a ring whose newest point is at m_heads[i].
+// A ribbon goes through the particle's current position, then its history from newest to oldest.
+struct particle_trails
+{
+    // A point is only recorded once the particle moved min_distance away from the last recorded point
+    particle_trails(UINT history_length, float min_distance, float width);
+
+    void resize(size_t num_slots);
+    void start(size_t slot, XMFLOAT3 const &position);
+    void record(size_t slot, XMFLOAT3 const &position);
+    void move(size_t dst_slot, size_t src_slot, size_t count = 1);
+
+    // Every ribbon has the same number of vertices, so the indices are built once and shared by all ribbons
+    UINT vertices_per_ribbon() const { return 2 * (m_history_length + 1); }
+    UINT indices_per_ribbon() const { return 6 * m_history_length; }
+    void build_indices(UINT *indices, size_t num_ribbons) const;
+
+    // Writes the ribbon of the particle at slot, facing eye_pos, to vertices_per_ribbon() vertices
+    void build_ribbon(size_t slot, XMFLOAT3 const &position, XMFLOAT3 const &eye_pos, position_color *vertices) const;
+
+    // Grows min and max to include the recorded points of the slot
+    void extend_bounds(size_t slot, XMVECTOR &min, XMVECTOR &max) const;
+
+    UINT m_history_length = 0;
+    float m_min_distance_sq = 0.f;
+    float m_width = 0.f;
+    XMFLOAT4 m_color = {1.f, 1.f, 1.f, 1.f};
+
+    std::vector<float> m_x;
+    std::vector<float> m_y;
+    std::vector<float> m_z;
+    std::vector<BYTE> m_heads;
+    std::vector<BYTE> m_counts;
+};
+
+} // namespace particle
@@ -6,9 +6,11 @@
 #include "step_timer.h"
 #include "particle_system_oop.h"
 #include "camera.h"
+#include "frustum_culler.h"
 #include "DDSTextureLoader12.h"
 #include "geometry_helpers.h"
 #include "transform.h"
+#include "frame_arena.h"
 #include "particle_system_gpu.h"
 #include "shaders/shader_shared_constants.h"
 #include <numeric>
@@ -56,17 +58,6 @@ s_internal HANDLE cpu_copy_wait_event = nullptr;
 s_internal bool is_first_reset = true;
 
 // Shader objects
-enum heap_offsets
-{
-    heap_offset_srv_fire_texture,
-    heap_offset_cbv_texture_transform,
-    heap_offset_uav_particle_systems_bounds,
-    heap_offset_uav_filtered_simcmds,
-    heap_offset_uav_filtered_drawcmds,
-    heap_offset_uav_filtered_bounds_drawcmds,
-    heap_offset_uav_filtered_bounds_calccmds,
-};
-
 void create_shader_objects();
 s_internal ID3DBlob *billboard_blob_vs = nullptr;
 s_internal ID3DBlob *billboard_blob_ps = nullptr;
@@ -85,6 +76,8 @@ s_internal ID3DBlob *debug_lines_blob_vs = nullptr;
 s_internal ID3DBlob *debug_lines_blob_ps = nullptr;
 s_internal ID3DBlob *debug_planes_blob_vs = nullptr;
 s_internal ID3DBlob *debug_planes_blob_ps = nullptr;
+s_internal ID3DBlob *ribbons_blob_vs = nullptr;
+s_internal ID3DBlob *ribbons_blob_ps = nullptr;
 
 s_internal ID3D12PipelineState *billboard_pso = nullptr;
 s_internal ID3D12PipelineState *point_pso = nullptr;
@@ -96,12 +89,24 @@ s_internal ID3D12PipelineState *bounds_pso = nullptr;
 s_internal ID3D12PipelineState *calc_bounds_pso = nullptr;
 s_internal ID3D12PipelineState *debug_line_pso = nullptr;
 s_internal ID3D12PipelineState *debug_plane_pso = nullptr;
+s_internal ID3D12PipelineState *ribbons_pso = nullptr;
+
+// Descriptors, the ranges bound as a descriptor table hold the table's descriptors in order.
+// The material table points at the frame's constant buffer, so it's written in the frame's transient region every frame.
+s_internal constexpr UINT num_persistent_descriptors = 64;
+s_internal constexpr UINT num_frame_descriptors = 2; // Texture SRV, texture transform CBV
+s_internal descriptor_heap *descriptors = nullptr;
+s_internal void write_material_descriptors();
+s_internal descriptor_range bounds_uav_descriptor = {};
+s_internal descriptor_range filtered_simcmds_uav_descriptor = {};
+s_internal descriptor_range filtered_drawcmds_uav_descriptors = {}; // Particle draw commands UAV, bounds draw commands UAV
+s_internal descriptor_range filtered_bounds_calccmds_uav_descriptor = {};
 
 // Textures
-ID3D12DescriptorHeap *srv_heap = nullptr;
 void create_texture_objects();
 s_internal ID3D12Resource *fire_texture_default_resource = nullptr;
 s_internal ID3D12Resource *fire_texture_upload_resource = nullptr;
+s_internal D3D12_SHADER_RESOURCE_VIEW_DESC fire_texture_srv_desc = {};
 s_internal material_data cb_material = {};
 
 // Benchmarking
@@ -123,12 +128,22 @@ s_internal std::string cpu_particle_sim = "cpu_particle_sim";
 s_internal UINT num_particle_systems = 0;
 
 s_internal particle::particle_system_oop *particle_system = nullptr;
-s_internal std::array<particle::aligned_aos, particle_system->m_max_particles_per_frame> *particle_data = nullptr;
+// Saved from the UI, next to the executable
+s_internal const wchar_t *cpu_particles_snapshot_path = L"cpu_particles.psnp";
 
 // new particle data
 s_internal std::vector<particle_system_gpu> particle_systems;
 s_internal void create_particle_systems_batch();
 
+// Upload memory for the buffers initialized from the CPU, and for the data streamed every frame.
+// The initialization fills a part of it once, then the frames reclaim their space when their fence completes.
+s_internal constexpr size_t upload_ring_size = 4 * 1024 * 1024;
+s_internal d3d12_upload_ring *uploads = nullptr;
+
+// Passes and resources of the frame, the graph is rebuilt every frame
+s_internal render_graph frame_graph;
+s_internal d3d12_render_graph_backend *graph_backend = nullptr;
+
 // Command signatures for indirect drawing/simulation
 s_internal ID3D12CommandSignature *drawing_cmd_sig = nullptr;
 s_internal ID3D12CommandSignature *particle_sim_cmd_sig = nullptr;
@@ -137,13 +152,9 @@ s_internal ID3D12CommandSignature *bounds_calc_cmd_sig = nullptr;
 
 // Buffer used to group together all of the indirect simulation/drawing commands from all the particle systems
 s_internal ID3D12Resource *input_simcmds_grouped_default = nullptr;
-s_internal ID3D12Resource *input_simcmds_grouped_upload = nullptr;
 s_internal ID3D12Resource *input_drawcmds_grouped_default = nullptr;
-s_internal ID3D12Resource *input_drawcmds_grouped_upload = nullptr;
 s_internal ID3D12Resource *input_bounds_drawcmds_grouped_default = nullptr;
-s_internal ID3D12Resource *input_bounds_drawcmds_grouped_upload = nullptr;
 s_internal ID3D12Resource *input_bounds_calccmds_grouped_default = nullptr;
-s_internal ID3D12Resource *input_bounds_calccmds_grouped_upload = nullptr;
 
 // Counters
 s_internal ID3D12Resource *simcmds_counter = nullptr;
@@ -159,23 +170,17 @@ s_internal ID3D12Resource *bounds_vertices_counter_reset = nullptr;
 
 // Buffer used to received the filtered simulation/drawing commands that passed the furstum culling test
 s_internal ID3D12Resource *filtered_simcmds_default = nullptr;
-s_internal ID3D12Resource *filtered_simcmds_upload = nullptr;
 s_internal ID3D12Resource *filtered_drawcmds_default = nullptr;
-s_internal ID3D12Resource *filtered_drawcmds_grouped_upload = nullptr;
 s_internal ID3D12Resource *cleared_simcmds_default = nullptr;
 s_internal ID3D12Resource *filtered_bounds_drawcmds_default = nullptr;
-s_internal ID3D12Resource *filtered_bounds_drawcmds_upload = nullptr;
 s_internal ID3D12Resource *filtered_bounds_calccmds_default = nullptr;
-s_internal ID3D12Resource *filtered_bounds_calccmds_upload = nullptr;
 
 // Same as simulation_cmds_input, but with the particle_input_uav and particle_output_uav buffers swapped
 s_internal ID3D12Resource *swap_simcmds_grouped_default = nullptr;
-s_internal ID3D12Resource *swap_simcmds_grouped_upload = nullptr;
 
 // Buffers to hold Axis-aligned bounding box data
 s_internal ID3D12Resource *particle_system_bounds_vertices_default = nullptr;
 s_internal ID3D12Resource *particle_system_bounds_indices_default = nullptr;
-s_internal ID3D12Resource *particle_system_bounds_indices_upload = nullptr;
 
 // Camera
 s_internal ImVec2 last_mouse_pos = {};
@@ -189,6 +194,11 @@ s_internal INT num_cameras = 2;
 s_internal std::unique_ptr<camera> main_cam = nullptr;
 s_internal std::unique_ptr<camera> debug_cam = nullptr;
 
+// The CPU particles are culled against both cameras in one sweep, the current camera decides if they're drawn
+s_internal multi_frustum_culler camera_culler;
+s_internal aabb_soa cpu_particles_bounds;
+s_internal UINT64 cpu_particles_visibility[2] = {};
+
 // Scene
 mesh floor_grid = {};
 s_internal pass_data cb_pass = {};
@@ -205,10 +215,34 @@ struct debug_mesh
     UINT indices_count;
 };
 s_internal ID3D12Resource *debug_indices_default = nullptr;
-s_internal ID3D12Resource *debug_indices_upload = nullptr;
 s_internal debug_mesh debugcam_frustum;
 s_internal debug_mesh debugcam_frustum_planes;
 s_internal debug_mesh maincam_frustum;
+s_internal upload_allocation debug_vertices_upload; // This frame's vertices of the debug meshes
+
+// Flat ring in the xz plane. Its inner and outer triangles have different areas, the particles are spread over it by area.
+s_internal mesh_data create_emitter_ring(float inner_radius, float outer_radius, UINT num_segments)
+{
+    mesh_data ring;
+    ring.name = "emitter_ring";
+    for (UINT i = 0; i < num_segments; i++)
+    {
+        float angle = XM_2PI * float(i) / float(num_segments);
+        float c = cosf(angle);
+        float s = sinf(angle);
+        ring.vertices.push_back({XMFLOAT3(inner_radius * c, 0.f, inner_radius * s), XMFLOAT4(1.f, 1.f, 1.f, 1.f)});
+        ring.vertices.push_back({XMFLOAT3(outer_radius * c, 0.f, outer_radius * s), XMFLOAT4(1.f, 1.f, 1.f, 1.f)});
+    }
+
+    for (UINT i = 0; i < num_segments; i++)
+    {
+        WORD inner = WORD(2 * i);
+        WORD next_inner = WORD(2 * ((i + 1) % num_segments));
+        WORD quad[] = {inner, WORD(inner + 1), WORD(next_inner + 1), inner, WORD(next_inner + 1), next_inner};
+        ring.indices.insert(ring.indices.end(), quad, quad + 6);
+    }
+    return ring;
+}
 
 extern "C" __declspec(dllexport) bool initialize()
 {
@@ -220,21 +254,27 @@ extern "C" __declspec(dllexport) bool initialize()
     // Initialize the camera
     main_cam = std::make_unique<camera>(transform({0.f, 0.f, -10.f}), 1.f, 1000.f);
     debug_cam = std::make_unique<camera>(transform({0.f, 0.f, 0.f}), 1.f, 5.f);
+    cpu_particles_bounds.resize(1);
 
     // Initialize device resources
     dr = new device_resources();
     device = dr->device;
     cmd_queue = dr->cmd_queue;
+    uploads = new d3d12_upload_ring(device, dr->fence, upload_ring_size, "upload_ring");
+    descriptors = new descriptor_heap(device, num_persistent_descriptors, num_frame_descriptors, "descriptors");
 
     // Initialize Dear ImGui
     imgui_init(device);
 
-    // Initialize particles
+    // Initialize particles, the CPU system draws its particles as trails
+    particle::particle_trails *trails = new particle::particle_trails(16, 0.05f, 0.05f);
+    trails->m_color = XMFLOAT4(1.f, 0.5f, 0.1f, 1.f);
     particle_system = new particle::particle_system_oop(
         // The source
         new particle::flow(50.0,
                            {// List of initializers
-                            new particle::position<particle::point>(XMFLOAT3(0.0f, -1.5f, 0.0f)),
+                            new particle::position<particle::mesh_surface>(particle::mesh_surface(create_emitter_ring(0.3f, 0.5f, 32),
+                                                                                                  XMMatrixTranslation(0.f, -1.5f, 0.f))),
                             new particle::size<particle::constant>(1.f),
                             new particle::age<particle::constant>(1.f),
                             //new particle::velocity<particle::point>(XMFLOAT3(0.f, 01.f, 0.f))
@@ -248,12 +288,17 @@ extern "C" __declspec(dllexport) bool initialize()
             new particle::move()
             //new particle::gravity(XMVectorSet(0.f, 0.f, -1.8f, 0.f))
         },
-        device);
+        device,
+        trails);
+
+    // Warm start from a saved snapshot instead of waiting for the effect to fill up, a missing file starts it empty
+    particle::particle_snapshot warm_start(cpu_particles_snapshot_path);
+    particle_system->load_snapshot(warm_start);
 
     // Initialize command objects
     for (UINT i = 0; i < NUM_BACK_BUFFERS; i++)
     {
-        frame_resources[i] = new frame_resource(device, i, particle_system->get_frame_partition(i), num_particle_systems_at_launch);
+        frame_resources[i] = new frame_resource(device, i, num_particle_systems_at_launch);
     }
     frame = frame_resources[0];
 
@@ -264,6 +309,7 @@ extern "C" __declspec(dllexport) bool initialize()
                                        nullptr,
                                        IID_PPV_ARGS(&main_cmdlist)));
     NAME_D3D12_OBJECT(main_cmdlist);
+    graph_backend = new d3d12_render_graph_backend(main_cmdlist);
 
     // Create the copy objects
     cpu_copy_wait_event = CreateEventEx(NULL, NULL, NULL, EVENT_ALL_ACCESS);
@@ -386,9 +432,9 @@ extern "C" __declspec(dllexport) bool initialize()
     debugcam_frustum_planes.indices_byte_offset = indices_byte_offset;
     debugcam_frustum_planes.indices_byte_size = index_size * debugcam_frustum_planes.indices_count;
 
-    create_default_buffer(device, main_cmdlist,
+    create_default_buffer(device, main_cmdlist, uploads,
                           indices.data(), index_size * indices.size(),
-                          &debug_indices_upload, &debug_indices_default,
+                          &debug_indices_default,
                           "debug_indices");
 
     // Create the floor grid data
@@ -417,17 +463,19 @@ extern "C" __declspec(dllexport) bool initialize()
         4, 5, 4, 6,
         5, 7, 6, 7};
 
-    create_default_buffer(device, main_cmdlist,
+    create_default_buffer(device, main_cmdlist, uploads,
                           bounds_indices, sizeof(UINT16) * _countof(bounds_indices),
-                          &particle_system_bounds_indices_upload, &particle_system_bounds_indices_default,
+                          &particle_system_bounds_indices_default,
                           "particle_system_bounds_indices");
 
     // Create the particle systems
     create_particle_systems_batch();
 
     // Create UAVs for the resource that require a counter
-    D3D12_CPU_DESCRIPTOR_HANDLE handle = {};
-    handle.ptr = srv_heap->GetCPUDescriptorHandleForHeapStart().ptr + (dr->srv_desc_handle_incr_size * heap_offset_uav_particle_systems_bounds);
+    bounds_uav_descriptor = descriptors->allocate(1);
+    filtered_simcmds_uav_descriptor = descriptors->allocate(1);
+    filtered_drawcmds_uav_descriptors = descriptors->allocate(2);
+    filtered_bounds_calccmds_uav_descriptor = descriptors->allocate(1);
 
     D3D12_UNORDERED_ACCESS_VIEW_DESC uav_desc;
     uav_desc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
@@ -437,26 +485,27 @@ extern "C" __declspec(dllexport) bool initialize()
     uav_desc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
     uav_desc.Buffer.NumElements = num_particle_systems_at_launch;
     uav_desc.Buffer.StructureByteStride = sizeof(bounding_box);
-    device->CreateUnorderedAccessView(particle_system_bounds_vertices_default, bounds_vertices_counter, &uav_desc, handle);
+    device->CreateUnorderedAccessView(particle_system_bounds_vertices_default, bounds_vertices_counter, &uav_desc,
+                                      descriptors->cpu(bounds_uav_descriptor));
 
-    handle.ptr = srv_heap->GetCPUDescriptorHandleForHeapStart().ptr + (dr->srv_desc_handle_incr_size * heap_offset_uav_filtered_simcmds);
     uav_desc.Buffer.NumElements = max_num_particle_systems;
     uav_desc.Buffer.FirstElement = 0;
     uav_desc.Buffer.CounterOffsetInBytes = 0;
     uav_desc.Buffer.StructureByteStride = sizeof(simulation_indirect_command);
-    device->CreateUnorderedAccessView(filtered_simcmds_default, simcmds_counter, &uav_desc, handle);
+    device->CreateUnorderedAccessView(filtered_simcmds_default, simcmds_counter, &uav_desc,
+                                      descriptors->cpu(filtered_simcmds_uav_descriptor));
 
     uav_desc.Buffer.StructureByteStride = sizeof(draw_indirect_command2);
-    handle.ptr = srv_heap->GetCPUDescriptorHandleForHeapStart().ptr + (dr->srv_desc_handle_incr_size * heap_offset_uav_filtered_drawcmds);
-    device->CreateUnorderedAccessView(filtered_drawcmds_default, drawcmds_counter, &uav_desc, handle);
+    device->CreateUnorderedAccessView(filtered_drawcmds_default, drawcmds_counter, &uav_desc,
+                                      descriptors->cpu(filtered_drawcmds_uav_descriptors, 0));
 
     uav_desc.Buffer.StructureByteStride = sizeof(bounds_draw_indirect_command);
-    handle.ptr = srv_heap->GetCPUDescriptorHandleForHeapStart().ptr + (dr->srv_desc_handle_incr_size * heap_offset_uav_filtered_bounds_drawcmds);
-    device->CreateUnorderedAccessView(filtered_bounds_drawcmds_default, bounds_draw_counter, &uav_desc, handle);
+    device->CreateUnorderedAccessView(filtered_bounds_drawcmds_default, bounds_draw_counter, &uav_desc,
+                                      descriptors->cpu(filtered_drawcmds_uav_descriptors, 1));
 
     uav_desc.Buffer.StructureByteStride = sizeof(bounds_calc_indirect_command);
-    handle.ptr = srv_heap->GetCPUDescriptorHandleForHeapStart().ptr + (dr->srv_desc_handle_incr_size * heap_offset_uav_filtered_bounds_calccmds);
-    device->CreateUnorderedAccessView(filtered_bounds_calccmds_default, bounds_calc_counter, &uav_desc, handle);
+    device->CreateUnorderedAccessView(filtered_bounds_calccmds_default, bounds_calc_counter, &uav_desc,
+                                      descriptors->cpu(filtered_bounds_calccmds_uav_descriptor));
 
     // Indirect drawing command signature
     D3D12_INDIRECT_ARGUMENT_DESC draw_indirect_args[3] = {};
@@ -531,6 +580,7 @@ extern "C" __declspec(dllexport) bool initialize()
     main_cmdlist->Close();
     cmd_queue->ExecuteCommandLists(1, (ID3D12CommandList *const *)&main_cmdlist);
     dr->flush_cmd_queue();
+    uploads->end_frame(dr->last_signaled_fence_value);
 
     return true;
 }
@@ -567,7 +617,7 @@ s_internal void create_particle_systems_batch()
         size_t bounds_offset = (sizeof(bounding_box) * i) + offsetof(bounding_box, positions);
         D3D12_GPU_VIRTUAL_ADDRESS ps_bounds_vertices_gpu_va = particle_system_bounds_vertices_default->GetGPUVirtualAddress() + bounds_offset;
 
-        particle_system_gpu system = particle_system_gpu(device, main_cmdlist,
+        particle_system_gpu system = particle_system_gpu(device, main_cmdlist, uploads,
                                                          particle_data.get(),
                                                          transforms_gpu_va,
                                                          physics_gpu_va,
@@ -581,51 +631,51 @@ s_internal void create_particle_systems_batch()
     // Create the buffers that will hold all of the simulation commands
     size_t indirect_sim_size = sizeof(simulation_indirect_command);
     size_t indirect_buffer_size = indirect_sim_size * max_num_particle_systems;
-    create_default_buffer(device, main_cmdlist,
+    create_default_buffer(device, main_cmdlist, uploads,
                           nullptr, indirect_buffer_size,
-                          &input_simcmds_grouped_upload, &input_simcmds_grouped_default,
+                          &input_simcmds_grouped_default,
                           "input_simcmds_grouped");
-    create_default_buffer(device, main_cmdlist,
+    create_default_buffer(device, main_cmdlist, uploads,
                           nullptr, indirect_buffer_size,
-                          &swap_simcmds_grouped_upload, &swap_simcmds_grouped_default,
+                          &swap_simcmds_grouped_default,
                           "swap_simcmds_grouped");
-    create_default_buffer(device, main_cmdlist,
+    create_default_buffer(device, main_cmdlist, uploads,
                           nullptr, indirect_buffer_size,
-                          &filtered_simcmds_upload, &filtered_simcmds_default,
+                          &filtered_simcmds_default,
                           "filtered_simcmds", D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
 
     // Create the buffers that will hold the drawing commands
     size_t indirect_draw_size = sizeof(draw_indirect_command2);
     indirect_buffer_size = indirect_draw_size * max_num_particle_systems;
-    create_default_buffer(device, main_cmdlist,
+    create_default_buffer(device, main_cmdlist, uploads,
                           nullptr, indirect_buffer_size,
-                          &input_drawcmds_grouped_upload, &input_drawcmds_grouped_default,
+                          &input_drawcmds_grouped_default,
                           "input_drawcmds_grouped");
 
-    create_default_buffer(device, main_cmdlist,
+    create_default_buffer(device, main_cmdlist, uploads,
                           nullptr, indirect_buffer_size,
-                          &filtered_drawcmds_grouped_upload, &filtered_drawcmds_default,
+                          &filtered_drawcmds_default,
                           "filtered_drawcmds", D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
 
     // Create the buffers that will hold the bounds drawing commands
     size_t indirect_bounds_draw_size = sizeof(bounds_draw_indirect_command);
     indirect_buffer_size = indirect_bounds_draw_size * max_num_particle_systems;
-    create_default_buffer(device, main_cmdlist,
+    create_default_buffer(device, main_cmdlist, uploads,
                           nullptr, indirect_buffer_size,
-                          &input_bounds_drawcmds_grouped_upload, &input_bounds_drawcmds_grouped_default, "input_bounds_drawcmds");
-    create_default_buffer(device, main_cmdlist,
+                          &input_bounds_drawcmds_grouped_default, "input_bounds_drawcmds");
+    create_default_buffer(device, main_cmdlist, uploads,
                           nullptr, indirect_buffer_size,
-                          &filtered_bounds_drawcmds_upload, &filtered_bounds_drawcmds_default, "filtered_bounds_drawcmds", D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+                          &filtered_bounds_drawcmds_default, "filtered_bounds_drawcmds", D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
 
     // Create the buffers that will hold the bounds calculation commands
     size_t indirect_bounds_calc_size = sizeof(bounds_calc_indirect_command);
     indirect_buffer_size = indirect_bounds_calc_size * max_num_particle_systems;
-    create_default_buffer(device, main_cmdlist,
+    create_default_buffer(device, main_cmdlist, uploads,
                           nullptr, indirect_buffer_size,
-                          &input_bounds_calccmds_grouped_upload, &input_bounds_calccmds_grouped_default, "input_bounds_calccmds");
-    create_default_buffer(device, main_cmdlist,
+                          &input_bounds_calccmds_grouped_default, "input_bounds_calccmds");
+    create_default_buffer(device, main_cmdlist, uploads,
                           nullptr, indirect_buffer_size,
-                          &filtered_bounds_calccmds_upload, &filtered_bounds_calccmds_default, "filtered_bounds_calccmds", D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+                          &filtered_bounds_calccmds_default, "filtered_bounds_calccmds", D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
 
     // Create the buffers to hold the UAV counter and a reset buffer
     create_default_buffer(device, main_cmdlist,
@@ -761,6 +811,9 @@ s_internal void create_particle_systems_batch()
 
 extern "C" __declspec(dllexport) bool update_and_render()
 {
+    // Nothing allocated in the frame arena survives the previous frame
+    thread_frame_arena().reset();
+
     //
     // Update
     //
@@ -785,17 +838,16 @@ extern "C" __declspec(dllexport) bool update_and_render()
     particle_systems[0].m_transform.set_translation(0.f, 0.f, 15.f);
 
     // Update model data
-    for (size_t i = 0; i < particle_systems.size(); i++)
-    {
-        frame->cb_transforms_upload->copy_data((int)i, (model_data *)&particle_systems[i].m_transform.m_world_transposed);
-    }
+    frame->cb_transforms_upload->write_span(0, particle_systems.data(), particle_systems.size(), [](const particle_system_gpu &system, model_data &model) {
+        model.transform = system.m_transform.m_world_transposed;
+    });
 
     // Debug camera frustum
-    std::vector<position_color> debug_vertices(0);
+    frame_vector<position_color> debug_vertices;
     UINT vertices_byte_offset = 0;
     UINT vertex_size = sizeof(position_color);
 
-    std::vector<position_color> debugcam_frustum_positions = debug_cam->calc_frustum_vertices();
+    frame_vector<position_color> debugcam_frustum_positions = debug_cam->calc_frustum_vertices();
     debugcam_frustum.vertices_count = (UINT)debugcam_frustum_positions.size();
     debugcam_frustum.vertices_byte_offset = vertices_byte_offset;
     debugcam_frustum.vertices_byte_size = vertex_size * debugcam_frustum.vertices_count;
@@ -811,7 +863,7 @@ extern "C" __declspec(dllexport) bool update_and_render()
     vertices_byte_offset += debugcam_frustum.vertices_byte_size;
 
     // Main camera frustum
-    std::vector<position_color> maincam_frustum_positions = main_cam->calc_frustum_vertices();
+    frame_vector<position_color> maincam_frustum_positions = main_cam->calc_frustum_vertices();
     maincam_frustum.vertices_count = (UINT)maincam_frustum_positions.size();
     maincam_frustum.vertices_byte_offset = vertices_byte_offset;
     maincam_frustum.vertices_byte_size = vertex_size * maincam_frustum.vertices_count;
@@ -819,10 +871,10 @@ extern "C" __declspec(dllexport) bool update_and_render()
     debug_vertices.insert(debug_vertices.end(),
                           maincam_frustum_positions.begin(), maincam_frustum_positions.end());
 
-    for (size_t i = 0; i < debug_vertices.size(); i++)
-    {
-        frame->cb_debug_vertices_upload->copy_data((int)i, &debug_vertices[i]);
-    }
+    size_t debug_vertices_size = debug_vertices.size() * sizeof(position_color);
+    debug_vertices_upload = uploads->allocate(debug_vertices_size, alignof(position_color));
+    ASSERT2(debug_vertices_upload.is_valid(), "The upload ring is too small for the debug vertices.");
+    memcpy(debug_vertices_upload.cpu, debug_vertices.data(), debug_vertices_size);
 
     // Update pass data
     switch (current_camera)
@@ -832,13 +884,8 @@ extern "C" __declspec(dllexport) bool update_and_render()
         cb_pass.view = main_cam->m_inv_view;
         XMStoreFloat4x4(&cb_pass.proj, XMMatrixTranspose(XMLoadFloat4x4(&main_cam->m_proj)));
 
-        // Pass the other camera's planes
-        cb_pass.frustum_planes[0] = main_cam->m_far_plane;
-        cb_pass.frustum_planes[1] = main_cam->m_near_plane;
-        cb_pass.frustum_planes[2] = main_cam->m_bottom_plane;
-        cb_pass.frustum_planes[3] = main_cam->m_top_plane;
-        cb_pass.frustum_planes[4] = main_cam->m_left_plane;
-        cb_pass.frustum_planes[5] = main_cam->m_right_plane;
+        // Pass the other camera's planes, in world space so the culling shader doesn't transform them per box
+        main_cam->world_frustum_planes(cb_pass.frustum_planes);
         break;
     case debug:
         cb_pass.eye_pos = debug_cam->m_transform.m_translation;
@@ -846,12 +893,7 @@ extern "C" __declspec(dllexport) bool update_and_render()
         XMStoreFloat4x4(&cb_pass.proj, XMMatrixTranspose(XMLoadFloat4x4(&debug_cam->m_proj)));
 
         // Pass the other camera's planes
-        cb_pass.frustum_planes[0] = debug_cam->m_bottom_plane;
-        cb_pass.frustum_planes[1] = debug_cam->m_top_plane;
-        cb_pass.frustum_planes[2] = debug_cam->m_far_plane;
-        cb_pass.frustum_planes[3] = debug_cam->m_near_plane;
-        cb_pass.frustum_planes[4] = debug_cam->m_left_plane;
-        cb_pass.frustum_planes[5] = debug_cam->m_right_plane;
+        debug_cam->world_frustum_planes(cb_pass.frustum_planes);
         break;
     }
     cb_pass.time = (float)timer.total_time;
@@ -878,14 +920,6 @@ extern "C" __declspec(dllexport) bool update_and_render()
     // Update physics data
     frame->cb_physics->copy_data(0, &cb_physics);
 
-    // Update particles
-    //timer.start(cpu_particle_sim);
-    //if (particle_system->m_simulation_mode == particle::simulation_mode::cpu)
-    //{
-    //    particle_system->simulate(dt, frame);
-    //}
-    //timer.stop(cpu_particle_sim);
-
     timer.start(cpu_wait_time);
     if (is_waiting_present)
     {
@@ -898,8 +932,25 @@ extern "C" __declspec(dllexport) bool update_and_render()
     frame = frame_resources[backbuffer_index];
     dr->cpu_wait(frame->fence_value);
     cmd_alloc = frame->cmd_alloc;
+    descriptors->begin_frame(backbuffer_index);
     timer.stop(cpu_wait_time);
 
+    // Update the CPU particles once the GPU is done reading the frame's upload partition
+    timer.start(cpu_particle_sim);
+    if (particle_system->m_simulation_mode == particle::simulation_mode::cpu)
+    {
+        particle_system->simulate(dt, frame, cb_pass.eye_pos);
+    }
+    timer.stop(cpu_particle_sim);
+
+    XMFLOAT4 camera_planes[2][6];
+    main_cam->world_frustum_planes(camera_planes[main]);
+    debug_cam->world_frustum_planes(camera_planes[debug]);
+    camera_culler.set_frusta(camera_planes, 2);
+    cpu_particles_bounds.set(0, particle_system->m_bounds);
+    UINT64 *visibility_masks[] = {&cpu_particles_visibility[main], &cpu_particles_visibility[debug]};
+    camera_culler.cull(cpu_particles_bounds, visibility_masks);
+
     timer.start(cpu_rest_of_frame);
 
     // Render
@@ -907,7 +958,9 @@ extern "C" __declspec(dllexport) bool update_and_render()
     main_cmdlist->Reset(cmd_alloc, nullptr);
 
     PIXEndEvent(main_cmdlist);
-    PIXBeginEvent(main_cmdlist, 1, (std::string("Frame ") + std::to_string(timer.total_frame_count)).c_str());
+    char frame_event_name[32];
+    sprintf(frame_event_name, "Frame %llu", timer.total_frame_count);
+    PIXBeginEvent(main_cmdlist, 1, frame_event_name);
 
     frame->cb_pass_upload->copy_data(0, &cb_pass);
 
@@ -918,306 +971,266 @@ extern "C" __declspec(dllexport) bool update_and_render()
 
     query->start(gpu_frame_time_query);
 
-    main_cmdlist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
-                                         dr->back_buffers[backbuffer_index],
-                                         D3D12_RESOURCE_STATE_PRESENT | D3D12_RESOURCE_STATE_COMMON,
-                                         D3D12_RESOURCE_STATE_RENDER_TARGET));
-
+    // Bound for the whole frame, the passes only set what they change
     set_viewport_rects(main_cmdlist);
-
-    PIXBeginEvent(main_cmdlist, 1, "clear dsv and rtv");
-    main_cmdlist->ClearDepthStencilView(dr->dsv_heap->GetCPUDescriptorHandleForHeapStart(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.f, 0, 0, NULL);
-    main_cmdlist->ClearRenderTargetView(dr->rtv_descriptor_handles[backbuffer_index], DirectX::Colors::Black, 0, NULL);
-    PIXEndEvent(main_cmdlist);
-
     main_cmdlist->OMSetRenderTargets(1, &dr->rtv_descriptor_handles[backbuffer_index], FALSE, &dr->dsv_heap->GetCPUDescriptorHandleForHeapStart());
-
     main_cmdlist->SetGraphicsRootSignature(dr->rootsig);
     main_cmdlist->SetComputeRootSignature(dr->rootsig);
     main_cmdlist->SetGraphicsRootConstantBufferView(0, frame->cb_pass_upload->m_upload->GetGPUVirtualAddress());
-
-    // Draw floor grid
-    PIXBeginEvent(main_cmdlist, 1, "Draw floor grid");
-    main_cmdlist->IASetVertexBuffers(0, 1, &floor_grid.resource->vbv);
-    main_cmdlist->IASetIndexBuffer(&floor_grid.resource->ibv);
-    main_cmdlist->SetPipelineState(floorgrid_pso);
-    main_cmdlist->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_LINELIST);
-    main_cmdlist->DrawIndexedInstanced(floor_grid.index_count, 1, 0, 0, 0);
-    PIXEndEvent(main_cmdlist);
-
-    query->start(gpu_particles_time_query);
-
-    // Draw particles
-    main_cmdlist->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_POINTLIST);
+    main_cmdlist->SetComputeRootConstantBufferView(0, frame->cb_pass_upload->m_upload->GetGPUVirtualAddress());
+    ID3D12DescriptorHeap *heaps[] = {descriptors->heap()};
+    main_cmdlist->SetDescriptorHeaps(_countof(heaps), heaps);
+    write_material_descriptors();
 
     num_particle_systems = (UINT)particle_systems.size();
 
-    std::vector<D3D12_RESOURCE_BARRIER> transitions = std::vector<D3D12_RESOURCE_BARRIER>();
-    D3D12_RESOURCE_BARRIER transition;
-    transition.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-    transition.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-    transition.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
-
-    // Transition to prepare for resetting uav counters
-    transition.Transition.StateBefore = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
-    transition.Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_DEST;
-    transition.Transition.pResource = simcmds_counter;
-    transitions.push_back(transition);
-
-    transition.Transition.pResource = drawcmds_counter;
-    transitions.push_back(transition);
-
-    transition.Transition.pResource = bounds_draw_counter;
-    transitions.push_back(transition);
-
-    transition.Transition.pResource = bounds_calc_counter;
-    transitions.push_back(transition);
-
-    transition.Transition.pResource = bounds_vertices_counter;
-    transitions.push_back(transition);
-    main_cmdlist->ResourceBarrier((UINT)transitions.size(), transitions.data());
-
-    // Reset the counters
-    PIXBeginEvent(main_cmdlist, 1, "Reset counters");
-    main_cmdlist->CopyResource(bounds_vertices_counter, bounds_vertices_counter_reset);
-    main_cmdlist->CopyResource(simcmds_counter, simcmds_counter_reset);
-    main_cmdlist->CopyResource(drawcmds_counter, drawcmds_counter_reset);
-    main_cmdlist->CopyResource(bounds_draw_counter, bounds_draw_counter_reset);
-    main_cmdlist->CopyResource(bounds_calc_counter, bounds_calc_counter_reset);
-    PIXEndEvent(main_cmdlist);
-
-    // Transition to prepare for culling on simulation and draw commands
-    transitions.clear();
-
-    transition.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
-    transition.Transition.StateAfter = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
-    transition.Transition.pResource = bounds_vertices_counter;
-    transitions.push_back(transition);
-
-    transition.Transition.pResource = simcmds_counter;
-    transitions.push_back(transition);
-
-    transition.Transition.pResource = drawcmds_counter;
-    transitions.push_back(transition);
-
-    transition.Transition.pResource = bounds_draw_counter;
-    transitions.push_back(transition);
-
-    transition.Transition.pResource = bounds_calc_counter;
-    transitions.push_back(transition);
-
-    transition.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
-    transition.Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-    transition.Transition.pResource = filtered_simcmds_default;
-    transitions.push_back(transition);
-
-    transition.Transition.StateBefore = D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER;
-    transition.Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-    transition.Transition.pResource = filtered_drawcmds_default;
-    transitions.push_back(transition);
-
-    transition.Transition.StateBefore = D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER;
-    transition.Transition.StateAfter = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
-    transition.Transition.pResource = particle_system_bounds_vertices_default;
-    transitions.push_back(transition);
-
-    transition.Transition.StateBefore = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
-    transition.Transition.StateAfter = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-    transition.Transition.pResource = filtered_bounds_calccmds_default;
-    transitions.push_back(transition);
-
+    // Buffers decay to the common state at the end of every ExecuteCommandLists, so they all start the frame there
+    frame_graph.reset();
+    render_graph::resource_id back_buffer = frame_graph.import_resource("back_buffer", dr->back_buffers[backbuffer_index], state_present, state_present);
+    render_graph::resource_id bounds_vertices = frame_graph.import_resource("particle_system_bounds_vertices", particle_system_bounds_vertices_default, state_common);
+    render_graph::resource_id bounds_vertices_count = frame_graph.import_resource("bounds_vertices_counter", bounds_vertices_counter, state_common);
+    render_graph::resource_id input_simcmds = frame_graph.import_resource("input_simcmds_grouped", input_simcmds_grouped_default, state_common);
+    render_graph::resource_id input_drawcmds = frame_graph.import_resource("input_drawcmds_grouped", input_drawcmds_grouped_default, state_common);
+    render_graph::resource_id input_bounds_drawcmds = frame_graph.import_resource("input_bounds_drawcmds_grouped", input_bounds_drawcmds_grouped_default, state_common);
+    render_graph::resource_id input_bounds_calccmds = frame_graph.import_resource("input_bounds_calccmds_grouped", input_bounds_calccmds_grouped_default, state_common);
+    render_graph::resource_id filtered_simcmds = frame_graph.import_resource("filtered_simcmds", filtered_simcmds_default, state_common);
+    render_graph::resource_id filtered_drawcmds = frame_graph.import_resource("filtered_drawcmds", filtered_drawcmds_default, state_common);
+    render_graph::resource_id filtered_bounds_drawcmds = frame_graph.import_resource("filtered_bounds_drawcmds", filtered_bounds_drawcmds_default, state_common);
+    render_graph::resource_id filtered_bounds_calccmds = frame_graph.import_resource("filtered_bounds_calccmds", filtered_bounds_calccmds_default, state_common);
+    render_graph::resource_id simcmds_count = frame_graph.import_resource("simcmds_counter", simcmds_counter, state_common);
+    render_graph::resource_id drawcmds_count = frame_graph.import_resource("drawcmds_counter", drawcmds_counter, state_common);
+    render_graph::resource_id bounds_draw_count = frame_graph.import_resource("bounds_draw_counter", bounds_draw_counter, state_common);
+    render_graph::resource_id bounds_calc_count = frame_graph.import_resource("bounds_calc_counter", bounds_calc_counter, state_common);
+
+    // Particle system outputs are consecutive ids
+    render_graph::resource_id first_output = (render_graph::resource_id)frame_graph.resource_count();
     for (particle_system_gpu &particle_system : particle_systems)
-    {
-        transition.Transition.pResource = particle_system.m_output_default;
-        transitions.push_back(transition);
-    }
-    main_cmdlist->ResourceBarrier((UINT)transitions.size(), &transitions[0]);
-
-    // GPU frustum culling of simulation and draw commands
-    PIXBeginEvent(main_cmdlist, 1, "Frustum culling of commands");
-    main_cmdlist->SetPipelineState(commands_pso);
-    main_cmdlist->SetDescriptorHeaps(1, &srv_heap);
-
-    main_cmdlist->SetComputeRootConstantBufferView(0, frame->cb_pass_upload->m_upload->GetGPUVirtualAddress());
-    main_cmdlist->SetComputeRoot32BitConstant(6, num_particle_systems, 0); // commands_count
-
-    //main_cmdlist->SetComputeRootShaderResourceView(4, input_simcmds_grouped_default->GetGPUVirtualAddress());
-    main_cmdlist->SetComputeRootUnorderedAccessView(4, input_simcmds_grouped_default->GetGPUVirtualAddress());
-
-    main_cmdlist->SetComputeRootShaderResourceView(13, input_bounds_calccmds_grouped_default->GetGPUVirtualAddress());
-    CD3DX12_GPU_DESCRIPTOR_HANDLE filtered_simcmds_handle = {};
-    filtered_simcmds_handle.ptr = srv_heap->GetGPUDescriptorHandleForHeapStart().ptr +
-                                  (heap_offset_uav_filtered_simcmds * dr->srv_desc_handle_incr_size);
-    main_cmdlist->SetComputeRootDescriptorTable(5, filtered_simcmds_handle);
-
-    main_cmdlist->SetComputeRootShaderResourceView(9, input_drawcmds_grouped_default->GetGPUVirtualAddress());
-    CD3DX12_GPU_DESCRIPTOR_HANDLE drawcmds_handle = {};
-    drawcmds_handle.ptr = srv_heap->GetGPUDescriptorHandleForHeapStart().ptr +
-                          (heap_offset_uav_filtered_drawcmds * dr->srv_desc_handle_incr_size);
-    main_cmdlist->SetComputeRootDescriptorTable(10, drawcmds_handle);
-
-    CD3DX12_GPU_DESCRIPTOR_HANDLE particle_bounds_calc_handle = {};
-    particle_bounds_calc_handle.ptr = srv_heap->GetGPUDescriptorHandleForHeapStart().ptr +
-                                      (heap_offset_uav_filtered_bounds_calccmds * dr->srv_desc_handle_incr_size);
-    main_cmdlist->SetComputeRootDescriptorTable(14, particle_bounds_calc_handle);
+        frame_graph.import_resource("particle_output", particle_system.m_output_default, state_common);
+
+    render_graph::pass_builder reset_counters = frame_graph.add_pass("Reset counters", [] {
+        main_cmdlist->CopyResource(bounds_vertices_counter, bounds_vertices_counter_reset);
+        main_cmdlist->CopyResource(simcmds_counter, simcmds_counter_reset);
+        main_cmdlist->CopyResource(drawcmds_counter, drawcmds_counter_reset);
+        main_cmdlist->CopyResource(bounds_draw_counter, bounds_draw_counter_reset);
+        main_cmdlist->CopyResource(bounds_calc_counter, bounds_calc_counter_reset);
+    });
+    reset_counters.write(bounds_vertices_count, state_copy_dest)
+        .write(simcmds_count, state_copy_dest)
+        .write(drawcmds_count, state_copy_dest)
+        .write(bounds_draw_count, state_copy_dest)
+        .write(bounds_calc_count, state_copy_dest);
+
+    render_graph::pass_builder clear = frame_graph.add_pass("clear dsv and rtv", [backbuffer_index] {
+        main_cmdlist->ClearDepthStencilView(dr->dsv_heap->GetCPUDescriptorHandleForHeapStart(), D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.f, 0, 0, NULL);
+        main_cmdlist->ClearRenderTargetView(dr->rtv_descriptor_handles[backbuffer_index], DirectX::Colors::Black, 0, NULL);
+    });
+    clear.write(back_buffer, state_render_target);
+
+    render_graph::pass_builder floor_grid_drawing = frame_graph.add_pass("Draw floor grid", [] {
+        main_cmdlist->IASetVertexBuffers(0, 1, &floor_grid.resource->vbv);
+        main_cmdlist->IASetIndexBuffer(&floor_grid.resource->ibv);
+        main_cmdlist->SetPipelineState(floorgrid_pso);
+        main_cmdlist->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_LINELIST);
+        main_cmdlist->DrawIndexedInstanced(floor_grid.index_count, 1, 0, 0, 0);
+    });
+    floor_grid_drawing.read_write(back_buffer, state_render_target);
 
-    main_cmdlist->SetComputeRootShaderResourceView(11, input_bounds_drawcmds_grouped_default->GetGPUVirtualAddress());
+    // The particles' GPU time starts before the culling, which writes the simulation commands read here
+    frame_graph.add_pass("Start particles timer", [] { query->start(gpu_particles_time_query); })
+        .read(input_simcmds, state_unordered_access)
+        .side_effect();
 
-    main_cmdlist->SetComputeRootShaderResourceView(12, particle_system_bounds_vertices_default->GetGPUVirtualAddress());
-    main_cmdlist->Dispatch(1, 1, 1);
-    PIXEndEvent(main_cmdlist);
+    // GPU frustum culling of simulation and draw commands
+    render_graph::pass_builder culling = frame_graph.add_pass("Frustum culling of commands", [] {
+        main_cmdlist->SetPipelineState(commands_pso);
+        main_cmdlist->SetComputeRoot32BitConstant(6, num_particle_systems, 0); // commands_count
+
+        //main_cmdlist->SetComputeRootShaderResourceView(4, input_simcmds_grouped_default->GetGPUVirtualAddress());
+        main_cmdlist->SetComputeRootUnorderedAccessView(4, input_simcmds_grouped_default->GetGPUVirtualAddress());
+
+        main_cmdlist->SetComputeRootShaderResourceView(13, input_bounds_calccmds_grouped_default->GetGPUVirtualAddress());
+        main_cmdlist->SetComputeRootDescriptorTable(5, descriptors->gpu(filtered_simcmds_uav_descriptor));
+
+        main_cmdlist->SetComputeRootShaderResourceView(9, input_drawcmds_grouped_default->GetGPUVirtualAddress());
+        main_cmdlist->SetComputeRootDescriptorTable(10, descriptors->gpu(filtered_drawcmds_uav_descriptors));
+        main_cmdlist->SetComputeRootDescriptorTable(14, descriptors->gpu(filtered_bounds_calccmds_uav_descriptor));
+
+        main_cmdlist->SetComputeRootShaderResourceView(11, input_bounds_drawcmds_grouped_default->GetGPUVirtualAddress());
+
+        main_cmdlist->SetComputeRootShaderResourceView(12, particle_system_bounds_vertices_default->GetGPUVirtualAddress());
+        main_cmdlist->Dispatch(1, 1, 1);
+    });
+    culling.read_write(input_simcmds, state_unordered_access)
+        .read(input_drawcmds, state_non_pixel_shader_resource)
+        .read(input_bounds_drawcmds, state_non_pixel_shader_resource)
+        .read(input_bounds_calccmds, state_non_pixel_shader_resource)
+        .read(bounds_vertices, state_non_pixel_shader_resource)
+        .write(filtered_simcmds, state_unordered_access)
+        .write(filtered_drawcmds, state_unordered_access)
+        .write(filtered_bounds_drawcmds, state_unordered_access)
+        .write(filtered_bounds_calccmds, state_unordered_access)
+        .read_write(simcmds_count, state_unordered_access)
+        .read_write(drawcmds_count, state_unordered_access)
+        .read_write(bounds_draw_count, state_unordered_access)
+        .read_write(bounds_calc_count, state_unordered_access);
 
     // Indirect particle simulation
-    PIXBeginEvent(main_cmdlist, 1, "Particle simulation");
-    main_cmdlist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
-                                         particle_system_bounds_vertices_default,
-                                         D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
-                                         D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
-    main_cmdlist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
-                                         filtered_simcmds_default,
-                                         D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
-                                         D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT));
-
-    main_cmdlist->SetPipelineState(particle_sim_pso);
-
-    CD3DX12_GPU_DESCRIPTOR_HANDLE particle_bounds_handle = {};
-    particle_bounds_handle.ptr = srv_heap->GetGPUDescriptorHandleForHeapStart().ptr +
-                                 (heap_offset_uav_particle_systems_bounds * dr->srv_desc_handle_incr_size);
-    main_cmdlist->SetComputeRootDescriptorTable(8, particle_bounds_handle);
-
-    main_cmdlist->ExecuteIndirect(particle_sim_cmd_sig, num_particle_systems,
-                                  filtered_simcmds_default, 0,
-                                  simcmds_counter, 0);
-    PIXEndEvent(main_cmdlist);
+    render_graph::pass_builder simulation = frame_graph.add_pass("Particle simulation", [] {
+        main_cmdlist->SetPipelineState(particle_sim_pso);
+        main_cmdlist->SetComputeRootDescriptorTable(8, descriptors->gpu(bounds_uav_descriptor));
+        main_cmdlist->ExecuteIndirect(particle_sim_cmd_sig, num_particle_systems,
+                                      filtered_simcmds_default, 0,
+                                      simcmds_counter, 0);
+    });
+    simulation.read(filtered_simcmds, state_indirect_argument)
+        .read(simcmds_count, state_indirect_argument)
+        .read_write(bounds_vertices, state_unordered_access)
+        .read_write(bounds_vertices_count, state_unordered_access);
+    for (UINT i = 0; i < num_particle_systems; i++)
+        simulation.read_write(first_output + i, state_unordered_access);
 
     // Calculate particle bounding boxes
-    PIXBeginEvent(main_cmdlist, 1, "Particle bounds calculation");
-    main_cmdlist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
-                                         filtered_bounds_calccmds_default,
-                                         D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
-                                         D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT));
-    main_cmdlist->SetPipelineState(calc_bounds_pso);
-    main_cmdlist->ExecuteIndirect(bounds_calc_cmd_sig, num_particle_systems,
-                                  filtered_bounds_calccmds_default, 0,
-                                  bounds_calc_counter, 0);
-    PIXEndEvent(main_cmdlist);
+    render_graph::pass_builder bounds_calculation = frame_graph.add_pass("Particle bounds calculation", [] {
+        main_cmdlist->SetPipelineState(calc_bounds_pso);
+        main_cmdlist->ExecuteIndirect(bounds_calc_cmd_sig, num_particle_systems,
+                                      filtered_bounds_calccmds_default, 0,
+                                      bounds_calc_counter, 0);
+    });
+    bounds_calculation.read(filtered_bounds_calccmds, state_indirect_argument)
+        .read(bounds_calc_count, state_indirect_argument)
+        .read_write(bounds_vertices, state_unordered_access);
+    for (UINT i = 0; i < num_particle_systems; i++)
+        bounds_calculation.read_write(first_output + i, state_unordered_access);
 
     // Indirect particle drawing
-    PIXBeginEvent(main_cmdlist, 1, "Particle drawing");
-    transitions.clear();
-    transition.Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-    transition.Transition.StateAfter = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
-    transition.Transition.pResource = filtered_drawcmds_default;
-    transitions.push_back(transition);
-
-    transition.Transition.pResource = filtered_bounds_drawcmds_default;
-    transitions.push_back(transition);
+    render_graph::pass_builder drawing = frame_graph.add_pass("Particle drawing", [] {
+        main_cmdlist->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_POINTLIST);
+        main_cmdlist->SetPipelineState(point_pso);
+        main_cmdlist->ExecuteIndirect(drawing_cmd_sig, num_particle_systems,
+                                      filtered_drawcmds_default, 0,
+                                      drawcmds_counter, 0);
+    });
+    drawing.read(filtered_drawcmds, state_indirect_argument)
+        .read(drawcmds_count, state_indirect_argument)
+        .read_write(back_buffer, state_render_target);
+    for (UINT i = 0; i < num_particle_systems; i++)
+        drawing.read(first_output + i, state_vertex_and_constant_buffer);
+
+    // Draw particle system bounds, always added to keep the bounds in the particles' GPU time
+    render_graph::pass_builder bounds_drawing = frame_graph.add_pass("Particle bounds drawing", [] {
+        if (show_bounds)
+        {
+            main_cmdlist->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_LINELIST);
+            main_cmdlist->SetPipelineState(bounds_pso);
+            main_cmdlist->ExecuteIndirect(bounds_drawing_cmd_sig, num_particle_systems,
+                                          filtered_bounds_drawcmds_default, 0,
+                                          bounds_draw_counter, 0);
+        }
+    });
+    bounds_drawing.read(filtered_bounds_drawcmds, state_indirect_argument)
+        .read(bounds_draw_count, state_indirect_argument)
+        .read(bounds_vertices, state_vertex_and_constant_buffer)
+        .read_write(back_buffer, state_render_target);
+
+    // After both particle draws, which write the back buffer before it
+    frame_graph.add_pass("Stop particles timer", [] { query->stop(gpu_particles_time_query); })
+        .read_write(back_buffer, state_render_target)
+        .side_effect();
+
+    // Draw the CPU particles' trails, every ribbon in one indexed draw
+    render_graph::pass_builder ribbons_drawing = frame_graph.add_pass("Particle ribbons drawing", [] {
+        if (particle_system->m_num_ribbon_indices_to_render == 0 || cpu_particles_visibility[current_camera] == 0)
+            return;
+
+        main_cmdlist->SetPipelineState(ribbons_pso);
+        main_cmdlist->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        main_cmdlist->IASetVertexBuffers(0, 1, &particle_system->m_ribbon_VBV);
+        main_cmdlist->IASetIndexBuffer(&particle_system->m_ribbon_IBV);
+        main_cmdlist->DrawIndexedInstanced(particle_system->m_num_ribbon_indices_to_render, 1, 0, 0, 0);
+    });
+    ribbons_drawing.read_write(back_buffer, state_render_target);
 
-    transition.Transition.StateBefore = D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
-    transition.Transition.StateAfter = D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER;
-    transition.Transition.pResource = particle_system_bounds_vertices_default;
-    transitions.push_back(transition);
+    // Draw debug objects
+    render_graph::pass_builder debug_drawing = frame_graph.add_pass("Draw debug objects", [] {
+        D3D12_GPU_VIRTUAL_ADDRESS vertices_gpu_va = debug_vertices_upload.gpu_address;
+        D3D12_GPU_VIRTUAL_ADDRESS indices_gpu_va = debug_indices_default->GetGPUVirtualAddress();
+        main_cmdlist->SetPipelineState(debug_line_pso);
+        main_cmdlist->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_LINELIST);
 
-    main_cmdlist->ResourceBarrier((UINT)transitions.size(), transitions.data());
+        // Debug cam
+        if (is_camera_debug_info_visible)
+        {
+            D3D12_VERTEX_BUFFER_VIEW debug_vbv;
+            debug_vbv.SizeInBytes = debugcam_frustum.vertices_byte_size;
+            debug_vbv.StrideInBytes = sizeof(position_color);
+            debug_vbv.BufferLocation = vertices_gpu_va + debugcam_frustum.vertices_byte_offset;
+            main_cmdlist->IASetVertexBuffers(0, 1, &debug_vbv);
+
+            D3D12_INDEX_BUFFER_VIEW debug_ibv;
+            debug_ibv.BufferLocation = indices_gpu_va + debugcam_frustum.indices_byte_offset;
+            debug_ibv.SizeInBytes = debugcam_frustum.indices_byte_size;
+            debug_ibv.Format = DXGI_FORMAT_R16_UINT;
+            main_cmdlist->IASetIndexBuffer(&debug_ibv);
+
+            main_cmdlist->DrawIndexedInstanced(debugcam_frustum.indices_count, 1, 0, 0, 0);
+
+            // Main cam
+            debug_vbv.SizeInBytes = maincam_frustum.vertices_byte_size;
+            debug_vbv.StrideInBytes = sizeof(position_color);
+            debug_vbv.BufferLocation = vertices_gpu_va + maincam_frustum.vertices_byte_offset;
+            main_cmdlist->IASetVertexBuffers(0, 1, &debug_vbv);
+
+            debug_ibv.BufferLocation = indices_gpu_va + maincam_frustum.indices_byte_offset;
+            debug_ibv.SizeInBytes = maincam_frustum.indices_byte_size;
+            debug_ibv.Format = DXGI_FORMAT_R16_UINT;
+            main_cmdlist->IASetIndexBuffer(&debug_ibv);
+
+            main_cmdlist->DrawIndexedInstanced(maincam_frustum.indices_count, 1, 0, 0, 0);
+
+            // Draw debug camera planes
+            main_cmdlist->SetPipelineState(debug_plane_pso);
+            main_cmdlist->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+            D3D12_VERTEX_BUFFER_VIEW debug_planes_vbv;
+            debug_planes_vbv.BufferLocation = vertices_gpu_va + debugcam_frustum_planes.vertices_byte_offset;
+            debug_planes_vbv.StrideInBytes = sizeof(position_color);
+            debug_planes_vbv.SizeInBytes = debugcam_frustum_planes.vertices_byte_size;
+            main_cmdlist->IASetVertexBuffers(0, 1, &debug_planes_vbv);
+
+            D3D12_INDEX_BUFFER_VIEW debug_planes_ibv;
+            debug_planes_ibv.BufferLocation = indices_gpu_va + debugcam_frustum_planes.indices_byte_offset;
+            debug_planes_ibv.SizeInBytes = debugcam_frustum_planes.indices_byte_size;
+            debug_planes_ibv.Format = DXGI_FORMAT_R16_UINT;
+            main_cmdlist->IASetIndexBuffer(&debug_planes_ibv);
+
+            main_cmdlist->DrawIndexedInstanced(debugcam_frustum_planes.indices_count, 1, 0, 0, 0);
+        }
+    });
+    debug_drawing.read_write(back_buffer, state_render_target);
 
-    main_cmdlist->SetPipelineState(point_pso);
-    main_cmdlist->ExecuteIndirect(drawing_cmd_sig, num_particle_systems,
-                                  filtered_drawcmds_default, 0,
-                                  drawcmds_counter, 0);
-    PIXEndEvent(main_cmdlist);
+    // UI rendering
+    render_graph::pass_builder ui_rendering = frame_graph.add_pass(gpu_imgui_time_query.c_str(), [] {
+        query->start(gpu_imgui_time_query);
+        imgui_render(main_cmdlist);
+        query->stop(gpu_imgui_time_query);
+    });
+    ui_rendering.read_write(back_buffer, state_render_target);
 
-    // Draw particle system bounds
-    if (show_bounds)
-    {
-        PIXBeginEvent(main_cmdlist, 1, "Particle bounds drawing");
-        main_cmdlist->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_LINELIST);
-        main_cmdlist->SetPipelineState(bounds_pso);
-        main_cmdlist->ExecuteIndirect(bounds_drawing_cmd_sig, num_particle_systems,
-                                      filtered_bounds_drawcmds_default, 0,
-                                      bounds_draw_counter, 0);
-        PIXEndEvent(main_cmdlist);
-    }
+    bool is_graph_valid = frame_graph.compile();
+    ASSERT2(is_graph_valid, frame_graph.error());
+    frame_graph.execute(*graph_backend);
 
     // Swap particle simulation command buffers
     ID3D12Resource *tmp = input_simcmds_grouped_default;
     input_simcmds_grouped_default = swap_simcmds_grouped_default;
     swap_simcmds_grouped_default = tmp;
 
-    query->stop(gpu_particles_time_query);
-
-    // Draw debug objects
-    D3D12_GPU_VIRTUAL_ADDRESS vertices_gpu_va = frame->cb_debug_vertices_upload->m_upload->GetGPUVirtualAddress();
-    D3D12_GPU_VIRTUAL_ADDRESS indices_gpu_va = debug_indices_default->GetGPUVirtualAddress();
-    main_cmdlist->SetPipelineState(debug_line_pso);
-    main_cmdlist->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_LINELIST);
-
-    // Debug cam
-    if (is_camera_debug_info_visible)
-    {
-        D3D12_VERTEX_BUFFER_VIEW debug_vbv;
-        debug_vbv.SizeInBytes = debugcam_frustum.vertices_byte_size;
-        debug_vbv.StrideInBytes = sizeof(position_color);
-        debug_vbv.BufferLocation = vertices_gpu_va + debugcam_frustum.vertices_byte_offset;
-        main_cmdlist->IASetVertexBuffers(0, 1, &debug_vbv);
-
-        D3D12_INDEX_BUFFER_VIEW debug_ibv;
-        debug_ibv.BufferLocation = indices_gpu_va + debugcam_frustum.indices_byte_offset;
-        debug_ibv.SizeInBytes = debugcam_frustum.indices_byte_size;
-        debug_ibv.Format = DXGI_FORMAT_R16_UINT;
-        main_cmdlist->IASetIndexBuffer(&debug_ibv);
-
-        main_cmdlist->DrawIndexedInstanced(debugcam_frustum.indices_count, 1, 0, 0, 0);
-
-        // Main cam
-        debug_vbv.SizeInBytes = maincam_frustum.vertices_byte_size;
-        debug_vbv.StrideInBytes = sizeof(position_color);
-        debug_vbv.BufferLocation = vertices_gpu_va + maincam_frustum.vertices_byte_offset;
-        main_cmdlist->IASetVertexBuffers(0, 1, &debug_vbv);
-
-        debug_ibv.BufferLocation = indices_gpu_va + maincam_frustum.indices_byte_offset;
-        debug_ibv.SizeInBytes = maincam_frustum.indices_byte_size;
-        debug_ibv.Format = DXGI_FORMAT_R16_UINT;
-        main_cmdlist->IASetIndexBuffer(&debug_ibv);
-
-        main_cmdlist->DrawIndexedInstanced(maincam_frustum.indices_count, 1, 0, 0, 0);
-
-        // Draw debug camera planes
-        main_cmdlist->SetPipelineState(debug_plane_pso);
-        main_cmdlist->IASetPrimitiveTopology(D3D10_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-
-        D3D12_VERTEX_BUFFER_VIEW debug_planes_vbv;
-        debug_planes_vbv.BufferLocation = vertices_gpu_va + debugcam_frustum_planes.vertices_byte_offset;
-        debug_planes_vbv.StrideInBytes = sizeof(position_color);
-        debug_planes_vbv.SizeInBytes = debugcam_frustum_planes.vertices_byte_size;
-        main_cmdlist->IASetVertexBuffers(0, 1, &debug_planes_vbv);
-
-        D3D12_INDEX_BUFFER_VIEW debug_planes_ibv;
-        debug_planes_ibv.BufferLocation = indices_gpu_va + debugcam_frustum_planes.indices_byte_offset;
-        debug_planes_ibv.SizeInBytes = debugcam_frustum_planes.indices_byte_size;
-        debug_planes_ibv.Format = DXGI_FORMAT_R16_UINT;
-        main_cmdlist->IASetIndexBuffer(&debug_planes_ibv);
-
-        main_cmdlist->DrawIndexedInstanced(debugcam_frustum_planes.indices_count, 1, 0, 0, 0);
-    }
-
     auto res = dr->readback<simulation_indirect_command>(input_simcmds_grouped_default, num_particle_systems_at_launch);
     accum_1 = res[0].dt_accum;
     accum_2 = res[1].dt_accum;
     missed_frames_1 = res[0].missed_frames;
     missed_frames_2 = res[1].missed_frames;
 
-    // UI rendering
-    PIXBeginEvent(main_cmdlist, 0, gpu_imgui_time_query.c_str());
-    query->start(gpu_imgui_time_query);
-    imgui_render(main_cmdlist);
-    query->stop(gpu_imgui_time_query);
-    PIXEndEvent(main_cmdlist);
-
-    main_cmdlist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
-                                         dr->back_buffers[backbuffer_index],
-                                         D3D12_RESOURCE_STATE_RENDER_TARGET,
-                                         D3D12_RESOURCE_STATE_PRESENT));
-
     query->stop(gpu_frame_time_query);
     query->resolve();
 
@@ -1226,6 +1239,7 @@ extern "C" __declspec(dllexport) bool update_and_render()
 
     dr->present(is_vsync);
     frame->fence_value = dr->signal();
+    uploads->end_frame(frame->fence_value);
 
     timer.stop(cpu_rest_of_frame);
 
@@ -1276,6 +1290,10 @@ void imgui_update()
     ImGui::Text("FPS: %d", timer.fps);
     ImGui::Text("GPU ImGui time: %f ms", query->result(gpu_imgui_time_query));
     ImGui::Text("GPU frame time: %f ms", query->result(gpu_frame_time_query));
+    ImGui::Text("Frame arena: %zu KB used, %zu KB high water mark", thread_frame_arena().used() / 1024, thread_frame_arena().high_water_mark() / 1024);
+    ImGui::Text("Upload ring: %zu KB used, %zu frames in flight", uploads->ring().used() / 1024, uploads->ring().frames_in_flight());
+    ImGui::Text("Render graph: %zu passes, %zu culled, %zu barriers in %zu batches", frame_graph.pass_count(), frame_graph.culled_pass_count(),
+                frame_graph.barriers().size(), frame_graph.barrier_batch_count());
 
     ImGui::Separator();
 
@@ -1288,7 +1306,9 @@ void imgui_update()
 
     ImGui::Spacing();
 
-    //ImGui::Text("Particles alive: %d / %d", particle_system->m_num_particles_alive, particle_system->m_max_particles_per_frame);
+    ImGui::Text("CPU particles alive: %zu / %zu", particle_system->m_num_particles_alive, particle_system->m_max_particles_per_frame);
+    ImGui::Text("CPU particles in view: main camera %s, debug camera %s",
+                cpu_particles_visibility[main] ? "yes" : "no", cpu_particles_visibility[debug] ? "yes" : "no");
     //ImGui::Text("Particles total: %d", particle_system->m_num_particles_total);
 
     ImGui::Separator();
@@ -1296,6 +1316,9 @@ void imgui_update()
     imgui_combobox((int *)&current_camera, {"Main", "Debug"}, "Current camera");
     ImGui::Separator();
 
+    if (ImGui::Button("Save CPU particles snapshot"))
+        particle_system->save_snapshot(cpu_particles_snapshot_path);
+
     if (ImGui::Button("Reset particle system"))
     {
         // Only need to set the reset_cmdlist once
@@ -1357,10 +1380,7 @@ void imgui_update()
         dr->copy_fence->SetEventOnCompletion(dr->copy_fence_value, dr->copy_fence_event);
         WaitForSingleObject(dr->copy_fence_event, INFINITE);
 
-        //for (size_t i = 0; i < _countof(frame_resources); i++)
-        //{
-        //    particle_system->reset(reinterpret_cast<particle::particle>(frame_resources[i]->particle_vb_range));
-        //}
+        //particle_system->reset();
     }
 
     ImGui::Separator();
@@ -1407,6 +1427,10 @@ void create_shader_objects()
     compile_shader(L"..\\..\\particles\\shaders\\debug_plane.hlsl", L"VS", shader_type::vertex, &debug_planes_blob_vs);
     compile_shader(L"..\\..\\particles\\shaders\\debug_plane.hlsl", L"PS", shader_type::pixel, &debug_planes_blob_ps);
 
+    // Particle trails shader
+    compile_shader(L"..\\..\\particles\\shaders\\ribbons.hlsl", L"VS", shader_type::vertex, &ribbons_blob_vs);
+    compile_shader(L"..\\..\\particles\\shaders\\ribbons.hlsl", L"PS", shader_type::pixel, &ribbons_blob_ps);
+
     std::vector<CD3DX12_ROOT_PARAMETER1> params = {};
 
     // (root) ConstantBuffer<pass_data> cb_pass : register(b0);
@@ -1583,6 +1607,9 @@ void create_shader_objects()
     blendadd_rtv_blend_desc.SrcBlend = D3D12_BLEND_ONE;
     blendadd_rtv_blend_desc.DestBlend = D3D12_BLEND_INV_SRC_ALPHA;
 
+    D3D12_BLEND_DESC blendadd_blend_desc = transparency_blend_desc;
+    blendadd_blend_desc.RenderTarget[0] = blendadd_rtv_blend_desc;
+
     // Default particle PSO
     D3D12_GRAPHICS_PIPELINE_STATE_DESC default_particle_pso_desc = dr->create_default_pso_desc(&particle_input_elem_desc);
 
@@ -1646,6 +1673,17 @@ void create_shader_objects()
     check_hr(device->CreateGraphicsPipelineState(&debug_planes_pso_desc, IID_PPV_ARGS(&debug_plane_pso)));
     NAME_D3D12_OBJECT(debug_plane_pso);
 
+    // Particle trails PSO, depth tested but not written like the billboards
+    D3D12_GRAPHICS_PIPELINE_STATE_DESC ribbons_pso_desc = dr->create_default_pso_desc(&mesh_input_elem_desc);
+    ribbons_pso_desc.VS = {ribbons_blob_vs->GetBufferPointer(), ribbons_blob_vs->GetBufferSize()};
+    ribbons_pso_desc.PS = {ribbons_blob_ps->GetBufferPointer(), ribbons_blob_ps->GetBufferSize()};
+    ribbons_pso_desc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
+    ribbons_pso_desc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+    ribbons_pso_desc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+    ribbons_pso_desc.BlendState = blendadd_blend_desc;
+    check_hr(device->CreateGraphicsPipelineState(&ribbons_pso_desc, IID_PPV_ARGS(&ribbons_pso)));
+    NAME_D3D12_OBJECT(ribbons_pso);
+
     // Particle simulation compute PSO
     D3D12_COMPUTE_PIPELINE_STATE_DESC particle_sim_pso_desc = {};
     particle_sim_pso_desc.CS = {particle_sim_blob_cs->GetBufferPointer(), particle_sim_blob_cs->GetBufferSize()};
@@ -1703,36 +1741,30 @@ void create_texture_objects()
                                          D3D12_RESOURCE_STATE_COPY_DEST,
                                          D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
 
-    // Create the heap to hold the SRVs
-    D3D12_DESCRIPTOR_HEAP_DESC srv_heap_desc;
-    srv_heap_desc.NodeMask = DEFAULT_NODE;
-    srv_heap_desc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-    srv_heap_desc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-    srv_heap_desc.NumDescriptors = 8;
-    check_hr(device->CreateDescriptorHeap(&srv_heap_desc, IID_PPV_ARGS(&srv_heap)));
-
-    // Create the fire texture's SRV
+    // The material table's SRV, the table is written every frame
     D3D12_RESOURCE_DESC fire_tex_desc = fire_texture_default_resource->GetDesc();
-    D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc = {};
-    srv_desc.Texture2D.MipLevels = fire_tex_desc.MipLevels;
-    srv_desc.Format = fire_tex_desc.Format;
-    srv_desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-    srv_desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+    fire_texture_srv_desc.Texture2D.MipLevels = fire_tex_desc.MipLevels;
+    fire_texture_srv_desc.Format = fire_tex_desc.Format;
+    fire_texture_srv_desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+    fire_texture_srv_desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+}
+
+// The material table holds the texture SRV followed by the texture transform CBV of the current frame
+s_internal void write_material_descriptors()
+{
+    descriptor_range material_descriptors = descriptors->allocate_transient(num_frame_descriptors);
+
     device->CreateShaderResourceView(fire_texture_default_resource,
-                                     &srv_desc,
-                                     srv_heap->GetCPUDescriptorHandleForHeapStart());
+                                     &fire_texture_srv_desc,
+                                     descriptors->cpu(material_descriptors, 0));
 
-    // Create the fire texture transform's CBV
     D3D12_CONSTANT_BUFFER_VIEW_DESC tex_transform_cbv_desc = {};
     tex_transform_cbv_desc.BufferLocation = frame->cb_material_upload->m_uploadbuffer->GetGPUVirtualAddress();
     tex_transform_cbv_desc.SizeInBytes = (UINT)frame->cb_material_upload->m_buffer_size;
-
-    // Place it in the heap directly after the fire texture SRV
-    D3D12_CPU_DESCRIPTOR_HANDLE cpu_handle = {};
-    cpu_handle.ptr = srv_heap->GetCPUDescriptorHandleForHeapStart().ptr + dr->srv_desc_handle_incr_size;
-
     device->CreateConstantBufferView(&tex_transform_cbv_desc,
-                                     cpu_handle);
+                                     descriptors->cpu(material_descriptors, 1));
+
+    main_cmdlist->SetGraphicsRootDescriptorTable(1, descriptors->gpu(material_descriptors));
 }
 
 extern "C" __declspec(dllexport) void resize(int width, int height)
@@ -1749,12 +1781,12 @@ extern "C" __declspec(dllexport) void cleanup()
     dr->flush_cmd_queue();
     delete particle_system;
     delete query;
-    safe_release(srv_heap);
     safe_release(drawing_cmd_sig);
     safe_release(particle_sim_pso);
     safe_release(commands_pso);
     safe_release(point_pso);
     safe_release(billboard_pso);
+    safe_release(ribbons_pso);
     safe_release(floorgrid_pso);
     safe_release(main_cmdlist);
     safe_release(fire_texture_default_resource);
@@ -1764,6 +1796,9 @@ extern "C" __declspec(dllexport) void cleanup()
     safe_release(floor_grid.resource->vertex_default);
     safe_release(floor_grid.resource->vertex_upload);
     delete floor_grid.resource;
+    delete uploads;
+    delete descriptors;
+    delete graph_backend;
     imgui_shutdown();
     delete dr;
 
@@ -59,8 +59,8 @@ bool is_aabb_visible(float4 planes[6], float4 center, float4 extents)
 {
     for (int i = 0; i < 6; i++)
     {
+        // The planes are already in world space
         float4 plane = planes[i];
-        plane = mul(plane, transpose(cb_pass.view));
 
         float r = abs(plane.x * extents.x) + abs(plane.y * extents.y) + abs(plane.z * extents.z);
         float c = dot(plane.xyz, center.xyz) + plane.w;
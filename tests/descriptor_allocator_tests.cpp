@@ -0,0 +1,109 @@
+#include "test.h"
+#include "descriptor_allocator.h"
+
+TEST(descriptor_allocator_coalesces_freed_ranges)
+{
+    descriptor_allocator allocator(descriptor_heap_type::cbv_srv_uav, 16, 4, 2);
+    descriptor_range a = allocator.allocate(4);
+    descriptor_range b = allocator.allocate(4);
+    descriptor_range c = allocator.allocate(4);
+    CHECK(a.first == 0 && b.first == 4 && c.first == 8);
+    CHECK(allocator.persistent_used() == 12);
+    CHECK(allocator.largest_free_range() == 4);
+
+    // Freeing the middle range last merges it with both neighbours
+    CHECK(allocator.free(a));
+    CHECK(allocator.free(c));
+    CHECK(allocator.largest_free_range() == 8);
+    CHECK(allocator.free(b));
+    CHECK(allocator.persistent_used() == 0);
+    CHECK(allocator.largest_free_range() == 16);
+
+    descriptor_range all = allocator.allocate(16);
+    CHECK(all.is_valid() && all.first == 0);
+    CHECK(!allocator.allocate(1).is_valid());
+}
+
+TEST(descriptor_allocator_fragmentation)
+{
+    descriptor_allocator allocator(descriptor_heap_type::cbv_srv_uav, 16, 0, 1);
+    descriptor_range ranges[8];
+    for (descriptor_range &range : ranges)
+        range = allocator.allocate(2);
+
+    // Every other range is free: half of the heap is free, but no more than 2 in a row
+    for (int i = 0; i < 8; i += 2)
+        CHECK(allocator.free(ranges[i]));
+    CHECK(allocator.persistent_used() == 8);
+    CHECK(allocator.largest_free_range() == 2);
+    CHECK(!allocator.allocate(3).is_valid());
+
+    // First fit takes the front hole
+    descriptor_range small = allocator.allocate(1);
+    CHECK(small.first == 0);
+
+    // Freeing a neighbour joins two holes and the larger allocation fits again
+    CHECK(allocator.free(ranges[3]));
+    CHECK(allocator.largest_free_range() == 6);
+    descriptor_range large = allocator.allocate(5);
+    CHECK(large.is_valid() && large.first == 4);
+}
+
+TEST(descriptor_allocator_recycles_frame_regions)
+{
+    descriptor_allocator allocator(descriptor_heap_type::cbv_srv_uav, 8, 4, 2);
+    CHECK(allocator.capacity() == 16);
+
+    // Each frame has its own region after the persistent one
+    CHECK(allocator.begin_frame(0));
+    descriptor_range frame0 = allocator.allocate_transient(3);
+    CHECK(frame0.first == 8);
+    CHECK(!allocator.allocate_transient(2).is_valid());
+    CHECK(allocator.allocate_transient(1).first == 11);
+
+    CHECK(allocator.begin_frame(1));
+    CHECK(allocator.transient_used() == 0);
+    descriptor_range frame1 = allocator.allocate_transient(4);
+    CHECK(frame1.first == 12);
+
+    // The first frame's region is reused once it comes back around
+    CHECK(allocator.begin_frame(0));
+    CHECK(allocator.allocate_transient(4).first == 8);
+
+    // A frame that doesn't exist gets no descriptors
+    CHECK(!allocator.begin_frame(2));
+    CHECK(!allocator.allocate_transient(1).is_valid());
+    CHECK(allocator.persistent_used() == 0);
+}
+
+TEST(descriptor_allocator_rejects_bad_frees)
+{
+    descriptor_allocator allocator(descriptor_heap_type::cbv_srv_uav, 16, 4, 2);
+    descriptor_range a = allocator.allocate(4);
+    descriptor_range b = allocator.allocate(4);
+    CHECK(allocator.free(a));
+
+    // Freed twice, overlapping the freed range, or overlapping the free space after the allocations
+    CHECK(!allocator.free(a));
+    CHECK(!allocator.free({2, 4, descriptor_heap_type::cbv_srv_uav}));
+    CHECK(!allocator.free({6, 4, descriptor_heap_type::cbv_srv_uav}));
+    CHECK(allocator.persistent_used() == 4);
+    CHECK(allocator.largest_free_range() == 8);
+
+    // Another heap type, a transient range, and a range past the end of the heap
+    descriptor_range sampler = b;
+    sampler.type = descriptor_heap_type::sampler;
+    CHECK(!allocator.free(sampler));
+    CHECK(allocator.begin_frame(0));
+    CHECK(!allocator.free(allocator.allocate_transient(1)));
+    CHECK(!allocator.free({UINT32_MAX - 1, 4, descriptor_heap_type::cbv_srv_uav}));
+
+    // The allocator was left unchanged, b can still be freed once
+    CHECK(allocator.persistent_used() == 4);
+    CHECK(allocator.free(b));
+    CHECK(!allocator.free(b));
+    CHECK(allocator.largest_free_range() == 16);
+
+    // An invalid range is a no-op
+    CHECK(allocator.free(descriptor_range()));
+}
@@ -0,0 +1,168 @@
+#include "test.h"
+#include "draw_list.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+// Keys spread over every field, with many repeated states
+static std::vector<uint64_t> random_keys(size_t count, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<uint64_t> keys(count);
+    for (uint64_t &key : keys)
+        key = draw_key::make(rng() % 3, rng() % 8, rng() % 64, rng() % 16, rng() % 4);
+    return keys;
+}
+
+TEST(draw_list_sorts_by_key)
+{
+    std::vector<uint64_t> keys = random_keys(5000, 1);
+    draw_list draws;
+    for (uint64_t key : keys)
+        draws.add(key);
+    draws.sort();
+
+    // Every draw is still there once, each with the key it was added with, in increasing key order
+    CHECK(draws.size() == keys.size());
+    bool in_order = true;
+    bool same_keys = true;
+    std::vector<bool> seen(keys.size(), false);
+    for (size_t i = 0; i < draws.size(); i++)
+    {
+        in_order = in_order && (i == 0 || draws.key(i - 1) <= draws.key(i));
+        same_keys = same_keys && draws.key(i) == keys[draws.draw(i)] && !seen[draws.draw(i)];
+        seen[draws.draw(i)] = true;
+    }
+    CHECK(in_order);
+    CHECK(same_keys);
+
+    // The fields come back out of the key
+    uint64_t key = draw_key::make(5, 300, 40000, 1234, 7);
+    CHECK(draw_key::pass(key) == 5 && draw_key::pso(key) == 300 && draw_key::mesh(key) == 40000 && draw_key::material(key) == 1234);
+    CHECK(draw_key::make(1, 0, 0, 0) > draw_key::make(0, draw_key::max_psos - 1, draw_key::max_meshes - 1, draw_key::max_materials - 1));
+}
+
+TEST(draw_list_sort_is_stable)
+{
+    // Two states, added interleaved: the draws of each state keep the order they were added in
+    draw_list draws;
+    for (uint32_t i = 0; i < 1000; i++)
+        draws.add(draw_key::make(0, i % 2, 0, 0));
+    draws.sort();
+
+    bool stable = true;
+    for (size_t i = 1; i < draws.size(); i++)
+    {
+        if (draws.key(i - 1) == draws.key(i))
+            stable = stable && draws.draw(i - 1) < draws.draw(i);
+    }
+    CHECK(stable);
+    CHECK(draws.draw(0) == 0 && draws.draw(500) == 1);
+}
+
+TEST(draw_list_collapses_state_changes)
+{
+    draw_list draws;
+    draws.add(draw_key::make(1, 2, 7, 3));
+    draws.add(draw_key::make(0, 1, 5, 2));
+    draws.add(draw_key::make(0, 1, 5, 9));
+    draws.add(draw_key::make(0, 1, 6, 9));
+    draws.sort();
+    draws.build_commands();
+
+    // Only the states that differ from the previous draw are set
+    std::vector<draw_command> const &commands = draws.commands();
+    draw_command_type const expected_types[] = {
+        draw_command_type::set_pass, draw_command_type::set_pso, draw_command_type::set_mesh, draw_command_type::set_material, draw_command_type::draw,
+        draw_command_type::set_material, draw_command_type::draw,
+        draw_command_type::set_mesh, draw_command_type::draw,
+        draw_command_type::set_pass, draw_command_type::set_pso, draw_command_type::set_mesh, draw_command_type::set_material, draw_command_type::draw,
+    };
+    uint32_t const expected_values[] = {0, 1, 5, 2, 0, 9, 1, 6, 2, 1, 2, 7, 3, 3};
+    CHECK(commands.size() == 14);
+    bool as_expected = commands.size() == 14;
+    for (size_t i = 0; as_expected && i < commands.size(); i++)
+        as_expected = commands[i].type == expected_types[i] && commands[i].value == expected_values[i];
+    CHECK(as_expected);
+    CHECK(draws.state_changes() == 10);
+
+    // The draw commands refer to the sorted draws
+    CHECK(draws.draw(commands[4].value) == 1);
+    CHECK(draws.draw(commands[13].value) == 0);
+
+    // Cleared lists keep nothing
+    draws.clear();
+    draws.build_commands();
+    CHECK(draws.commands().empty() && draws.state_changes() == 0);
+}
+
+TEST(draw_list_merges_instanced_runs)
+{
+    // Three instances of one mesh, added between draws of another mesh, and in a chosen order
+    draw_list draws;
+    draws.add(draw_key::make(0, 0, 1, 0, 2));
+    draws.add(draw_key::make(0, 0, 2, 0));
+    draws.add(draw_key::make(0, 0, 1, 0, 0));
+    draws.add(draw_key::make(0, 0, 2, 0));
+    draws.add(draw_key::make(0, 0, 1, 0, 1));
+    draws.sort();
+    draws.build_commands();
+
+    std::vector<draw_command> const &commands = draws.commands();
+    std::vector<draw_command> runs;
+    for (draw_command const &command : commands)
+    {
+        if (command.type == draw_command_type::draw)
+            runs.push_back(command);
+    }
+
+    // One draw command per state, its draws are in sequence order
+    CHECK(runs.size() == 2);
+    if (runs.size() == 2)
+    {
+        CHECK(runs[0].count == 3);
+        CHECK(draws.draw(runs[0].value) == 2 && draws.draw(runs[0].value + 1) == 4 && draws.draw(runs[0].value + 2) == 0);
+        CHECK(runs[1].count == 2);
+        CHECK(draws.draw(runs[1].value) == 1 && draws.draw(runs[1].value + 1) == 3);
+    }
+    // Every state for the first run, then only the mesh
+    CHECK(draws.state_changes() == 5);
+}
+
+// Not a correctness check: prints what sorting and building a frame's commands costs,
+// next to a comparison sort of the same keys
+TEST(draw_list_benchmark)
+{
+    using clock = std::chrono::steady_clock;
+    size_t const draw_count = 100000;
+    int const frames = 20;
+    std::vector<uint64_t> keys = random_keys(draw_count, 2);
+
+    draw_list draws;
+    double list_ms = 0.0;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        clock::time_point start = clock::now();
+        draws.clear();
+        for (uint64_t key : keys)
+            draws.add(key);
+        draws.sort();
+        draws.build_commands();
+        list_ms += std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    }
+
+    double stable_sort_ms = 0.0;
+    std::vector<uint64_t> sorted;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        clock::time_point start = clock::now();
+        sorted = keys;
+        std::stable_sort(sorted.begin(), sorted.end());
+        stable_sort_ms += std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    }
+
+    printf("    %zu draws: draw list %.3f ms per frame (%zu commands, %zu state changes), std::stable_sort alone %.3f ms\n",
+           draw_count, list_ms / frames, draws.commands().size(), draws.state_changes(), stable_sort_ms / frames);
+    CHECK(draws.size() == draw_count && draws.key(0) == sorted[0] && draws.key(draw_count - 1) == sorted.back());
+}
@@ -0,0 +1,209 @@
+#include "test.h"
+#include "draw_list.h"
+#include "frame_arena.h"
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Counts the heap allocations of the test executable, the frames below must not make any once they're warm.
+// Every replaceable form is replaced so that each allocation is freed by the matching function.
+static size_t heap_allocations = 0;
+
+static void *counted_allocate(size_t size) noexcept
+{
+    heap_allocations++;
+    return std::malloc(size ? size : 1);
+}
+
+static void *counted_allocate_or_throw(size_t size)
+{
+    if (void *ptr = counted_allocate(size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size) { return counted_allocate_or_throw(size); }
+void *operator new[](size_t size) { return counted_allocate_or_throw(size); }
+void *operator new(size_t size, std::nothrow_t const &) noexcept { return counted_allocate(size); }
+void *operator new[](size_t size, std::nothrow_t const &) noexcept { return counted_allocate(size); }
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::nothrow_t const &) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::nothrow_t const &) noexcept { std::free(ptr); }
+
+#ifdef __cpp_aligned_new
+// Over-aligned types in C++17 builds: the block from malloc is stored just before the aligned pointer
+static void *counted_allocate(size_t size, std::align_val_t alignment) noexcept
+{
+    size_t align = size_t(alignment);
+    void *block = counted_allocate(size + align + sizeof(void *));
+    if (!block)
+        return nullptr;
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(block) + sizeof(void *) + align - 1) & ~(uintptr_t(align) - 1);
+    reinterpret_cast<void **>(aligned)[-1] = block;
+    return reinterpret_cast<void *>(aligned);
+}
+
+static void *counted_allocate_or_throw(size_t size, std::align_val_t alignment)
+{
+    if (void *ptr = counted_allocate(size, alignment))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+static void aligned_free(void *ptr) noexcept
+{
+    if (ptr)
+        std::free(static_cast<void **>(ptr)[-1]);
+}
+
+void *operator new(size_t size, std::align_val_t alignment) { return counted_allocate_or_throw(size, alignment); }
+void *operator new[](size_t size, std::align_val_t alignment) { return counted_allocate_or_throw(size, alignment); }
+void *operator new(size_t size, std::align_val_t alignment, std::nothrow_t const &) noexcept { return counted_allocate(size, alignment); }
+void *operator new[](size_t size, std::align_val_t alignment, std::nothrow_t const &) noexcept { return counted_allocate(size, alignment); }
+void operator delete(void *ptr, std::align_val_t) noexcept { aligned_free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { aligned_free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept { aligned_free(ptr); }
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept { aligned_free(ptr); }
+void operator delete(void *ptr, std::align_val_t, std::nothrow_t const &) noexcept { aligned_free(ptr); }
+void operator delete[](void *ptr, std::align_val_t, std::nothrow_t const &) noexcept { aligned_free(ptr); }
+#endif
+
+// Builds the kind of containers a frame fills, sized by the frame so that some frames are larger than others
+static size_t run_frame(frame_arena &arena, size_t frame)
+{
+    arena.reset();
+
+    size_t item_count = 100 + (frame % 4) * 300;
+    frame_vector<unsigned> visible_ids{arena_allocator<unsigned>(arena)};
+    frame_vector<void const *> draw_items{arena_allocator<void const *>(arena)};
+    for (size_t i = 0; i < item_count; i++)
+    {
+        visible_ids.push_back(unsigned(i));
+        if (i % 3 == 0)
+            draw_items.push_back(&visible_ids[i]);
+    }
+
+    frame_vector<float> bounds(item_count * 6, 0.f, arena_allocator<float>(arena));
+    frame_string label("frame arena steady state test label", arena_allocator<char>(arena));
+    return visible_ids.size() + draw_items.size() + bounds.size() + label.size();
+}
+
+TEST(frame_arena_steady_state_frames_dont_allocate)
+{
+    // Small enough for the first frames to overflow it
+    frame_arena arena(1024);
+
+    // Warm up until the arena has seen the largest frame and merged its blocks
+    for (size_t frame = 0; frame < 4; frame++)
+        run_frame(arena, frame);
+    run_frame(arena, 4);
+
+    size_t block_allocations = arena.block_allocations();
+    size_t heap_allocations_before = heap_allocations;
+    for (size_t frame = 5; frame < 100; frame++)
+        CHECK(run_frame(arena, frame) > 0);
+
+    CHECK(heap_allocations == heap_allocations_before);
+    CHECK(arena.block_allocations() == block_allocations);
+    CHECK(arena.high_water_mark() <= arena.capacity());
+}
+
+struct test_item
+{
+    uint32_t mesh;
+    uint32_t material;
+    bool is_selected;
+};
+
+// The draw list path of the 3d transforms demo: the per-frame arrays come from the thread's arena
+// and the draw list keeps its storage between frames
+static size_t draw_frame(draw_list &draws, std::vector<test_item> const &items, size_t visible_count)
+{
+    thread_frame_arena().reset();
+    draws.clear();
+
+    frame_vector<test_item const *> draw_items;
+    frame_vector<test_item const *> draw_meshes;
+    for (size_t i = 0; i < visible_count; i++)
+    {
+        test_item const &item = items[i];
+        if (item.mesh >= draw_meshes.size())
+            draw_meshes.resize(item.mesh + 1);
+        draw_meshes[item.mesh] = &item;
+
+        draws.add(draw_key::make(0, 0, item.mesh, item.material));
+        draw_items.push_back(&item);
+        if (item.is_selected)
+        {
+            draws.add(draw_key::make(1, 1, item.mesh, item.material));
+            draw_items.push_back(&item);
+        }
+    }
+    draws.sort();
+    draws.build_commands();
+
+    size_t issued = 0;
+    for (draw_command const &command : draws.commands())
+    {
+        if (command.type == draw_command_type::draw && draw_items[draws.draw(command.value)])
+            issued++;
+    }
+    return issued;
+}
+
+TEST(frame_arena_steady_state_draw_list_doesnt_allocate)
+{
+    std::vector<test_item> items;
+    for (uint32_t i = 0; i < 500; i++)
+        items.push_back({i % 37, i, i % 5 == 0});
+
+    // The largest frame sizes the arena and the draw list, the smaller ones then reuse them
+    draw_list draws;
+    draw_frame(draws, items, items.size());
+    draw_frame(draws, items, items.size());
+
+    size_t heap_allocations_before = heap_allocations;
+    for (size_t frame = 0; frame < 50; frame++)
+    {
+        size_t visible_count = items.size() - (frame % 7) * 50;
+        CHECK(draw_frame(draws, items, visible_count) == visible_count + (visible_count + 4) / 5);
+    }
+    CHECK(heap_allocations == heap_allocations_before);
+}
+
+TEST(frame_arena_merges_overflow_blocks)
+{
+    frame_arena arena(256);
+    CHECK(arena.block_allocations() == 1);
+
+    arena.allocate(200, 16);
+    arena.allocate(200, 16);
+    CHECK(arena.block_allocations() == 2);
+    CHECK(arena.used() >= 400);
+
+    // The overflow is merged into one block that fits the whole frame
+    arena.reset();
+    CHECK(arena.block_allocations() == 3);
+    CHECK(arena.capacity() >= 400);
+
+    arena.allocate(200, 16);
+    arena.allocate(200, 16);
+    CHECK(arena.block_allocations() == 3);
+    CHECK(arena.high_water_mark() >= 400);
+}
+
+TEST(frame_arena_alignment)
+{
+    frame_arena arena(1024);
+    arena.allocate(1, 1);
+    void *aligned = arena.allocate(64, 64);
+    CHECK(reinterpret_cast<uintptr_t>(aligned) % 64 == 0);
+
+    // An allocation larger than the block gets a block of its own
+    void *large = arena.allocate(4096, 256);
+    CHECK(reinterpret_cast<uintptr_t>(large) % 256 == 0);
+    CHECK(arena.capacity() >= 4096 + 1024);
+}
@@ -0,0 +1,138 @@
+#include "test.h"
+#include "geometry_batcher.h"
+#include <cstring>
+
+using namespace DirectX;
+
+struct test_vertex
+{
+    float position[3];
+    uint32_t color;
+};
+
+static test_vertex const quad_vertices[] = {
+    {{0.f, 0.f, 0.f}, 0xff0000ff},
+    {{1.f, 0.f, 0.f}, 0xff00ff00},
+    {{1.f, 1.f, 0.f}, 0xffff0000},
+    {{0.f, 1.f, 0.f}, 0xffffffff},
+};
+static uint16_t const quad_indices[] = {0, 1, 2, 0, 2, 3};
+
+static test_vertex const triangle_vertices[] = {
+    {{0.f, 0.f, 1.f}, 0xff0000ff},
+    {{1.f, 0.f, 1.f}, 0xff00ff00},
+    {{0.f, 1.f, 1.f}, 0xffff0000},
+};
+static uint16_t const triangle_indices[] = {0, 1, 2};
+
+// The translation tells the instances apart
+static XMFLOAT4X4 translation(float x)
+{
+    XMFLOAT4X4 transform = {};
+    transform._11 = transform._22 = transform._33 = transform._44 = 1.f;
+    transform._41 = x;
+    return transform;
+}
+
+static bool same_vertices(geometry_batcher const &batcher, uint32_t base_vertex, test_vertex const *vertices, size_t count)
+{
+    return memcmp(&batcher.vertices()[base_vertex * sizeof(test_vertex)], vertices, count * sizeof(test_vertex)) == 0;
+}
+
+static bool same_indices(geometry_batcher const &batcher, uint32_t start_index, uint16_t const *indices, size_t count)
+{
+    return memcmp(&batcher.indices()[start_index], indices, count * sizeof(uint16_t)) == 0;
+}
+
+TEST(batcher_identical_meshes_share_a_batch)
+{
+    geometry_batcher batcher(sizeof(test_vertex));
+    batcher.add(quad_vertices, 4, quad_indices, 6, translation(0.f));
+    batcher.add(quad_vertices, 4, quad_indices, 6, translation(1.f));
+    batcher.add(quad_vertices, 4, quad_indices, 6, translation(2.f));
+    batcher.build();
+
+    // The streams hold one copy of the mesh
+    CHECK(batcher.batches().size() == 1);
+    CHECK(batcher.vertices().size() == sizeof(quad_vertices));
+    CHECK(batcher.indices().size() == 6);
+    CHECK(same_vertices(batcher, 0, quad_vertices, 4));
+    CHECK(same_indices(batcher, 0, quad_indices, 6));
+
+    geometry_batcher::batch const &b = batcher.batches()[0];
+    CHECK(b.base_vertex == 0 && b.vertex_count == 4);
+    CHECK(b.start_index == 0 && b.index_count == 6);
+    CHECK(b.first_instance == 0 && b.instance_count == 3);
+    CHECK(batcher.instances().size() == 3);
+    CHECK(batcher.instances()[2]._41 == 2.f);
+}
+
+TEST(batcher_output_buffers)
+{
+    geometry_batcher batcher(sizeof(test_vertex));
+    uint32_t quad_a = batcher.add(quad_vertices, 4, quad_indices, 6, translation(0.f));
+    uint32_t triangle_a = batcher.add(triangle_vertices, 3, triangle_indices, 3, translation(1.f));
+    uint32_t quad_b = batcher.add(quad_vertices, 4, quad_indices, 6, translation(2.f));
+    uint32_t triangle_b = batcher.add(triangle_vertices, 3, triangle_indices, 3, translation(3.f));
+    batcher.build();
+
+    // The meshes are appended in the order they were first added, the indices stay relative to the base vertex
+    CHECK(batcher.batches().size() == 2);
+    CHECK(batcher.vertices().size() == sizeof(quad_vertices) + sizeof(triangle_vertices));
+    CHECK(batcher.indices().size() == 9);
+
+    geometry_batcher::batch const &quad = batcher.batches()[0];
+    geometry_batcher::batch const &triangle = batcher.batches()[1];
+    CHECK(quad.base_vertex == 0 && quad.start_index == 0);
+    CHECK(triangle.base_vertex == 4 && triangle.start_index == 6);
+    CHECK(same_vertices(batcher, quad.base_vertex, quad_vertices, 4));
+    CHECK(same_indices(batcher, quad.start_index, quad_indices, 6));
+    CHECK(same_vertices(batcher, triangle.base_vertex, triangle_vertices, 3));
+    CHECK(same_indices(batcher, triangle.start_index, triangle_indices, 3));
+
+    // The instances are grouped by batch and keep the order they were added in
+    CHECK(quad.first_instance == 0 && quad.instance_count == 2);
+    CHECK(triangle.first_instance == 2 && triangle.instance_count == 2);
+    CHECK(batcher.instance_batch(quad_b) == 0 && batcher.instance_batch(triangle_a) == 1);
+    CHECK(batcher.instance_index(quad_a) == 0);
+    CHECK(batcher.instance_index(quad_b) == 1);
+    CHECK(batcher.instance_index(triangle_a) == 2);
+    CHECK(batcher.instance_index(triangle_b) == 3);
+    CHECK(batcher.instances()[batcher.instance_index(quad_b)]._41 == 2.f);
+    CHECK(batcher.instances()[batcher.instance_index(triangle_a)]._41 == 1.f);
+}
+
+TEST(batcher_keys_on_bytes_not_topology)
+{
+    // The same quad with its vertices in another order, and with its triangles rotated
+    test_vertex const reordered_vertices[] = {quad_vertices[3], quad_vertices[0], quad_vertices[1], quad_vertices[2]};
+    uint16_t const reordered_indices[] = {1, 2, 3, 1, 3, 0};
+    uint16_t const rotated_indices[] = {1, 2, 0, 2, 3, 0};
+
+    geometry_batcher batcher(sizeof(test_vertex));
+    batcher.add(quad_vertices, 4, quad_indices, 6, translation(0.f));
+    batcher.add(reordered_vertices, 4, reordered_indices, 6, translation(1.f));
+    batcher.add(quad_vertices, 4, rotated_indices, 6, translation(2.f));
+    batcher.build();
+
+    CHECK(batcher.batches().size() == 3);
+    CHECK(batcher.vertices().size() == 3 * sizeof(quad_vertices));
+    CHECK(same_vertices(batcher, batcher.batches()[1].base_vertex, reordered_vertices, 4));
+    CHECK(same_indices(batcher, batcher.batches()[2].start_index, rotated_indices, 6));
+}
+
+TEST(batcher_clear)
+{
+    geometry_batcher batcher(sizeof(test_vertex));
+    batcher.add(quad_vertices, 4, quad_indices, 6, translation(0.f));
+    batcher.build();
+    batcher.clear();
+
+    batcher.add(triangle_vertices, 3, triangle_indices, 3, translation(1.f));
+    batcher.build();
+    CHECK(batcher.batches().size() == 1);
+    CHECK(batcher.vertices().size() == sizeof(triangle_vertices));
+    CHECK(same_vertices(batcher, 0, triangle_vertices, 3));
+    CHECK(same_indices(batcher, 0, triangle_indices, 3));
+    CHECK(batcher.instances().size() == 1);
+}
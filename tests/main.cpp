@@ -0,0 +1,47 @@
+#include "test.h"
+#include <vector>
+
+struct test_case
+{
+    const char *name;
+    void (*run)();
+};
+
+// Function-local so that registering from other translation units doesn't depend on their initialization order
+static std::vector<test_case> &tests()
+{
+    static std::vector<test_case> registered;
+    return registered;
+}
+
+static int failed_checks = 0;
+
+int register_test(const char *name, void (*run)())
+{
+    tests().push_back({name, run});
+    return (int)tests().size();
+}
+
+void failed_check(const char *file, int line, const char *statement)
+{
+    printf("    %s(%d): CHECK(%s) failed\n", file, line, statement);
+    failed_checks++;
+}
+
+int main()
+{
+    int failed_tests = 0;
+    for (test_case const &test : tests())
+    {
+        int failed_before = failed_checks;
+        test.run();
+
+        bool passed = failed_checks == failed_before;
+        printf("%s %s\n", passed ? "[ ok ]" : "[fail]", test.name);
+        if (!passed)
+            failed_tests++;
+    }
+
+    printf("%d of %d tests passed\n", int(tests().size()) - failed_tests, int(tests().size()));
+    return failed_tests == 0 ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+#include "test.h"
+#include "particle_system_oop.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace particle;
+
+// Right triangles 10 units apart along x, with areas 1, 2, 3 and 4, then a degenerate one
+static mesh_data test_mesh()
+{
+    mesh_data mesh;
+    for (int i = 0; i < 4; i++)
+    {
+        float x = 10.f * float(i);
+        float leg = sqrtf(2.f * float(i + 1));
+        WORD first = WORD(mesh.vertices.size());
+        mesh.vertices.push_back({XMFLOAT3(x, 0.f, 0.f), XMFLOAT4(1.f, 1.f, 1.f, 1.f)});
+        mesh.vertices.push_back({XMFLOAT3(x + leg, 0.f, 0.f), XMFLOAT4(1.f, 1.f, 1.f, 1.f)});
+        mesh.vertices.push_back({XMFLOAT3(x, 0.f, leg), XMFLOAT4(1.f, 1.f, 1.f, 1.f)});
+        mesh.indices.insert(mesh.indices.end(), {first, WORD(first + 1), WORD(first + 2)});
+    }
+
+    WORD first = WORD(mesh.vertices.size());
+    for (int i = 0; i < 3; i++)
+        mesh.vertices.push_back({XMFLOAT3(40.f + float(i), 0.f, 0.f), XMFLOAT4(1.f, 1.f, 1.f, 1.f)});
+    mesh.indices.insert(mesh.indices.end(), {first, WORD(first + 1), WORD(first + 2)});
+    return mesh;
+}
+
+TEST(mesh_surface_alias_table_keeps_the_areas)
+{
+    mesh_surface surface(test_mesh());
+    CHECK(fabsf(surface.m_total_area - 10.f) < 1e-4f);
+
+    // Each column gives its probability to its own triangle and the rest to its alias,
+    // a triangle's share of all the columns is its share of the area
+    size_t num_triangles = surface.m_probability.size();
+    std::vector<float> share(num_triangles, 0.f);
+    for (size_t i = 0; i < num_triangles; i++)
+    {
+        share[i] += surface.m_probability[i];
+        share[surface.m_alias[i]] += 1.f - surface.m_probability[i];
+    }
+
+    float const areas[] = {1.f, 2.f, 3.f, 4.f, 0.f};
+    bool matches = num_triangles == 5;
+    for (size_t i = 0; matches && i < num_triangles; i++)
+        matches = fabsf(share[i] / float(num_triangles) - areas[i] / 10.f) < 1e-4f;
+    CHECK(matches);
+}
+
+TEST(mesh_surface_emits_by_area)
+{
+    // The batches take the 4-wide path and the one-by-one remainder
+    mesh_surface surface(test_mesh(), XMMatrixTranslation(0.f, 5.f, 0.f));
+    size_t counts[5] = {};
+    size_t outside = 0;
+    size_t num_emitted = 0;
+    aligned_aos batch[255];
+    for (int b = 0; b < 2000; b++)
+    {
+        surface.emit(batch, batch + 255);
+        for (aligned_aos const &p : batch)
+        {
+            // Up to rounding errors
+            XMFLOAT3 const &position = p.position;
+            size_t triangle = size_t(std::max((position.x + 1.f) / 10.f, 0.f));
+            float local_x = position.x - 10.f * float(triangle);
+            float leg = triangle < 4 ? sqrtf(2.f * float(triangle + 1)) : 0.f;
+            float const epsilon = 1e-4f;
+            if (triangle > 4 || fabsf(position.y - 5.f) > epsilon || local_x < -epsilon || position.z < -epsilon || local_x + position.z > leg + epsilon)
+                outside++;
+            else
+                counts[triangle]++;
+            num_emitted++;
+        }
+    }
+
+    // Every position is on the surface, each triangle gets its share of the area within 2%
+    CHECK(outside == 0);
+    CHECK(counts[4] == 0);
+    bool by_area = true;
+    for (int i = 0; i < 4; i++)
+    {
+        float expected = float(num_emitted) * float(i + 1) / 10.f;
+        by_area = by_area && fabsf(float(counts[i]) - expected) < 0.02f * expected;
+    }
+    CHECK(by_area);
+}
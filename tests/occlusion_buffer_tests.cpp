@@ -0,0 +1,151 @@
+#include "test.h"
+#include "occlusion_buffer.h"
+#include <cfloat>
+
+using namespace DirectX;
+
+// Unit box from -1 to 1, scaled and moved by the world matrix
+static XMFLOAT3 const box_positions[] = {
+    {-1.f, -1.f, -1.f}, {1.f, -1.f, -1.f}, {1.f, 1.f, -1.f}, {-1.f, 1.f, -1.f},
+    {-1.f, -1.f, 1.f}, {1.f, -1.f, 1.f}, {1.f, 1.f, 1.f}, {-1.f, 1.f, 1.f},
+};
+static unsigned short const box_indices[] = {
+    0, 1, 2, 0, 2, 3, // front
+    5, 4, 7, 5, 7, 6, // back
+    4, 0, 3, 4, 3, 7, // left
+    1, 5, 6, 1, 6, 2, // right
+    3, 2, 6, 3, 6, 7, // top
+    4, 5, 1, 4, 1, 0, // bottom
+};
+
+static XMFLOAT4X4 box_world(XMFLOAT3 const &center, XMFLOAT3 const &extents)
+{
+    XMFLOAT4X4 world = {};
+    world._11 = extents.x;
+    world._22 = extents.y;
+    world._33 = extents.z;
+    world._41 = center.x;
+    world._42 = center.y;
+    world._43 = center.z;
+    world._44 = 1.f;
+    return world;
+}
+
+// Camera at the origin looking down +z with a 90 degree field of view, left handed like the demos
+static XMFLOAT4X4 view_proj()
+{
+    float near_z = 0.1f;
+    float far_z = 100.f;
+    XMFLOAT4X4 proj = {};
+    proj._11 = 1.f;
+    proj._22 = 1.f;
+    proj._33 = far_z / (far_z - near_z);
+    proj._34 = 1.f;
+    proj._43 = -near_z * far_z / (far_z - near_z);
+    return proj;
+}
+
+static void rasterize_box(occlusion_buffer &buffer, XMFLOAT3 const &center, XMFLOAT3 const &extents)
+{
+    buffer.rasterize(box_positions, sizeof(XMFLOAT3), 8, box_indices, 36, box_world(center, extents));
+}
+
+TEST(occlusion_hides_boxes_behind_occluders)
+{
+    occlusion_buffer buffer(64, 64);
+    buffer.begin(view_proj());
+    rasterize_box(buffer, {0.f, 0.f, 10.f}, {5.f, 5.f, 0.5f});
+    buffer.build_hierarchy();
+
+    // Behind the wall, in front of it, and behind it but off to the side
+    CHECK(!buffer.is_visible(BoundingBox({0.f, 0.f, 20.f}, {1.f, 1.f, 1.f})));
+    CHECK(buffer.is_visible(BoundingBox({0.f, 0.f, 5.f}, {1.f, 1.f, 1.f})));
+    CHECK(buffer.is_visible(BoundingBox({15.f, 0.f, 20.f}, {1.f, 1.f, 1.f})));
+
+    // Off screen
+    CHECK(!buffer.is_visible(BoundingBox({100.f, 0.f, 20.f}, {1.f, 1.f, 1.f})));
+}
+
+TEST(occlusion_clips_occluders_crossing_the_near_plane)
+{
+    occlusion_buffer buffer(64, 64);
+    buffer.begin(view_proj());
+
+    // Fills the left half of the view from behind the camera to z = 30, only its back face is fully in front of the
+    // near plane, so the box at z = 20 is only hidden by the clipped side faces
+    rasterize_box(buffer, {-25.5f, 0.f, 12.5f}, {24.5f, 50.f, 17.5f});
+    buffer.build_hierarchy();
+
+    CHECK(!buffer.is_visible(BoundingBox({-10.f, 0.f, 20.f}, {1.f, 1.f, 1.f})));
+    CHECK(buffer.is_visible(BoundingBox({10.f, 0.f, 20.f}, {1.f, 1.f, 1.f})));
+
+    // The left half of the buffer is covered, the depth grows towards the middle
+    CHECK(buffer.depth(8, 32) < buffer.depth(28, 32));
+    CHECK(buffer.depth(28, 32) < 1.f);
+    CHECK(buffer.depth(40, 32) == 1.f);
+}
+
+TEST(occlusion_boxes_crossing_the_near_plane_are_visible)
+{
+    occlusion_buffer buffer(64, 64);
+    buffer.begin(view_proj());
+    rasterize_box(buffer, {0.f, 0.f, 10.f}, {50.f, 50.f, 0.5f});
+    buffer.build_hierarchy();
+
+    // The camera could be inside it
+    CHECK(buffer.is_visible(BoundingBox({0.f, 0.f, 0.f}, {1.f, 1.f, 1.f})));
+    CHECK(!buffer.is_visible(BoundingBox({0.f, 0.f, 20.f}, {1.f, 1.f, 1.f})));
+}
+
+TEST(occlusion_projected_size)
+{
+    occlusion_buffer buffer(64, 64);
+    buffer.begin(view_proj());
+
+    // A sphere of radius 1 at a distance of 10 covers a tenth of the height
+    float size = buffer.projected_size(BoundingSphere({0.f, 0.f, 10.f}, 1.f));
+    CHECK(size > 6.3f && size < 6.5f);
+    CHECK(buffer.projected_size(BoundingSphere({0.f, 0.f, 20.f}, 1.f)) < size);
+    CHECK(buffer.projected_size(BoundingSphere({0.f, 0.f, 0.5f}, 1.f)) == FLT_MAX);
+}
+
+TEST(occlusion_simplified_occluders)
+{
+    // A grid of 32x32 quads on the z = 0 plane
+    std::vector<XMFLOAT3> positions;
+    std::vector<unsigned short> indices;
+    unsigned short const side = 33;
+    for (unsigned short y = 0; y < side; y++)
+    {
+        for (unsigned short x = 0; x < side; x++)
+            positions.push_back(XMFLOAT3(float(x), float(y), 0.f));
+    }
+    for (unsigned short y = 0; y + 1 < side; y++)
+    {
+        for (unsigned short x = 0; x + 1 < side; x++)
+        {
+            unsigned short corner = y * side + x;
+            unsigned short quad[] = {corner, (unsigned short)(corner + 1), (unsigned short)(corner + side + 1),
+                                     corner, (unsigned short)(corner + side + 1), (unsigned short)(corner + side)};
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+
+    occluder_mesh simplified = simplify_occluder(positions.data(), sizeof(XMFLOAT3), positions.size(), indices.data(), indices.size(), 8);
+    CHECK(simplified.positions.size() <= 8 * 8);
+    CHECK(!simplified.indices.empty() && simplified.indices.size() < indices.size() / 8);
+
+    // The clusters stay inside the original mesh
+    bool inside = true;
+    for (XMFLOAT3 const &p : simplified.positions)
+        inside = inside && p.x >= 0.f && p.x <= 32.f && p.y >= 0.f && p.y <= 32.f && p.z == 0.f;
+    CHECK(inside);
+
+    bool valid_indices = true;
+    for (unsigned short index : simplified.indices)
+        valid_indices = valid_indices && index < simplified.positions.size();
+    CHECK(valid_indices);
+
+    occluder_mesh empty = simplify_occluder(nullptr, sizeof(XMFLOAT3), 0, nullptr, 0, 8);
+    CHECK(empty.positions.empty() && empty.indices.empty());
+}
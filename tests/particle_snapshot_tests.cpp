@@ -0,0 +1,156 @@
+#include "test.h"
+#include "particle_snapshot.h"
+#include "particle_system_oop.h"
+#include <string>
+
+using namespace particle;
+
+static std::wstring temp_path(const wchar_t *name)
+{
+    wchar_t dir[MAX_PATH];
+    GetTempPathW(MAX_PATH, dir);
+    return std::wstring(dir) + name;
+}
+
+// Particle i of a test snapshot, offset lets two snapshots differ everywhere
+static void write_particles(particle_snapshot &snapshot, float offset)
+{
+    for (size_t i = 0; i < snapshot.num_particles(); i++)
+    {
+        float f = float(i) + offset;
+        snapshot.m_positions[i] = XMFLOAT3(f, 2.f * f, -f);
+        snapshot.m_sizes[i] = 0.5f * f;
+        snapshot.m_velocities[i] = XMFLOAT3(-f, 0.f, f);
+        snapshot.m_ages[i] = 0.1f * f;
+    }
+}
+
+static void write_snapshot(std::wstring const &path, size_t num_particles, float offset)
+{
+    particle_snapshot snapshot(path.c_str(), num_particles);
+    CHECK(snapshot.is_valid());
+    snapshot.m_header->source.time = 3.f;
+    snapshot.m_header->source.num_created = 1234;
+    write_particles(snapshot, offset);
+}
+
+TEST(snapshot_round_trip)
+{
+    std::wstring path = temp_path(L"round_trip.psnp");
+    write_snapshot(path, 100, 0.f);
+
+    particle_snapshot snapshot(path.c_str());
+    CHECK(snapshot.is_valid());
+    CHECK(snapshot.num_particles() == 100);
+    CHECK(snapshot.m_header->source.time == 3.f);
+    CHECK(snapshot.m_header->source.num_created == 1234);
+    CHECK(snapshot.m_positions[42].y == 84.f);
+    CHECK(snapshot.m_sizes[42] == 21.f);
+    CHECK(snapshot.m_velocities[42].z == 42.f);
+    CHECK(snapshot.m_ages[99] == 0.1f * 99.f);
+}
+
+TEST(snapshot_file_starts_with_magic_bytes)
+{
+    std::wstring path = temp_path(L"magic.psnp");
+    write_snapshot(path, 1, 0.f);
+
+    FILE *file = _wfopen(path.c_str(), L"rb");
+    CHECK(file != nullptr);
+    char magic[4] = {};
+    fread(magic, 1, 4, file);
+    fclose(file);
+    CHECK(magic[0] == 'P' && magic[1] == 'S' && magic[2] == 'N' && magic[3] == 'P');
+}
+
+TEST(snapshot_rejects_truncated_files)
+{
+    std::wstring path = temp_path(L"truncated.psnp");
+    write_snapshot(path, 10, 0.f);
+
+    HANDLE file = CreateFile2(path.c_str(), GENERIC_WRITE, 0, OPEN_EXISTING, nullptr);
+    LARGE_INTEGER end = {};
+    end.QuadPart = LONGLONG(particle_snapshot::file_size(10) - sizeof(float));
+    SetFilePointerEx(file, end, nullptr, FILE_BEGIN);
+    SetEndOfFile(file);
+    CloseHandle(file);
+
+    particle_snapshot snapshot(path.c_str());
+    CHECK(!snapshot.is_valid());
+}
+
+TEST(snapshots_match_finds_first_mismatch)
+{
+    std::wstring path_a = temp_path(L"a.psnp");
+    std::wstring path_b = temp_path(L"b.psnp");
+    write_snapshot(path_a, 50, 0.f);
+    write_snapshot(path_b, 50, 0.f);
+
+    {
+        particle_snapshot b(path_b.c_str());
+        particle_snapshot a(path_a.c_str());
+        size_t mismatch = 0;
+        CHECK(snapshots_match(a, b, 0.f, &mismatch));
+        CHECK(mismatch == SIZE_MAX);
+    }
+
+    // Perturb one particle of b, within and past the tolerance
+    {
+        particle_snapshot b(path_b.c_str(), 50);
+        write_particles(b, 0.f);
+        b.m_ages[17] += 0.01f;
+    }
+
+    particle_snapshot a(path_a.c_str());
+    particle_snapshot b(path_b.c_str());
+    size_t mismatch = 0;
+    CHECK(snapshots_match(a, b, 0.1f, &mismatch));
+    CHECK(!snapshots_match(a, b, 0.001f, &mismatch));
+    CHECK(mismatch == 17);
+}
+
+TEST(snapshots_match_counts_extra_particles)
+{
+    std::wstring path_short = temp_path(L"short.psnp");
+    std::wstring path_long = temp_path(L"long.psnp");
+    write_snapshot(path_short, 20, 0.f);
+    write_snapshot(path_long, 25, 0.f);
+
+    particle_snapshot a(path_short.c_str());
+    particle_snapshot b(path_long.c_str());
+    size_t mismatch = 0;
+    CHECK(!snapshots_match(a, b, 0.f, &mismatch));
+    CHECK(mismatch == 20);
+}
+
+TEST(snapshot_warm_starts_a_system)
+{
+    std::wstring path = temp_path(L"warm_start.psnp");
+    write_snapshot(path, 100, 0.f);
+
+    // No device: the system only needs one once it's simulated
+    flow *source = new flow(50.0, {new age<constant>(0.f)});
+    particle_system_oop system(source, {new move()}, nullptr);
+    {
+        particle_snapshot snapshot(path.c_str());
+        CHECK(system.load_snapshot(snapshot));
+    }
+
+    // The particles and the emission progress are restored, so the source doesn't emit a catch-up burst
+    CHECK(system.m_num_particles_alive == 100);
+    CHECK(source->m_time == 3.f);
+    CHECK(source->m_num_created == 1234);
+
+    // Saving the system again gives back the same particles
+    std::wstring saved_path = temp_path(L"warm_start_saved.psnp");
+    CHECK(system.save_snapshot(saved_path.c_str()));
+    particle_snapshot loaded(path.c_str());
+    particle_snapshot saved(saved_path.c_str());
+    CHECK(saved.is_valid() && saved.m_header->source.num_created == 1234);
+    CHECK(snapshots_match(loaded, saved, 0.f));
+
+    // A missing file leaves the system as it was
+    particle_snapshot missing(temp_path(L"missing.psnp").c_str());
+    CHECK(!system.load_snapshot(missing));
+    CHECK(system.m_num_particles_alive == 100);
+}
@@ -0,0 +1,241 @@
+#include "test.h"
+#include "render_graph.h"
+#include <string>
+
+using barrier = render_graph::barrier;
+using event = render_graph_recorder::event;
+
+// What the backend was asked to do: a batch of barriers is "B<count>", a pass is its name
+static std::string recorded(render_graph_recorder const &recorder)
+{
+    std::string sequence;
+    size_t batch_size = 0;
+    for (event const &e : recorder.events())
+    {
+        if (e.type == event::barrier)
+        {
+            batch_size++;
+            continue;
+        }
+        if (batch_size > 0)
+        {
+            sequence += "B" + std::to_string(batch_size) + " ";
+            batch_size = 0;
+        }
+        if (e.type == event::begin_pass)
+            sequence += std::string(e.pass_name) + " ";
+    }
+    if (batch_size > 0)
+        sequence += "B" + std::to_string(batch_size) + " ";
+    return sequence;
+}
+
+static barrier const *find_barrier(render_graph const &graph, barrier::barrier_type type, render_graph::resource_id resource)
+{
+    for (barrier const &b : graph.barriers())
+    {
+        if (b.type == type && b.resource == resource)
+            return &b;
+    }
+    return nullptr;
+}
+
+TEST(render_graph_culls_unused_passes)
+{
+    render_graph graph;
+    bool ran[5] = {};
+    render_graph::resource_id back_buffer = graph.import_resource("back_buffer", nullptr, state_render_target);
+    render_graph::resource_id unused = graph.create_transient("unused", {1024, 256});
+    render_graph::resource_id scratch = graph.create_transient("scratch", {1024, 256});
+
+    graph.add_pass("write unused", [&] { ran[0] = true; }).write(unused, state_unordered_access);
+    graph.add_pass("overwritten", [&] { ran[1] = true; }).write(scratch, state_unordered_access);
+    graph.add_pass("write scratch", [&] { ran[2] = true; }).write(scratch, state_unordered_access);
+    graph.add_pass("draw", [&] { ran[3] = true; }).read(scratch, state_pixel_shader_resource).read_write(back_buffer, state_render_target);
+    graph.add_pass("capture", [&] { ran[4] = true; }).side_effect();
+    CHECK(graph.compile());
+
+    // Nothing reads the first transient, and the second pass's content is replaced before it's read
+    CHECK(graph.is_culled(0));
+    CHECK(graph.is_culled(1));
+    CHECK(!graph.is_culled(2) && !graph.is_culled(3) && !graph.is_culled(4));
+    CHECK(graph.culled_pass_count() == 2);
+
+    render_graph_recorder recorder;
+    graph.execute(recorder);
+    CHECK(recorded(recorder) == "write scratch B1 draw capture ");
+    CHECK(!ran[0] && !ran[1] && ran[2] && ran[3] && ran[4]);
+}
+
+TEST(render_graph_orders_passes_by_level)
+{
+    render_graph graph;
+    render_graph::resource_id back_buffer = graph.import_resource("back_buffer", nullptr, state_present, state_present);
+    render_graph::resource_id readback = graph.import_resource("readback", nullptr, state_common);
+    render_graph::resource_id shadow_map = graph.create_transient("shadow_map", {1024, 256});
+    render_graph::resource_id gbuffer = graph.create_transient("gbuffer", {1024, 256});
+
+    // Added out of dependency order: the copy doesn't depend on anything and runs with the first level
+    graph.add_pass("shadows", [] {}).write(shadow_map, state_depth_write);
+    graph.add_pass("gbuffer", [] {}).write(gbuffer, state_render_target);
+    graph.add_pass("lighting", [] {})
+        .read(shadow_map, state_pixel_shader_resource)
+        .read(gbuffer, state_pixel_shader_resource)
+        .write(back_buffer, state_render_target);
+    graph.add_pass("ui", [] {}).read_write(back_buffer, state_render_target);
+    graph.add_pass("copy", [] {}).write(readback, state_copy_dest);
+    CHECK(graph.compile());
+
+    std::vector<uint32_t> expected_schedule = {0, 1, 4, 2, 3};
+    CHECK(graph.schedule() == expected_schedule);
+
+    // One barrier call per level that needs one, the ui pass finds the back buffer in the state it needs,
+    // then the back buffer goes back to present
+    render_graph_recorder recorder;
+    graph.execute(recorder);
+    CHECK(recorded(recorder) == "B1 shadows gbuffer copy B3 lighting ui B1 ");
+    CHECK(recorder.barrier_calls() == 3);
+    CHECK(graph.barrier_batch_count() == 4);
+}
+
+TEST(render_graph_side_effects_keep_their_order)
+{
+    render_graph graph;
+    render_graph::resource_id back_buffer = graph.import_resource("back_buffer", nullptr, state_render_target);
+    render_graph::resource_id scene = graph.create_transient("scene", {1024, 256});
+
+    // Like starting and stopping a timer: no resources, but they must stay around the passes they were added around
+    graph.add_pass("start timer", [] {}).side_effect();
+    graph.add_pass("draw", [] {}).write(scene, state_render_target);
+    graph.add_pass("post", [] {}).read(scene, state_pixel_shader_resource).read_write(back_buffer, state_render_target);
+    graph.add_pass("stop timer", [] {}).side_effect();
+    graph.add_pass("clear readback", [] {}).side_effect();
+    graph.add_pass("unrelated", [] {}).write(graph.import_resource("readback", nullptr, state_copy_dest), state_copy_dest);
+    CHECK(graph.compile());
+
+    // The stop runs last in the post level, the unrelated pass added after it still runs with the first level
+    std::vector<uint32_t> expected_schedule = {0, 1, 5, 2, 3, 4};
+    CHECK(graph.schedule() == expected_schedule);
+
+    render_graph_recorder recorder;
+    graph.execute(recorder);
+    CHECK(recorded(recorder) == "start timer draw unrelated B1 post stop timer clear readback ");
+}
+
+TEST(render_graph_uav_barriers)
+{
+    render_graph graph;
+    render_graph::resource_id particles = graph.import_resource("particles", nullptr, state_unordered_access);
+
+    // The draws only read graph resources, their output is outside of the graph
+    graph.add_pass("emit", [] {}).read_write(particles, state_unordered_access);
+    graph.add_pass("simulate", [] {}).read_write(particles, state_unordered_access);
+    graph.add_pass("draw", [] {}).read(particles, state_vertex_and_constant_buffer).side_effect();
+    graph.add_pass("draw bounds", [] {}).read(particles, state_indirect_argument).side_effect();
+    graph.add_pass("sort", [] {}).read_write(particles, state_unordered_access);
+    graph.add_pass("compact", [] {}).read_write(particles, state_unordered_access);
+    CHECK(graph.compile());
+
+    // The second UAV pass waits for the first without a transition, the two reads of the same level share one transition
+    std::vector<barrier> const &barriers = graph.barriers();
+    CHECK(barriers.size() == 4);
+    if (barriers.size() == 4)
+    {
+        CHECK(barriers[0].type == barrier::uav);
+        CHECK(barriers[1].type == barrier::transition);
+        CHECK(barriers[1].state_before == state_unordered_access);
+        CHECK(barriers[1].state_after == (state_vertex_and_constant_buffer | state_indirect_argument));
+        CHECK(barriers[2].type == barrier::transition);
+        CHECK(barriers[2].state_after == state_unordered_access);
+        CHECK(barriers[3].type == barrier::uav);
+    }
+
+    render_graph_recorder recorder;
+    graph.execute(recorder);
+    CHECK(recorded(recorder) == "emit B1 simulate B1 draw draw bounds B1 sort B1 compact ");
+}
+
+TEST(render_graph_final_states)
+{
+    render_graph graph;
+    render_graph::resource_id back_buffer = graph.import_resource("back_buffer", nullptr, state_present, state_present);
+    render_graph::resource_id depth = graph.import_resource("depth", nullptr, state_depth_write, state_depth_write);
+    render_graph::resource_id counters = graph.import_resource("counters", nullptr, state_common);
+
+    graph.add_pass("draw", [] {})
+        .read_write(back_buffer, state_render_target)
+        .read_write(depth, state_depth_write)
+        .write(counters, state_unordered_access);
+    CHECK(graph.compile());
+
+    // The back buffer returns to present, the depth buffer is already in its final state and the counters have none
+    barrier const *present = nullptr;
+    size_t final_transitions = 0;
+    for (size_t i = 0; i < graph.barriers().size(); i++)
+    {
+        barrier const &b = graph.barriers()[i];
+        if (b.type == barrier::transition && b.state_after == state_present)
+        {
+            present = &b;
+            final_transitions++;
+        }
+    }
+    CHECK(final_transitions == 1);
+    CHECK(present && present->resource == back_buffer && present->state_before == state_render_target);
+    CHECK(graph.barriers().back().resource == back_buffer);
+    CHECK(find_barrier(graph, barrier::transition, depth) == nullptr);
+
+    render_graph_recorder recorder;
+    graph.execute(recorder);
+    CHECK(recorded(recorder) == "B2 draw B1 ");
+}
+
+TEST(render_graph_aliases_transients)
+{
+    render_graph graph;
+    render_graph::resource_id back_buffer = graph.import_resource("back_buffer", nullptr, state_render_target);
+    render_graph::resource_id depth = graph.create_transient("depth", {1024 * 1024, 64 * 1024});
+    render_graph::resource_id color = graph.create_transient("color", {1024 * 1024, 64 * 1024});
+    render_graph::resource_id blur = graph.create_transient("blur", {512 * 1024, 64 * 1024});
+
+    // Each transient lives for two levels, the blur target starts after the depth buffer's last use
+    graph.add_pass("depth prepass", [] {}).write(depth, state_unordered_access);
+    graph.add_pass("shading", [] {}).read(depth, state_non_pixel_shader_resource).write(color, state_render_target);
+    graph.add_pass("blur", [] {}).read(color, state_pixel_shader_resource).write(blur, state_unordered_access);
+    graph.add_pass("composite", [] {}).read(blur, state_pixel_shader_resource).read_write(back_buffer, state_render_target);
+    CHECK(graph.compile());
+
+    // The depth and color lifetimes overlap in the shading level, the blur target takes the depth buffer's memory.
+    // Only the blur target's memory had an owner before it.
+    CHECK(graph.transient_offset(depth) == 0);
+    CHECK(graph.transient_offset(color) == 1024 * 1024);
+    CHECK(graph.transient_offset(blur) == 0);
+    CHECK(graph.transient_heap_size() == 2 * 1024 * 1024);
+    CHECK(graph.initial_state(blur) == state_unordered_access);
+
+    barrier const *depth_alias = find_barrier(graph, barrier::aliasing, depth);
+    barrier const *color_alias = find_barrier(graph, barrier::aliasing, color);
+    barrier const *blur_alias = find_barrier(graph, barrier::aliasing, blur);
+    CHECK(depth_alias == nullptr && color_alias == nullptr);
+    CHECK(blur_alias && blur_alias->resource_before == depth);
+
+    // The backend gets the native resources of both sides of the aliasing barrier
+    int depth_native = 0;
+    int blur_native = 0;
+    graph.set_native(depth, &depth_native);
+    graph.set_native(blur, &blur_native);
+
+    render_graph_recorder recorder;
+    graph.execute(recorder);
+    bool found_blur_alias = false;
+    for (event const &e : recorder.events())
+    {
+        if (e.type == event::barrier && e.barrier_data.type == barrier::aliasing && e.barrier_data.resource == blur)
+        {
+            found_blur_alias = true;
+            CHECK(e.barrier_data.native == &blur_native);
+            CHECK(e.barrier_data.native_before == &depth_native);
+        }
+    }
+    CHECK(found_blur_alias);
+}
@@ -0,0 +1,81 @@
+#include "test.h"
+#include "stream_copy.h"
+#include <cstring>
+#include <vector>
+
+// Below, at and above the size where the copy switches to streaming stores, with partial lines at both ends
+static size_t const copy_sizes[] = {0, 1, 15, 63, 64, 65, 255, 256, 257, 1000, 4096 + 13, 100000};
+
+static void fill_pattern(std::vector<uint8_t> &bytes, uint8_t seed)
+{
+    for (size_t i = 0; i < bytes.size(); i++)
+        bytes[i] = uint8_t(i * 31 + seed);
+}
+
+TEST(stream_copy_matches_memcpy)
+{
+    size_t const guard = 64;
+    bool all_equal = true;
+    bool guards_intact = true;
+    for (size_t size : copy_sizes)
+    {
+        // Every alignment of the destination within a line, and a few of the source
+        for (size_t dst_offset = 0; dst_offset < 64; dst_offset += 7)
+        {
+            for (size_t src_offset : {0, 3, 16, 33})
+            {
+                std::vector<uint8_t> src(size + 128);
+                fill_pattern(src, uint8_t(size));
+
+                std::vector<uint8_t> expected(size + 2 * guard + 64, 0xCD);
+                std::vector<uint8_t> actual(expected);
+                std::memcpy(&expected[guard + dst_offset], &src[src_offset], size);
+                stream_copy(&actual[guard + dst_offset], &src[src_offset], size);
+
+                all_equal = all_equal && std::memcmp(&expected[guard + dst_offset], &actual[guard + dst_offset], size) == 0;
+                guards_intact = guards_intact && expected == actual;
+            }
+        }
+    }
+    CHECK(all_equal);
+    CHECK(guards_intact);
+}
+
+struct test_constants
+{
+    float values[5];
+};
+
+TEST(stream_convert_pads_elements)
+{
+    // Like constant buffers: 20 byte elements written 256 bytes apart, more than fit in one staging batch
+    size_t const stride = 256;
+    size_t const count = stream_staging_size / stride * 2 + 3;
+    std::vector<int> src(count);
+    for (size_t i = 0; i < count; i++)
+        src[i] = int(i);
+
+    std::vector<uint8_t> dst(count * stride + 64, 0xCD);
+    stream_convert(dst.data(), stride, src.data(), count, [](int const &value, void *element) {
+        test_constants constants;
+        for (int i = 0; i < 5; i++)
+            constants.values[i] = float(value + i);
+        std::memcpy(element, &constants, sizeof(constants));
+    });
+
+    bool converted = true;
+    bool padding_cleared = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        test_constants constants;
+        std::memcpy(&constants, &dst[i * stride], sizeof(constants));
+        converted = converted && constants.values[0] == float(i) && constants.values[4] == float(i + 4);
+        for (size_t b = sizeof(constants); b < stride; b++)
+            padding_cleared = padding_cleared && dst[i * stride + b] == 0;
+    }
+    CHECK(converted);
+    CHECK(padding_cleared);
+
+    // Nothing written past the last element
+    CHECK(dst[count * stride] == 0xCD && dst.back() == 0xCD);
+}
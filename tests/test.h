@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdio>
+
+// Minimal test runner: TEST bodies register themselves before main, CHECK reports the failed statement and keeps going.
+// The tests of the headless modules don't need Windows, they can also be built with any C++14 compiler.
+int register_test(const char *name, void (*run)());
+void failed_check(const char *file, int line, const char *statement);
+
+#define TEST(name)                                                 \
+    static void name();                                            \
+    static int name##_registration = register_test(#name, name);   \
+    static void name()
+
+#define CHECK(statement)                                  \
+    do                                                    \
+    {                                                     \
+        if (!(statement))                                 \
+            failed_check(__FILE__, __LINE__, #statement); \
+    } while ((void)0, 0)
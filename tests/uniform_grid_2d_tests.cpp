@@ -0,0 +1,178 @@
+#include "test.h"
+#include "uniform_grid_2d.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using rect = uniform_grid_2d::rect;
+
+// Rectangles around the size of a cell, some spanning several cells, on both sides of the origin
+static rect random_rect(std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> position(-10.f, 10.f);
+    std::uniform_real_distribution<float> size(0.f, 2.5f);
+    float x = position(rng);
+    float y = position(rng);
+    return {x, y, x + size(rng), y + size(rng)};
+}
+
+static bool overlaps(rect const &a, rect const &b)
+{
+    return a.min_x <= b.max_x && a.max_x >= b.min_x && a.min_y <= b.max_y && a.max_y >= b.min_y;
+}
+
+static float distance_to(rect const &r, float x, float y)
+{
+    float dx = std::max(std::max(r.min_x - x, 0.f), x - r.max_x);
+    float dy = std::max(std::max(r.min_y - y, 0.f), y - r.max_y);
+    return std::sqrt(dx * dx + dy * dy);
+}
+
+// Compares every query with testing all the live rectangles
+struct grid_checker
+{
+    uniform_grid_2d grid{1.f};
+    std::vector<rect> rects;
+    std::vector<bool> live;
+    size_t mismatches = 0;
+
+    void check_rect(rect const &area)
+    {
+        std::vector<uint32_t> expected;
+        for (uint32_t id = 0; id < rects.size(); id++)
+        {
+            if (live[id] && overlaps(rects[id], area))
+                expected.push_back(id);
+        }
+
+        std::vector<uint32_t> found;
+        grid.query_rect(area, found);
+        std::sort(found.begin(), found.end());
+        mismatches += found != expected;
+    }
+
+    void check_point(float x, float y)
+    {
+        std::vector<uint32_t> expected;
+        for (uint32_t id = 0; id < rects.size(); id++)
+        {
+            if (live[id] && overlaps(rects[id], {x, y, x, y}))
+                expected.push_back(id);
+        }
+
+        std::vector<uint32_t> found;
+        grid.query_point(x, y, found);
+        std::sort(found.begin(), found.end());
+        mismatches += found != expected;
+    }
+
+    // Ties may return any of the nearest rectangles, so the distances are compared
+    void check_nearest(float x, float y, float max_distance)
+    {
+        float expected = FLT_MAX;
+        for (uint32_t id = 0; id < rects.size(); id++)
+        {
+            if (live[id])
+                expected = std::min(expected, distance_to(rects[id], x, y));
+        }
+
+        uint32_t id = UINT32_MAX;
+        float distance = 0.f;
+        bool found = grid.nearest(x, y, max_distance, id, distance);
+        if (expected > max_distance)
+            mismatches += found;
+        else
+            mismatches += !found || !live[id] || distance != expected || distance_to(rects[id], x, y) != expected;
+    }
+
+    void check_queries(std::mt19937 &rng)
+    {
+        std::uniform_real_distribution<float> position(-12.f, 14.f);
+        for (int i = 0; i < 20; i++)
+        {
+            check_point(position(rng), position(rng));
+            check_nearest(position(rng), position(rng), i % 2 == 0 ? FLT_MAX : 1.5f);
+
+            // Small areas walk the cells, large ones walk the occupied cells
+            rect area = random_rect(rng);
+            if (i % 4 == 0)
+                area.max_x += 20.f;
+            check_rect(area);
+        }
+    }
+};
+
+TEST(uniform_grid_2d_queries_match_brute_force)
+{
+    std::mt19937 rng(7);
+    grid_checker checker;
+    for (uint32_t id = 0; id < 300; id++)
+    {
+        checker.rects.push_back(random_rect(rng));
+        checker.live.push_back(true);
+        checker.grid.insert(id, checker.rects[id]);
+    }
+    checker.check_queries(rng);
+    CHECK(checker.mismatches == 0);
+
+    // Nothing closer than the maximum distance, and an empty grid
+    uint32_t id = 0;
+    float distance = 0.f;
+    CHECK(!checker.grid.nearest(100.f, 100.f, 10.f, id, distance));
+    checker.grid.clear();
+    CHECK(!checker.grid.nearest(0.f, 0.f, FLT_MAX, id, distance));
+    CHECK(checker.grid.occupied_cells() == 0);
+}
+
+TEST(uniform_grid_2d_updates_across_cell_borders)
+{
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> step(-0.6f, 0.6f);
+    grid_checker checker;
+    for (uint32_t id = 0; id < 200; id++)
+    {
+        checker.rects.push_back(random_rect(rng));
+        checker.live.push_back(true);
+        checker.grid.insert(id, checker.rects[id]);
+    }
+
+    // Moves smaller than a cell: some stay in their cells, others cross a border, some rectangles leave and come back
+    for (int frame = 0; frame < 50; frame++)
+    {
+        for (uint32_t id = 0; id < checker.rects.size(); id++)
+        {
+            if (rng() % 16 == 0)
+            {
+                if (checker.live[id])
+                    checker.grid.remove(id);
+                else
+                    checker.grid.insert(id, checker.rects[id]);
+                checker.live[id] = !checker.live[id];
+                continue;
+            }
+
+            if (!checker.live[id])
+                continue;
+
+            rect &r = checker.rects[id];
+            float dx = step(rng);
+            float dy = step(rng);
+            r = {r.min_x + dx, r.min_y + dy, r.max_x + dx, r.max_y + dy};
+            checker.grid.update(id, r);
+        }
+        checker.check_queries(rng);
+    }
+    CHECK(checker.mismatches == 0);
+
+    bool contains_live = true;
+    for (uint32_t id = 0; id < checker.rects.size(); id++)
+        contains_live = contains_live && checker.grid.contains(id) == checker.live[id];
+    CHECK(contains_live);
+
+    // Every cell left behind is released once the rectangles are gone
+    for (uint32_t id = 0; id < checker.rects.size(); id++)
+        checker.grid.remove(id);
+    CHECK(checker.grid.occupied_cells() == 0);
+}
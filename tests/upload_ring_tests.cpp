@@ -0,0 +1,112 @@
+#include "test.h"
+#include "upload_ring.h"
+
+TEST(upload_ring_alignment_padding)
+{
+    null_upload_backend backend(4096);
+    upload_ring ring(&backend);
+
+    upload_allocation vertices = ring.allocate(10, 4);
+    CHECK(vertices.is_valid() && vertices.offset == 0 && vertices.size == 10);
+
+    // The constant buffer starts at the next multiple of 256, the padding counts as used
+    upload_allocation constants = ring.allocate(16, 256);
+    CHECK(constants.offset == 256);
+    CHECK(constants.cpu == backend.cpu_base() + 256);
+    CHECK(constants.gpu_address == backend.gpu_base() + 256);
+    CHECK(ring.used() == 272);
+
+    upload_allocation indices = ring.allocate(6, 2);
+    CHECK(indices.offset == 272);
+    CHECK(ring.used() == 278);
+}
+
+TEST(upload_ring_retires_completed_frames)
+{
+    null_upload_backend backend(4096);
+    upload_ring ring(&backend);
+
+    for (uint64_t fence = 1; fence <= 3; fence++)
+    {
+        CHECK(ring.allocate(512, 16).is_valid());
+        ring.end_frame(fence);
+    }
+    CHECK(ring.frames_in_flight() == 3);
+    CHECK(ring.used() == 3 * 512);
+
+    // A frame without uploads has nothing to reclaim
+    ring.end_frame(4);
+    CHECK(ring.frames_in_flight() == 3);
+
+    // Only the frames whose fence completed come back
+    backend.complete(2);
+    ring.retire();
+    CHECK(ring.frames_in_flight() == 1);
+    CHECK(ring.used() == 512);
+
+    backend.complete(3);
+    ring.retire();
+    CHECK(ring.frames_in_flight() == 0);
+    CHECK(ring.used() == 0);
+
+    // An empty ring starts over at the front
+    CHECK(ring.allocate(64, 16).offset == 0);
+    CHECK(ring.wait_count() == 0 && backend.wait_count() == 0);
+}
+
+TEST(upload_ring_wraps_around)
+{
+    null_upload_backend backend(1024);
+    upload_ring ring(&backend);
+
+    CHECK(ring.allocate(600, 8).offset == 0);
+    ring.end_frame(1);
+    CHECK(ring.allocate(300, 8).offset == 600);
+    ring.end_frame(2);
+
+    // 124 bytes are left at the end, the allocation goes to the front once the first frame is retired
+    backend.complete(1);
+    upload_allocation wrapped = ring.allocate(200, 8);
+    CHECK(wrapped.is_valid() && wrapped.offset == 0);
+    CHECK(ring.used() == 300 + 124 + 200);
+    CHECK(ring.wait_count() == 0);
+
+    // The skipped end of the ring comes back with the frame that skipped it
+    ring.end_frame(3);
+    backend.complete(2);
+    ring.retire();
+    CHECK(ring.used() == 124 + 200);
+    CHECK(ring.allocate(400, 8).offset == 200);
+    ring.end_frame(4);
+
+    backend.complete(4);
+    ring.retire();
+    CHECK(ring.used() == 0 && ring.frames_in_flight() == 0);
+}
+
+TEST(upload_ring_blocks_when_full)
+{
+    null_upload_backend backend(1024);
+    upload_ring ring(&backend);
+
+    CHECK(ring.allocate(512, 16).is_valid());
+    ring.end_frame(1);
+    CHECK(ring.allocate(512, 16).is_valid());
+    ring.end_frame(2);
+
+    // Nothing completed: the ring waits for the oldest frame only
+    upload_allocation allocation = ring.allocate(256, 16);
+    CHECK(allocation.is_valid() && allocation.offset == 0);
+    CHECK(backend.wait_count() == 1 && ring.wait_count() == 1);
+    CHECK(backend.completed_fence() == 1);
+    CHECK(ring.frames_in_flight() == 1);
+
+    // Larger than what's left next to the current frame's allocations even with every frame retired
+    upload_allocation too_large = ring.allocate(1024, 16);
+    CHECK(!too_large.is_valid());
+    CHECK(ring.frames_in_flight() == 0);
+    CHECK(ring.used() == 256);
+
+    CHECK(!ring.allocate(2048, 16).is_valid());
+    CHECK(!ring.allocate(0, 16).is_valid());
+}
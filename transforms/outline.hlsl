@@ -19,12 +19,25 @@ struct model
 };
 ConstantBuffer<model> cb_model : register(b1);
 
+// Batched quads read their transform from the instances of their batch
+struct quad_instance
+{
+    matrix model;
+};
+StructuredBuffer<quad_instance> sb_quad_instances : register(t0);
+
+struct instance_offset
+{
+    uint first_instance;
+};
+ConstantBuffer<instance_offset> cb_instance_offset : register(b3);
+
 VertexShaderOutput VS(VertexPosColor IN, uint instanceID : SV_InstanceID)
 {
     VertexShaderOutput OUT;
 
-    float4 Hpos = float4((IN.Position.xy * (instanceID + 1)) * 1.1f, 0.0f, 1.0f);
-    OUT.Position = mul(Hpos, cb_model.model);
+    float4 Hpos = float4(IN.Position.xy * 1.1f, 0.0f, 1.0f);
+    OUT.Position = mul(Hpos, sb_quad_instances[cb_instance_offset.first_instance + instanceID].model);
     OUT.Color = float4(IN.Color, 1.f);
     return OUT;
 }
@@ -6,6 +6,8 @@
 #include <common.h>
 #include <gpu_query.h>
 #include <imgui_helpers.h>
+#include <geometry_batcher.h>
+#include <uniform_grid_2d.h>
 
 #ifdef DX12_ENABLE_DEBUG_LAYER
 #include <dxgidebug.h>
@@ -25,7 +27,6 @@ struct frame_context
 {
     ID3D12CommandAllocator *cmd_alloc;
     UINT64 fence_value;
-    UINT64 triangle_index;
 
     ID3D12Resource *modelcb_resource;
     BYTE *cpu_mapped_model_cb;
@@ -39,12 +40,11 @@ size_t aligned_packed_uploadheap_size;
 #define IDT_TIMER1 1
 UINT backbuffer_index = 0; // gets updated after each call to Present()
 UINT next_backbuffer_index = 0;
-UINT srv_desc_handle_incr_size = 0;
 static struct frame_context g_frame_context[NUM_BACK_BUFFERS];
 static ID3D12Device *g_device = NULL;
 static IDXGIAdapter4 *adapter = NULL;
 static ID3D12DescriptorHeap *rtv_desc_heap = NULL;
-static ID3D12DescriptorHeap *cbv_srv_uav_heap = NULL;
+static descriptor_heap *cbv_srv_uav_heap = NULL;
 static ID3D12DescriptorHeap *dsv_heap = NULL;
 static ID3D12CommandQueue *g_cmd_queue = NULL;
 static std::vector<ID3D12GraphicsCommandList *> cmd_lists;
@@ -141,19 +141,34 @@ struct triangle_mesh
     ID3D12Resource *model_cb_resource = NULL;
     model_cb *cpu_mapped_model_cb = NULL;
     D3D12_VERTEX_BUFFER_VIEW vbv = {};
-    size_t cb_index = 0;
+    descriptor_range cbv = {}; // Invalid for the triangles whose CBV is written every frame
+    bool is_cbv_per_frame = false;
 };
 
 struct quad
 {
-    D3D12_VERTEX_BUFFER_VIEW vbv = {};
-    D3D12_INDEX_BUFFER_VIEW ibv = {};
-    size_t cb_index = 0;
+    UINT instance = 0; // index of the quad's transform in the batched instances
+    UINT batch = 0;
     ImVec2 position;
     BoundingBox bounds;
 };
 std::vector<quad> quads;
 
+// Quads with the same geometry share their vertices and indices and are drawn with one instanced draw per batch
+struct quad_instance
+{
+    XMFLOAT4X4 model;
+};
+geometry_batcher quad_batcher(sizeof(quad_vert2d));
+D3D12_VERTEX_BUFFER_VIEW quads_vbv = {};
+D3D12_INDEX_BUFFER_VIEW quads_ibv = {};
+D3D12_GPU_VIRTUAL_ADDRESS quad_instances_address = 0;
+bool is_packed_resource_copied = false;
+
+// Spatial index of the quads' bounds for hovering, ids are indices into quads
+uniform_grid_2d quad_grid(0.5f);
+std::vector<uint32_t> hovered_quads;
+
 #define max_tris 5000
 #define max_quads 5000
 #define indices_per_quad 6
@@ -185,13 +200,10 @@ void create_rendertarget();
 void create_dsv(UINT64 width, UINT height);
 void create_query_objects();
 void compile_shader(const wchar_t *file, ID3DBlob **vs_blob, ID3DBlob **ps_blob);
-void create_cb_resource_per_cbv(int triangle_index, size_t heap_index);
-void append_cb_toheap(int triangle_index, size_t heap_index);
-void create_cb_resource_per_frame(int triangle_index);
-void fill_packed_resource(
-    size_t vertex_size, size_t vertex_count, quad_vert2d *vertices,
-    size_t index_size, size_t index_count, WORD *indices,
-    size_t heap_index);
+void create_cb_resource_per_cbv(int triangle_index, descriptor_range cbv);
+void append_cb_toheap(int triangle_index, descriptor_range cbv);
+descriptor_range create_cb_resource_per_frame(int triangle_index);
+void upload_quad_batches();
 void create_quads(int count);
 
 // synchronization
@@ -330,17 +342,8 @@ bool create_device()
         }
     }
 
-    {
-        D3D12_DESCRIPTOR_HEAP_DESC main_heap_desc;
-        main_heap_desc.NodeMask = 0;
-        main_heap_desc.Type = D3D12_DESCRIPTOR_HEAP_TYPE::D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-        main_heap_desc.NumDescriptors = max_tris;
-        main_heap_desc.Flags = D3D12_DESCRIPTOR_HEAP_FLAGS::D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-        hr = g_device->CreateDescriptorHeap(&main_heap_desc, __uuidof(ID3D12DescriptorHeap), (void **)&cbv_srv_uav_heap);
-
-        ASSERT(SUCCEEDED(hr));
-        cbv_srv_uav_heap->SetName(L"tri_cbv_srv_uav_heap");
-    }
+    // The triangles with a CBV per frame take one from the frame's region every frame
+    cbv_srv_uav_heap = new descriptor_heap(g_device, max_tris, max_tris, "tri_cbv_srv_uav_heap");
 
     {
         D3D12_DESCRIPTOR_HEAP_DESC desc;
@@ -441,8 +444,8 @@ bool create_device()
 
     g_hswapchain_waitableobject = g_swapchain->GetFrameLatencyWaitableObject();
 
-    // packed quads
-    size_t packed_uploadheap_size = (cb_per_quad * sizeof(model_cb) +
+    // packed quads, the batched vertices and indices followed by the instance transforms
+    size_t packed_uploadheap_size = (cb_per_quad * sizeof(quad_instance) +
                                      (indices_per_quad * sizeof(WORD)) +
                                      (vertices_per_quad * sizeof(quad_vert2d))) *
                                     max_quads;
@@ -474,8 +477,6 @@ bool create_device()
     create_dsv(g_hwnd_width, g_hwnd_height);
     create_query_objects();
 
-    srv_desc_handle_incr_size = g_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE::D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
-
     // flush command queue
     g_cmd_list->Close();
     g_cmd_queue->ExecuteCommandLists(1, (ID3D12CommandList *const *)&g_cmd_list);
@@ -556,7 +557,7 @@ s_internal void init_pipeline()
     ASSERT(SUCCEEDED(hr));
 
     // (root) ConstantBuffer<model_to_proj> cb_modelproj : register(b0);
-    D3D12_ROOT_PARAMETER1 parameters[2];
+    D3D12_ROOT_PARAMETER1 parameters[4];
     D3D12_ROOT_PARAMETER1 param_modelproj;
     param_modelproj.ParameterType = D3D12_ROOT_PARAMETER_TYPE::D3D12_ROOT_PARAMETER_TYPE_CBV;
     param_modelproj.ShaderVisibility = D3D12_SHADER_VISIBILITY::D3D12_SHADER_VISIBILITY_VERTEX;
@@ -582,6 +583,21 @@ s_internal void init_pipeline()
     param_model.DescriptorTable = model_cbv_table;
     parameters[1] = param_model;
 
+    // (root) StructuredBuffer<quad_instance> sb_quad_instances : register(t0);
+    D3D12_ROOT_PARAMETER1 param_quad_instances;
+    param_quad_instances.ParameterType = D3D12_ROOT_PARAMETER_TYPE::D3D12_ROOT_PARAMETER_TYPE_SRV;
+    param_quad_instances.ShaderVisibility = D3D12_SHADER_VISIBILITY::D3D12_SHADER_VISIBILITY_VERTEX;
+    param_quad_instances.Descriptor = {0, 0, D3D12_ROOT_DESCRIPTOR_FLAGS::D3D12_ROOT_DESCRIPTOR_FLAG_NONE};
+    parameters[2] = param_quad_instances;
+
+    // (root) ConstantBuffer<instance_offset> cb_instance_offset : register(b3);
+    // SV_InstanceID doesn't include the start instance location
+    D3D12_ROOT_PARAMETER1 param_instance_offset;
+    param_instance_offset.ParameterType = D3D12_ROOT_PARAMETER_TYPE::D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+    param_instance_offset.ShaderVisibility = D3D12_SHADER_VISIBILITY::D3D12_SHADER_VISIBILITY_VERTEX;
+    param_instance_offset.Constants = {3, 0, 1};
+    parameters[3] = param_instance_offset;
+
     // Root Signature
     D3D12_VERSIONED_ROOT_SIGNATURE_DESC versioned_rootsig_desc;
     versioned_rootsig_desc.Version = D3D_ROOT_SIGNATURE_VERSION::D3D_ROOT_SIGNATURE_VERSION_1_1;
@@ -848,35 +864,30 @@ void compile_shader(const wchar_t *file, ID3DBlob **vs_blob, ID3DBlob **ps_blob)
     ASSERT(SUCCEEDED(hr));
 }
 
-void fill_packed_resource(
-    size_t vertex_size, size_t vertex_count, quad_vert2d *vertices,
-    size_t index_size, size_t index_count, WORD *indices,
-    size_t heap_index)
+void upload_quad_batches()
 {
-    size_t vertices_size = vertex_size * vertex_count;
-    size_t indices_size = index_size * index_count;
-
-    size_t vertices_offset = (vertices_size + indices_size) * heap_index;
-    size_t indices_offset = vertices_size * (heap_index + 1) + (heap_index * indices_size);
+    size_t vertices_size = quad_batcher.vertices().size();
+    size_t indices_size = quad_batcher.indices().size() * sizeof(WORD);
+    size_t instances_size = quad_batcher.instances().size() * sizeof(quad_instance);
 
-    memcpy((void *)&cpu_mapped_packed[vertices_offset],
-           (void *)vertices,
-           vertices_size);
+    size_t indices_offset = vertices_size;
+    size_t instances_offset = align_up(indices_offset + indices_size, D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+    ASSERT(instances_offset + instances_size <= aligned_packed_uploadheap_size);
 
-    memcpy((void *)&cpu_mapped_packed[indices_offset],
-           (void *)indices,
-           indices_size);
+    memcpy((void *)&cpu_mapped_packed[0], (void *)quad_batcher.vertices().data(), vertices_size);
+    memcpy((void *)&cpu_mapped_packed[indices_offset], (void *)quad_batcher.indices().data(), indices_size);
+    memcpy((void *)&cpu_mapped_packed[instances_offset], (void *)quad_batcher.instances().data(), instances_size);
 
-    quad new_quad = {};
-    new_quad.ibv.BufferLocation = packed_default_resource->GetGPUVirtualAddress() + indices_offset;
-    new_quad.ibv.Format = DXGI_FORMAT::DXGI_FORMAT_R16_UINT;
-    new_quad.ibv.SizeInBytes = (UINT)indices_size;
+    D3D12_GPU_VIRTUAL_ADDRESS address = packed_default_resource->GetGPUVirtualAddress();
+    quads_vbv.BufferLocation = address;
+    quads_vbv.SizeInBytes = (UINT)vertices_size;
+    quads_vbv.StrideInBytes = (UINT)quad_batcher.vertex_size();
 
-    new_quad.vbv.BufferLocation = packed_default_resource->GetGPUVirtualAddress() + vertices_offset;
-    new_quad.vbv.SizeInBytes = (UINT)vertices_size;
-    new_quad.vbv.StrideInBytes = (UINT)vertex_size;
+    quads_ibv.BufferLocation = address + indices_offset;
+    quads_ibv.Format = DXGI_FORMAT::DXGI_FORMAT_R16_UINT;
+    quads_ibv.SizeInBytes = (UINT)indices_size;
 
-    quads.push_back(new_quad);
+    quad_instances_address = address + instances_offset;
 }
 
 void create_quads(int count)
@@ -884,11 +895,15 @@ void create_quads(int count)
     if (count <= 0)
         return;
 
+    // The previous quads may still be drawn by the frames in flight
+    cpu_wait(g_fence_last_signaled_value);
+
     hr = ui_requests_cmd_alloc->Reset();
     ASSERT(SUCCEEDED(hr));
     hr = ui_requests_cmdlist->Reset(ui_requests_cmd_alloc, nullptr);
     ASSERT(SUCCEEDED(hr));
 
+    quad_batcher.clear();
     for (int i = 0; i < count; ++i)
     {
         quad_vert2d vertices[4] = {
@@ -902,21 +917,18 @@ void create_quads(int count)
             0, 1, 2,
             3, 0, 2};
 
-        fill_packed_resource(sizeof(quad_vert2d), _countof(vertices), vertices,
-                             sizeof(WORD), _countof(indices), indices, i);
-
-        quads[i].cb_index = (max_quads - i) - 1;
-        append_cb_toheap((int)quads[i].cb_index, quads[i].cb_index);
-
         XMMATRIX scale = XMMatrixScaling(0.4f, 0.4f, 0.4f);
         XMMATRIX translation = XMMatrixTranslation(0.f, (float)i * 1.f, 0.f);
         XMMATRIX model = translation * scale;
-        XMMATRIX t_model = XMMatrixTranspose(model);
-        memcpy((void *)&cpu_map_prealloc_modelcb[quads[i].cb_index * model_cb_size], (void *)&t_model, sizeof(XMMATRIX));
+        XMFLOAT4X4 t_model;
+        XMStoreFloat4x4(&t_model, XMMatrixTranspose(model));
+
+        quad new_quad = {};
+        new_quad.instance = quad_batcher.add(vertices, _countof(vertices), indices, _countof(indices), t_model);
 
         XMVECTOR tv = translation.r[3];
-        quads[i].position.x = XMVectorGetX(tv);
-        quads[i].position.y = XMVectorGetY(tv);
+        new_quad.position.x = XMVectorGetX(tv);
+        new_quad.position.y = XMVectorGetY(tv);
 
         // loop over all vertices to find the min and max vector
         XMVECTOR vmax = XMVectorReplicate(-FLT_MAX);
@@ -929,9 +941,27 @@ void create_quads(int count)
             vmax = XMVectorMax(vmax, pm);
         }
 
-        quads[i].bounds.CreateFromPoints(quads[i].bounds,
+        new_quad.bounds.CreateFromPoints(new_quad.bounds,
                                          XMVectorSet(XMVectorGetX(vmin), XMVectorGetY(vmin), 0.f, 0.f),
                                          XMVectorSet(XMVectorGetX(vmax), XMVectorGetY(vmax), 0.f, 0.f));
+        quad_grid.insert((uint32_t)quads.size(), {XMVectorGetX(vmin), XMVectorGetY(vmin), XMVectorGetX(vmax), XMVectorGetY(vmax)});
+        quads.push_back(new_quad);
+    }
+
+    quad_batcher.build();
+    for (quad &q : quads)
+    {
+        q.batch = quad_batcher.instance_batch(q.instance);
+        q.instance = quad_batcher.instance_index(q.instance);
+    }
+    upload_quad_batches();
+
+    if (is_packed_resource_copied)
+    {
+        ui_requests_cmdlist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
+                                                    packed_default_resource,
+                                                    D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER | D3D12_RESOURCE_STATE_INDEX_BUFFER | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+                                                    D3D12_RESOURCE_STATE_COPY_DEST));
     }
 
     ui_requests_cmdlist->CopyBufferRegion(
@@ -941,13 +971,14 @@ void create_quads(int count)
     ui_requests_cmdlist->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
                                                 packed_default_resource,
                                                 D3D12_RESOURCE_STATE_COPY_DEST,
-                                                D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER | D3D12_RESOURCE_STATE_INDEX_BUFFER));
+                                                D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER | D3D12_RESOURCE_STATE_INDEX_BUFFER | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
+    is_packed_resource_copied = true;
 
     ui_requests_cmdlist->Close();
     g_cmd_queue->ExecuteCommandLists(1, (ID3D12CommandList *const *)&ui_requests_cmdlist);
 }
 
-void create_cb_resource_per_cbv(int triangle_index, size_t heap_index)
+void create_cb_resource_per_cbv(int triangle_index, descriptor_range cbv)
 {
     int i = triangle_index;
 
@@ -973,16 +1004,13 @@ void create_cb_resource_per_cbv(int triangle_index, size_t heap_index)
     memcpy((void *)triangles[i].cpu_mapped_model_cb, (void *)&t_model, sizeof(XMMATRIX));
     triangles[i].model_cb_resource->Unmap(0, &range);
 
-    D3D12_CPU_DESCRIPTOR_HANDLE handle = {};
-    handle.ptr = cbv_srv_uav_heap->GetCPUDescriptorHandleForHeapStart().ptr + (heap_index * srv_desc_handle_incr_size);
-
     D3D12_CONSTANT_BUFFER_VIEW_DESC cbv_model_desc;
     cbv_model_desc.BufferLocation = triangles[i].model_cb_resource->GetGPUVirtualAddress();
     cbv_model_desc.SizeInBytes = model_cb_size;
-    g_device->CreateConstantBufferView(&cbv_model_desc, handle);
+    g_device->CreateConstantBufferView(&cbv_model_desc, cbv_srv_uav_heap->cpu(cbv));
 }
 
-void append_cb_toheap(int triangle_index, size_t heap_index)
+void append_cb_toheap(int triangle_index, descriptor_range cbv)
 {
     if (!is_resource_created)
     {
@@ -1002,16 +1030,15 @@ void append_cb_toheap(int triangle_index, size_t heap_index)
         is_resource_created = true;
     }
 
-    D3D12_CPU_DESCRIPTOR_HANDLE handle = {};
-    handle.ptr = cbv_srv_uav_heap->GetCPUDescriptorHandleForHeapStart().ptr + (heap_index * srv_desc_handle_incr_size);
-
     D3D12_CONSTANT_BUFFER_VIEW_DESC cbv_model_desc;
     cbv_model_desc.BufferLocation = preallocated_modelcb_resource->GetGPUVirtualAddress() + (triangle_index * model_cb_size);
     cbv_model_desc.SizeInBytes = model_cb_size;
-    g_device->CreateConstantBufferView(&cbv_model_desc, handle);
+    g_device->CreateConstantBufferView(&cbv_model_desc, cbv_srv_uav_heap->cpu(cbv));
 }
 
-void create_cb_resource_per_frame(int triangle_index)
+// Called every frame: the frame's constant buffer gets the model and the CBV goes in the frame's transient descriptors,
+// so the frames in flight keep reading their own copies
+descriptor_range create_cb_resource_per_frame(int triangle_index)
 {
     int i = triangle_index;
 
@@ -1020,22 +1047,15 @@ void create_cb_resource_per_frame(int triangle_index)
     XMMATRIX t_model = XMMatrixTranspose(translation * scale);
 
     frame_context *frame_ctx = &g_frame_context[backbuffer_index];
-    UINT64 current_triangle_index = frame_ctx->triangle_index;
-    UINT64 copy_offset = current_triangle_index * model_cb_size;
-
-    memcpy((void *)&frame_ctx->cpu_mapped_model_cb[copy_offset], // i needs to be an index belonging to each frame context
-           (void *)&t_model, sizeof(XMMATRIX));
-
-    D3D12_CPU_DESCRIPTOR_HANDLE handle = {};
-    handle.ptr = cbv_srv_uav_heap->GetCPUDescriptorHandleForHeapStart().ptr + (i * srv_desc_handle_incr_size);
+    UINT64 copy_offset = UINT64(i) * model_cb_size;
+    memcpy((void *)&frame_ctx->cpu_mapped_model_cb[copy_offset], (void *)&t_model, sizeof(XMMATRIX));
 
+    descriptor_range cbv = cbv_srv_uav_heap->allocate_transient(1);
     D3D12_CONSTANT_BUFFER_VIEW_DESC cbv_model_desc;
-    cbv_model_desc.BufferLocation = g_frame_context[backbuffer_index].modelcb_resource->GetGPUVirtualAddress() + copy_offset;
+    cbv_model_desc.BufferLocation = frame_ctx->modelcb_resource->GetGPUVirtualAddress() + copy_offset;
     cbv_model_desc.SizeInBytes = model_cb_size;
-    g_device->CreateConstantBufferView(&cbv_model_desc, handle);
-
-    current_triangle_index++;
-    frame_ctx->triangle_index = current_triangle_index;
+    g_device->CreateConstantBufferView(&cbv_model_desc, cbv_srv_uav_heap->cpu(cbv));
+    return cbv;
 }
 
 void resize_swapchain(HWND hWnd, int width, int height)
@@ -1074,6 +1094,7 @@ void resize_swapchain(HWND hWnd, int width, int height)
 extern "C" __declspec(dllexport) bool update_and_render()
 {
     frame_context *frame_ctx = WaitForNextFrameResources();
+    cbv_srv_uav_heap->begin_frame(UINT(frame_ctx - g_frame_context));
     frame_ctx->cmd_alloc->Reset();
     g_cmd_list->Reset(frame_ctx->cmd_alloc, NULL);
     cmd_lists.push_back(g_cmd_list);
@@ -1169,6 +1190,7 @@ extern "C" __declspec(dllexport) bool update_and_render()
                 if (!quads.empty())
                 {
                     quads.clear();
+                    quad_grid.clear();
                 }
                 create_quads(total_quads_torender);
             }
@@ -1212,7 +1234,8 @@ extern "C" __declspec(dllexport) bool update_and_render()
 
     g_cmd_list->OMSetRenderTargets(1, &g_rtv_descriptors[backbuffer_index], FALSE, &dsv_heap->GetCPUDescriptorHandleForHeapStart());
 
-    g_cmd_list->SetDescriptorHeaps(1, &cbv_srv_uav_heap);
+    ID3D12DescriptorHeap *heaps[] = {cbv_srv_uav_heap->heap()};
+    g_cmd_list->SetDescriptorHeaps(_countof(heaps), heaps);
     g_cmd_list->SetGraphicsRootSignature(g_rootsig);
 
     // allocate and upload triangles data
@@ -1275,21 +1298,21 @@ extern "C" __declspec(dllexport) bool update_and_render()
                                                D3D12_RESOURCE_STATES::D3D12_RESOURCE_STATE_COPY_DEST,
                                                D3D12_RESOURCE_STATES::D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
 
-            triangles[i].cb_index = num_tris_rendered;
-
             // create CBVs
             switch (cbv_creation_option)
             {
             case committed_resource_per_cbv:
-                create_cb_resource_per_cbv(i, triangles[i].cb_index);
+                triangles[i].cbv = cbv_srv_uav_heap->allocate(1);
+                create_cb_resource_per_cbv(i, triangles[i].cbv);
                 break;
 
             case committed_resource_per_frame:
-                create_cb_resource_per_frame(i);
+                triangles[i].is_cbv_per_frame = true;
                 break;
 
             case committed_resource_multiple_cbv:
-                append_cb_toheap(i, triangles[i].cb_index);
+                triangles[i].cbv = cbv_srv_uav_heap->allocate(1);
+                append_cb_toheap(i, triangles[i].cbv);
                 XMMATRIX scale = XMMatrixScaling(0.2f, 0.2f, 0.2f);
                 XMMATRIX translation = XMMatrixTranslation(0.f, (float)i * 1.f, 0.f);
                 XMMATRIX model = translation * scale;
@@ -1317,6 +1340,7 @@ extern "C" __declspec(dllexport) bool update_and_render()
             safe_release(tri_to_delete.model_cb_resource);
             safe_release(tri_to_delete.vertex_default_resource);
             safe_release(tri_to_delete.vertex_upload_resource);
+            cbv_srv_uav_heap->free(tri_to_delete.cbv);
 
             triangles.pop_back();
             num_tris_rendered--;
@@ -1328,9 +1352,8 @@ extern "C" __declspec(dllexport) bool update_and_render()
     // draw triangles
     for (int i = 0; i < total_tris_torender; ++i)
     {
-        D3D12_GPU_DESCRIPTOR_HANDLE handle = {};
-        handle.ptr = cbv_srv_uav_heap->GetGPUDescriptorHandleForHeapStart().ptr + (triangles[i].cb_index * srv_desc_handle_incr_size);
-        g_cmd_list->SetGraphicsRootDescriptorTable(1, handle);
+        descriptor_range cbv = triangles[i].is_cbv_per_frame ? create_cb_resource_per_frame(i) : triangles[i].cbv;
+        g_cmd_list->SetGraphicsRootDescriptorTable(1, cbv_srv_uav_heap->gpu(cbv));
 
         g_cmd_list->SetPipelineState(g_pso);
         g_cmd_list->IASetVertexBuffers(0, 1, &triangles[i].vbv);
@@ -1340,29 +1363,37 @@ extern "C" __declspec(dllexport) bool update_and_render()
 
     queries->start("quads_rendering");
     // draw quads
-    for (int i = 0; i < quads.size(); i++)
+    if (!quads.empty())
     {
-        D3D12_GPU_DESCRIPTOR_HANDLE handle = {};
-        handle.ptr = cbv_srv_uav_heap->GetGPUDescriptorHandleForHeapStart().ptr + (quads[i].cb_index * srv_desc_handle_incr_size);
-        g_cmd_list->SetGraphicsRootDescriptorTable(1, handle);
-        g_cmd_list->IASetVertexBuffers(0, 1, &quads[i].vbv);
-        g_cmd_list->IASetIndexBuffer(&quads[i].ibv);
+        g_cmd_list->IASetVertexBuffers(0, 1, &quads_vbv);
+        g_cmd_list->IASetIndexBuffer(&quads_ibv);
+        g_cmd_list->SetGraphicsRootShaderResourceView(2, quad_instances_address);
 
-        if (quads[i].bounds.Contains(XMVectorSet(ndc_mouse_pos.x, ndc_mouse_pos.y, 0.f, 0.f)))
+        hovered_quads.clear();
+        quad_grid.query_point(ndc_mouse_pos.x, ndc_mouse_pos.y, hovered_quads);
+        for (uint32_t hovered : hovered_quads)
         {
+            quad const &q = quads[hovered];
+            geometry_batcher::batch const &b = quad_batcher.batches()[q.batch];
+            g_cmd_list->SetGraphicsRoot32BitConstant(3, q.instance, 0);
+
             // draw to stencil buffer
             g_cmd_list->OMSetStencilRef(1);
             g_cmd_list->SetPipelineState(stencil_pso);
-            g_cmd_list->DrawIndexedInstanced(6, 1, 0, 0, 0);
+            g_cmd_list->DrawIndexedInstanced(b.index_count, 1, b.start_index, b.base_vertex, 0);
 
             // draw scaled up outline
             g_cmd_list->SetPipelineState(outline_pso);
-            g_cmd_list->DrawIndexedInstanced(6, 1, 0, 0, 0);
+            g_cmd_list->DrawIndexedInstanced(b.index_count, 1, b.start_index, b.base_vertex, 0);
         }
 
-        // draw quad
+        // draw quads, one draw per batch
         g_cmd_list->SetPipelineState(quad_pso);
-        g_cmd_list->DrawIndexedInstanced(6, 1, 0, 0, 0);
+        for (geometry_batcher::batch const &b : quad_batcher.batches())
+        {
+            g_cmd_list->SetGraphicsRoot32BitConstant(3, b.first_instance, 0);
+            g_cmd_list->DrawIndexedInstanced(b.index_count, b.instance_count, b.start_index, b.base_vertex, 0);
+        }
     }
     queries->stop("quads_and_tri");
     queries->stop("quads_rendering");
@@ -1477,7 +1508,7 @@ void cleanup_device()
     safe_release(g_cmd_queue);
     safe_release(g_cmd_list);
     safe_release(rtv_desc_heap);
-    safe_release(cbv_srv_uav_heap);
+    delete cbv_srv_uav_heap;
     safe_release(dsv_heap);
     safe_release(g_fence);
     safe_release(query_rb_buffer);